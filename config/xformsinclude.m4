@@ -33,6 +33,69 @@ AC_CHECK_LIB(jpeg, jpeg_CreateDecompress, JPEG_LIB="-ljpeg",
 AC_SUBST(JPEG_LIB)
 ])
 
+dnl Usage XFORMS_CHECK_LIB_ZLIB: Checks for the (optional) zlib library
+AC_DEFUN([XFORMS_CHECK_LIB_ZLIB],[
+### Check for zlib
+Z_LIB=
+AC_CHECK_HEADER(zlib.h,
+  [AC_CHECK_LIB(z, gzdopen, [Z_LIB="-lz"
+    AC_DEFINE(HAVE_ZLIB, 1, [Define if you have the zlib library])])])
+if test "x$Z_LIB" = x ; then
+  XFORMS_WARNING([Unable to find zlib, gzip'ed images will be read and written via the external 'gzip' program])
+fi
+AC_SUBST(Z_LIB)
+])
+
+dnl Usage XFORMS_CHECK_LIB_PNG: Checks for the (optional) png library
+AC_DEFUN([XFORMS_CHECK_LIB_PNG],[
+AC_REQUIRE([XFORMS_CHECK_LIB_ZLIB])
+### Check for png library
+PNG_LIB=
+if test "x$Z_LIB" != x ; then
+  AC_CHECK_HEADER(png.h,
+    [AC_CHECK_LIB(png, png_set_expand_gray_1_2_4_to_8, [PNG_LIB="-lpng"
+      AC_DEFINE(HAVE_LIBPNG, 1, [Define if you have the png library])],,
+      [$Z_LIB -lm])])
+fi
+if test "x$PNG_LIB" = x ; then
+  XFORMS_WARNING([Unable to find libpng, PNG images will be read and written via the external netpbm programs])
+fi
+AC_SUBST(PNG_LIB)
+])
+
+dnl Usage XFORMS_CHECK_LIB_XFT: Checks for the (optional) Xft library
+AC_DEFUN([XFORMS_CHECK_LIB_XFT],[
+### Check for Xft (its header needs the freetype headers, so ask
+### pkg-config for the flags if it's available)
+XFT_CFLAGS=
+XFT_LIB=
+if test "x$enable_xft" != xno ; then
+  AC_PATH_PROG(XFORMS_PKG_CONFIG, pkg-config, no)
+  if test "x$XFORMS_PKG_CONFIG" != xno && $XFORMS_PKG_CONFIG --exists xft ; then
+    xforms_xft_cflags=`$XFORMS_PKG_CONFIG --cflags xft`
+    xforms_xft_libs=`$XFORMS_PKG_CONFIG --libs xft`
+  else
+    xforms_xft_cflags="-I/usr/include/freetype2"
+    xforms_xft_libs="-lXft"
+  fi
+  SAVE_CPPFLAGS="$CPPFLAGS"
+  SAVE_LIBS="$LIBS"
+  CPPFLAGS="$X_CFLAGS $xforms_xft_cflags $CPPFLAGS"
+  LIBS="$X_PRE_LIBS $LIBS $X_LIBS $xforms_xft_libs -lX11 $X_EXTRA_LIBS"
+  AC_CHECK_HEADER(X11/Xft/Xft.h,
+    [AC_CHECK_FUNC(XftDrawString8, [XFT_CFLAGS="$xforms_xft_cflags"
+      XFT_LIB="$xforms_xft_libs"
+      AC_DEFINE(HAVE_XFT, 1, [Define if you have the Xft library])])])
+  CPPFLAGS="$SAVE_CPPFLAGS"
+  LIBS="$SAVE_LIBS"
+  if test "x$XFT_LIB" = x ; then
+    XFORMS_WARNING([Unable to find Xft, text will always be drawn with core X fonts])
+  fi
+fi
+AC_SUBST(XFT_CFLAGS)
+AC_SUBST(XFT_LIB)
+])
+
 dnl Usage XFORMS_PATH_XPM: Checks for xpm library and header
 AC_DEFUN([XFORMS_PATH_XPM],[
 ### Check for Xpm library
@@ -19,11 +19,19 @@
 
 
 /*
- * Convert an image file using the image support of Forms Library.
+ * Convert image files using the image support of Forms Library.
  *
- *  Usage: iconvert [-version][-verbose][-help] inputimage outimage [fmt]
- *     output image format is determined by the extension or
- *     by fmt if present.
+ *  Usage: iconvert [options] inputimage outimage [fmt]
+ *         iconvert [options] -batch fmt input ...
+ *
+ *     In the first form the output image format is determined by the
+ *     extension or by fmt if present. In the second form all inputs
+ *     (files, directories, which are searched recursively, or "-" for
+ *     a list of file names read from stdin) are converted to fmt by
+ *     a number of worker threads, and a summary of the time spent in
+ *     each stage of the conversion is printed at the end.
+ *
+ *     No connection to the X server is needed (and none is made).
  *
  *  Exit status:  0 (success) 1 (bad command line)  3 (conversion failed)
  *
@@ -36,15 +44,91 @@
 #endif
 
 #include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 #include "include/forms.h"
 #include "image/flimage.h"
 
+
+/* Stages of a conversion we keep the time of */
+
+enum {
+    LOAD,
+    SCALE,
+    CONVERT,
+    WRITE,
+    NSTAGES
+};
+
+static const char *stage_names[ NSTAGES ] =
+{
+    "load", "scale", "convert", "write"
+};
+
+typedef struct {
+    double times[ NSTAGES ];
+    int    ok,
+           failed,
+           skipped;
+} Stats;
+
+/* What's to be done with each file */
+
+static struct {
+    const char * fmt;         /* output format                      */
+    const char * ext;         /* its file name extension            */
+    const char * outdir;      /* where output files go, if set      */
+    int          jobs;        /* number of worker threads           */
+    double       factor;      /* scale factor, if not 0             */
+    int          fit_w,       /* size to fit into, if not 0         */
+                 fit_h;
+    int          colors;      /* quantize to that many colors       */
+    int          gray;        /* convert to gray                    */
+    int          verbose;
+} opt;
+
+/* The list of files to convert. Files found in a directory given on
+   the command line keep the part of their name below that directory
+   (root_len) when written to the output directory */
+
+typedef struct {
+    char * name;
+    int    root_len;
+} Job;
+
+static Job *jobs;
+static int njobs,
+           next_job,
+           read_stdin;
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+#define lock( )    pthread_mutex_lock( &job_lock )
+#define unlock( )  pthread_mutex_unlock( &job_lock )
+#else
+#define lock( )
+#define unlock( )
+#endif
+
 static void initialize( void );
 static void usage( const char *,
                    int );
 static int parse_command_line( int *,
                                char ** );
+static int convert( const char *,
+                    const char *,
+                    const char *,
+                    Stats * );
+static int batch( char * const * );
 
 
 /***************************************
@@ -54,13 +138,20 @@ int
 main( int    argc,
       char * argv[ ] )
 {
-    FL_IMAGE *im;
+    Stats stats;
     const char *fmt = 0;
     char *const *args;
 
     initialize( );
     args = argv + parse_command_line( &argc, argv );
 
+    if ( opt.fmt )
+    {
+        if ( argc < 2 )
+            usage( argv[ 0 ], 0 );
+        return batch( args + 1 );
+    }
+
     if (   argc < 3 ||
          ! ( fmt = ( argc >= 4 ? args[ 3 ] : strrchr( args[ 2 ], '.' ) ) ) )
     {
@@ -69,9 +160,398 @@ main( int    argc,
     }
 
     fmt += fmt[ 0 ] == '.';
-    im = flimage_load( strdup( args[ 1 ] ) );
+    memset( &stats, 0, sizeof stats );
+
+    return convert( args[ 1 ], args[ 2 ], fmt, &stats ) < 0 ? 3 : 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static double
+now( void )
+{
+    struct timeval tv;
+
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + 1.0e-6 * tv.tv_usec;
+}
+
+
+/***************************************
+ * Convert one file, adding the time spent in each stage to the stats
+ ***************************************/
 
-    return flimage_dump( im, args[ 2 ], fmt ) < 0 ? 3 : 0;
+static int
+convert( const char * infile,
+         const char * outfile,
+         const char * fmt,
+         Stats      * stats )
+{
+    FL_IMAGE *image,
+             *im;
+    double t = now( ),
+           t1,
+           f;
+    int err = 0;
+
+    image = flimage_load( infile );
+    stats->times[ LOAD ] += now( ) - t;
+
+    if ( ! image )
+        return -1;
+
+    /* all frames of multi-frame images get the same treatment */
+
+    for ( im = image; im && ! err; im = im->next )
+    {
+        t = now( );
+
+        if ( opt.factor > 0.0 )
+            err = flimage_scale( im, im->w * opt.factor + 0.5,
+                                 im->h * opt.factor + 0.5,
+                                 FLIMAGE_SUBPIXEL ) < 0;
+        else if ( opt.fit_w > 0 )
+        {
+            f = FL_min( ( double ) opt.fit_w / im->w,
+                        ( double ) opt.fit_h / im->h );
+            err = flimage_scale( im, FL_max( 1, im->w * f + 0.5 ),
+                                 FL_max( 1, im->h * f + 0.5 ),
+                                 FLIMAGE_SUBPIXEL ) < 0;
+        }
+
+        stats->times[ SCALE ] += ( t1 = now( ) ) - t;
+
+        if ( ! err && opt.gray )
+            err = flimage_convert( im, FL_IMAGE_GRAY, 0 ) < 0;
+
+        if ( ! err && opt.colors > 0 )
+            err = flimage_convert( im, FL_IMAGE_CI, opt.colors ) < 0;
+
+        stats->times[ CONVERT ] += now( ) - t1;
+    }
+
+    if ( ! err )
+    {
+        t = now( );
+        err = flimage_dump( image, outfile, fmt ) < 0;
+        stats->times[ WRITE ] += now( ) - t;
+    }
+
+    flimage_free( image );
+
+    return err ? -1 : 0;
+}
+
+
+/***************************************
+ * Add a file to the job list
+ ***************************************/
+
+static void
+add_job( const char * name,
+         int          root_len )
+{
+    static int maxjobs;
+
+    if ( njobs == maxjobs )
+    {
+        maxjobs = maxjobs ? 2 * maxjobs : 64;
+        jobs = fl_realloc( jobs, maxjobs * sizeof *jobs );
+    }
+
+    jobs[ njobs ].name = strdup( name );
+    jobs[ njobs++ ].root_len = root_len;
+}
+
+
+/***************************************
+ * Add all files below a directory to the job list
+ ***************************************/
+
+static void
+add_dir( const char * dirname,
+         int          root_len )
+{
+    DIR *dir;
+    struct dirent *e;
+    struct stat st;
+    char *name;
+
+    if ( ! ( dir = opendir( dirname ) ) )
+    {
+        fprintf( stderr, "iconvert: can't read directory %s: %s\n",
+                 dirname, strerror( errno ) );
+        return;
+    }
+
+    while ( ( e = readdir( dir ) ) )
+    {
+        if ( *e->d_name == '.' )
+            continue;
+
+        name = fl_malloc( strlen( dirname ) + strlen( e->d_name ) + 2 );
+        sprintf( name, "%s/%s", dirname, e->d_name );
+
+        if ( stat( name, &st ) == 0 )
+        {
+            if ( S_ISDIR( st.st_mode ) )
+                add_dir( name, root_len );
+            else if ( S_ISREG( st.st_mode ) )
+                add_job( name, root_len );
+        }
+
+        fl_free( name );
+    }
+
+    closedir( dir );
+}
+
+
+/***************************************
+ * Get the next file to convert. Once the files from the command line
+ * are done, read names from stdin if asked to. Returns 0 when there's
+ * nothing left to do
+ ***************************************/
+
+static int
+get_job( Job * job )
+{
+    char buf[ 4096 ];
+    int ret,
+        len;
+
+    lock( );
+
+    while ( next_job == njobs && read_stdin )
+    {
+        if ( ! fgets( buf, sizeof buf, stdin ) )
+            read_stdin = 0;
+        else
+        {
+            len = strlen( buf );
+            while (    len > 0
+                    && ( buf[ len - 1 ] == '\n' || buf[ len - 1 ] == '\r' ) )
+                buf[ --len ] = '\0';
+            if ( len > 0 )
+                add_job( buf, 0 );
+        }
+    }
+
+    if ( ( ret = next_job < njobs ) )
+        *job = jobs[ next_job++ ];
+
+    unlock( );
+
+    return ret;
+}
+
+
+/***************************************
+ * Create all the directories leading to a file
+ ***************************************/
+
+static void
+make_dirs( char * file )
+{
+    char *p;
+
+    for ( p = strchr( file + 1, '/' ); p; p = strchr( p + 1, '/' ) )
+    {
+        *p = '\0';
+        if ( mkdir( file, 0777 ) < 0 && errno != EEXIST )
+            fprintf( stderr, "iconvert: can't create %s: %s\n",
+                     file, strerror( errno ) );
+        *p = '/';
+    }
+}
+
+
+/***************************************
+ * Name of the output file for a job: the input file name with the
+ * extension replaced by the one of the output format, if an output
+ * directory is set below that directory
+ ***************************************/
+
+static char *
+output_name( const Job * job )
+{
+    const char *in = job->name,
+               *base;
+    char *out,
+         *p;
+
+    if ( opt.outdir )
+    {
+        if ( job->root_len )
+            base = in + job->root_len;
+        else
+            base = ( base = strrchr( in, '/' ) ) ? base + 1 : in;
+        while ( *base == '/' )
+            base++;
+    }
+    else
+        base = in;
+
+    out = fl_malloc(   ( opt.outdir ? strlen( opt.outdir ) + 1 : 0 )
+                     + strlen( base ) + strlen( opt.ext ) + 2 );
+
+    if ( opt.outdir )
+        sprintf( out, "%s/%s", opt.outdir, base );
+    else
+        strcpy( out, base );
+
+    if (    ( p = strrchr( out, '.' ) )
+         && p > out + ( opt.outdir ? strlen( opt.outdir ) : 0 )
+         && ! strchr( p, '/' ) )
+        *p = '\0';
+
+    strcat( strcat( out, "." ), opt.ext );
+
+    return out;
+}
+
+
+/***************************************
+ * A worker: convert files until there are no more
+ ***************************************/
+
+static void *
+worker( void * data )
+{
+    Stats *stats = data;
+    Job job;
+    char *out;
+    double t;
+    int status;
+
+    while ( get_job( &job ) )
+    {
+        /* files found in directories may well not be images */
+
+        if ( job.root_len && ! flimage_is_supported( job.name ) )
+        {
+            stats->skipped++;
+            continue;
+        }
+
+        out = output_name( &job );
+
+        if ( ! strcmp( out, job.name ) )
+        {
+            fprintf( stderr, "iconvert: %s: not overwriting input file\n",
+                     job.name );
+            stats->failed++;
+            fl_free( out );
+            continue;
+        }
+
+        if ( opt.outdir )
+            make_dirs( out );
+
+        t = now( );
+        status = convert( job.name, out, opt.fmt, stats );
+
+        if ( status < 0 )
+        {
+            fprintf( stderr, "iconvert: %s: conversion failed\n", job.name );
+            stats->failed++;
+        }
+        else
+        {
+            stats->ok++;
+            if ( opt.verbose )
+                fprintf( stderr, "%s -> %s (%.1f ms)\n", job.name, out,
+                         1000.0 * ( now( ) - t ) );
+        }
+
+        fl_free( out );
+    }
+
+    return NULL;
+}
+
+
+/***************************************
+ * Convert all files (or files in directories) in the list of names
+ ***************************************/
+
+static int
+batch( char * const * names )
+{
+    Stats *stats,
+          total;
+    struct stat st;
+    double t = now( );
+    int i,
+        n;
+
+    for ( ; *names; names++ )
+    {
+        if ( ! strcmp( *names, "-" ) )
+            read_stdin = 1;
+        else if ( stat( *names, &st ) == 0 && S_ISDIR( st.st_mode ) )
+            add_dir( *names, strlen( *names ) );
+        else
+            add_job( *names, 0 );
+    }
+
+    stats = fl_calloc( opt.jobs, sizeof *stats );
+
+#ifdef HAVE_PTHREAD_H
+    if ( opt.jobs > 1 )
+    {
+        pthread_t *threads = fl_malloc( opt.jobs * sizeof *threads );
+
+        for ( n = 0; n < opt.jobs; n++ )
+            if ( pthread_create( threads + n, NULL, worker, stats + n ) )
+                break;
+
+        /* if we couldn't start a single thread, do it ourselves */
+
+        if ( n == 0 )
+            worker( stats );
+
+        for ( i = 0; i < n; i++ )
+            pthread_join( threads[ i ], NULL );
+
+        opt.jobs = FL_max( n, 1 );
+        fl_free( threads );
+    }
+    else
+#endif
+        worker( stats );
+
+    /* summary */
+
+    memset( &total, 0, sizeof total );
+    for ( i = 0; i < opt.jobs; i++ )
+    {
+        for ( n = 0; n < NSTAGES; n++ )
+            total.times[ n ] += stats[ i ].times[ n ];
+        total.ok      += stats[ i ].ok;
+        total.failed  += stats[ i ].failed;
+        total.skipped += stats[ i ].skipped;
+    }
+
+    fprintf( stderr, "iconvert: %d converted, %d failed, %d skipped "
+             "in %.2f s using %d worker%s\n", total.ok, total.failed,
+             total.skipped, now( ) - t, opt.jobs, opt.jobs > 1 ? "s" : "" );
+    fprintf( stderr, "  %-8s %12s %16s\n", "stage", "time (s)",
+             "per image (ms)" );
+    for ( n = 0; n < NSTAGES; n++ )
+        fprintf( stderr, "  %-8s %12.3f %16.2f\n", stage_names[ n ],
+                 total.times[ n ], 1000.0 * total.times[ n ]
+                 / FL_max( 1, total.ok + total.failed ) );
+
+    fl_free( stats );
+
+    for ( i = 0; i < njobs; i++ )
+        free( jobs[ i ].name );
+    fl_free( jobs );
+
+    return total.failed ? 3 : 0;
 }
 
 
@@ -87,12 +567,21 @@ usage( const char * cmd,
         i,
         k;
 
-    fprintf( stderr, "Usage: %s [-verbose][-help] infile outfile [fmt]\n",
-             cmd );
+    fprintf( stderr, "Usage: %s [options] infile outfile [fmt]\n"
+             "       %s [options] -batch fmt file|directory|- ...\n",
+             cmd, cmd );
 
     if ( ! more )
        exit( 1 );
 
+    fputs( " Options:\n"
+           "  -verbose     print what's being done\n"
+           "  -help        print this message\n"
+           "  -scale s     scale by factor s or to fit into WxH\n"
+           "  -gray        convert to gray scale\n"
+           "  -colors n    quantize to n colors\n"
+           "  -outdir dir  batch mode: write the output files to dir\n"
+           "  -jobs n      batch mode: use n worker threads\n", stderr );
     fputs( " The output format is determined by the file extension or fmt.\n"
 		   " fmt or extension must be one of the following:\n", stderr );
 
@@ -128,6 +617,45 @@ noop( FL_IMAGE   * im  FL_UNUSED_ARG,
 }
 
 
+/***************************************
+ * Error messages from several threads better say what file they're about
+ ***************************************/
+
+static void
+error_message( FL_IMAGE   * im,
+               const char * s )
+{
+    if ( s && *s )
+        fprintf( stderr, "iconvert: %s: %s\n",
+                 im->infile && *im->infile ? im->infile : "?", s );
+}
+
+
+/***************************************
+ * Look up the file name extension of a writable format
+ ***************************************/
+
+static const char *
+format_extension( const char * fmt )
+{
+    const FLIMAGE_FORMAT_INFO *info;
+    int i,
+        n = flimage_get_number_of_formats( );
+
+    for ( i = 1; i <= n; i++ )
+    {
+        info = flimage_get_format_info( i );
+        if (    info->read_write & FLIMAGE_WRITABLE
+             && (    ! strcasecmp( info->formal_name, fmt )
+                  || ! strcasecmp( info->short_name,  fmt )
+                  || ! strcasecmp( info->extension,   fmt ) ) )
+            return info->extension;
+    }
+
+    return NULL;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -139,23 +667,66 @@ parse_command_line( int  * argc,
     static FLIMAGE_SETUP setup;
 
     setup.visual_cue = noop;
+    setup.error_message = error_message;
+    opt.jobs = 1;
 
-    for ( i = 1; i < *argc && *argv[ i ] == '-'; )
+#ifdef _SC_NPROCESSORS_ONLN
+    if ( ( opt.jobs = sysconf( _SC_NPROCESSORS_ONLN ) ) < 1 )
+        opt.jobs = 1;
+#endif
+
+    for ( i = 1; i < *argc && *argv[ i ] == '-' && argv[ i ][ 1 ]; i++ )
     {
         if ( strncmp( argv[ i ], "-verb", 5 ) == 0 )
+            opt.verbose = 1;
+        else if ( strncmp( argv[ i ], "-h", 2 ) == 0 )
+            usage( argv[ 0 ], 1 );
+        else if ( strcmp( argv[ i ], "-gray" ) == 0 )
+            opt.gray = 1;
+        else if ( i + 1 >= *argc )
+            usage( argv[ 0 ], 0 );
+        else if ( strcmp( argv[ i ], "-scale" ) == 0 )
         {
-            setup.visual_cue = 0;
-            i++;
+            if ( sscanf( argv[ ++i ], "%dx%d", &opt.fit_w, &opt.fit_h ) == 2 )
+            {
+                if ( opt.fit_w <= 0 || opt.fit_h <= 0 )
+                    usage( argv[ 0 ], 0 );
+            }
+            else if ( ( opt.fit_w = 0, opt.factor = atof( argv[ i ] ) ) <= 0 )
+                usage( argv[ 0 ], 0 );
         }
-        else if ( strncmp( argv[ i ], "-h", 2 ) == 0 )
+        else if ( strcmp( argv[ i ], "-colors" ) == 0 )
+            opt.colors = atoi( argv[ ++i ] );
+        else if ( strcmp( argv[ i ], "-outdir" ) == 0 )
+            opt.outdir = argv[ ++i ];
+        else if ( strcmp( argv[ i ], "-jobs" ) == 0 )
         {
-            usage( argv[ 0 ], 1 );
-            i++;
+            if ( ( opt.jobs = atoi( argv[ ++i ] ) ) < 1 )
+                opt.jobs = 1;
+        }
+        else if ( strcmp( argv[ i ], "-batch" ) == 0 )
+        {
+            if ( ! ( opt.ext = format_extension( opt.fmt = argv[ ++i ] ) ) )
+            {
+                fprintf( stderr, "iconvert: can't write format %s\n",
+                         opt.fmt );
+                exit( 1 );
+            }
         }
         else
             usage( argv[ 0 ], 0 );
     }
 
+    /* with more than one image in the works the progress display would
+       be just noise, so verbose only gets us a line per file then */
+
+    if ( opt.verbose && ! opt.fmt )
+        setup.visual_cue = 0;
+
+    /* uncompressed gray images don't even need to be read */
+
+    setup.use_mmap = 1;
+
     flimage_setup( &setup );
     *argc -= i - 1;
 
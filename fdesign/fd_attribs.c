@@ -259,6 +259,7 @@ save_edited_object( FL_OBJECT * obj )
     saved_object.obj = fl_malloc( sizeof *saved_object.obj );
     *saved_object.obj = *obj;
     saved_object.obj->spec = NULL;
+    saved_object.obj->label_layout = NULL;
 
 	/* Get the objects name, name of the callback function and
 	   the argument string and store them */
@@ -290,6 +291,7 @@ restore_edited_object( FL_OBJECT * obj )
 {
     void *sp = obj->spec;
 
+    fli_free_label_layout( obj );
     fl_free( obj->label );
     fl_free( obj->shortcut );
 
@@ -344,6 +344,15 @@ typedef struct flimage_ {
     int               isPixmap;
     FLIMAGESETUP      setup;
     char            * info;
+    void            * region;         /* region-on-demand state    */
+    void            * view;           /* zoomed/panned display     */
+    void            * mapped;         /* mapped input file         */
+    unsigned long     mapped_len;
+
+    /* reduced resolution reading, 0 if the full image is wanted */
+
+    int               target_w,       /* smallest size still needed */
+                      target_h;
 } FL_IMAGE;
 
 /* some configuration stuff */
@@ -370,10 +379,24 @@ typedef struct flimage_setup_ {
 
     unsigned long   trailblazer;
     int             header_info;
+
+    /* region reading, views, file mapping and color reduction */
+
+    unsigned long   region_cache;   /* region cache limit in bytes */
+    unsigned long   view_cache;     /* view tile cache limit       */
+    int             use_mmap;       /* map uncompressed files      */
+    int             quantizer;      /* FLIMAGE_MEDIANCUT/OCTREE    */
 } FLIMAGE_SETUP;
 
 FL_EXPORT void flimage_setup( FLIMAGE_SETUP * );
 
+/* Color quantizers */
+
+enum {
+   FLIMAGE_MEDIANCUT,           /* median cut, the default */
+   FLIMAGE_OCTREE               /* octree, faster          */
+};
+
 /* Possible errors from the library. Not currently (v0.89) used */
 
 enum {
@@ -395,6 +418,10 @@ typedef int ( * FLIMAGE_Write_Image )( FL_IMAGE * );
 
 FL_EXPORT FL_IMAGE * flimage_load( const char * file );
 
+FL_EXPORT FL_IMAGE * flimage_load_reduced( const char * file,
+                                           int          w,
+                                           int          h );
+
 FL_EXPORT FL_IMAGE * flimage_read( FL_IMAGE * im );
 
 FL_EXPORT int flimage_dump( FL_IMAGE *,
@@ -403,10 +430,23 @@ FL_EXPORT int flimage_dump( FL_IMAGE *,
 
 FL_EXPORT int flimage_close( FL_IMAGE * );
 
+FL_EXPORT int flimage_read_region( FL_IMAGE *,
+                                   int,
+                                   int,
+                                   int,
+                                   int,
+                                   int );
+
+FL_EXPORT int flimage_get_full_size( FL_IMAGE *,
+                                     int *,
+                                     int * );
+
 FL_EXPORT FL_IMAGE * flimage_alloc( void );
 
 FL_EXPORT int flimage_getmem( FL_IMAGE * );
 
+FL_EXPORT int flimage_unshare( FL_IMAGE * );
+
 FL_EXPORT int flimage_is_supported( const char * );
 
 FL_EXPORT int flimage_description_via_filter( FL_IMAGE *,
@@ -429,6 +469,14 @@ FL_EXPORT int flimage_display( FL_IMAGE *,
 FL_EXPORT int flimage_sdisplay( FL_IMAGE *,
 								Window );
 
+FL_EXPORT int flimage_view_display( FL_IMAGE *,
+                                    FL_WINDOW,
+                                    double,
+                                    double,
+                                    double );
+
+FL_EXPORT void flimage_free_view( FL_IMAGE * );
+
 FL_EXPORT int flimage_convert( FL_IMAGE *,
 							   int,
 							   int );
@@ -476,6 +524,8 @@ FL_EXPORT void flimage_delete_all_markers( FL_IMAGE * );
 FL_EXPORT int flimage_render_annotation( FL_IMAGE *,
 										 FL_WINDOW );
 
+FL_EXPORT int flimage_rasterize_annotation( FL_IMAGE * );
+
 FL_EXPORT void flimage_error( FL_IMAGE *,
 							  const char *,
 							  ... );
@@ -562,6 +612,8 @@ FL_EXPORT int flimage_getcolormap( FL_IMAGE * );
 
 FL_EXPORT void fl_select_mediancut_quantizer( void );
 
+FL_EXPORT void fl_select_octree_quantizer( void );
+
 /* Simple image processing routines */
 
 #define FLIMAGE_SHARPEN        ( ( int** )( -1 ) )
@@ -575,7 +627,11 @@ enum {
    FLIMAGE_CENTER     =  2,     /* center warped image. default  */
    FLIMAGE_RIGHT      =  8,     /* flush right the warped image  */
    FLIMAGE_ASPECT     = 32,     /* fit the size */
-   FLIMAGE_NOCENTER   = FL_ALIGN_LEFT_TOP
+   FLIMAGE_NOCENTER   = FL_ALIGN_LEFT_TOP,
+   FLIMAGE_AREA       = 64,     /* scale with area averaging     */
+   FLIMAGE_BILINEAR   = 128,    /* scale with bilinear filter    */
+   FLIMAGE_BICUBIC    = 256,    /* scale with bicubic filter     */
+   FLIMAGE_LANCZOS    = 512     /* scale with Lanczos-3 filter   */
 };
 
 FL_EXPORT int flimage_convolve( FL_IMAGE *,
@@ -37,6 +37,65 @@
                                  }                  \
                              } while( 0 )
 
+/* Images may be loaded and processed on any thread (only displaying
+   them has to be done by the thread talking to the X server). State
+   shared between images is set up once with fli_once() or guarded by
+   a FLI_MUTEX. Without pthreads these do nothing */
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+
+typedef pthread_once_t   FLI_ONCE;
+typedef pthread_mutex_t  FLI_MUTEX;
+
+#define FLI_ONCE_INIT     PTHREAD_ONCE_INIT
+#define FLI_MUTEX_INIT    PTHREAD_MUTEX_INITIALIZER
+
+#define fli_once( o, f )  pthread_once( o, f )
+#define fli_lock( m )     pthread_mutex_lock( m )
+#define fli_unlock( m )   pthread_mutex_unlock( m )
+#else
+typedef int FLI_ONCE;
+typedef int FLI_MUTEX;
+
+#define FLI_ONCE_INIT     0
+#define FLI_MUTEX_INIT    0
+
+#define fli_once( o, f )  do {                      \
+                              if ( ! *( o ) )       \
+                              {                     \
+                                  *( o ) = 1;       \
+                                  f( );             \
+                              }                     \
+                          } while ( 0 )
+#define fli_lock( m )     ( ( void ) ( m ) )
+#define fli_unlock( m )   ( ( void ) ( m ) )
+#endif
+
+/* Region-on-demand support. A format that can decode single rows of a
+   file without reading the rest of it registers an open_region handler,
+   which sets up the row reader and the private data in FLIMAGE_REGION */
+
+typedef struct flimage_region_ FLIMAGE_REGION;
+
+typedef int ( * FLIMAGE_Open_Region )( FL_IMAGE * );
+
+typedef int ( * FLIMAGE_Read_Row )( FL_IMAGE *,
+                                    int,
+                                    int,
+                                    int,
+                                    int,
+                                    void ** );
+
+/* Magic numbers a format can be recognized by, a list terminated by
+   an entry with len 0 */
+
+typedef struct {
+    int          offset;
+    int          len;
+    const char * bytes;
+} FLIMAGE_MAGIC;
+
 typedef struct flimageIO {
     const char          * formal_name;
     const char          * short_name;
@@ -48,8 +107,71 @@ typedef struct flimageIO {
     FLIMAGE_Read_Pixels   read_pixels;
     FLIMAGE_Write_Image   write_image;
     int annotation;
+    FLIMAGE_Open_Region   open_region;
+    const FLIMAGE_MAGIC * magic;
+    FLIMAGE_FORMAT_INFO   info;         /* flimage_get_format_info() */
 } FLIMAGE_IO;
 
+/* Decoded pixels are kept in blocks of FLIMAGE_REGION_BLOCK squared
+   pixels of a given level (level n is the image subsampled by 2^n) */
+
+#define FLIMAGE_REGION_BLOCK   256
+
+typedef struct flimage_block_ {
+    int                      level,
+                             bx,
+                             by;
+    int                      w,
+                             h;
+    unsigned short         * gray;      /* GRAY, GRAY16, CI and MONO */
+    unsigned char          * rgb[ 3 ];  /* RGB                       */
+    unsigned long            size;
+    struct flimage_block_  * hnext;     /* hash chain                */
+    struct flimage_block_  * prev,      /* LRU list, newest first    */
+                           * next;
+} FLIMAGE_BLOCK;
+
+#define FLIMAGE_REGION_HASH    64
+
+struct flimage_region_ {
+    int                w,           /* full image size              */
+                       h;
+    int                type;        /* type of the decoded pixels   */
+    int                x,           /* region currently in im       */
+                       y,
+                       rw,
+                       rh,
+                       level;
+    int                current;     /* im still holds region's pixels */
+    FLIMAGE_Read_Row   read_row;    /* decode (part of) a row       */
+    void               ( * cleanup )( FL_IMAGE * );
+    void             * spec;        /* format private data          */
+    FLIMAGE_BLOCK    * hash[ FLIMAGE_REGION_HASH ];
+    FLIMAGE_BLOCK    * newest,
+                     * oldest;
+    unsigned long      used,        /* bytes held by cached blocks  */
+                       limit;
+};
+
+void flimage_set_magic( int,
+                        const FLIMAGE_MAGIC * );
+
+void flimage_set_region_support( int,
+                                 FLIMAGE_Open_Region );
+
+void flimage_free_region( FL_IMAGE * );
+
+void * flimage_map_file( FL_IMAGE *,
+                         long,
+                         unsigned long );
+
+void flimage_unmap_file( FL_IMAGE * );
+
+void flimage_release_map( FL_IMAGE * );
+
+int flimage_map_gray16( FL_IMAGE *,
+                        long );
+
 typedef struct {
     int    w,
            h;
@@ -67,7 +189,8 @@ typedef struct {
 } SubImage;
 
 SubImage * flimage_get_subimage( FL_IMAGE * im,
-                                 int make );
+                                 int        make,
+                                 SubImage * sub );
 
 
 #define FL_IsGray( t )        ( t == FL_IMAGE_GRAY || t == FL_IMAGE_GRAY16 )
@@ -121,6 +244,13 @@ int flimage_transform( FL_IMAGE *,
 
 int flimage_getmem( FL_IMAGE * );
 
+int flimage_box_reduce( FL_IMAGE *,
+                        int );
+
+int flimage_reduce_factor( FL_IMAGE *,
+                           int,
+                           int );
+
 void flimage_freemem( FL_IMAGE * );
 
 void flimage_add_comments( FL_IMAGE *,
@@ -151,6 +281,30 @@ int j2pass_quantize_packed( unsigned int **,
                             int *,
                             FL_IMAGE * );
 
+int octree_quantize_rgb( unsigned char **,
+                         unsigned char **,
+                         unsigned char **,
+                         int,
+                         int,
+                         int,
+                         unsigned short **,
+                         int *,
+                         int *,
+                         int *,
+                         int *,
+                         FL_IMAGE * );
+
+int octree_quantize_packed( unsigned int **,
+                            int,
+                            int,
+                            int,
+                            unsigned short **,
+                            int *,
+                            int *,
+                            int *,
+                            int *,
+                            FL_IMAGE * );
+
 /* These numbers can be anything, but should be less than < 128 and may not
    equal 0 */
 
@@ -159,10 +313,16 @@ enum {
     FL_MAKE_MATRIX
 };
 
+void * fl_share_matrix( void * );
+
+int fl_unshare_matrix( void * );
+
 void flimage_enable_gzip( void );
 
 void flimage_invalidate_pixels( FL_IMAGE * );
 
+void flimage_free_xresources( FL_IMAGE * );
+
 int flimage_get_closest_color_from_map( FL_IMAGE *,
                                         unsigned int );
 
@@ -35,6 +35,8 @@
 #include "private/flsnprintf.h"
 #include <stdlib.h>
 #include <stdarg.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 static int visual_cue( FL_IMAGE *,
                        const char * );
@@ -53,7 +55,8 @@ FLIMAGE_QUANTIZE_PACKED flimage_quantize_packed;
 static int ppm_added,
            gzip_added;
 
-static void add_default_formats( void );
+static void init_once( void );
+static void free_io_spec( FL_IMAGE * );
 
 
 /*********************************************************************
@@ -79,21 +82,12 @@ flimage_setup( FLIMAGE_SETUP * setup )
     if ( setup->delay > 2000 )
         current_setup.delay = 2000;
 
-    add_default_formats( );
-}
-
-
-/***************************************
- ***************************************/
-
-static void
-init_setup( void )
-{
-    if ( current_setup.max_frames || current_setup.delay )
-        return;
+    if ( setup->quantizer == FLIMAGE_OCTREE )
+        fl_select_octree_quantizer( );
+    else
+        fl_select_mediancut_quantizer( );
 
-    current_setup.max_frames = 30;
-    current_setup.delay = 50;
+    init_once( );
 }
 
 
@@ -105,9 +99,7 @@ flimage_alloc( void )
 {
     FL_IMAGE *image = fl_calloc( 1, sizeof *image );
 
-    init_setup( );
-
-    add_default_formats( );
+    init_once( );
 
     image->setup = &current_setup;
     image->visual_cue = current_setup.visual_cue;
@@ -130,14 +122,6 @@ flimage_alloc( void )
     if ( ! image->xdisplay )
         image->xdisplay = fl_display;
 
-    /* initialize the quantizer */
-
-    if ( ! flimage_quantize_rgb )
-    {
-        flimage_quantize_rgb = j2pass_quantize_rgb;
-        flimage_quantize_packed = j2pass_quantize_packed;
-    }
-
     /* make sure visual_cue and error_message are ok */
 
     if ( ! image->visual_cue )
@@ -161,6 +145,228 @@ flimage_alloc( void )
  * Image identification
  *************************************************************************/
 
+/* Formats with a magic number are recognized from the first
+ * FLIMAGE_MAGIC_LEN bytes of the file, read just once. Only the format
+ * that matches gets its identify routine called (to confirm and to set
+ * whatever it needs to). The formats without one (the text formats
+ * XBM and XPM and those added by applications) get the full probe only
+ * when no magic number matched */
+
+#define FLIMAGE_MAGIC_LEN  64
+
+static int
+find_format( FILE * fp )
+{
+    unsigned char buf[ FLIMAGE_MAGIC_LEN ];
+    const FLIMAGE_MAGIC *m;
+    FLIMAGE_IO *io;
+    size_t n;
+
+    /* The identify routine of a format that was tried before may have
+       left the stream anywhere */
+
+    rewind( fp );
+    n = fread( buf, 1, sizeof buf, fp );
+
+    for ( io = flimage_io; io->formal_name; io++ )
+    {
+        for ( m = io->magic; m && m->len; m++ )
+        {
+            if (    m->offset + m->len <= ( int ) n
+                 && ! memcmp( buf + m->offset, m->bytes, m->len ) )
+            {
+                rewind( fp );
+                if ( io->identify( fp ) > 0 )
+                    return io - flimage_io + 1;
+                break;
+            }
+        }
+    }
+
+    for ( io = flimage_io; io->formal_name; io++ )
+    {
+        if ( io->magic )
+            continue;
+
+        rewind( fp );
+        if ( io->identify( fp ) > 0 )
+            return io - flimage_io + 1;
+    }
+
+    return 0;
+}
+
+
+/* Results of find_format() for the files seen recently. A browser
+   tends to ask about the same files over and over again */
+
+#define ID_HASH   1024
+#define ID_MAX    16384
+
+typedef struct flimage_id_ {
+    char               * file;
+    time_t               mtime;
+    off_t                size;
+    int                  format;
+    struct flimage_id_ * next;
+} FLIMAGE_ID;
+
+static FLIMAGE_ID *id_hash[ ID_HASH ];
+static int id_count;
+static FLI_MUTEX id_lock = FLI_MUTEX_INIT;
+
+
+/***************************************
+ ***************************************/
+
+static unsigned int
+id_hash_value( const char * file )
+{
+    unsigned int h = 0;
+
+    while ( *file )
+        h = h * 31 + ( unsigned char ) *file++;
+
+    return h % ID_HASH;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+clear_ids( void )
+{
+    FLIMAGE_ID *id;
+    int i;
+
+    for ( i = 0; i < ID_HASH; i++ )
+    {
+        while ( ( id = id_hash[ i ] ) )
+        {
+            id_hash[ i ] = id->next;
+            fl_free( id->file );
+            fl_free( id );
+        }
+    }
+
+    id_count = 0;
+}
+
+
+/***************************************
+ * Forget all results, e.g., when formats are added or replaced
+ ***************************************/
+
+static void
+flush_id_cache( void )
+{
+    fli_lock( &id_lock );
+    clear_ids( );
+    fli_unlock( &id_lock );
+}
+
+
+/***************************************
+ * Returns the cached format (0 for none) or -1 if the file isn't known
+ * or has changed since
+ ***************************************/
+
+static int
+lookup_id( const char        * file,
+           const struct stat * st )
+{
+    FLIMAGE_ID *id;
+    int format = -1;
+
+    fli_lock( &id_lock );
+
+    for ( id = id_hash[ id_hash_value( file ) ]; id; id = id->next )
+        if ( ! strcmp( id->file, file ) )
+        {
+            if ( id->mtime == st->st_mtime && id->size == st->st_size )
+                format = id->format;
+            break;
+        }
+
+    fli_unlock( &id_lock );
+
+    return format;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+remember_id( const char        * file,
+             const struct stat * st,
+             int                 format )
+{
+    unsigned int h = id_hash_value( file );
+    FLIMAGE_ID *id;
+
+    fli_lock( &id_lock );
+
+    for ( id = id_hash[ h ]; id && strcmp( id->file, file ); id = id->next )
+        /* empty */ ;
+
+    if ( ! id )
+    {
+        if ( id_count >= ID_MAX )
+            clear_ids( );
+
+        if ( ! ( id = fl_malloc( sizeof *id ) ) )
+            goto done;
+
+        if ( ! ( id->file = fl_strdup( file ) ) )
+        {
+            fl_free( id );
+            goto done;
+        }
+
+        id->next = id_hash[ h ];
+        id_hash[ h ] = id;
+        id_count++;
+    }
+
+    id->mtime = st->st_mtime;
+    id->size = st->st_size;
+    id->format = format;
+
+ done:
+    fli_unlock( &id_lock );
+}
+
+
+/***************************************
+ * Drop what we know about a file, e.g. after writing it
+ ***************************************/
+
+static void
+forget_id( const char * file )
+{
+    FLIMAGE_ID **idp = id_hash + id_hash_value( file ),
+               *id;
+
+    fli_lock( &id_lock );
+
+    for ( ; ( id = *idp ); idp = &id->next )
+    {
+        if ( ! strcmp( id->file, file ) )
+        {
+            *idp = id->next;
+            fl_free( id->file );
+            fl_free( id );
+            id_count--;
+            break;
+        }
+    }
+
+    fli_unlock( &id_lock );
+}
+
+
 /* it's important that this routine be silient. is_supported calls this */
 
 static FL_IMAGE *
@@ -169,6 +375,8 @@ identify_image( const char *file )
     FILE *fp;
     FLIMAGE_IO *io;
     FL_IMAGE *image = NULL;
+    struct stat st;
+    int k;
 
     if ( ! file || ! *file )
         return NULL;
@@ -179,27 +387,39 @@ identify_image( const char *file )
         return NULL;
     }
 
-    if ( ! ppm_added )
-        add_default_formats( );
+    init_once( );
 
-    for ( io = flimage_io; io->formal_name; io++ )
+    /* the format still has to have a look at the file, its identify
+       routine may set up things needed for reading it */
+
+    if (    fstat( fileno( fp ), &st ) == 0
+         && ( k = lookup_id( file, &st ) ) >= 0 )
     {
-        if ( io->identify( fp ) > 0 )
-        {
-            image = flimage_alloc( );
-            image->image_io = io;
-            image->original_type = io->type;
-            image->fpin = fp;
-            strncpy( image->infile, file, MaxImageFileNameLen - 5 );
-            image->infile[ MaxImageFileNameLen - 5 ] = '\0';
-            return image;
-        }
+        io = flimage_io + k - 1;
+        if ( k && io->identify( fp ) <= 0 )
+            k = find_format( fp );
+    }
+    else
+        k = find_format( fp );
 
-        rewind( fp );
+    if ( fstat( fileno( fp ), &st ) == 0 )
+        remember_id( file, &st, k );
+
+    if ( ! k )
+    {
+        fclose( fp );
+        return NULL;
     }
 
-    fclose( fp );
-    return NULL;
+    io = flimage_io + k - 1;
+    image = flimage_alloc( );
+    image->image_io = io;
+    image->original_type = io->type;
+    image->fpin = fp;
+    strncpy( image->infile, file, MaxImageFileNameLen - 5 );
+    image->infile[ MaxImageFileNameLen - 5 ] = '\0';
+
+    return image;
 }
 
 
@@ -211,29 +431,28 @@ int
 flimage_is_supported( const char * file )
 {
     FILE *fp;
-    FLIMAGE_IO *io;
-    int n;
+    struct stat st;
+    int k;
 
-    if ( ! file || ! *file || ! ( fp = fopen( file, "rb" ) ) )
+    if ( ! file || ! *file )
         return 0;
 
-    if ( ! ppm_added )
-        add_default_formats( );
+    init_once( );
 
-    for ( n = 0, io = flimage_io; io->formal_name; io++, n++ )
-    {
-        if ( io->identify( fp ) > 0 )
-        {
-            fclose( fp );
-            return n + 1;
-        }
-        else
-            rewind( fp );
-    }
+    if ( stat( file, &st ) == 0 && ( k = lookup_id( file, &st ) ) >= 0 )
+        return k;
+
+    if ( ! ( fp = fopen( file, "rb" ) ) )
+        return 0;
+
+    k = find_format( fp );
+
+    if ( fstat( fileno( fp ), &st ) == 0 )
+        remember_id( file, &st, k );
 
     fclose( fp );
 
-    return 0;
+    return k;
 }
 
 
@@ -265,6 +484,11 @@ flimage_close( FL_IMAGE * im )
     if ( ! im )
         return -1;
 
+    /* the region reader needs the input file, so it goes with it */
+
+    if ( im->region )
+        flimage_free_region( im );
+
     if ( im->fpin )
         status = fclose( im->fpin );
 
@@ -282,6 +506,27 @@ flimage_close( FL_IMAGE * im )
  * Input routines
  **********************************************************************{*/
 
+/***************************************
+ * If only a reduced image is wanted and the format couldn't deliver
+ * it that small, box-reduce it
+ ***************************************/
+
+static void
+reduce_to_target( FL_IMAGE * im )
+{
+    int f;
+
+    if ( im->target_w <= 0 && im->target_h <= 0 )
+        return;
+
+    if ( ( f = flimage_reduce_factor( im, im->w, im->h ) ) > 1 )
+        flimage_box_reduce( im, f );
+}
+
+
+/***************************************
+ ***************************************/
+
 FL_IMAGE *
 flimage_read( FL_IMAGE * im )
 {
@@ -355,8 +600,10 @@ default_next_frame( FL_IMAGE * im )
 /***************************************
  ***************************************/
 
-FL_IMAGE *
-flimage_load( const char * file )
+static FL_IMAGE *
+load_image( const char * file,
+            int          target_w,
+            int          target_h )
 {
     FL_IMAGE *image,
              *im;
@@ -365,10 +612,13 @@ flimage_load( const char * file )
         total_frames = 1;
     char buf[ 256 ];
 
-    add_default_formats( );
+    init_once( );
 
     if ( ( image = flimage_open( file ) ) )
     {
+        image->target_w = target_w;
+        image->target_h = target_h;
+
         if ( ! ( im = flimage_read( image ) ) )
         {
             flimage_free( image );
@@ -399,54 +649,87 @@ flimage_load( const char * file )
         if ( ( ( FLIMAGE_IO * ) image->image_io )->annotation )
             flimage_read_annotation( image );
         flimage_close( image );
-        fli_safe_free( image->io_spec );
-        image->spec_size = 0;
+        free_io_spec( image );
         image->display = flimage_sdisplay;
-        return image;
     }
+    else
+    {
+        image->current_frame = 1;
 
-    image->current_frame = 1;
-
-    /* We have multi-frames */
+        /* We have multi-frames */
 
-    err = 0;
-    im = image;
+        err = 0;
+        im = image;
 
-    while (    ! err
-            && im->more
-            && im->more > im->completed
-            && im->current_frame < current_setup.max_frames )
-    {
-        if ( ! ( err = ! ( im->next = flimage_dup_( im, 0 ) ) ) )
+        while (    ! err
+                && im->more
+                && im->more > im->completed
+                && im->current_frame < current_setup.max_frames )
         {
-            im = im->next;
-            im->current_frame++;
+            if ( ! ( err = ! ( im->next = flimage_dup_( im, 0 ) ) ) )
+            {
+                im = im->next;
+                im->current_frame++;
+            }
+            sprintf( buf, "Done image %d of %d",
+                     im->current_frame, current_setup.max_frames );
+            im->visual_cue( im, buf );
+            err = err || ( im->next_frame( im ) < 0 );
+            total_frames += ! err;
         }
-        sprintf( buf, "Done image %d of %d",
-                 im->current_frame, current_setup.max_frames );
-        im->visual_cue( im, buf );
-        err = err || ( im->next_frame( im ) < 0 );
-        total_frames += ! err;
-    }
 
-    flimage_close( image );
+        flimage_close( image );
 
-    image->completed = im->total;
-    sprintf( buf, "Done Reading multi-frame %s", image->fmt_name );
-    image->visual_cue( image, err ? "Error Reading" : buf );
+        image->completed = im->total;
+        sprintf( buf, "Done Reading multi-frame %s", image->fmt_name );
+        image->visual_cue( image, err ? "Error Reading" : buf );
 
-    /* multi frame cleanup */
+        /* multi frame cleanup */
 
-    if ( image->cleanup )
-        image->cleanup( image );
+        if ( image->cleanup )
+            image->cleanup( image );
+
+        /* update the number of frames */
+
+        image->total_frames = total_frames;
+    }
 
-    /* update the number of frames */
+    /* Frames can only be reduced once all of them have been read, the
+       next one may be decoded into the previous one */
+
+    for ( im = image; im; im = im->next )
+        reduce_to_target( im );
 
-    image->total_frames = total_frames;
     return image;
 }
 
 
+/***************************************
+ ***************************************/
+
+FL_IMAGE *
+flimage_load( const char * file )
+{
+    return load_image( file, 0, 0 );
+}
+
+
+/***************************************
+ * Load an image at reduced resolution, e.g., for a thumbnail. The
+ * image is reduced by an integer factor (as far as possible while
+ * staying at least w x h, either can be 0 if it doesn't matter), by
+ * the decoder if it can do that (JPEG) or by averaging afterwards
+ ***************************************/
+
+FL_IMAGE *
+flimage_load_reduced( const char * file,
+                      int          w,
+                      int          h )
+{
+    return load_image( file, FL_max( w, 0 ), FL_max( h, 0 ) );
+}
+
+
 /**********************************************************************
  * Output routines
  *********************************************************************/
@@ -502,6 +785,7 @@ flimage_dump( FL_IMAGE   * image,
 
             image->fpout = fp;
             otype = image->type;
+            forget_id( image->outfile );
 
             for ( tmpimage = image; tmpimage; tmpimage = tmpimage->next )
                 convert_type( tmpimage, io );
@@ -622,6 +906,7 @@ flimage_free( FL_IMAGE * image )
 
     for ( im = image; im; im = imnext)
     {
+        flimage_free_view( im );
         flimage_freemem( im );
         if ( im == image )
             flimage_close( im );
@@ -687,10 +972,14 @@ flimage_free_linearlut( FL_IMAGE * im )
 
 
 /***************************************
+ * Make sure the image has pixel matrices of the right type and size.
+ * Unless 'shared' is set these also are made private to the image, so
+ * they can be written to (see flimage_unshare())
  ***************************************/
 
-int
-flimage_getmem( FL_IMAGE * im )
+static int
+getmem( FL_IMAGE * im,
+        int        shared )
 {
     int nomap,
         err = 0,
@@ -810,6 +1099,85 @@ flimage_getmem( FL_IMAGE * im )
     im->matr = im->h;
     im->matc = im->w;
 
+    if ( ! err && ! shared )
+        err = flimage_unshare( im ) < 0;
+
+    return err ? -1 : 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+flimage_getmem( FL_IMAGE * im )
+{
+    return getmem( im, 0 );
+}
+
+
+/***************************************
+ * Called whenever the pixels of an image are about to be changed or
+ * replaced, so state derived from them gets dropped
+ ***************************************/
+
+static void
+pixels_changed( FL_IMAGE * im )
+{
+    if ( im->region )
+        ( ( FLIMAGE_REGION * ) im->region )->current = 0;
+
+    flimage_free_view( im );
+}
+
+
+/***************************************
+ * Pixels of an image made by flimage_dup() are shared with the original
+ * until one of them gets modified. Everything changing pixels in place
+ * must call this first to get a private copy of the matrices of the
+ * image's type. Costs nothing if they aren't shared
+ ***************************************/
+
+int
+flimage_unshare( FL_IMAGE * im )
+{
+    int err;
+
+    if ( ! im )
+        return -1;
+
+    pixels_changed( im );
+
+    switch ( im->type )
+    {
+        case FL_IMAGE_RGB:
+            err =    fl_unshare_matrix( im->red   ) < 0
+                  || fl_unshare_matrix( im->green ) < 0
+                  || fl_unshare_matrix( im->blue  ) < 0
+                  || fl_unshare_matrix( im->alpha ) < 0;
+            break;
+
+        case FL_IMAGE_CI:
+        case FL_IMAGE_MONO:
+            err = fl_unshare_matrix( im->ci ) < 0;
+            break;
+
+        case FL_IMAGE_GRAY:
+        case FL_IMAGE_GRAY16:
+            err = fl_unshare_matrix( im->gray ) < 0;
+            break;
+
+        case FL_IMAGE_PACKED:
+            err = fl_unshare_matrix( im->packed ) < 0;
+            break;
+
+        default:
+            return 0;
+    }
+
+    if ( err )
+        flimage_error( im, "Can't get memory for a private copy of pixels" );
+
     return err ? -1 : 0;
 }
 
@@ -870,6 +1238,8 @@ flimage_getcolormap( FL_IMAGE * im )
 void
 flimage_invalidate_pixels( FL_IMAGE * im )
 {
+    pixels_changed( im );
+
     if ( ! FL_IsGray( im->type ) )
     {
         fl_free_matrix( im->gray );
@@ -897,10 +1267,28 @@ flimage_invalidate_pixels( FL_IMAGE * im )
         im->red = im->green = im->blue = im->alpha = NULL;
     }
 
+    flimage_release_map( im );
+
     im->available_type = im->type;
 }
 
 
+/***************************************
+ * The reader's helper data may hold memory of its own, give the
+ * format a chance to release it via the cleanup hook first
+ ***************************************/
+
+static void
+free_io_spec( FL_IMAGE * image )
+{
+    if ( image->io_spec && image->cleanup )
+        image->cleanup( image );
+
+    fli_safe_free( image->io_spec );
+    image->spec_size = 0;
+}
+
+
 /***************************************
  * Free all allocated memory associated with the image
  ***************************************/
@@ -959,36 +1347,7 @@ flimage_freemem( FL_IMAGE * image )
     image->free_markers( image );
     flimage_free_linearlut( image );
 
-    if ( image->pixmap )
-    {
-        XFreePixmap( image->xdisplay, image->pixmap );
-        image->pixmap = None;
-        image->pixmap_depth = 0;
-    }
-
-    if ( image->ximage )
-    {
-        XDestroyImage( ( XImage * ) image->ximage );
-        image->ximage = NULL;
-    }
-
-    if ( image->gc )
-    {
-        XFreeGC( image->xdisplay, image->gc );
-        image->gc = None;
-    }
-
-    if ( image->textgc )
-    {
-        XFreeGC( image->xdisplay, image->textgc );
-        image->textgc = None;
-    }
-
-    if ( image->markergc )
-    {
-        XFreeGC( image->xdisplay, image->markergc );
-        image->markergc = None;
-    }
+    flimage_free_xresources( image );
 
     if ( image->pixels )
     {
@@ -996,11 +1355,12 @@ flimage_freemem( FL_IMAGE * image )
         image->pixels = NULL;
     }
 
-    fli_safe_free( image->io_spec );
-    image->spec_size = 0;
+    free_io_spec( image );
 
     fli_safe_free( image->info );
 
+    flimage_unmap_file( image );
+
     image->w = image->h = 0;
     image->matr = image->matc = 0;
     image->type = FL_IMAGE_NONE;
@@ -1008,6 +1368,26 @@ flimage_freemem( FL_IMAGE * image )
 }
 
 
+/***************************************
+ * What flimage_get_format_info() returns, set up when the format gets
+ * registered so it can be handed out from any thread
+ ***************************************/
+
+static void
+set_format_info( FLIMAGE_IO * io )
+{
+    FLIMAGE_FORMAT_INFO *fmtinfo = &io->info;
+
+    fmtinfo->formal_name = io->formal_name;
+    fmtinfo->short_name = io->short_name;
+    fmtinfo->extension = io->extension;
+    fmtinfo->type = io->type;
+    fmtinfo->annotation = io->annotation;
+    fmtinfo->read_write =   ( io->write_image ? FLIMAGE_WRITABLE : 0 )
+                          | ( io->read_pixels ? FLIMAGE_READABLE : 0 );
+}
+
+
 /***************************************
  ***************************************/
 
@@ -1071,12 +1451,20 @@ flimage_add_format( const char          * formal_name,
     thisIO->read_pixels = read_pixels;
     thisIO->write_image = write_image;
     thisIO->annotation = 0;
+    thisIO->open_region = 0;
+    thisIO->magic = NULL;
 
     nimage += k == nimage;
 
+    /* format numbers may have changed */
+
+    flush_id_cache( );
+
     if ( ! strcmp( short_name, "ppm" ) || ! strcmp( short_name, "pgm" ) )
         thisIO->annotation = 1;
 
+    set_format_info( thisIO );
+
     /* sentinel */
 
     ( ++thisIO )->formal_name = NULL;
@@ -1097,6 +1485,43 @@ flimage_set_annotation_support( int in,
      if ( in < 0 || in >= nimage )
          return;
      flimage_io[ in ].annotation = flag != 0;
+     set_format_info( flimage_io + in );
+}
+
+
+/***************************************
+ * Formats with magic numbers register them after flimage_add_format()
+ * with the index it returned. Their identify routine then only gets
+ * called for files that start with one of them
+ ***************************************/
+
+void
+flimage_set_magic( int                   in,
+                   const FLIMAGE_MAGIC * magic )
+{
+     --in;
+
+     if ( in < 0 || in >= nimage )
+         return;
+     flimage_io[ in ].magic = magic;
+     flush_id_cache( );
+}
+
+
+/***************************************
+ * Formats that can decode rows on demand call this after
+ * flimage_add_format() with the index it returned
+ ***************************************/
+
+void
+flimage_set_region_support( int                 in,
+                            FLIMAGE_Open_Region open_region )
+{
+     --in;
+
+     if ( in < 0 || in >= nimage )
+         return;
+     flimage_io[ in ].open_region = open_region;
 }
 
 
@@ -1131,7 +1556,7 @@ flimage_type_name( int type )
 int
 flimage_get_number_of_formats( void )
 {
-    add_default_formats( );
+    init_once( );
     return nimage - 1;
 }
 
@@ -1139,34 +1564,15 @@ flimage_get_number_of_formats( void )
 /***************************************
  ***************************************/
 
-#define MaxInfoBuffer 6
-
 const FLIMAGE_FORMAT_INFO *
 flimage_get_format_info( int n )
 {
-    static FLIMAGE_FORMAT_INFO fmt_return[ MaxInfoBuffer ];
-    static int k;
-    FLIMAGE_IO *io;
-    FLIMAGE_FORMAT_INFO *fmtinfo;
-
-    add_default_formats( );
+    init_once( );
 
-    if ( n <= 0 || n > nimage )
+    if ( n <= 0 || n >= nimage )
         return 0;
 
-    fmtinfo = fmt_return + k++ % MaxInfoBuffer;
-    n--;
-    io = flimage_io + n;
-
-    fmtinfo->formal_name = io->formal_name;
-    fmtinfo->short_name = io->short_name;
-    fmtinfo->extension = io->extension;
-    fmtinfo->type = io->type;
-    fmtinfo->annotation = io->annotation;
-    fmtinfo->read_write =   ( io->write_image ? FLIMAGE_WRITABLE : 0 )
-                          | ( io->read_pixels ? FLIMAGE_READABLE : 0 );
-
-    return fmtinfo;
+    return &flimage_io[ n - 1 ].info;
 }
 
 
@@ -1223,6 +1629,8 @@ flimage_replace_image( FL_IMAGE * im,
     im->matr = h;
     im->matc = w;
 
+    flimage_release_map( im );
+
     im->total = im->h;
 
     /* invalidate subimage settings if any */
@@ -1344,6 +1752,66 @@ copy_pixels( FL_IMAGE * dim,
 }
 
 
+/***************************************
+ * Let the new image use the pixel matrices of the original instead of
+ * copying them, whoever writes to them first gets a private copy (see
+ * flimage_unshare()). Fails for pixels the original doesn't own, e.g.
+ * matrices sitting on a mapped file
+ ***************************************/
+
+static int
+share_pixels( FL_IMAGE * dim,
+              FL_IMAGE * sim )
+{
+    switch ( sim->type )
+    {
+        case FLIMAGE_RGB:
+            if (    ( dim->red   = fl_share_matrix( sim->red   ) )
+                 && ( dim->green = fl_share_matrix( sim->green ) )
+                 && ( dim->blue  = fl_share_matrix( sim->blue  ) )
+                 && ( dim->alpha = fl_share_matrix( sim->alpha ) ) )
+            {
+                dim->rgba[ 0 ] = dim->red;
+                dim->rgba[ 1 ] = dim->green;
+                dim->rgba[ 2 ] = dim->blue;
+                dim->rgba[ 3 ] = dim->alpha;
+                break;
+            }
+
+            fl_free_matrix( dim->red );
+            fl_free_matrix( dim->green );
+            fl_free_matrix( dim->blue );
+            dim->red = dim->green = dim->blue = NULL;
+            return -1;
+
+        case FLIMAGE_CI:
+        case FLIMAGE_MONO:
+            if ( ! ( dim->ci = fl_share_matrix( sim->ci ) ) )
+                return -1;
+            break;
+
+        case FLIMAGE_GRAY:
+        case FLIMAGE_GRAY16:
+            if ( ! ( dim->gray = fl_share_matrix( sim->gray ) ) )
+                return -1;
+            break;
+
+        case FLIMAGE_PACKED:
+            if ( ! ( dim->packed = fl_share_matrix( sim->packed ) ) )
+                return -1;
+            break;
+
+        default:
+            return -1;
+    }
+
+    dim->matr = dim->h;
+    dim->matc = dim->w;
+
+    return 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -1369,6 +1837,7 @@ flimage_dup_( FL_IMAGE * sim,
     unsigned int mapsize = sim->map_len * sizeof *sim->red_lut;
     char *infile,
          *outfile;
+    int shared;
 
     if ( ! im )
     {
@@ -1393,17 +1862,25 @@ flimage_dup_( FL_IMAGE * sim,
     im->llut[ 0 ] = im->llut[ 1 ] = im->llut[ 2 ] = NULL;
     im->extra_io_info = NULL;
     im->info = NULL;
+    im->region = NULL;
+    im->view = NULL;
+    im->mapped = NULL;
+    im->mapped_len = 0;
+
+    /* the pixels, if requested, are shared until one of the images
+       gets modified. If that's not possible they're copied */
 
-    flimage_getmem( im );
+    if ( ( shared = pix && share_pixels( im, sim ) == 0 ) )
+        getmem( im, 1 );
+    else
+        flimage_getmem( im );
 
     im->available_type = im->type;
     im->next = NULL;
     strcpy( im->infile = infile, sim->infile );
     strcpy( im->outfile = outfile, sim->outfile );
 
-    /* copy pixels if requested */
-
-    if ( pix )
+    if ( pix && ! shared )
         copy_pixels( im, sim );
 
     if ( mapsize )
@@ -1452,14 +1929,21 @@ flimage_dup_( FL_IMAGE * sim,
 
 
 /***************************************
+ * Default error handler, writes the message in one go to stderr
+ * since, unlike M_err(), that's safe to do from any thread
  ***************************************/
 
 static void
 error_message( FL_IMAGE   * im  FL_UNUSED_ARG,
                const char * s )
 {
-    if ( s && *s )
-        M_err( 0, s );
+    char buf[ 1100 ];
+
+    if ( ! s || ! *s )
+        return;
+
+    fli_snprintf( buf, sizeof buf, "flimage: %s\n", s );
+    fputs( buf, stderr );
 }
 
 
@@ -1583,12 +2067,24 @@ pack_bits( unsigned char  * out,
 
 
 /***************************************
- * Default supported image formats
+ * Default setup, quantizer and supported image formats
  ***************************************/
 
 static void
-add_default_formats( void )
+init_image_support( void )
 {
+    if ( ! current_setup.max_frames && ! current_setup.delay )
+    {
+        current_setup.max_frames = 30;
+        current_setup.delay = 50;
+    }
+
+    if ( ! flimage_quantize_rgb )
+    {
+        flimage_quantize_rgb = j2pass_quantize_rgb;
+        flimage_quantize_packed = j2pass_quantize_packed;
+    }
+
     if ( ! ppm_added )
     {
         flimage_enable_pnm( );
@@ -1600,6 +2096,20 @@ add_default_formats( void )
 }
 
 
+/***************************************
+ * Whatever thread gets here first does the initialization, all others
+ * wait for it to be done
+ ***************************************/
+
+static void
+init_once( void )
+{
+    static FLI_ONCE once = FLI_ONCE_INIT;
+
+    fli_once( &once, init_image_support );
+}
+
+
 /***************************************
  * Given a format, find the corresponding io handler
  ***************************************/
@@ -1649,10 +2159,10 @@ write_marker( FLIMAGE_MARKER * m,
 
 static int
 read_marker( FLIMAGE_MARKER * m,
+             char           * name,
              FILE           * fp )
 {
     char buf[ 128 ];
-    static char name[ 64 ];
     int r,
         g,
         b,
@@ -1713,9 +2223,9 @@ static FLI_VN_PAIR fonts_vn[ ] =
  ***************************************/
 
 static const char *
-get_font_style( int fstyle )
+get_font_style( int    fstyle,
+                char * retbuf )
 {
-    static char retbuf[ 128 ];
     const char *font_spstyle = "normal";
     int spstyle = fstyle / FL_SHADOW_STYLE;
     int style = fstyle % FL_SHADOW_STYLE;
@@ -1751,7 +2261,8 @@ write_text( FLIMAGE_TEXT * t,
     int r,
         g,
         b;
-    char *p;
+    char *p,
+         style[ 128 ];
 
     /* output string. */
 
@@ -1764,7 +2275,8 @@ write_text( FLIMAGE_TEXT * t,
     }
     putc( RB, fp );
 
-    fprintf( fp, " %s %d %d %d %s %d %d", get_font_style( t->style ), t->size,
+    fprintf( fp, " %s %d %d %d %s %d %d", get_font_style( t->style, style ),
+             t->size,
              t->x, t->y, fli_get_vn_name( align_vn, t->align ), t->angle,
              t->nobk );
     FL_UNPACK( t->color, r, g, b );
@@ -1777,15 +2289,17 @@ write_text( FLIMAGE_TEXT * t,
 /***************************************
  ***************************************/
 
+#define MaxTextLen  512
+
 static int
 read_text( FLIMAGE_TEXT * t,
-           FILE *         fp )
+           char         * name,
+           FILE         * fp )
 {
     char buf[ 1024 ],
          fnt[ 64 ],
          style[ 64 ],
          align[ 64 ];
-    static char name[ 512 ];
     int r,
         g,
         b,
@@ -1794,7 +2308,7 @@ read_text( FLIMAGE_TEXT * t,
         bb;
     char *p  = buf + 1,
          *s  = name,
-         *ss = name + sizeof name - 1;
+         *ss = name + MaxTextLen - 1;
 
     if ( fgets( buf, sizeof buf - 1, fp ) )
         buf[ sizeof buf - 1 ] = '\0';
@@ -1903,7 +2417,8 @@ flimage_read_annotation( FL_IMAGE * im )
         nmarkers,
         i,
         ntext;
-    char buf[ 1024 ];
+    char buf[ 1024 ],
+         name[ MaxTextLen ];
 
     if ( ! im || im->type == FL_IMAGE_NONE )
         return -1;
@@ -1932,7 +2447,7 @@ flimage_read_annotation( FL_IMAGE * im )
             {
                 while ( skip_line( fp ) )
                     /* empty */ ;
-                if ( read_marker( &m, fp ) >= 0 )
+                if ( read_marker( &m, name, fp ) >= 0 )
                     flimage_add_marker_struct( im, &m );
             }
         }
@@ -1946,7 +2461,7 @@ flimage_read_annotation( FL_IMAGE * im )
             {
                 while ( skip_line( fp ) )
                     /* empty */ ;
-                if ( read_text( &t, fp) >= 0 )
+                if ( read_text( &t, name, fp ) >= 0 )
                     flimage_add_text_struct( im, &t );
             }
             done = 1;
@@ -710,18 +710,28 @@ BMP_write_image( FL_IMAGE * im )
 }
 
 
+static const FLIMAGE_MAGIC bmp_magic[ ] =
+{
+    { 0, 2, "BM" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_bmp( void )
 {
-    flimage_add_format( "Windows/OS2 BMP file", "bmp", "bmp",
-                        FL_IMAGE_FLEX & ~FL_IMAGE_GRAY16,
-                        BMP_identify,
-                        BMP_description,
-                        BMP_read_pixels,
-                        BMP_write_image );
+    int k;
+
+    k = flimage_add_format( "Windows/OS2 BMP file", "bmp", "bmp",
+                            FL_IMAGE_FLEX & ~FL_IMAGE_GRAY16,
+                            BMP_identify,
+                            BMP_description,
+                            BMP_read_pixels,
+                            BMP_write_image );
+    flimage_set_magic( k, bmp_magic );
 }
 
 
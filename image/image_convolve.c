@@ -273,6 +273,7 @@ gray_convolve( unsigned short ** gray,
 
 static int **sharpen_kernel;
 static int **smooth_kernel;
+static FLI_ONCE kernel_once = FLI_ONCE_INIT;
 
 
 /***************************************
@@ -288,7 +289,8 @@ flimage_convolve( FL_IMAGE  * im,
         i;
     const char * what = "convolving";
     char buf[ 128 ];
-    SubImage *sub;
+    SubImage subimage,
+             *sub;
 
     if ( !im || im->w <= 0 || im->type == FL_IMAGE_NONE )
     {
@@ -304,8 +306,7 @@ flimage_convolve( FL_IMAGE  * im,
         return -1;
     }
 
-    if ( ! sharpen_kernel )
-        init_kernels( );
+    fli_once( &kernel_once, init_kernels );
 
     if ( kernel == FL_SHARPEN )
     {
@@ -338,7 +339,10 @@ flimage_convolve( FL_IMAGE  * im,
     if ( ! FL_IsGray( im->type ) )
         flimage_convert( im, FL_IMAGE_RGB, 0 );
 
-    if ( ! ( sub = flimage_get_subimage( im, 1 ) ) )
+    if ( flimage_unshare( im ) < 0 )
+        return -1;
+
+    if ( ! ( sub = flimage_get_subimage( im, 1, &subimage ) ) )
         return -1;
 
     im->completed = 0;
@@ -152,6 +152,7 @@ get_all_colors( FL_IMAGE      * im,
                                         mapentry, max_colors,
                                         &xc[ i ].pixel );
 
+        fli_forget_closest_color( mapentry );
         fl_free( mapentry );
     }
 }
@@ -879,6 +880,7 @@ flimage_color_to_pixel( FL_IMAGE * im,
             for ( i = 0; i < max_col; i++ )
                 xcolor[ i ].pixel = i;
             XQueryColors( im->xdisplay, im->xcolormap, xcolor, max_col );
+            fli_forget_closest_color( xcolor );
             lastcolormap = im->xcolormap;
         }
 
@@ -1154,6 +1156,51 @@ flimage_to_ximage( FL_IMAGE *          im,
 }
 
 
+/***************************************
+ * For an image read by region sx, sy, sw and sh select the part of the
+ * whole image (at the level last asked for) to show. A zero width or
+ * height means as much as fits into the window. The region gets read
+ * and then shown as a normal image.
+ ***************************************/
+
+static int
+display_region( FL_IMAGE * im,
+                Window     win )
+{
+    FLIMAGE_REGION *rg = im->region;
+    XWindowAttributes xwa;
+    int sx = im->sx,
+        sy = im->sy,
+        sw = im->sw,
+        sh = im->sh,
+        level = FL_max( rg->level, 0 ),
+        w,
+        h,
+        ret;
+
+    XGetWindowAttributes( im->xdisplay, win, &xwa );
+
+    w = sw > 0 ? sw : FL_max( xwa.width  - im->wx, 1 ) << level;
+    h = sh > 0 ? sh : FL_max( xwa.height - im->wy, 1 ) << level;
+
+    if ( flimage_read_region( im, sx, sy, w, h, level ) < 0 )
+        return -1;
+
+    im->region = NULL;
+    im->sx = im->sy = im->sw = im->sh = 0;
+
+    ret = flimage_sdisplay( im, win );
+
+    im->region = rg;
+    im->sx = sx;
+    im->sy = sy;
+    im->sw = sw;
+    im->sh = sh;
+
+    return ret;
+}
+
+
 /***************************************
  * We always keep hi-res image whenever possible. For this reason,
  * the displayed image and the image in memory are not necessarily the
@@ -1168,7 +1215,13 @@ flimage_sdisplay( FL_IMAGE * im,
     XWindowAttributes xwa;
     int ret = 0;
 
-    if ( win <= 0 || !im || im->w <= 0 || im->type == FL_IMAGE_NONE )
+    if ( win <= 0 || ! im )
+        return -1;
+
+    if ( im->region )
+        return display_region( im, win );
+
+    if ( im->w <= 0 || im->type == FL_IMAGE_NONE )
         return -1;
 
     if ( sizeof( int ) != 4 )
@@ -1707,7 +1760,53 @@ Pixmap flimage_to_pixmap( FL_IMAGE  * im,
 
 
 /***************************************
- * Render possible annotations into the the image
+ * Releases everything an image holds on the X server. Images that
+ * never were displayed don't have anything there, so this is safe to
+ * call without a display.
+ ***************************************/
+
+void
+flimage_free_xresources( FL_IMAGE * im )
+{
+    if ( ! im->xdisplay )
+        return;
+
+    if ( im->pixmap )
+    {
+        XFreePixmap( im->xdisplay, im->pixmap );
+        im->pixmap = None;
+        im->pixmap_depth = 0;
+    }
+
+    if ( im->ximage )
+    {
+        XDestroyImage( ( XImage * ) im->ximage );
+        im->ximage = NULL;
+    }
+
+    if ( im->gc )
+    {
+        XFreeGC( im->xdisplay, im->gc );
+        im->gc = None;
+    }
+
+    if ( im->textgc )
+    {
+        XFreeGC( im->xdisplay, im->textgc );
+        im->textgc = None;
+    }
+
+    if ( im->markergc )
+    {
+        XFreeGC( im->xdisplay, im->markergc );
+        im->markergc = None;
+    }
+}
+
+
+/***************************************
+ * Render possible annotations into the the image. Without a window
+ * (or display) they get rasterized by the library itself.
  ***************************************/
 
 int
@@ -1717,12 +1816,15 @@ flimage_render_annotation( FL_IMAGE  * im,
     int status;
     XWindowAttributes xwa;
 
-    if ( ! im || ! win )
+    if ( ! im )
         return -1;
 
     if ( ! im->ntext && ! im->nmarkers )
         return 0;
 
+    if ( ! win || ! im->xdisplay )
+        return flimage_rasterize_annotation( im );
+
     XGetWindowAttributes( im->xdisplay, win, &xwa );
 
     /* Create an offscreen pixmap to hold the image */
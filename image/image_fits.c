@@ -149,8 +149,9 @@ detect_endian( void )
 static void
 init_fits( SPEC * sp )
 {
-    if ( little_endian < 0 )
-    detect_endian( );
+    static FLI_ONCE once = FLI_ONCE_INIT;
+
+    fli_once( &once, detect_endian );
 
     sp->bpp = sp->ndim = -1;
     sp->bscale = 1.0;
@@ -163,16 +164,18 @@ init_fits( SPEC * sp )
 /***************************************
  ***************************************/
 
+#define MAXINFO  15
+
 static char **
-FITS_header_info( const void * p )
+FITS_header_info( const void * p,
+                  char         hbuf[ ][ 80 ],
+                  char      ** buf )
 {
     const SPEC *h = p;
-    static char hbuf[ 15 ][ 80 ];
-    static char *buf[ 15 ];
     int i,
         j;
 
-    for ( i = 0; i < 15; i++ )
+    for ( i = 0; i < MAXINFO; i++ )
         buf[ i ] = hbuf[ i ];
 
     i = 0;
@@ -204,12 +207,15 @@ static void
 generate_fits_header_info( FL_IMAGE * im )
 {
     SPEC *h = im->io_spec;
-    char **q;
+    char hbuf[ MAXINFO ][ 80 ],
+         *buf[ MAXINFO ],
+         **q;
 
     if ( ! ( im->info = fl_malloc( 1024 ) ) )
         return;
 
-    for ( im->info[ 0 ] = '\0', q = FITS_header_info( h ); *q; q++ )
+    im->info[ 0 ] = '\0';
+    for ( q = FITS_header_info( h, hbuf, buf ); *q; q++ )
         strcat( strcat( im->info, *q ),"\n" );
 }
 
@@ -225,12 +231,14 @@ static int verbose = 4;
 static void
 echo_FITS_header( SPEC * h )
 {
-    char **q;
+    char hbuf[ MAXINFO ][ 80 ],
+         *buf[ MAXINFO ],
+         **q;
 
     if ( verbose <= ML_INFO1 )
         return;
 
-    for ( q = FITS_header_info( h ); *q; q++ )
+    for ( q = FITS_header_info( h, hbuf, buf ); *q; q++ )
         fprintf( stderr, "%s\n", *q );
 }
 
@@ -544,6 +552,139 @@ parse_fits_header( FILE     * fp,
                           } while ( 0 )
 
 
+static double raw_value( const SPEC *,
+                         const unsigned char * );
+
+
+/***************************************
+ * Overall offset and scale from raw data to pixel values. Also sets
+ * the reverse transform, from pixel values to physical data
+ ***************************************/
+
+static void
+set_fits_scale( FL_IMAGE * im,
+                SPEC     * sp,
+                double   * offset,
+                double   * scale )
+{
+    *scale = sp->dmax > sp->dmin ?
+             im->gray_maxval / ( sp->dmax - sp->dmin ) : 0.0;
+    *offset = -sp->dmin * *scale;
+
+    /* figure in the raw to physcal transform */
+
+    *offset = *offset + sp->bzero * *scale;
+    *scale = sp->bscale * *scale;
+
+    /* reverse transform */
+
+    if ( *scale != 0.0 )
+    {
+        im->poffset = -*offset / *scale;
+        im->pscale = 1.0 / *scale;
+    }
+
+    im->pmin = sp->dmin;
+    im->pmax = sp->dmax;
+    im->xdist_scale = sp->cdelta[ 0 ];
+    im->ydist_scale = sp->cdelta[ 1 ];
+}
+
+
+/***************************************
+ * Use the data of the current frame right from the (privately) mapped
+ * file. Pixels are never bigger than the data elements (except for
+ * BITPIX 8), so they can be converted in place. Returns -1 if the file
+ * can't be mapped and needs to be read the normal way
+ ***************************************/
+
+static int
+map_fits( FL_IMAGE * im )
+{
+    SPEC *sp = im->io_spec;
+    int bpp = FL_abs( sp->bpp ) / 8,
+        maxval = FL_IsGray( im->type ) ? im->gray_maxval : im->map_len - 1,
+        i,
+        j;
+    long pos = ftell( im->fpin );
+    unsigned long npix = ( unsigned long ) im->w * im->h;
+    unsigned char *data,
+                  *c;
+    unsigned short **mat,
+                   *pix;
+    double dmin = 1.0e30,
+           dmax = -1.0e30,
+           offset,
+           scale,
+           v;
+
+    if ( bpp < 2 )
+        return -1;
+
+    /* The first frame starts at the record following the header, the
+       others right after the previous one */
+
+    if ( sp->nframe == 1 )
+        pos = ( pos / RECORD_LEN ) * RECORD_LEN;
+
+    if ( ! ( data = flimage_map_file( im, pos, npix * bpp ) ) )
+        return -1;
+
+    if ( ! ( mat = fl_make_matrix( im->h, im->w, sizeof *pix, data ) ) )
+    {
+        flimage_unmap_file( im );
+        return -1;
+    }
+
+    fseek( im->fpin, pos + npix * bpp, SEEK_SET );
+
+    if ( sp->dmax == sp->dmin )
+    {
+        for ( c = data, i = 0; i < im->h; i++ )
+            for ( j = 0; j < im->w; j++, c += bpp )
+            {
+                v = raw_value( sp, c );
+                if ( v < dmin )
+                    dmin = v;
+                if ( v > dmax )
+                    dmax = v;
+            }
+
+        sp->dmin = sp->bzero + dmin * sp->bscale;
+        sp->dmax = sp->bzero + dmax * sp->bscale;
+    }
+
+    set_fits_scale( im, sp, &offset, &scale );
+
+    /* pixel n is written over data that have already been read */
+
+    for ( c = data, i = 0; i < im->h; i++, im->completed++ )
+    {
+        if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Reading FITS" );
+
+        for ( pix = mat[ i ], j = 0; j < im->w; j++, c += bpp )
+        {
+            v = offset + raw_value( sp, c ) * scale;
+            pix[ j ] = v <= 0 ? 0 : ( v >= maxval ? maxval : v );
+        }
+    }
+
+    if ( FL_IsGray( im->type ) )
+    {
+        fl_free_matrix( im->gray );
+        im->gray = mat;
+    }
+    else
+    {
+        fl_free_matrix( im->ci );
+        im->ci = mat;
+    }
+
+    return 1;
+}
+
+
 /***************************************
  * Assuming IEEE-745 floating point native
  ***************************************/
@@ -575,6 +716,9 @@ FITS_load( FL_IMAGE * im )
              tmp32;
     void **vals;
 
+    if ( map_fits( im ) > 0 )
+        return 1;
+
     dmin = 1.0e30;
     dmax = -1.0e30;
     has_minmax = sp->dmax != sp->dmin;
@@ -663,6 +807,7 @@ FITS_load( FL_IMAGE * im )
                 {
                     if ( little_endian )
                     {
+                        SWAP4( c, uc );
                         /* Using
                             fval[ j ] = * ( FLOAT32 * ) uc;
                            results in type-punning warning, so instead: */
@@ -717,24 +862,7 @@ FITS_load( FL_IMAGE * im )
         sp->dmax = sp->bzero + dmax * sp->bscale;
     }
 
-    /* now the overall offset and scale for physical data */
-
-    scale = im->gray_maxval / ( sp->dmax - sp->dmin );
-    offset = -sp->dmin * scale;
-
-    /* figure in the raw to physcal transform */
-
-    offset = offset + sp->bzero * scale;
-    scale = sp->bscale * scale;
-
-    /* reverse transform */
-
-    im->poffset = -offset / scale;
-    im->pscale = 1.0 / scale;
-    im->pmin = sp->dmin;
-    im->pmax = sp->dmax;
-    im->xdist_scale = sp->cdelta[ 0 ];
-    im->ydist_scale = sp->cdelta[ 1 ];
+    set_fits_scale( im, sp, &offset, &scale );
 
     /* remap data into pixels */
 
@@ -760,6 +888,209 @@ FITS_load( FL_IMAGE * im )
 }
 
 
+/*************************************************************************
+ * Region-on-demand reading. The data array is uncompressed, so any
+ * part of a row can be read directly from the file
+ *************************************************************************/
+
+typedef struct
+{
+    SPEC            hdr;
+    long            data_offset;    /* start of the data array         */
+    int             byte_per_pix;
+    double          offset,         /* raw data to pixel value         */
+                    scale;
+    unsigned char * buf;
+} FITS_REGION;
+
+
+/***************************************
+ * Raw value of the data element c points to
+ ***************************************/
+
+static double
+raw_value( const SPEC          * sp,
+           const unsigned char * c )
+{
+    unsigned char uc[ 8 ];
+    FLOAT32 fval,
+            tmp32;
+    FLOAT64 dval,
+            tmp64;
+    int ival;
+
+    switch ( sp->bpp )
+    {
+        case 8 :
+            return c[ 0 ];
+
+        case 16 :
+            ival = ( short ) ( ( c[ 0 ] << 8 ) | c[ 1 ] );
+            return sp->has_blank && ival == sp->blank ? blank_replace : ival;
+
+        case 32 :
+            ival =   ( c[ 0 ] << 24 ) | ( c[ 1 ] << 16 )
+                   | ( c[ 2 ] <<  8 ) | c[ 3 ];
+            return sp->has_blank && ival == sp->blank ? blank_replace : ival;
+
+        case -32 :
+            if ( little_endian )
+                SWAP4( c, uc );
+            else
+                memcpy( uc, c, 4 );
+            memcpy( &fval, uc, 4 );
+            return ISNAN( fval, tmp32 ) ? nan_replace : fval;
+
+        default :
+            if ( little_endian )
+                SWAP8( c, uc );
+            else
+                memcpy( uc, c, 8 );
+            memcpy( &dval, uc, 8 );
+            return ISNAN( dval, tmp64 ) ? nan_replace : dval;
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+read_fits_row( FL_IMAGE * im,
+               int        row,
+               int        col,
+               int        n )
+{
+    FLIMAGE_REGION *rg = im->region;
+    FITS_REGION *fr = rg->spec;
+
+    fseek( im->fpin,   fr->data_offset
+                     + ( ( long ) row * rg->w + col )
+                     * fr->byte_per_pix, SEEK_SET );
+
+    return fread( fr->buf, fr->byte_per_pix, n, im->fpin ) == ( size_t ) n ?
+           0 : -1;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+FITS_read_row( FL_IMAGE * im,
+               int        row,
+               int        col,
+               int        n,
+               int        step,
+               void    ** out )
+{
+    FITS_REGION *fr = ( ( FLIMAGE_REGION * ) im->region )->spec;
+    unsigned short *ci = out[ 0 ];
+    unsigned char *c = fr->buf;
+    int maxval = FL_IsGray( im->type ) ? im->gray_maxval : im->map_len - 1,
+        k;
+    double v;
+
+    if ( read_fits_row( im, row, col, ( n - 1 ) * step + 1 ) < 0 )
+        return -1;
+
+    for ( k = 0; k < n; k++, c += step * fr->byte_per_pix )
+    {
+        v = fr->offset + raw_value( &fr->hdr, c ) * fr->scale;
+        ci[ k ] = v <= 0 ? 0 : ( v >= maxval ? maxval : v );
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+FITS_close_region( FL_IMAGE * im )
+{
+    FLIMAGE_REGION *rg = im->region;
+    FITS_REGION *fr = rg->spec;
+
+    if ( fr )
+        fli_safe_free( fr->buf );
+    fli_safe_free( rg->spec );
+}
+
+
+/***************************************
+ * Set up the region reader. Same scaling as FITS_load, but without
+ * DATAMIN/DATAMAX in the header we need one pass over the data, row
+ * by row, to find the range
+ ***************************************/
+
+static int
+FITS_open_region( FL_IMAGE * im )
+{
+    FLIMAGE_REGION *rg = im->region;
+    SPEC *sp = im->io_spec;
+    FITS_REGION *fr = fl_calloc( 1, sizeof *fr );
+    double dmin = 1.0e30,
+           dmax = -1.0e30,
+           v;
+    int i,
+        j;
+
+    if ( ! fr )
+        return -1;
+
+    rg->spec = fr;
+    rg->read_row = FITS_read_row;
+    rg->cleanup = FITS_close_region;
+
+    fr->hdr = *sp;
+    fr->byte_per_pix = FL_abs( sp->bpp ) / 8;
+
+    /* the header got read up to the padding, the data start at the
+       record boundary */
+
+    fr->data_offset = ( ftell( im->fpin ) / RECORD_LEN ) * RECORD_LEN;
+
+    if ( ! ( fr->buf = fl_malloc( im->w * fr->byte_per_pix ) ) )
+    {
+        flimage_error( im, "Can't get memory for FITS" );
+        return -1;
+    }
+
+    if ( sp->dmax == sp->dmin )
+    {
+        for ( i = 0; i < im->h; i++ )
+        {
+            if ( ! ( i & FLIMAGE_REPFREQ ) )
+                im->visual_cue( im, "Scanning FITS" );
+
+            if ( read_fits_row( im, i, 0, im->w ) < 0 )
+            {
+                flimage_error( im, "Error reading FITS" );
+                return -1;
+            }
+
+            for ( j = 0; j < im->w; j++ )
+            {
+                v = raw_value( sp, fr->buf + j * fr->byte_per_pix );
+                if ( v < dmin )
+                    dmin = v;
+                if ( v > dmax )
+                    dmax = v;
+            }
+        }
+
+        sp->dmin = sp->bzero + dmin * sp->bscale;
+        sp->dmax = sp->bzero + dmax * sp->bscale;
+    }
+
+    set_fits_scale( im, sp, &fr->offset, &fr->scale );
+
+    return 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -829,18 +1160,29 @@ FITS_next( FL_IMAGE * im )
 }
 
 
+static const FLIMAGE_MAGIC fits_magic[ ] =
+{
+    { 0, 6, "SIMPLE" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_fits( void )
 {
-    flimage_add_format( "NASA/NOST FITS", "fits", "fits",
-                        FL_IMAGE_GRAY | FL_IMAGE_GRAY16,
-                        FITS_identify,
-                        FITS_description,
-                        FITS_load,
-                        FITS_dump );
+    int k;
+
+    k = flimage_add_format( "NASA/NOST FITS", "fits", "fits",
+                            FL_IMAGE_GRAY | FL_IMAGE_GRAY16,
+                            FITS_identify,
+                            FITS_description,
+                            FITS_load,
+                            FITS_dump );
+    flimage_set_magic( k, fits_magic );
+    flimage_set_region_support( k, FITS_open_region );
 }
 
 
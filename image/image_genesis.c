@@ -56,7 +56,7 @@ GENESIS_identify( FILE * fp )
 {
     char buf[ 4 ];
 
-    if ( fread( buf, 1, 4, fp ) == 4 )
+    if ( fread( buf, 1, 4, fp ) != 4 )
         return 0;
     rewind( fp );
     return ! strncmp( buf, "IMGF", 4 );
@@ -122,28 +122,53 @@ GENESIS_load( FL_IMAGE * im )
 {
     FILE *fp = im->fpin;
     SPEC *sp = im->io_spec;
+    unsigned short *gray = im->gray[ 0 ];
+    int i,
+        npix = im->w * im->h;
+
+    if ( sp->depth > 8 && flimage_map_gray16( im, sp->hdr_len ) == 0 )
+        return 0;
 
     fseek( fp, sp->hdr_len, SEEK_SET );
-    if ( fread( im->gray[ 0 ], sp->depth / 8, im->w * im->h, fp )
-                                                 != ( size_t ) im->w * im->h )
-        convert_msbf( im->gray[ 0 ], im->w * im->h );
+
+    if ( sp->depth == 8 )
+    {
+        for ( i = 0; i < npix; i++ )
+            gray[ i ] = getc( fp );
+        return feof( fp ) ? -1 : 0;
+    }
+
+    if ( fread( gray, 2, npix, fp ) != ( size_t ) npix )
+        return -1;
+
+    convert_msbf( gray, npix );
 
     return 0;
 }
 
 
+static const FLIMAGE_MAGIC genesis_magic[ ] =
+{
+    { 0, 4, "IMGF" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_genesis( void )
 {
-    flimage_add_format( "GE Genesis", "genesis", "ge",
-                        FL_IMAGE_GRAY16 | FL_IMAGE_GRAY,
-                        GENESIS_identify,
-                        GENESIS_description,
-                        GENESIS_load,
-                        0 );
+    int k;
+
+    k = flimage_add_format( "GE Genesis", "genesis", "ge",
+                            FL_IMAGE_GRAY16 | FL_IMAGE_GRAY,
+                            GENESIS_identify,
+                            GENESIS_description,
+                            GENESIS_load,
+                            0 );
+    flimage_set_magic( k, genesis_magic );
 }
 
 
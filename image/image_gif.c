@@ -59,7 +59,7 @@ GIF_identify( FILE * fp )
     if ( fread( buf, 1, 6, fp ) != 6 )
         return 0;
     rewind( fp );
-    return ! strncmp( buf, "GIFa", 4 );
+    return ! strncmp( buf, "GIF87a", 6 ) || ! strncmp( buf, "GIF89a", 6 );
 }
 
 
@@ -348,22 +348,9 @@ convert_gif_text( FL_IMAGE * im )
 
 static int readextension( FILE *,
                           FL_IMAGE * );
-static int next_lineno( int,
-                        int,
-                        int );
-static int process_lzw_code( FL_IMAGE *,
-                             int );
-static void outputline( FL_IMAGE *,
-                        unsigned char * );
-
-
-/****************** decoder variables ******************/
-
-static const unsigned int gif_codemask[ ] =
-{
-    0x0000, 0x0001, 0x0003, 0x0007, 0x000f, 0x001f,
-    0x003f, 0x007f, 0x00ff, 0x01ff, 0x03ff, 0x07ff, 0x0fff
-};
+static int gif_lineno( int,
+                       int,
+                       int );
 
 
 /***************************************
@@ -379,15 +366,11 @@ outputline( FL_IMAGE      * im,
     unsigned short *po;
     unsigned char *pi = line;
     SPEC *sp = im->io_spec;
-    static int lines;
     int k;
 
-    if ( sp->cur_total == 0 )   /* first entry */
-        lines = 0;
-
     /* figure out the real row  number if interlace */
 
-    k = next_lineno( lines, im->h, sp->interlace );
+    k = gif_lineno( sp->cur_total / im->w, im->h, sp->interlace );
 
     sp->cur_total += im->w;
 
@@ -399,7 +382,7 @@ outputline( FL_IMAGE      * im,
     for ( po = im->ci[ k ], line += im->w; pi < line; )
         *po++ = *pi++;
 
-    im->completed = ++lines;
+    im->completed = sp->cur_total / im->w;
     if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
         im->visual_cue( im, "Reading GIF" );
 }
@@ -558,170 +541,251 @@ skip_extension( FILE     * fp,
 }
 
 
-#define LZW_INIT          9000
-
-
-static int bpp,
-           ClearCode,
-           EOFCode,
-           CodeSize;
+/*
+ * The LZW string table. Each code is a prefix code plus a suffix
+ * character. With the length and the first character of each string
+ * also in the table, a string can be written backwards right into
+ * the line buffer, without a stack. All decoder state lives here
+ * (and in the SPEC), so several images can be read at the same time.
+ */
 
-#include <ctype.h>
+#define LZW_BITS     12
+#define LZW_TABSIZE  ( 1 << LZW_BITS )
 
-static unsigned char * lhead,
-                     *lbuf,
-                     *stackp;   /* local buffers */
+typedef struct
+{
+    unsigned short   prefix[ LZW_TABSIZE ];
+    unsigned short   length[ LZW_TABSIZE ];
+    unsigned char    suffix[ LZW_TABSIZE ];
+    unsigned char    first[ LZW_TABSIZE ];
+    int              bpp;               /* initial code size - 1 */
+    int              codesize;          /* current code size     */
+    int              clear;             /* clear code            */
+    int              eoi;               /* end of information    */
+    int              avail;             /* next free code        */
+    int              oldcode;
+    unsigned int     datum;             /* bits not used yet     */
+    int              bits;
+    unsigned char  * line;              /* w + LZW_TABSIZE bytes */
+    unsigned char  * lp;
+} LZW_DECODER;
 
 
 /***************************************
  ***************************************/
 
-static int
-GIF_load( FL_IMAGE * im )
+static LZW_DECODER *
+lzw_decoder_new( FL_IMAGE * im,
+                 int        bpp )
 {
-    int bits = 0,
-        err,
-        count,
-        code = -1;
-    unsigned int datum = 0;
-    unsigned char *ch,
-                  buf[ 257 ];
-    SPEC *sp = im->io_spec;
-    const char *func = "GIFReadPix";
-    FILE *fp = im->fpin;
+    LZW_DECODER *dec;
+    int i;
 
-    sp->ctext = 0;
+    if ( ! ( dec = fl_malloc( sizeof *dec ) ) )
+        return NULL;
 
-    CodeSize = getc( fp );
-    if ( CodeSize > 8 || CodeSize < 2 )
+    if ( ! ( dec->line = fl_malloc( im->w + 1 + LZW_TABSIZE ) ) )
     {
-        flimage_error( im, "Load: Bad CodeSize %d(%s)", CodeSize, im->infile );
-        return -1;
+        fl_free( dec );
+        return NULL;
     }
 
-    /* initialize the decompressor */
-
-    err = sp->cur_total = 0;
-    process_lzw_code( im, LZW_INIT );
-
-    while ( ! err && ( count = getc( fp ) ) != EOF && count > 0 )
+    dec->lp = dec->line;
+    dec->bpp = bpp;
+    dec->clear = 1 << bpp;
+    dec->eoi = dec->clear + 1;
+    dec->codesize = bpp + 1;
+    dec->avail = dec->clear + 2;
+    dec->oldcode = -1;
+    dec->datum = 0;
+    dec->bits = 0;
+
+    for ( i = 0; i < dec->clear; i++ )
     {
-        err = Badfread( buf, 1, ( size_t )count, fp );
-        for ( ch = buf; count-- > 0; ch++ )
-        {
-            datum += *ch << bits;
-            bits += 8;
-            while ( bits >= CodeSize && ! err )
-            {
-                code = datum & gif_codemask[ CodeSize ];
-                datum >>= CodeSize;
-                bits -= CodeSize;
-                err = code == EOFCode || process_lzw_code( im, code );
-            }
-        }
+        dec->prefix[ i ] = 0;
+        dec->length[ i ] = 1;
+        dec->suffix[ i ] = dec->first[ i ] = i;
+    }
 
-        /* EOFcode is not exactly an errr */
+    return dec;
+}
 
-        if ( err && code == EOFCode )
-            err = 0;
 
-        if ( code != EOFCode && sp->cur_total > (long) im->w * im->h )
-        {
-            flimage_error( im, "%s: Raster full before EOI", im->infile );
-            err = 1;
-        }
-    }
+/***************************************
+ ***************************************/
 
-    if ( ! err )
+static void
+lzw_decoder_free( LZW_DECODER * dec )
+{
+    if ( dec )
     {
-        if ( ( code = getc( fp ) ) == EXTENSION )
-        {
-            ungetc( code, fp );
-            while (    ( code = skip_extension( fp, im ) ) != EOF
-                    && code != IMAGESEP )
-                /* empty */ ;
-        }
-
-        if ( code == IMAGESEP )
-        {
-            im->more = 1;
-            ungetc( IMAGESEP, fp );
-        }
-        else if (    code != EOF
-                  && fread( buf, 1, 50, fp )
-                  && getc( fp ) != EOF )
-        {
-            M_info( func, "%s: Garbage(> 50bytes) at end", im->infile );
-        }
+        fl_free( dec->line );
+        fl_free( dec );
     }
+}
 
-    count = sp->cur_total / im->w;
-
-    /* final check: get pixels that are decoded but yet to be output */
 
-    if ( count < im->h )
-    {
-        int leftover;
-        leftover = lbuf - lhead;
-
-        M_warn( func, "total %ld should be %d", sp->cur_total + leftover,
-                im->w * im->h );
+/***************************************
+ * Output all complete scanlines in the line buffer and move what
+ * is left over to the start of it
+ ***************************************/
 
-        if ( leftover )
-            outputline( im, lhead );
-    }
+static void
+flush_lines( FL_IMAGE    * im,
+             LZW_DECODER * dec )
+{
+    unsigned char *p = dec->line;
+    int n = dec->lp - dec->line;
 
-    /* if more than 1/4 image is read, return positive value so that driver
-       will try to display it.  */
+    if ( n < im->w )
+        return;
 
-    convert_gif_text( im );
+    for ( ; n >= im->w; n -= im->w, p += im->w )
+        outputline( im, p );
 
-    return count >= im->h / 4 ? count : -1;
+    memmove( dec->line, p, n );
+    dec->lp = dec->line + n;
 }
 
 
 /***************************************
- * process_lzw_code - Process a compression code.  "clear" resets the
- * code table. Otherwise make a new code table entry, and output the
- * bytes associated with the code.
+ * Decode the codes in one data sub-block. Returns 1 when the end of
+ * information code is seen, -1 on a corrupt code stream and 0
+ * otherwise.
  *
  * Based on gifpaste by Kipp Hickman @ Silicon Graphics
  ***************************************/
 
-#define OUTPIX( c )    ( *lbuf++ = ( c ) )
-#define MC_SIZE        4097
+static int
+lzw_decode( FL_IMAGE            * im,
+            LZW_DECODER         * dec,
+            const unsigned char * buf,
+            int                   count )
+{
+    const unsigned char *end = buf + count;
+    unsigned int datum = dec->datum;
+    int bits = dec->bits,
+        codesize = dec->codesize,
+        clear = dec->clear,
+        avail = dec->avail,
+        oldcode = dec->oldcode,
+        ret = 0;
+    unsigned char *lp = dec->lp,
+                  *p;
+    int code = 0,
+        c,
+        len;
+
+    while ( buf < end && ! ret )
+    {
+        datum |= ( unsigned int ) *buf++ << bits;
+        bits += 8;
 
+        while ( bits >= codesize )
+        {
+            code = datum & ( ( 1 << codesize ) - 1 );
+            datum >>= codesize;
+            bits -= codesize;
 
-/***************************************
- * if we've got more than one scanline, output
- ***************************************/
+            if ( code == clear )
+            {
+                codesize = dec->bpp + 1;
+                avail = clear + 2;
+                oldcode = -1;
+                continue;
+            }
 
-static void
-flush_buffer( FL_IMAGE * im )
-{
-    int incode;
+            if ( code == dec->eoi )
+            {
+                ret = 1;
+                break;
+            }
+
+            if ( oldcode == -1 )
+            {
+                /* the first code after a clear must be a root */
 
-    incode = lbuf - lhead;
+                if ( code >= clear )
+                {
+                    ret = -1;
+                    break;
+                }
 
-    if ( incode >= im->w )
-    {
-        int i;
+                *lp++ = code;
+                oldcode = code;
+            }
+            else
+            {
+                if ( code < avail )
+                {
+                    len = dec->length[ code ];
+                    c = code;
+                }
+                else if ( code == avail )
+                {
+                    /* the KwKwK case: the string is the previous one
+                       plus its own first character */
 
-        lbuf = lhead;
+                    len = dec->length[ oldcode ] + 1;
+                    lp[ len - 1 ] = dec->first[ oldcode ];
+                    c = oldcode;
+                }
+                else
+                {
+                    ret = -1;
+                    break;
+                }
 
-        while ( incode >= im->w )
-        {
-            outputline( im, lbuf );
-            incode -= im->w;
-            lbuf += im->w;
-        }
+                /* write the string backwards */
+
+                p = lp + dec->length[ c ] - 1;
+                for ( ; c >= clear; c = dec->prefix[ c ] )
+                    *p-- = dec->suffix[ c ];
+                *p = c;
+
+                /* a full table is not an error: the encoder may decide
+                   to go on without a clear code */
+
+                if ( avail < LZW_TABSIZE )
+                {
+                    dec->prefix[ avail ] = oldcode;
+                    dec->suffix[ avail ] = *lp;
+                    dec->first[ avail ] = dec->first[ oldcode ];
+                    dec->length[ avail ] = dec->length[ oldcode ] + 1;
+
+                    if ( ++avail == 1 << codesize && codesize < LZW_BITS )
+                        codesize++;
+                }
+
+                lp += len;
+                oldcode = code;
+            }
 
-        /* copy the left over */
+            /* Clive Stubbings.
+             * There is the posibility of an image with just alternate
+             * single code bytes and resets. So flush the buffer before
+             * it overruns. */
 
-        for ( i = 0; i < incode; i++ )
-            lhead[ i ] = *lbuf++;
-        lbuf = lhead + incode;
+            if ( lp - dec->line >= im->w )
+            {
+                dec->lp = lp;
+                flush_lines( im, dec );
+                lp = dec->lp;
+            }
+        }
     }
+
+    if ( ret < 0 )
+        flimage_error( im, "GIFLZW(%s): Bad code 0x%04x", im->infile, code );
+
+    dec->datum = datum;
+    dec->bits = bits;
+    dec->codesize = codesize;
+    dec->avail = avail;
+    dec->oldcode = oldcode;
+    dec->lp = lp;
+
+    return ret;
 }
 
 
@@ -729,110 +793,119 @@ flush_buffer( FL_IMAGE * im )
  ***************************************/
 
 static int
-process_lzw_code( FL_IMAGE * im,
-                  int        code )
+GIF_load( FL_IMAGE * im )
 {
-    int incode;
-    static unsigned char firstchar;
-    static unsigned char stack[ MC_SIZE ];
-    static int avail,
-               oldcode;
-    static unsigned char suffix[ MC_SIZE ];
-    static unsigned short prefix[ MC_SIZE ];
-
-    if ( code == LZW_INIT )
-    {
-        lbuf = lhead = fl_realloc( lhead, im->w + 1 + 4096 );
-
-        bpp = CodeSize;
-        ClearCode = 1 << bpp;
-        EOFCode = ClearCode + 1;
-        CodeSize = bpp + 1;
-
-        for ( incode = ClearCode; --incode >= 0; )
-        {
-            *( suffix + incode ) = incode;
-            *( prefix + incode ) = 0;
-        }
+    int err = 0,
+        done = 0,
+        count,
+        next,
+        code;
+    unsigned char buf[ 257 ];
+    SPEC *sp = im->io_spec;
+    const char *func = "GIFReadPix";
+    FILE *fp = im->fpin;
+    LZW_DECODER *dec;
 
-        avail = ClearCode + 2;
-        oldcode = -1;
-        stackp = stack;
-        return lbuf ? 0 : -1;
-    }
+    sp->ctext = 0;
+    sp->cur_total = 0;
 
-    if ( code == ClearCode )
+    code = getc( fp );
+    if ( code > 8 || code < 2 )
     {
-        CodeSize = bpp + 1;
-        avail = ClearCode + 2;
-        oldcode = -1;
-        return 0;
+        flimage_error( im, "Load: Bad CodeSize %d(%s)", code, im->infile );
+        return -1;
     }
 
-    /* this is possible only if the image file is corrupt */
+    /* initialize the decompressor */
 
-    if ( code > avail || code < 0 )
+    if ( ! ( dec = lzw_decoder_new( im, code ) ) )
     {
-        flimage_error( im, "GIFLZW(%s): Bad code 0x%04x", im->infile, code );
+        flimage_error( im, "GIF_load: can't allocate memory" );
         return -1;
     }
 
-    if ( oldcode == -1 )
+    /* Read each data sub-block together with the size byte of the next
+       one, so it takes a single read per block */
+
+    count = getc( fp );
+
+    while ( ! err && count != EOF && count > 0 )
     {
-        OUTPIX( suffix[ code ] );
-        firstchar = oldcode = code;
+        if ( ( next = fread( buf, 1, count + 1, fp ) ) < count )
+        {
+            err = 1;
+            break;
+        }
 
-        /* Clive Stubbings.
-         * There is the posibility of an image with just alternate
-         * single code bytes and resets. I know thats really dumb,
-         * but I found one and it took a long time to work out why
-         * it crashed...
-         * So flush the buffer before it overuns. */
+        next = next > count ? buf[ count ] : EOF;
 
-        flush_buffer( im );
-        return 0;
-    }
+        if ( ! done )
+        {
+            if ( ( code = lzw_decode( im, dec, buf, count ) ) < 0 )
+                err = 1;
+            else if ( code > 0 )
+                done = 1;
+            else if ( sp->cur_total > ( long ) im->w * im->h )
+            {
+                flimage_error( im, "%s: Raster full before EOI", im->infile );
+                err = 1;
+            }
+        }
 
-    incode = code;
-    if ( code == avail )
-    {               /* the first code is always < avail */
-        *stackp++ = firstchar;
-        code = oldcode;
-    }
+        /* data after the EOI code are skipped */
 
-    while ( code > ClearCode )
-    {
-        *stackp++ = suffix[ code ];
-        code = prefix[ code ];
+        count = next;
     }
 
-    if ( avail >= 4096 )
+    if ( ! err )
     {
-        flimage_error( im, "GIFLZW(%s): BadBlock--TableFull", im->infile );
-        return -1;
-    }
+        if ( ( code = getc( fp ) ) == EXTENSION )
+        {
+            ungetc( code, fp );
+            while (    ( code = skip_extension( fp, im ) ) != EOF
+                    && code != IMAGESEP )
+                /* empty */ ;
+        }
 
-    *stackp++ = firstchar = suffix[ code ];
-    prefix[ avail ] = oldcode;
-    suffix[ avail ] = firstchar;
+        if ( code == IMAGESEP )
+        {
+            im->more = 1;
+            ungetc( IMAGESEP, fp );
+        }
+        else if (    code != EOF
+                  && fread( buf, 1, 50, fp )
+                  && getc( fp ) != EOF )
+        {
+            M_info( func, "%s: Garbage(> 50bytes) at end", im->infile );
+        }
+    }
 
-    avail++;
-    if ( ( avail & gif_codemask[ CodeSize ] ) == 0 && avail < 4096 )
-        CodeSize++;
+    count = sp->cur_total / im->w;
 
-    oldcode = incode;
+    /* final check: get pixels that are decoded but yet to be output */
 
-    do
+    if ( count < im->h )
     {
-        OUTPIX( *--stackp );
+        int leftover = dec->lp - dec->line;
+
+        M_warn( func, "total %ld should be %d", sp->cur_total + leftover,
+                im->w * im->h );
+
+        if ( leftover )
+        {
+            memset( dec->lp, 0, im->w - leftover );
+            outputline( im, dec->line );
+        }
     }
-    while ( stackp > stack );
 
-    /* if we've got more than one scanline, output */
+    lzw_decoder_free( dec );
 
-    flush_buffer( im );
+    /* if more than 1/4 image is read, return positive value so that driver
+       will try to display it.  */
 
-    return 0;
+    convert_gif_text( im );
+
+    return count >= im->h / 4 ? count : -1;
 }
 
 
@@ -871,137 +944,246 @@ GIF_next( FL_IMAGE * im )
 
 /***************************************
  * Given GIF sequence no. i, starting from 0, figure out the image
- * sequence number. If interlaced, the sequence will be independent
- * of i, sort of a bug, but for this application, it is perfectly ok.
+ * row number. Returns h if i is past the last row
  ***************************************/
 
 static int
-next_lineno( int i,
-             int h,
-             int interlace )
+gif_lineno( int i,
+            int h,
+            int interlace )
 {
-    static const int steps[ 5 ] = { 8, 8, 4, 2, 0 };
-    static const int start[ 5 ] = { 0, 4, 2, 1, 0 };
-    static int pass,
-               sofar,
-               current;
-    int line;
+    static const int steps[ 4 ] = { 8, 8, 4, 2 };
+    static const int start[ 4 ] = { 0, 4, 2, 1 };
+    int pass,
+        n;
 
-    /* init for each image */
+    if ( ! interlace )
+        return i;
 
-    if ( i == 0 )
-        pass = sofar = current = 0;
+    for ( pass = 0; pass < 4; pass++ )
+    {
+        n = h > start[ pass ] ?
+            ( h - start[ pass ] + steps[ pass ] - 1 ) / steps[ pass ] : 0;
 
-    line = i;           /* unless interlace */
+        if ( i < n )
+            return start[ pass ] + i * steps[ pass ];
 
-    if ( interlace )
-    {
-        line = current;
-        if ( ( current += steps[pass] ) >= h )
-            current = start[ ++pass ];
+        i -= n;
     }
 
-    sofar++;
-
-    return line;
+    return h;
 }
 
 
 /********************************************************************
  * GIF encoding routine.
- * Original code
  ********************************************************************/
 
-/************************************************************
- * Write image to a disk file in GIF format.
- ************************************************************/
-
-/* current char, cchar, must be of signed type, and code and prefix must be
- * at least 12 bits long. */
+/*
+ * The string table of the encoder is an open addressing hash keyed
+ * by ( suffix char, prefix code ), with the double hashing of
+ * compress(1). As with the decoder, all state is in the structure
+ * so several images can be written at the same time.
+ */
 
-typedef struct strspace_
-{
-    struct strspace_ * next;            /* link          */
-    int                code;            /* emit code     */
-    int                cchar;           /* current char */
-} Strtab;
+#define LZW_HSIZE    5003       /* prime, about 80% occupancy */
+#define LZW_HSHIFT   4
 
 typedef struct
 {
-    int prefix,
-        cchar,
-        code;
-} WorkStr;
+    long             htab[ LZW_HSIZE ];
+    unsigned short   codetab[ LZW_HSIZE ];
+    FILE           * fp;
+    int              interlace;         /* write rows interlaced */
+    int              bpp;
+    int              codesize;
+    int              clear;
+    int              eoi;
+    int              avail;
+    unsigned long    accum;
+    int              bits;
+    int              count;
+    unsigned char    block[ 256 ];      /* size byte plus data */
+} LZW_ENCODER;
 
-#define  MAXTABL  4097
 
-static Strtab *strtab[ MAXTABL ],
-               strspace[ MAXTABL ];
+/***************************************
+ * Write the data sub-block collected so far
+ ***************************************/
+
+static void
+lzw_flush_block( LZW_ENCODER * enc )
+{
+    if ( enc->count )
+    {
+        enc->block[ 0 ] = enc->count;
+        fwrite( enc->block, 1, enc->count + 1, enc->fp );
+        enc->count = 0;
+    }
+}
 
 
-/**************************************************************
- * Check if current string is already in the string table
- **************************************************************/
+/*******************************************************************
+ * Pack and output an LZW code (bpp+1 to 12 bits long).
+ *******************************************************************/
 
-static int
-in_table( WorkStr * cstr )
+static void
+lzw_output( LZW_ENCODER * enc,
+            int           code )
 {
-    Strtab *p = strtab[ cstr->prefix ];
+    enc->accum |= ( unsigned long ) code << enc->bits;
+    enc->bits += enc->codesize;
 
-    for ( ; p && p->cchar != cstr->cchar; p = p->next )
-        /* empty */ ;
+    while ( enc->bits >= 8 )
+    {
+        enc->block[ ++enc->count ] = enc->accum & 0xff;
+        enc->accum >>= 8;
+        enc->bits -= 8;
 
-    return p ? p->code : -1;
+        if ( enc->count == 255 )
+            lzw_flush_block( enc );
+    }
 }
 
-#define USE_TAB_FUNC
 
+/***************************************
+ * Empty the string table and tell the decoder about it
+ ***************************************/
 
-/*
- * A macro and function are supplied to insert a string into the
- * string table.
- */
+static void
+lzw_clear( LZW_ENCODER * enc )
+{
+    int i;
+
+    for ( i = 0; i < LZW_HSIZE; i++ )
+        enc->htab[ i ] = -1;
+
+    lzw_output( enc, enc->clear );
+    enc->codesize = enc->bpp + 1;
+    enc->avail = enc->eoi + 1;
+}
 
-#ifdef USE_TAB_FUNC
 
 /***************************************
  ***************************************/
 
-static void
-addto_table( WorkStr * cstr,
-             int       code )
+static int
+write_pixels( FL_IMAGE    * im,
+              int           bpp,
+              LZW_ENCODER * enc )
 {
-    Strtab *p = &strspace[ code ];
+    unsigned short *scan,
+                   *ss;
+    int colors,
+        ent = -1,
+        c,
+        i,
+        j,
+        disp;
+    long key;
+    FILE *fp = im->fpout;
 
-    p->code = code;
-    p->cchar = cstr->cchar;
-    p->next = strtab[ cstr->prefix ];
-    strtab[ cstr->prefix ] = p;
-}
+    /* IMPORTANT: number of colors handed to this routine might not be 2^n,
+       need to make it so to fool the encoder (colors-1 need to be full bits) */
 
-#else
+    colors = 1 << bpp;
 
-#define  addto_table(cstr, ccode )                         \
-    do {                                                   \
-        Strtab *p = &strspace[ ccode ];                    \
-        p->code = ccode;                                   \
-        p->cchar = cstr->cchar;                            \
-        p->next = strtab[ cstr->prefix ];                  \
-        strtab[ cstr->prefix ] = p;                        \
-   } while( 0 )
-#endif
+    /* min bpp by definition is no smaller than 2 */
 
+    if ( bpp < 2 )
+        bpp = 2;        /* initial codesize */
+    putc( bpp, fp );
 
-static void output_lzw_code( unsigned int,
-                             FILE * );
-static void init_table( int,
-                        FILE * );
-#if 0
-static unsigned short * get_scan_line( FL_IMAGE *,
-                                       int );
-#endif
+    enc->fp = fp;
+    enc->bpp = bpp;
+    enc->clear = 1 << bpp;
+    enc->eoi = enc->clear + 1;
+    enc->codesize = bpp + 1;
+    enc->accum = 0;
+    enc->bits = 0;
+    enc->count = 0;
+
+    lzw_clear( enc );
+
+    for ( j = 0; j < im->h; j++ )
+    {
+        scan = im->ci[ gif_lineno( j, im->h, enc->interlace ) ];
+
+        for ( ss = scan + im->w; scan < ss; scan++ )
+        {
+            c = *scan & ( colors - 1 );
+
+            if ( ent < 0 )
+            {
+                ent = c;
+                continue;
+            }
+
+            key = ( ( long ) c << LZW_BITS ) + ent;
+            i = ( c << LZW_HSHIFT ) ^ ent;
+
+            if ( enc->htab[ i ] != key && enc->htab[ i ] >= 0 )
+            {
+                disp = i ? LZW_HSIZE - i : 1;
+
+                do
+                {
+                    if ( ( i -= disp ) < 0 )
+                        i += LZW_HSIZE;
+                } while ( enc->htab[ i ] != key && enc->htab[ i ] >= 0 );
+            }
+
+            if ( enc->htab[ i ] == key )
+            {
+                ent = enc->codetab[ i ];
+                continue;
+            }
 
-static int interlace;
+            lzw_output( enc, ent );
+            ent = c;
+
+            if ( enc->avail < LZW_TABSIZE )
+            {
+                if ( enc->avail >= 1 << enc->codesize )
+                    enc->codesize++;
+                enc->codetab[ i ] = enc->avail++;
+                enc->htab[ i ] = key;
+            }
+            else
+                lzw_clear( enc );
+        }
+
+        im->completed = j + 1;
+        if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Writing GIF" );
+    }
+
+    /* Like compress(1) does after the final code: the decoder adds an
+       entry for it, so the code size may already have to grow for EOI */
+
+    if ( ent >= 0 )
+    {
+        lzw_output( enc, ent );
+        if ( enc->avail == 1 << enc->codesize && enc->codesize < LZW_BITS )
+            enc->codesize++;
+    }
+
+    lzw_output( enc, enc->eoi );
+
+    if ( enc->bits )
+        enc->block[ ++enc->count ] = enc->accum & 0xff;
+    lzw_flush_block( enc );
+
+    putc( 0, fp );      /* end block  */
+
+    return fflush( fp );
+}
+
+
+/* The default set by the application, copied into the state of each
+   writer when it starts */
+
+static int output_interlace;
 
 
 /***************************************
@@ -1010,7 +1192,7 @@ static int interlace;
 void
 flimage_gif_output_options( int inter )
 {
-    interlace = inter;
+    output_interlace = inter;
 }
 
 
@@ -1045,7 +1227,8 @@ write_gif_comments( FILE       * fp,
  ***************************************/
 
 static int
-write_descriptor( FL_IMAGE * im )
+write_descriptor( FL_IMAGE * im,
+                  int        interlace )
 {
     unsigned char buf[ 10 ];
     FILE *ffp = im->fpout;
@@ -1085,14 +1268,15 @@ write_descriptor( FL_IMAGE * im )
 
 
 /***************************************
- * write the image description
+ * write the image description, returns the bits per pixel
  ***************************************/
 
 static int
 write_desc( FL_IMAGE * im,
             FILE     * ffp )
 {
-    int packed;
+    int packed,
+        bpp;
 
     /* get bits per pixel first */
 
@@ -1131,117 +1315,46 @@ write_desc( FL_IMAGE * im,
     if ( im->comments )
         write_gif_comments( ffp, im->comments );
 
-    return 0;
+    return bpp;
 }
 
 
-/*******************************************************************
- * The encoder
- *******************************************************************/
-
 /***************************************
  ***************************************/
 
 static int
-write_pixels( FL_IMAGE * im )
+GIF_write( FL_IMAGE * sim )
 {
-    int j, code,
-        ccode;
-    unsigned short *scan,
-                   *ss;
-    WorkStr *cstr;
-    int colors;
-    WorkStr workstring;
-    FILE *fp = im->fpout;
-
-    /* IMPORTANT: number of colors handed to this routine might not be 2^n,
-       need to make it so to fool the encoder (colors-1 need to be full bits) */
-
-    colors = 1 << bpp;
-
-    /* min bpp by definition is no smaller than 2 */
-
-    if ( bpp < 2 )
-        bpp = 2;        /* initial codesize */
-    putc( bpp, fp );
-
-    ClearCode = 1 << bpp;   /* set clear and end codes */
-    EOFCode = ClearCode + 1;
-    CodeSize = bpp + 1;     /* start encoding */
-
-    init_table( colors, fp );   /* initialize the LZW tables */
-    cstr = &workstring;
-    ccode = EOFCode + 1;
-    cstr->prefix = -1;
-
-    /* start raster stream. Old way of doing things, that is as soon as we
-       get 4095, a clearcode is emitted. */
+    int err = 0,
+        bpp;
+    FL_IMAGE *im;
+    LZW_ENCODER *enc;
 
-    for ( j = 0; j < im->h; j++ )
+    if ( ! ( enc = fl_malloc( sizeof *enc ) ) )
     {
-        scan = im->ci[ next_lineno( j, im->h, interlace ) ];
-
-        for ( ss = scan + im->w; scan < ss; scan++ )
-        {
-            cstr->cchar = *scan & ( colors - 1 );
-            if ( cstr->prefix >= 0 )
-            {
-                if ( ( code = in_table( cstr ) ) >= 0 )
-                    cstr->prefix = code;
-                else
-                {
-                    addto_table( cstr, ccode );
-                    output_lzw_code( cstr->prefix, fp );
-                    cstr->prefix = cstr->cchar;
-
-                    if ( ccode >= 1 << CodeSize )
-                        CodeSize++;
-                    ccode++;
-
-                    if ( ccode >= 4096 )
-                    {
-                        output_lzw_code( cstr->prefix, fp );
-                        init_table( colors, fp );
-                        ccode = EOFCode + 1;
-                        cstr->prefix = -1;
-                    }
-                }
-            }
-            else
-            {           /* root entry */
-                cstr->prefix = cstr->code = cstr->cchar;
-            }
-        }
+        flimage_error( sim, "GIF_dump: can't allocate memory" );
+        return -1;
     }
 
-    output_lzw_code( cstr->prefix, fp );
-    output_lzw_code( EOFCode, fp );
-    putc( 0, fp );      /* end block  */
-
-    return fflush( fp );
-}
-
+    enc->interlace = output_interlace;
 
-/***************************************
- ***************************************/
-
-static int
-GIF_write( FL_IMAGE * sim )
-{
-    int err = 0;
-    FL_IMAGE *im;
-    
-    if ( write_desc( sim, sim->fpout ) < 0 )
+    if ( ( bpp = write_desc( sim, sim->fpout ) ) < 0 )
+    {
+        fl_free( enc );
         return -1;
+    }
 
     for ( err = 0, im = sim; !err && im; im = im->next )
     {
         im->fpout = sim->fpout;
-        err = write_descriptor( im ) < 0 || write_pixels( im ) < 0;
+        err =    write_descriptor( im, enc->interlace ) < 0
+              || write_pixels( im, bpp, enc ) < 0;
         if ( im != sim )
             im->fpout = 0;
     }
 
+    fl_free( enc );
+
     putc( ';', sim->fpout );    /* end stream */
     fflush( sim->fpout );
 
@@ -1249,78 +1362,12 @@ GIF_write( FL_IMAGE * sim )
 }
 
 
-/***************************************
- ***************************************/
-
-static void
-init_table( int    rootlen,
-            FILE * fp )
+static const FLIMAGE_MAGIC gif_magic[ ] =
 {
-    int i;
-    Strtab *sp = strspace;
-
-    output_lzw_code( ClearCode, fp );
-
-    CodeSize = bpp + 1;
-
-    for ( i = 0; i < rootlen; i++, sp++ )
-    {
-        sp->next = 0;
-        sp->code = i;
-        sp->cchar = -1;
-        strtab[ i ] = sp;
-    }
-
-    for ( ; i < MAXTABL; i++, sp++ )
-        strtab[ i ] = sp->next = 0;
-}
-
-
-/*******************************************************************
- * Packing and output an LZW code(bpp+1 to 12 bits long).
- *
- * Note: accum must be at least 19 bits long. accum and bits must be
- * re-initialized when EOFCode is written out.
- *******************************************************************/
-
-static void
-output_lzw_code( unsigned int   code,
-                 FILE         * fp )
-{
-    static unsigned int bytes,
-                        bits;
-    static unsigned char bbuf[ 255 + 3 ];
-    static unsigned long accum;
-    unsigned char *ch;
-
-    accum &= gif_codemask[ bits ];
-    accum |= code << bits;
-    bits += CodeSize;
-
-    ch = bbuf + bytes;
-    bytes += bits >> 3;
-
-    while ( bits >= 8 )
-    {
-        bits -= 8;
-        *ch++ = ( unsigned char ) ( accum & 255 );
-        accum >>= 8;
-    }
-
-    if ( bytes >= 254 || ( int ) code == EOFCode )
-    {
-        if ( ( int ) code == EOFCode && bits )
-        {
-            *ch = ( unsigned char ) ( accum & 255 );
-            bytes++;
-            bits = accum = 0;
-        }
-
-        putc(bytes, fp);
-        fwrite( bbuf, 1, bytes, fp );
-        bytes = 0;
-    }
-}
+    { 0, 6, "GIF87a" },
+    { 0, 6, "GIF89a" },
+    { 0, 0, NULL }
+};
 
 
 /***************************************
@@ -1329,12 +1376,15 @@ output_lzw_code( unsigned int   code,
 void
 flimage_enable_gif( void )
 {
-    flimage_add_format( "CompuServ GIF", "gif", "gif",
-                        FL_IMAGE_CI,
-                        GIF_identify,
-                        GIF_description,
-                        GIF_load,
-                        GIF_write);
+    int k;
+
+    k = flimage_add_format( "CompuServ GIF", "gif", "gif",
+                            FL_IMAGE_CI,
+                            GIF_identify,
+                            GIF_description,
+                            GIF_load,
+                            GIF_write);
+    flimage_set_magic( k, gif_magic );
 }
 
 
@@ -22,16 +22,36 @@
  *  All rights reserved.
  *
  *  handle gzip/compress
+ *
+ *  With zlib (and a C library that allows to build a stdio stream on
+ *  top of user supplied read and write functions) gzip'ed files are
+ *  decompressed on the fly while the reader for the format of the
+ *  compressed data reads from what looks like a normal FILE to it. No
+ *  temporary files get created. Without it, and always for files made
+ *  by compress(1), the external gzip program is used instead.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#if defined HAVE_ZLIB && defined HAVE_FOPENCOOKIE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#define USE_ZLIB
+#endif
+
 #include "include/forms.h"
 #include "flimage.h"
 #include "flimage_int.h"
 
+#ifdef USE_ZLIB
+#include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+#endif
+
 
 /***************************************
  ***************************************/
@@ -52,7 +72,7 @@ GZIP_identify( FILE * fp )
  ***************************************/
 
 static int
-GZIP_description( FL_IMAGE * im )
+GZIP_description_via_filter( FL_IMAGE * im )
 {
     static char *cmds[ ] = { "gzip -dc %s > %s", NULL };
 
@@ -60,14 +80,221 @@ GZIP_description( FL_IMAGE * im )
 }
 
 
+#ifdef USE_ZLIB
+
+/***************************************
+ * stdio callbacks for a stream on top of a gzFile
+ ***************************************/
+
+static ssize_t
+gz_read( void   * cookie,
+         char   * buf,
+         size_t   size )
+{
+    return gzread( cookie, buf, size );
+}
+
+
+/***************************************
+ ***************************************/
+
+static ssize_t
+gz_write( void       * cookie,
+          const char * buf,
+          size_t       size )
+{
+    return size ? gzwrite( cookie, buf, size ) : 0;
+}
+
+
 /***************************************
+ * Seeking works only relative to the start or the current position.
+ * Going back means decompressing again from the start, but readers
+ * normally only rewind to the very beginning.
  ***************************************/
 
 static int
-GZIP_load( FL_IMAGE * im  FL_UNUSED_ARG )
+gz_seek( void    * cookie,
+         off64_t * pos,
+         int       whence )
 {
-    fprintf( stderr, "should never been here\n" );
-    return -1;
+    z_off_t off;
+
+    if ( whence == SEEK_END )
+        return -1;
+
+    if ( ( off = gzseek( cookie, *pos, whence ) ) < 0 )
+        return -1;
+
+    *pos = off;
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+gz_close( void * cookie )
+{
+    return gzclose( cookie ) == Z_OK ? 0 : -1;
+}
+
+
+/***************************************
+ * Returns a stdio stream for reading from or writing to a gzip'ed
+ * file, starting at the current position of the stream for the
+ * compressed file. Since stdio may have buffered data the position of
+ * the underlying file descriptor must be synchronized first.
+ ***************************************/
+
+static FILE *
+gz_fdopen( FILE       * zfp,
+           const char * mode )
+{
+    cookie_io_functions_t funcs;
+    gzFile gz;
+    FILE *fp;
+    long pos = ftell( zfp );
+    int fd;
+
+    fflush( zfp );
+
+    if (    pos < 0
+         || ( fd = dup( fileno( zfp ) ) ) < 0 )
+        return NULL;
+
+    if ( lseek( fd, pos, SEEK_SET ) < 0 )
+    {
+        close( fd );
+        return NULL;
+    }
+
+    if ( ! ( gz = gzdopen( fd, mode ) ) )
+    {
+        close( fd );
+        return NULL;
+    }
+
+    funcs.read  = gz_read;
+    funcs.write = gz_write;
+    funcs.seek  = gz_seek;
+    funcs.close = gz_close;
+
+    if ( ! ( fp = fopencookie( gz, mode, funcs ) ) )
+        gzclose( gz );
+
+    return fp;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+GZIP_description( FL_IMAGE * im )
+{
+    FLIMAGE_IO *io;
+    FILE *fp;
+    char buf[ 2 ];
+
+    /* Files made by compress(1) can't be dealt with by zlib */
+
+    rewind( im->fpin );
+    if ( fread( buf, 1, 2, im->fpin ) != 2 || buf[ 1 ] != '\213' )
+        return GZIP_description_via_filter( im );
+
+    rewind( im->fpin );
+    if ( ! ( fp = gz_fdopen( im->fpin, "rb" ) ) )
+        return GZIP_description_via_filter( im );
+
+    /* Find out what's inside. The gzip handler itself gets skipped, there
+       isn't much use in reading gzip'ed gzip files. */
+
+    for ( io = flimage_io; io->formal_name; io++ )
+    {
+        if ( io->identify == GZIP_identify )
+            continue;
+        if ( io->identify( fp ) > 0 )
+            break;
+        rewind( fp );
+    }
+
+    if ( ! io->formal_name || ! io->read_description )
+    {
+        im->error_message( im, "unknown compressed image format" );
+        fclose( fp );
+        return -1;
+    }
+
+    im->visual_cue( im, "reading gzip ..." );
+
+    /* From now on read from the decompressed stream */
+
+    fclose( im->fpin );
+    im->fpin = fp;
+
+    im->image_io = io;
+    im->type = io->type;
+    im->fmt_name = io->short_name;
+
+    rewind( fp );
+    io->identify( fp );         /* advance file position */
+    return io->read_description( im );
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+GZIP_dump( FL_IMAGE * im )
+{
+    FLIMAGE_IO *io;
+    FILE *fp,
+         *fpout = im->fpout;
+    int status;
+
+    if ( im->type == FL_IMAGE_CI || im->type == FL_IMAGE_PACKED )
+        flimage_convert( im, FL_IMAGE_RGB, 0 );
+
+    if ( ! ( io = flimage_find_imageIO(   im->type == FL_IMAGE_RGB  ? "ppm"
+                                        : im->type == FL_IMAGE_MONO ? "pbm"
+                                        : "pgm" ) ) )
+    {
+        flimage_error( im, "can't find format handler" );
+        return -1;
+    }
+
+    if ( ! ( fp = gz_fdopen( fpout, "wb" ) ) )
+    {
+        flimage_error( im, "can't compress %s", im->outfile );
+        return -1;
+    }
+
+    im->fpout = fp;
+    status = io->write_image( im );
+    im->fpout = fpout;
+
+    if ( fclose( fp ) != 0 )
+    {
+        flimage_error( im, "error writing %s", im->outfile );
+        status = -1;
+    }
+
+    return status;
+}
+
+#else   /* ! USE_ZLIB */
+
+
+/***************************************
+ ***************************************/
+
+static int
+GZIP_description( FL_IMAGE * im )
+{
+    return GZIP_description_via_filter( im );
 }
 
 
@@ -82,6 +309,27 @@ GZIP_dump( FL_IMAGE * im )
     return flimage_write_via_filter( im, cmds, formats, 0 );
 }
 
+#endif  /* USE_ZLIB */
+
+
+/***************************************
+ ***************************************/
+
+static int
+GZIP_load( FL_IMAGE * im  FL_UNUSED_ARG )
+{
+    fprintf( stderr, "should never been here\n" );
+    return -1;
+}
+
+
+static const FLIMAGE_MAGIC gzip_magic[ ] =
+{
+    { 0, 2, "\037\213" },
+    { 0, 2, "\037\235" },
+    { 0, 0, NULL }
+};
+
 
 /***************************************
  ***************************************/
@@ -89,12 +337,15 @@ GZIP_dump( FL_IMAGE * im )
 void
 flimage_enable_gzip( void )
 {
-    flimage_add_format( "GZIP format", "gzip", "gz",
-                        FL_IMAGE_FLEX,
-                        GZIP_identify,
-                        GZIP_description,
-                        GZIP_load,
-                        GZIP_dump );
+    int k;
+
+    k = flimage_add_format( "GZIP format", "gzip", "gz",
+                            FL_IMAGE_FLEX,
+                            GZIP_identify,
+                            GZIP_description,
+                            GZIP_load,
+                            GZIP_dump );
+    flimage_set_magic( k, gzip_magic );
 }
 
 
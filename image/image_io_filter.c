@@ -47,31 +47,33 @@
 
 
 /***************************************
+ * Create a new temporary file, its name goes into buf
  ***************************************/
 
 static char *
-get_tmpf( char * obuf )
+get_tmpf( char   * name,
+          size_t   len )
 {
-    static int k,
-               seq;
-    static char buf[ 15 ][ 256 ];
+    static FLI_MUTEX lock = FLI_MUTEX_INIT;
+    static int seq;
     int fd = -1,
-        tries = 0;
-    char *name;
-
-    k = ( k + 1 ) % 15;
-    name = obuf ? obuf : buf[ k ];
+        tries = 0,
+        n;
 
     do
     {
+        fli_snprintf( name, len, "%s/.FLXXXXXX", "/tmp" );
+
         if ( ( fd = mkstemp( name ) ) >= 0 )
             /* empty */ ;
         else
         {
-            fli_snprintf( buf[ k ], sizeof buf[ k ],
-                          "%s/.FL%03d_%d.tmp", "/tmp", seq++,
+            fli_lock( &lock );
+            n = seq++;
+            fli_unlock( &lock );
+
+            fli_snprintf( name, len, "%s/.FL%03d_%d.tmp", "/tmp", n,
                           ( int ) getpid( ) );
-            name = buf[ k ];
 
             /* create the file now in exclusive mode (for security) */
 
@@ -101,12 +103,13 @@ flimage_description_via_filter( FL_IMAGE     * im,
                                 int verbose )
 {
     char cmd[ 1024 ],
+         tmpbuf[ 256 ],
          *tmpf;
     char * const *q = cmds;
     int status = 0,
         n;
 
-    if ( ! ( tmpf = get_tmpf( 0 ) ) )
+    if ( ! ( tmpf = get_tmpf( tmpbuf, sizeof tmpbuf ) ) )
     {
         im->error_message( im, "can't get tmpfile!" );
         return -1;
@@ -224,6 +227,7 @@ flimage_write_via_filter( FL_IMAGE     * im,
 {
     char *tmpf;
     char ofile[ 256 ],
+         tmpbuf[ 256 ],
          cmd[ 1024 ];
     char * const *shellcmd;
     FLIMAGE_IO *io;
@@ -241,7 +245,12 @@ flimage_write_via_filter( FL_IMAGE     * im,
     if ( ! ( io->type & im->type ) )
         flimage_convert( im, io->type, 256 );
 
-    tmpf = get_tmpf( 0 );
+    if ( ! ( tmpf = get_tmpf( tmpbuf, sizeof tmpbuf ) ) )
+    {
+        im->error_message( im, "can't get tmpfile!" );
+        return -1;
+    }
+
     strcpy( ofile, im->outfile );
     strcpy( im->outfile, tmpf );
 
@@ -83,29 +83,22 @@ static unsigned int jpeg_getc( j_decompress_ptr cinfo );
 static int
 JPEG_identify( FILE * fp )
 {
-    char buf[ 128 ];
+    char buf[ 3 ];
     int cnt;
-    int i;
 
-    cnt = fread( buf, 1, 128, fp );
+    cnt = fread( buf, 1, 3, fp );
     rewind( fp );
-    if ( cnt < 3 )
-        return 0;
 
     /* Clive Stubbings.
      * Test for a JPEG SOI code (0xff, 0xd8) followed by the start of
      * APP0 segement (0xff).
      * A 'raw' JPEG will not have the JFIF (JPEG file interchange format)
-     * header but is still readable
+     * header but is still readable. There's no point in looking for a
+     * JFIF marker further into the file, libjpeg refuses to read files
+     * not starting with the SOI code.
      */
- 
-    if ( ! strncmp( buf, "\xff\xd8\xff", 3 ) )
-         return 1;
-
-    for ( i = 0; i < cnt - 3 && buf[ i ] != 'J'; i++ )
-        /* empty */ ;
 
-    return i < cnt - 3 && ! strncmp( buf + i, "JFIF", 4 );
+    return cnt == 3 && ! strncmp( buf, "\xff\xd8\xff", 3 );
 }
 
 
@@ -129,7 +122,7 @@ static void
 error_exit( j_common_ptr cinfo )
 {
     SPEC *spec = ( SPEC * ) cinfo->err;
-    static char buf[ 1024 ];
+    char buf[ JMSG_LENGTH_MAX ];
 
     cinfo->err->format_message( cinfo, buf );
     spec->image->error_message( spec->image, buf );
@@ -226,6 +219,22 @@ JPEG_description( FL_IMAGE * im )
     jpeg_stdio_src( cinfo, im->fpin );
     jpeg_read_header( cinfo, FL_TRUE );
 
+    /* If only a reduced image is wanted let the decoder do as much of
+       the reduction as it can (it only ever computes the low frequency
+       DCT coefficients then) and use the fastest settings */
+
+    if ( im->target_w > 0 || im->target_h > 0 )
+    {
+        int f = flimage_reduce_factor( im, cinfo->image_width,
+                                       cinfo->image_height );
+
+        cinfo->scale_num = 1;
+        cinfo->scale_denom =   f >= 8 ? 8 : f >= 4 ? 4 : f >= 2 ? 2 : 1;
+        cinfo->dct_method = JDCT_IFAST;
+        cinfo->do_fancy_upsampling = FALSE;
+        cinfo->do_block_smoothing = FALSE;
+    }
+
     /* decompressison options such as quantization here */
     if (do_quantization)
     {
@@ -260,18 +269,25 @@ JPEG_description( FL_IMAGE * im )
 /***************************************
  ***************************************/
 
+#define JPEG_BATCH  16     /* rows asked for at a time */
+
 static int
 JPEG_read_pixels( FL_IMAGE * im )
 {
     SPEC *spec = im->io_spec;
     struct jpeg_decompress_struct *cinfo = &spec->dinfo;
     int i,
-        j,
+        k,
+        n,
+        row,
         stride,
-        err;
+        nrows;
     JSAMPARRAY buf;
-    unsigned short *gray,
-                   *ci;
+    JSAMPROW p;
+    unsigned char *r,
+                  *g,
+                  *b;
+    unsigned short *out;
 
     if ( setjmp( spec->jmp_buffer ) )
     {
@@ -280,61 +296,75 @@ JPEG_read_pixels( FL_IMAGE * im )
         return ( im->completed > im->w / 2 ) ? 1 : -1;
     }
 
-    err = 0;
+    if (    im->type != FL_IMAGE_RGB
+         && im->type != FL_IMAGE_CI
+         && im->type != FL_IMAGE_GRAY )
+    {
+        flimage_error( im, "%s: unknown color space", im->infile );
+        jpeg_destroy_decompress( cinfo );
+        return -1;
+    }
+
+    if ( im->type == FL_IMAGE_CI )
+    {
+        im->map_len = cinfo->actual_number_of_colors;
+        for ( i = 0; i < cinfo->actual_number_of_colors; i++ )
+        {
+            im->red_lut[   i ] = cinfo->colormap[ 0 ][ i ];
+            im->green_lut[ i ] = cinfo->colormap[ 1 ][ i ];
+            im->blue_lut[  i ] = cinfo->colormap[ 2 ][ i ];
+        }
+    }
+
     stride = cinfo->output_width * cinfo->output_components;
 
+    /* The decoder hands out rec_outbuf_height rows at most per call, but
+       let it have as many as it wants */
+
+    nrows = FL_max( JPEG_BATCH, cinfo->rec_outbuf_height );
     buf = cinfo->mem->alloc_sarray( ( j_common_ptr ) cinfo, JPOOL_IMAGE,
-                                    stride, 1 /* cinfo->rec_outbuf_height */ );
+                                    stride, nrows );
 
-    while ( cinfo->output_scanline < cinfo->output_height && ! err )
+    while ( cinfo->output_scanline < cinfo->output_height )
     {
-        jpeg_read_scanlines( cinfo, buf, 1 /* cinfo->rec_out_height  */ );
+        row = cinfo->output_scanline;
+        n = jpeg_read_scanlines( cinfo, buf, nrows );
 
-        if ( ! ( cinfo->output_scanline & FLIMAGE_REPFREQ ) )
+        for ( k = 0; k < n; k++, row++ )
         {
-            im->completed = cinfo->output_scanline;
-            im->visual_cue( im, "Reading JPEG" );
-        }
+            p = buf[ k ];
 
-        if ( im->type == FL_IMAGE_RGB )
-        {
-            for ( i = j = 0; i < ( int ) cinfo->output_width; i++, j += 3 )
+            if ( im->type == FL_IMAGE_RGB )
             {
-                im->red[   cinfo->output_scanline - 1 ][ i ] =
-                                                             buf[ 0 ][ j ];
-                im->green[ cinfo->output_scanline - 1 ][ i ] =
-                                                             buf[ 0 ][ j + 1 ];
-                im->blue[  cinfo->output_scanline - 1 ][ i ] =
-                                                             buf[ 0 ][ j + 2 ];
+                r = im->red[ row ];
+                g = im->green[ row ];
+                b = im->blue[ row ];
+
+                for ( i = 0; i < im->w; i++, p += 3 )
+                {
+                    r[ i ] = p[ 0 ];
+                    g[ i ] = p[ 1 ];
+                    b[ i ] = p[ 2 ];
+                }
             }
-        }
-        else if ( im->type == FL_IMAGE_CI )
-        {
-            im->map_len = cinfo->actual_number_of_colors;
-            for ( i = 0; i < cinfo->actual_number_of_colors; i++ )
+            else
             {
-                im->red_lut[   i ] = cinfo->colormap[ 0 ][ i ];
-                im->green_lut[ i ] = cinfo->colormap[ 1 ][ i ];
-                im->blue_lut[  i ] = cinfo->colormap[ 2 ][ i ];
+                out = im->type == FL_IMAGE_CI ? im->ci[ row ] : im->gray[ row ];
+                for ( i = 0; i < im->w; i++ )
+                    out[ i ] = p[ i ];
             }
-
-            ci = im->ci[ cinfo->output_scanline - 1 ];
-            for ( i = 0; i < ( int ) cinfo->output_width; i++ )
-                ci[ i ] = buf[ 0 ][ i ];
         }
-        else if ( im->type == FL_IMAGE_GRAY )
-        {
-            gray = im->gray[ cinfo->output_scanline - 1 ];
-            for ( i = j = 0; i < im->w; i++ )
-                gray[ i ] = buf[ 0 ][ i ];
-        }
-        else
+
+        if (    ( row & ~FLIMAGE_REPFREQ )
+             != ( ( row - n ) & ~FLIMAGE_REPFREQ ) )
         {
-            flimage_error( im, "%s: unknown color space", im->infile );
-            err = 1;
+            im->completed = row;
+            im->visual_cue( im, "Reading JPEG" );
         }
     }
 
+    im->completed = cinfo->output_scanline;
+
     jpeg_finish_decompress( cinfo );
     jpeg_destroy_decompress( cinfo );
 
@@ -451,18 +481,28 @@ jpeg_getc( j_decompress_ptr cinfo )
 }
 
 
+static const FLIMAGE_MAGIC jpeg_magic[ ] =
+{
+    { 0, 3, "\xff\xd8\xff" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_jpeg( void )
 {
-    flimage_add_format( "JPEG/JFIF format", "jpeg", "jpg",
-                        FL_IMAGE_RGB | FL_IMAGE_GRAY,
-                        JPEG_identify,
-                        JPEG_description,
-                        JPEG_read_pixels,
-                        JPEG_write );
+    int k;
+
+    k = flimage_add_format( "JPEG/JFIF format", "jpeg", "jpg",
+                            FL_IMAGE_RGB | FL_IMAGE_GRAY,
+                            JPEG_identify,
+                            JPEG_description,
+                            JPEG_read_pixels,
+                            JPEG_write );
+    flimage_set_magic( k, jpeg_magic );
 }
 
 
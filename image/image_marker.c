@@ -63,10 +63,10 @@ typedef struct
 /* M(moveto) LT(lineto) S(stroke) F(fill) LW(setlinewidth) C(closepath) */
 
 static char ps_cross[ ] = "-1 0 1 0 L 0 -1 0 1 L";
-static char ps_rect[ ] = "-1 1 -1 -1 L 1 1 LT 1 -1 LT C";
+static char ps_rect[ ] = "-1 1 -1 -1 L 1 -1 LT 1 1 LT C";
 static char ps_delta[ ] = " -1 -1 0 1 L 1 -1 LT C";
 static char ps_oval[ ] = " 0 0 1 0 360 arc";
-static char ps_line[ ] = "0 1 0 -1 L";
+static char ps_line[ ] = "-1 0 1 0 L";
 static char ps_star[ ] =
     "0 1 0.2245 0.309 L -0.2245 0.309 LT -0.9511 0.309 LT\n"
     "-0.3633 -0.118 LT -0.5878 -0.809 LT 0 -0.382 LT 0.5878 -0.809 LT\n"
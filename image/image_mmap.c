@@ -0,0 +1,204 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  Memory mapped pixels for uncompressed formats. The input file gets
+ *  mapped copy-on-write and the gray/ci matrix is made (fl_make_matrix)
+ *  right on top of the data. If the data are already in the form we
+ *  keep pixels in, nothing gets read or copied until the pixels are
+ *  used. Otherwise the format converts the data in place, which only
+ *  turns the pages it touches into private memory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flimage.h"
+#include "flimage_int.h"
+
+#if defined HAVE_MMAP && defined HAVE_SYS_MMAN_H
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define USE_MMAP
+#endif
+
+
+/***************************************
+ * Map len bytes of the input file, starting at offset. Returns the
+ * address of the data at offset or NULL if the file can't (or
+ * shouldn't) be mapped, in which case it must be read as usual
+ ***************************************/
+
+#ifdef USE_MMAP
+
+void *
+flimage_map_file( FL_IMAGE      * im,
+                  long            offset,
+                  unsigned long   len )
+{
+    long page = sysconf( _SC_PAGESIZE ),
+         start;
+    struct stat st;
+    void *addr;
+
+    if ( ! im->setup->use_mmap || ! im->fpin || offset < 0 || ! len )
+        return NULL;
+
+    /* touching a page beyond the end of the file would kill us, short
+       files are left to the normal error handling */
+
+    if (    fstat( fileno( im->fpin ), &st ) < 0
+         || ! S_ISREG( st.st_mode )
+         || ( unsigned long ) st.st_size < offset + len )
+        return NULL;
+
+    flimage_unmap_file( im );
+
+    /* mapping has to start on a page boundary */
+
+    start = page > 0 ? offset - offset % page : offset;
+
+    addr = mmap( NULL, len + offset - start, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE, fileno( im->fpin ), start );
+
+    if ( addr == MAP_FAILED )
+        return NULL;
+
+    im->mapped = addr;
+    im->mapped_len = len + offset - start;
+
+    return ( char * ) addr + offset - start;
+}
+
+#else
+
+void *
+flimage_map_file( FL_IMAGE      * im      FL_UNUSED_ARG,
+                  long            offset  FL_UNUSED_ARG,
+                  unsigned long   len     FL_UNUSED_ARG )
+{
+    return NULL;
+}
+
+#endif
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_unmap_file( FL_IMAGE * im )
+{
+#ifdef USE_MMAP
+    if ( im->mapped )
+        munmap( im->mapped, im->mapped_len );
+#endif
+
+    im->mapped = NULL;
+    im->mapped_len = 0;
+}
+
+
+/***************************************
+ * Check if the pixel matrix is sitting on the mapped file
+ ***************************************/
+
+static int
+in_map( FL_IMAGE * im,
+        void     * mat )
+{
+    char **m = mat,
+         *addr = im->mapped;
+
+    return    m
+           && m[ -1 ] == ( char * ) FL_MAKE_MATRIX
+           && m[ 0 ] >= addr
+           && m[ 0 ] < addr + im->mapped_len;
+}
+
+
+/***************************************
+ * Once the pixels have been replaced the file isn't needed anymore
+ ***************************************/
+
+void
+flimage_release_map( FL_IMAGE * im )
+{
+    if ( im->mapped && ! in_map( im, im->gray ) && ! in_map( im, im->ci ) )
+        flimage_unmap_file( im );
+}
+
+
+/***************************************
+ * Most uncompressed 16 bit gray formats (PGM, GENESIS) store the
+ * samples MSB first. Map them as the image's gray matrix, byte-swapping
+ * each row in place if the host is LSB first
+ ***************************************/
+
+int
+flimage_map_gray16( FL_IMAGE * im,
+                    long       offset )
+{
+    static unsigned short one = 1;
+    unsigned short **gray,
+                   *p,
+                   *pend;
+    unsigned char *c;
+    int row;
+
+    if ( ! ( p = flimage_map_file( im, offset, 2UL * im->w * im->h ) ) )
+        return -1;
+
+    if ( ! ( gray = fl_make_matrix( im->h, im->w, sizeof *p, p ) ) )
+    {
+        flimage_unmap_file( im );
+        return -1;
+    }
+
+    if ( * ( unsigned char * ) &one )
+    {
+        for ( row = 0; row < im->h; row++, im->completed++ )
+        {
+            if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+                im->visual_cue( im, "Converting" );
+
+            c = ( unsigned char * ) ( p = gray[ row ] );
+            for ( pend = p + im->w; p < pend; p++, c += 2 )
+                *p = ( c[ 0 ] << 8 ) | c[ 1 ];
+        }
+    }
+
+    fl_free_matrix( im->gray );
+    im->gray = gray;
+
+    return 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,555 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  Octree color quantizer (Gervautz and Purgathofer). Each pixel is
+ *  added to a tree of depth OCT_DEPTH in a single pass over the image,
+ *  with the deepest nodes merged into their parent as soon as there
+ *  are more leaves than colors asked for. The leaves are the colormap.
+ *  The pixels are then mapped with Floyd-Steinberg dithering, using a
+ *  lazily filled inverse colormap for the closest color lookup.
+ *
+ *  Building the colormap takes a single pass and a few hundred
+ *  kilobytes at most, independent of the number of colors in the
+ *  image. The median cut quantizer usually picks somewhat better colors.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flinternal.h"
+#include "flimage.h"
+#include "flimage_int.h"
+
+
+/* The two lowest bits hardly ever make a difference, but leaves at
+   that level would cost lots of nodes */
+
+#define OCT_DEPTH      6
+#define OCT_BLOCK      1024     /* nodes allocated at a time */
+#define OCT_MAXCOLORS  4096
+
+typedef struct onode_ {
+    struct onode_ * child[ 8 ];
+    struct onode_ * next;       /* reducible list or free list */
+    unsigned long   r,
+                    g,
+                    b,
+                    n;
+    int             nchild;
+    int             leaf;
+    int             index;
+} ONODE;
+
+typedef struct oblock_ {
+    struct oblock_ * next;
+    ONODE            node[ OCT_BLOCK ];
+} OBLOCK;
+
+typedef struct {
+    ONODE     * root;
+    ONODE     * reducible[ OCT_DEPTH ];
+    ONODE     * freelist;
+    OBLOCK    * blocks;
+    int         leaves;
+    int         max_color;
+    int         ncolors;
+    int       * red_lut,
+              * green_lut,
+              * blue_lut;
+} OCTREE;
+
+
+/***************************************
+ ***************************************/
+
+static ONODE *
+new_node( OCTREE * ot,
+          int      level )
+{
+    ONODE *node;
+
+    if ( ! ot->freelist )
+    {
+        OBLOCK *blk = fl_malloc( sizeof *blk );
+        int i;
+
+        if ( ! blk )
+            return NULL;
+
+        blk->next = ot->blocks;
+        ot->blocks = blk;
+
+        for ( i = 0; i < OCT_BLOCK; i++ )
+        {
+            blk->node[ i ].next = ot->freelist;
+            ot->freelist = blk->node + i;
+        }
+    }
+
+    node = ot->freelist;
+    ot->freelist = node->next;
+    memset( node, 0, sizeof *node );
+
+    if ( level == OCT_DEPTH )
+    {
+        node->leaf = 1;
+        ot->leaves++;
+    }
+    else
+    {
+        node->next = ot->reducible[ level ];
+        ot->reducible[ level ] = node;
+    }
+
+    return node;
+}
+
+
+/***************************************
+ * Merge the children of the most recently added node on the deepest
+ * level that has any into their parent
+ ***************************************/
+
+static void
+reduce( OCTREE * ot )
+{
+    ONODE *node,
+          *c;
+    int level,
+        i;
+
+    for ( level = OCT_DEPTH - 1; level > 0 && ! ot->reducible[ level ];
+          level-- )
+        /* empty */ ;
+
+    if ( ! ( node = ot->reducible[ level ] ) )
+        return;
+
+    ot->reducible[ level ] = node->next;
+
+    for ( i = 0; i < 8; i++ )
+    {
+        if ( ! ( c = node->child[ i ] ) )
+            continue;
+
+        node->r += c->r;
+        node->g += c->g;
+        node->b += c->b;
+        node->n += c->n;
+
+        c->next = ot->freelist;
+        ot->freelist = c;
+        node->child[ i ] = NULL;
+    }
+
+    node->leaf = 1;
+    ot->leaves -= node->nchild - 1;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+add_color( OCTREE * ot,
+           int      r,
+           int      g,
+           int      b )
+{
+    ONODE **np = &ot->root,
+          *node = NULL;
+    int level,
+        shift,
+        i;
+
+    for ( level = 0; ; level++ )
+    {
+        if ( ! *np )
+        {
+            if ( ! ( *np = new_node( ot, level ) ) )
+                return -1;
+            if ( level )
+                node->nchild++;
+        }
+
+        node = *np;
+
+        if ( node->leaf )
+            break;
+
+        shift = 7 - level;
+        i =   ( ( ( r >> shift ) & 1 ) << 2 )
+            | ( ( ( g >> shift ) & 1 ) << 1 )
+            |   ( ( b >> shift ) & 1 );
+        np = node->child + i;
+    }
+
+    node->r += r;
+    node->g += g;
+    node->b += b;
+    node->n++;
+
+    while ( ot->leaves > ot->max_color )
+        reduce( ot );
+
+    return 0;
+}
+
+
+/***************************************
+ * Assign the leaves their colormap index
+ ***************************************/
+
+static void
+make_colormap( OCTREE * ot,
+               ONODE  * node )
+{
+    int i;
+
+    if ( ! node )
+        return;
+
+    if ( ! node->leaf )
+    {
+        for ( i = 0; i < 8; i++ )
+            make_colormap( ot, node->child[ i ] );
+        return;
+    }
+
+    node->index = ot->ncolors++;
+    ot->red_lut[   node->index ] = ( node->r + node->n / 2 ) / node->n;
+    ot->green_lut[ node->index ] = ( node->g + node->n / 2 ) / node->n;
+    ot->blue_lut[  node->index ] = ( node->b + node->n / 2 ) / node->n;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_octree( OCTREE * ot )
+{
+    OBLOCK *blk;
+
+    while ( ( blk = ot->blocks ) )
+    {
+        ot->blocks = blk->next;
+        fl_free( blk );
+    }
+}
+
+
+/* Where the pixels come from, either three color planes or packed */
+
+typedef struct {
+    unsigned char ** red,
+                  ** green,
+                  ** blue;
+    unsigned int  ** packed;
+} OSRC;
+
+#define OSRC_GET( s, row, col, r, g, b )                        \
+    do {                                                        \
+        if ( ( s )->packed )                                    \
+            FL_UNPACK( ( s )->packed[ row ][ col ], r, g, b );  \
+        else                                                    \
+        {                                                       \
+            r = ( s )->red[   row ][ col ];                     \
+            g = ( s )->green[ row ][ col ];                     \
+            b = ( s )->blue[  row ][ col ];                     \
+        }                                                       \
+    } while ( 0 )
+
+
+/***************************************
+ * Floyd-Steinberg dithering, serpentine. Errors are kept for the
+ * current and the next row (times 16, with a guard pixel on each side)
+ ***************************************/
+
+static int
+map_pixels( OCTREE          * ot,
+            OSRC            * src,
+            unsigned short ** ci,
+            int               w,
+            int               h,
+            FL_IMAGE        * im )
+{
+    XColor *map = fl_malloc( ot->ncolors * sizeof *map );
+    int *err = fl_calloc( 6 * ( w + 2 ), sizeof *err );
+    FLI_ICMAP *icmap = NULL;
+    int *cur,
+        *nxt,
+        *tmp;
+    int row,
+        col,
+        dir,
+        end,
+        i,
+        k,
+        c[ 3 ],
+        e;
+    unsigned int r,
+                 g,
+                 b;
+
+    if ( map )
+    {
+        for ( i = 0; i < ot->ncolors; i++ )
+        {
+            map[ i ].red   = ot->red_lut[ i ]   << 8;
+            map[ i ].green = ot->green_lut[ i ] << 8;
+            map[ i ].blue  = ot->blue_lut[ i ]  << 8;
+        }
+
+        icmap = fli_icmap_create( map, ot->ncolors );
+    }
+
+    if ( ! err || ! icmap )
+    {
+        fli_safe_free( map );
+        fli_safe_free( err );
+        fli_icmap_free( icmap );
+        return -1;
+    }
+
+    cur = err;
+    nxt = err + 3 * ( w + 2 );
+
+    if ( im )
+    {
+        im->completed = 0;
+        im->total = h;
+        im->visual_cue( im, "Dithering ..." );
+    }
+
+    for ( row = 0; row < h; row++ )
+    {
+        if ( row & 1 )
+        {
+            col = w - 1;
+            end = -1;
+            dir = -1;
+        }
+        else
+        {
+            col = 0;
+            end = w;
+            dir = 1;
+        }
+
+        memset( nxt, 0, 3 * ( w + 2 ) * sizeof *nxt );
+
+        for ( ; col != end; col += dir )
+        {
+            OSRC_GET( src, row, col, r, g, b );
+
+            c[ 0 ] = r + ( ( cur[ 3 * ( col + 1 )     ] + 8 ) >> 4 );
+            c[ 1 ] = g + ( ( cur[ 3 * ( col + 1 ) + 1 ] + 8 ) >> 4 );
+            c[ 2 ] = b + ( ( cur[ 3 * ( col + 1 ) + 2 ] + 8 ) >> 4 );
+
+            for ( i = 0; i < 3; i++ )
+                c[ i ] = FL_clamp( c[ i ], 0, 255 );
+
+            k = fli_icmap_lookup( icmap, c[ 0 ], c[ 1 ], c[ 2 ] );
+            ci[ row ][ col ] = k;
+
+            c[ 0 ] -= ot->red_lut[ k ];
+            c[ 1 ] -= ot->green_lut[ k ];
+            c[ 2 ] -= ot->blue_lut[ k ];
+
+            for ( i = 0; i < 3; i++ )
+            {
+                e = c[ i ];
+                cur[ 3 * ( col + 1 + dir ) + i ] += 7 * e;
+                nxt[ 3 * ( col + 1 - dir ) + i ] += 3 * e;
+                nxt[ 3 * ( col + 1       ) + i ] += 5 * e;
+                nxt[ 3 * ( col + 1 + dir ) + i ] += e;
+            }
+        }
+
+        tmp = cur;
+        cur = nxt;
+        nxt = tmp;
+
+        if ( im && ! ( ++im->completed & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Dithering ..." );
+    }
+
+    fli_icmap_free( icmap );
+    fl_free( map );
+    fl_free( err );
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+octree_quantize( OSRC            * src,
+                 int               w,
+                 int               h,
+                 int               max_color,
+                 unsigned short ** ci,
+                 int             * actual_color,
+                 int             * red_lut,
+                 int             * green_lut,
+                 int             * blue_lut,
+                 FL_IMAGE        * im )
+{
+    OCTREE ot;
+    unsigned int r,
+                 g,
+                 b;
+    int row,
+        col;
+
+    memset( &ot, 0, sizeof ot );
+    ot.max_color = FL_clamp( max_color, 1, OCT_MAXCOLORS );
+    ot.red_lut = red_lut;
+    ot.green_lut = green_lut;
+    ot.blue_lut = blue_lut;
+
+    if ( im )
+    {
+        im->completed = 0;
+        im->total = h;
+        im->visual_cue( im, "Getting Histogram ..." );
+    }
+
+    for ( row = 0; row < h; row++ )
+    {
+        for ( col = 0; col < w; col++ )
+        {
+            OSRC_GET( src, row, col, r, g, b );
+
+            if ( add_color( &ot, r, g, b ) < 0 )
+            {
+                free_octree( &ot );
+                *actual_color = 0;
+                if ( im )
+                    im->error_message( im, "Quantize: can't allocate memory" );
+                return -1;
+            }
+        }
+
+        if ( im && ! ( ++im->completed & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Getting Histogram ..." );
+    }
+
+    make_colormap( &ot, ot.root );
+
+    if ( map_pixels( &ot, src, ci, w, h, im ) < 0 )
+    {
+        free_octree( &ot );
+        *actual_color = 0;
+        if ( im )
+            im->error_message( im, "Quantize: can't allocate memory" );
+        return -1;
+    }
+
+    free_octree( &ot );
+    *actual_color = ot.ncolors;
+
+    if ( im )
+    {
+        im->completed = im->h;
+        im->visual_cue( im, "Quantization Done" );
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+octree_quantize_rgb( unsigned char  ** red,
+                     unsigned char  ** green,
+                     unsigned char  ** blue,
+                     int               w,
+                     int               h,
+                     int               max_color,
+                     unsigned short ** ci,
+                     int             * actual_color,
+                     int             * red_lut,
+                     int             * green_lut,
+                     int             * blue_lut,
+                     FL_IMAGE        * im )
+{
+    OSRC src;
+
+    src.red = red;
+    src.green = green;
+    src.blue = blue;
+    src.packed = NULL;
+
+    return octree_quantize( &src, w, h, max_color, ci, actual_color,
+                            red_lut, green_lut, blue_lut, im );
+}
+
+
+/***************************************
+ ***************************************/
+
+int
+octree_quantize_packed( unsigned int   ** packed,
+                        int               w,
+                        int               h,
+                        int               max_color,
+                        unsigned short ** ci,
+                        int             * actual_color,
+                        int             * red_lut,
+                        int             * green_lut,
+                        int             * blue_lut,
+                        FL_IMAGE        * im )
+{
+    OSRC src;
+
+    src.red = src.green = src.blue = NULL;
+    src.packed = packed;
+
+    return octree_quantize( &src, w, h, max_color, ci, actual_color,
+                            red_lut, green_lut, blue_lut, im );
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+fl_select_octree_quantizer( void )
+{
+    flimage_quantize_rgb = octree_quantize_rgb;
+    flimage_quantize_packed = octree_quantize_packed;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
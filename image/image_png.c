@@ -21,7 +21,9 @@
  *  Copyright (c) 1993, 1998-2002  By T.C. Zhao
  *  All rights reserved.
  *
- *  TODO: png should be implemented in real code
+ *  PNG support. If libpng is available images are decoded one row at
+ *  a time directly into the image's buffers, otherwise the external
+ *  programs pngtopnm and pnmtopng from netpbm are used.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -32,6 +34,10 @@
 #include "flimage.h"
 #include "flimage_int.h"
 
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+
 
 /***************************************
  ***************************************/
@@ -48,6 +54,516 @@ PNG_identify( FILE * fp )
 }
 
 
+static const FLIMAGE_MAGIC png_magic[ ] =
+{
+    { 0, 8, "\x89PNG\x0d\x0a\x1a\x0a" },
+    { 0, 0, NULL }
+};
+
+
+#ifdef HAVE_LIBPNG
+
+typedef struct
+{
+    png_structp     png;
+    png_infop       info;
+    png_bytep       row;         /* one row of interleaved samples */
+    int             channels;    /* samples per pixel after transforms */
+    int             depth;       /* 8 or 16 */
+    int             interlaced;
+} SPEC;
+
+
+/***************************************
+ * 16 bit samples are stored MSB first in PNG files
+ ***************************************/
+
+static int
+host_is_lsbf( void )
+{
+    unsigned short one = 1;
+
+    return * ( unsigned char * ) &one;
+}
+
+
+/***************************************
+ * libpng calls this on fatal errors, we must not return
+ ***************************************/
+
+static void
+png_error_handler( png_structp  png,
+                   png_const_charp msg )
+{
+    FL_IMAGE *im = png_get_error_ptr( png );
+
+    flimage_error( im, "%s: %s", im->infile, msg );
+    png_longjmp( png, 1 );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+png_warning_handler( png_structp     png  FL_UNUSED_ARG,
+                     png_const_charp msg )
+{
+    M_warn( "PNG", msg );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_spec( FL_IMAGE * im )
+{
+    SPEC *sp = im->io_spec;
+
+    if ( ! sp )
+        return;
+
+    if ( sp->png )
+        png_destroy_read_struct( &sp->png, &sp->info, NULL );
+    fli_safe_free( sp->row );
+    fl_free( sp );
+    im->io_spec = NULL;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+PNG_description( FL_IMAGE * im )
+{
+    SPEC *sp = fl_calloc( 1, sizeof *sp );
+    png_uint_32 w,
+                h;
+    int depth,
+        color_type,
+        interlace;
+    png_textp text;
+    int ntext,
+        i;
+
+    if ( ! sp )
+    {
+        flimage_error( im, "%s: malloc() failed", im->infile );
+        return -1;
+    }
+
+    im->io_spec = sp;
+
+    sp->png = png_create_read_struct( PNG_LIBPNG_VER_STRING, im,
+                                      png_error_handler,
+                                      png_warning_handler );
+    if ( ! sp->png || ! ( sp->info = png_create_info_struct( sp->png ) ) )
+    {
+        flimage_error( im, "%s: can't create PNG decoder", im->infile );
+        free_spec( im );
+        return -1;
+    }
+
+    if ( setjmp( png_jmpbuf( sp->png ) ) )
+    {
+        free_spec( im );
+        return -1;
+    }
+
+    png_init_io( sp->png, im->fpin );
+    png_read_info( sp->png, sp->info );
+    png_get_IHDR( sp->png, sp->info, &w, &h, &depth, &color_type,
+                  &interlace, NULL, NULL );
+
+    im->w = w;
+    im->h = h;
+
+    /* Everything below 8 bits per sample gets expanded, palette images
+       stay colormapped, 16 bit data are only kept for gray scale images */
+
+    if ( depth < 8 )
+    {
+        if ( color_type == PNG_COLOR_TYPE_PALETTE )
+            png_set_packing( sp->png );
+        else
+            png_set_expand_gray_1_2_4_to_8( sp->png );
+    }
+
+    if ( depth == 16 && ( color_type & PNG_COLOR_MASK_COLOR ) )
+        png_set_strip_16( sp->png );
+
+    if ( depth == 16 && host_is_lsbf( ) )
+        png_set_swap( sp->png );
+
+    if ( color_type == PNG_COLOR_TYPE_PALETTE )
+    {
+        png_colorp pal;
+        png_bytep trans;
+        int npal = 0,
+            ntrans = 0;
+
+        png_get_PLTE( sp->png, sp->info, &pal, &npal );
+        im->type = FL_IMAGE_CI;
+        im->map_len = npal > 0 ? npal : 1;
+        flimage_getcolormap( im );
+
+        for ( i = 0; i < npal; i++ )
+        {
+            im->red_lut[ i ]   = pal[ i ].red;
+            im->green_lut[ i ] = pal[ i ].green;
+            im->blue_lut[ i ]  = pal[ i ].blue;
+        }
+
+        /* Only a single fully transparent entry is supported */
+
+        if (    png_get_tRNS( sp->png, sp->info, &trans, &ntrans, NULL )
+             && ntrans > 0 )
+        {
+            for ( i = 0; i < ntrans && trans[ i ] != 0; i++ )
+                /* empty */ ;
+            if ( i < ntrans )
+                im->tran_index = i;
+        }
+    }
+    else if ( color_type & PNG_COLOR_MASK_COLOR )
+        im->type = FL_IMAGE_RGB;
+    else if ( depth == 16 )
+    {
+        im->type = FL_IMAGE_GRAY16;
+        im->gray_maxval = 0xffff;
+    }
+    else
+        im->type = FL_IMAGE_GRAY;
+
+    /* Gray images with alpha channel lose it */
+
+    if ( color_type == PNG_COLOR_TYPE_GRAY_ALPHA )
+        png_set_strip_alpha( sp->png );
+
+    if ( im->type == FL_IMAGE_RGB && ! ( color_type & PNG_COLOR_MASK_ALPHA ) )
+        png_set_filler( sp->png, 0xff, PNG_FILLER_AFTER );
+
+    sp->interlaced = interlace != PNG_INTERLACE_NONE;
+    if ( sp->interlaced )
+        png_set_interlace_handling( sp->png );
+
+    png_read_update_info( sp->png, sp->info );
+
+    sp->channels = png_get_channels( sp->png, sp->info );
+    sp->depth    = png_get_bit_depth( sp->png, sp->info );
+    sp->row      = fl_malloc( png_get_rowbytes( sp->png, sp->info ) );
+
+    if ( png_get_text( sp->png, sp->info, &text, &ntext ) > 0 )
+        for ( i = 0; i < ntext; i++ )
+            if (    ! strcmp( text[ i ].key, "Comment" )
+                 || ! strcmp( text[ i ].key, "Description" ) )
+                flimage_add_comments( im, text[ i ].text,
+                                      strlen( text[ i ].text ) );
+
+    im->original_type = im->type;
+
+    if ( ! sp->row )
+    {
+        flimage_error( im, "%s: malloc() failed", im->infile );
+        free_spec( im );
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ * Copies a row from the image's buffers into the interleaved row
+ * buffer. Only needed for interlaced images where libpng combines
+ * each pass with what it got in the previous ones.
+ ***************************************/
+
+static void
+pack_row( FL_IMAGE * im,
+          SPEC     * sp,
+          int        y )
+{
+    png_bytep p = sp->row;
+    int x;
+
+    if ( im->type == FL_IMAGE_RGB )
+        for ( x = 0; x < im->w; x++ )
+        {
+            *p++ = im->red[ y ][ x ];
+            *p++ = im->green[ y ][ x ];
+            *p++ = im->blue[ y ][ x ];
+            *p++ = im->alpha[ y ][ x ];
+        }
+    else if ( im->type == FL_IMAGE_CI )
+        for ( x = 0; x < im->w; x++ )
+            *p++ = im->ci[ y ][ x ];
+    else if ( sp->depth == 16 )
+        memcpy( p, im->gray[ y ], 2 * im->w );
+    else
+        for ( x = 0; x < im->w; x++ )
+            *p++ = im->gray[ y ][ x ];
+}
+
+
+/***************************************
+ * Distributes a decoded row into the image's buffers
+ ***************************************/
+
+static void
+unpack_row( FL_IMAGE * im,
+            SPEC     * sp,
+            int        y )
+{
+    png_bytep p = sp->row;
+    int x;
+
+    if ( im->type == FL_IMAGE_RGB )
+    {
+        unsigned char *r = im->red[ y ],
+                      *g = im->green[ y ],
+                      *b = im->blue[ y ],
+                      *a = im->alpha[ y ];
+
+        for ( x = 0; x < im->w; x++ )
+        {
+            r[ x ] = *p++;
+            g[ x ] = *p++;
+            b[ x ] = *p++;
+            a[ x ] = *p++;
+        }
+    }
+    else if ( im->type == FL_IMAGE_CI )
+    {
+        unsigned short *ci = im->ci[ y ];
+
+        for ( x = 0; x < im->w; x++ )
+            ci[ x ] = *p++;
+    }
+    else if ( sp->depth == 16 )     /* already in host byte order */
+        memcpy( im->gray[ y ], p, 2 * im->w );
+    else
+    {
+        unsigned short *gray = im->gray[ y ];
+
+        for ( x = 0; x < im->w; x++ )
+            gray[ x ] = *p++;
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+PNG_load( FL_IMAGE * im )
+{
+    SPEC *sp = im->io_spec;
+    int npass,
+        pass,
+        y;
+
+    if ( setjmp( png_jmpbuf( sp->png ) ) )
+    {
+        free_spec( im );
+        return im->completed > im->h / 2 ? 1 : -1;
+    }
+
+    npass = sp->interlaced ? png_set_interlace_handling( sp->png ) : 1;
+    im->total = npass * im->h;
+
+    for ( im->completed = pass = 0; pass < npass; pass++ )
+    {
+        for ( y = 0; y < im->h; y++, im->completed++ )
+        {
+            if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+                im->visual_cue( im, "Reading PNG" );
+
+            if ( pass > 0 )
+                pack_row( im, sp, y );
+            png_read_row( sp->png, sp->row, NULL );
+            unpack_row( im, sp, y );
+        }
+    }
+
+    png_read_end( sp->png, NULL );
+    free_spec( im );
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+PNG_dump( FL_IMAGE * im )
+{
+    png_structp png;
+    png_infop info;
+    png_bytep volatile row = NULL;
+    png_text text;
+    png_color pal[ 256 ];
+    volatile int color_type,
+                 depth = 8;
+    int x,
+        y;
+
+    /* Colormapped images with too many colors for a palette are
+       written as RGB images (volatile since they're used after setjmp()
+       and might otherwise get clobbered by a longjmp()) */
+
+    if ( FL_IsCI( im->type ) && im->map_len <= 256 )
+        color_type = PNG_COLOR_TYPE_PALETTE;
+    else if ( FL_IsGray( im->type ) )
+    {
+        color_type = PNG_COLOR_TYPE_GRAY;
+        if ( im->type == FL_IMAGE_GRAY16 && im->gray_maxval > FL_PCMAX )
+            depth = 16;
+    }
+    else
+        color_type = PNG_COLOR_TYPE_RGB;
+
+    png = png_create_write_struct( PNG_LIBPNG_VER_STRING, im,
+                                   png_error_handler, png_warning_handler );
+    if ( ! png || ! ( info = png_create_info_struct( png ) ) )
+    {
+        png_destroy_write_struct( &png, NULL );
+        flimage_error( im, "%s: can't create PNG encoder", im->outfile );
+        return -1;
+    }
+
+    if ( setjmp( png_jmpbuf( png ) ) )
+    {
+        png_destroy_write_struct( &png, &info );
+        fl_free( row );
+        return -1;
+    }
+
+    png_init_io( png, im->fpout );
+    png_set_IHDR( png, info, im->w, im->h, depth, color_type,
+                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                  PNG_FILTER_TYPE_DEFAULT );
+
+    if ( color_type == PNG_COLOR_TYPE_PALETTE )
+    {
+        for ( x = 0; x < im->map_len; x++ )
+        {
+            pal[ x ].red   = im->red_lut[ x ];
+            pal[ x ].green = im->green_lut[ x ];
+            pal[ x ].blue  = im->blue_lut[ x ];
+        }
+
+        png_set_PLTE( png, info, pal, im->map_len );
+
+        if ( im->tran_index >= 0 && im->tran_index < im->map_len )
+        {
+            png_byte trans[ 256 ];
+
+            memset( trans, 0xff, sizeof trans );
+            trans[ im->tran_index ] = 0;
+            png_set_tRNS( png, info, trans, im->tran_index + 1, NULL );
+        }
+    }
+
+    if ( im->comments )
+    {
+        memset( &text, 0, sizeof text );
+        text.compression = PNG_TEXT_COMPRESSION_NONE;
+        text.key = "Comment";
+        text.text = im->comments;
+        png_set_text( png, info, &text, 1 );
+    }
+
+    png_write_info( png, info );
+
+    if ( depth == 16 && host_is_lsbf( ) )
+        png_set_swap( png );
+
+    if ( ! ( row = fl_malloc( 3 * im->w * sizeof *row ) ) )
+    {
+        png_destroy_write_struct( &png, &info );
+        flimage_error( im, "%s: malloc() failed", im->outfile );
+        return -1;
+    }
+
+    for ( y = 0; y < im->h; y++ )
+    {
+        png_bytep p = row;
+
+        if ( ! ( y & FLIMAGE_REPFREQ ) )
+        {
+            im->completed = y;
+            im->visual_cue( im, "Writing PNG" );
+        }
+
+        if ( color_type == PNG_COLOR_TYPE_PALETTE )
+            for ( x = 0; x < im->w; x++ )
+                *p++ = im->ci[ y ][ x ];
+        else if ( color_type == PNG_COLOR_TYPE_RGB && FL_IsCI( im->type ) )
+            for ( x = 0; x < im->w; x++ )
+            {
+                int c = im->ci[ y ][ x ];
+
+                *p++ = im->red_lut[ c ];
+                *p++ = im->green_lut[ c ];
+                *p++ = im->blue_lut[ c ];
+            }
+        else if ( color_type == PNG_COLOR_TYPE_RGB )
+            for ( x = 0; x < im->w; x++ )
+            {
+                *p++ = im->red[ y ][ x ];
+                *p++ = im->green[ y ][ x ];
+                *p++ = im->blue[ y ][ x ];
+            }
+        else if ( depth == 16 )
+        {
+            unsigned short *q = ( unsigned short * ) row;
+
+            for ( x = 0; x < im->w; x++ )
+                *q++ = im->gray[ y ][ x ] * 0xffffU / im->gray_maxval;
+        }
+        else if ( im->type == FL_IMAGE_GRAY16 )
+            for ( x = 0; x < im->w; x++ )
+                *p++ = im->gray[ y ][ x ] * FL_PCMAX / im->gray_maxval;
+        else
+            for ( x = 0; x < im->w; x++ )
+                *p++ = im->gray[ y ][ x ];
+
+        png_write_row( png, row );
+    }
+
+    png_write_end( png, info );
+    png_destroy_write_struct( &png, &info );
+    fl_free( row );
+
+    return 1;
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_enable_png( void )
+{
+    int k;
+
+    k = flimage_add_format( "Portable Network Graphics", "png", "png",
+                              FL_IMAGE_RGB | FL_IMAGE_GRAY | FL_IMAGE_GRAY16
+                            | FL_IMAGE_CI | FL_IMAGE_MONO,
+                            PNG_identify,
+                            PNG_description,
+                            PNG_load,
+                            PNG_dump );
+    flimage_set_magic( k, png_magic );
+}
+
+#else   /* ! HAVE_LIBPNG */
+
+
 /***************************************
  ***************************************/
 
@@ -93,14 +609,19 @@ PNG_dump( FL_IMAGE * im )
 void
 flimage_enable_png( void )
 {
-    flimage_add_format( "Portable Network Graphics", "png", "png",
-                        FL_IMAGE_RGB | FL_IMAGE_GRAY,
-                        PNG_identify,
-                        PNG_description,
-                        PNG_load,
-                        PNG_dump);
+    int k;
+
+    k = flimage_add_format( "Portable Network Graphics", "png", "png",
+                            FL_IMAGE_RGB | FL_IMAGE_GRAY,
+                            PNG_identify,
+                            PNG_description,
+                            PNG_load,
+                            PNG_dump);
+    flimage_set_magic( k, png_magic );
 }
 
+#endif  /* HAVE_LIBPNG */
+
 
 /*
  * Local variables:
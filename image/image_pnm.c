@@ -150,7 +150,7 @@ PNM_description( FL_IMAGE * im )
     else
         sp->maxval = 1;
 
-    if ( sp->maxval > 255 && sp->raw )
+    if ( sp->maxval > 255 && sp->raw && ! sp->pgm )
     {
         im->error_message( im, "can't handle 2byte raw ppm file" );
         return -1;
@@ -159,7 +159,7 @@ PNM_description( FL_IMAGE * im )
     im->type = FL_IMAGE_RGB;
 
     if ( sp->pgm )
-        im->type = sp->maxval > 256 ? FL_IMAGE_GRAY16 : FL_IMAGE_GRAY;
+        im->type = sp->maxval > 255 ? FL_IMAGE_GRAY16 : FL_IMAGE_GRAY;
 
     if (sp->pbm)
         im->type = FL_IMAGE_MONO;
@@ -230,7 +230,16 @@ PNM_read_pixels( FL_IMAGE * im )
     {
         unsigned short *gray = im->gray[0];
 
-        if ( sp->raw )
+        /* 2 byte samples are MSB first and can be used right from the
+           file if we're allowed to map it */
+
+        if ( sp->raw && sp->maxval > 255 )
+        {
+            if ( flimage_map_gray16( im, ftell( im->fpin ) ) < 0 )
+                for ( i = 0; i < npix; i++ )
+                    gray[ i ] = fli_fget2MSBF( im->fpin );
+        }
+        else if ( sp->raw )
             for ( i = 0; i < npix; i++ )
                 gray[ i ] = getc( im->fpin );
         else
@@ -408,24 +417,51 @@ PNM_write_image( FL_IMAGE * im )
 }
 
 
+static const FLIMAGE_MAGIC ppm_magic[ ] =
+{
+    { 0, 2, "P3" },
+    { 0, 2, "P6" },
+    { 0, 0, NULL }
+};
+
+static const FLIMAGE_MAGIC pgm_magic[ ] =
+{
+    { 0, 2, "P2" },
+    { 0, 2, "P5" },
+    { 0, 0, NULL }
+};
+
+static const FLIMAGE_MAGIC pbm_magic[ ] =
+{
+    { 0, 2, "P1" },
+    { 0, 2, "P4" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_pnm( void )
 {
-    flimage_add_format( "Portable Pixmap", "ppm", "ppm", FL_IMAGE_RGB,
-                        PPM_identify, PNM_description,
-                        PNM_read_pixels, PNM_write_image);
-
-    flimage_add_format( "Portable Graymap", "pgm", "pgm",
-                        FL_IMAGE_GRAY | FL_IMAGE_GRAY16,
-                        PGM_identify, PNM_description,
-                        PNM_read_pixels, PNM_write_image);
-
-    flimage_add_format( "Portable Bitmap", "pbm", "pbm", FL_IMAGE_MONO,
-                        PBM_identify, PNM_description,
-                        PNM_read_pixels, PNM_write_image);
+    int k;
+
+    k = flimage_add_format( "Portable Pixmap", "ppm", "ppm", FL_IMAGE_RGB,
+                            PPM_identify, PNM_description,
+                            PNM_read_pixels, PNM_write_image);
+    flimage_set_magic( k, ppm_magic );
+
+    k = flimage_add_format( "Portable Graymap", "pgm", "pgm",
+                            FL_IMAGE_GRAY | FL_IMAGE_GRAY16,
+                            PGM_identify, PNM_description,
+                            PNM_read_pixels, PNM_write_image);
+    flimage_set_magic( k, pgm_magic );
+
+    k = flimage_add_format( "Portable Bitmap", "pbm", "pbm", FL_IMAGE_MONO,
+                            PBM_identify, PNM_description,
+                            PNM_read_pixels, PNM_write_image);
+    flimage_set_magic( k, pbm_magic );
 }
 
 
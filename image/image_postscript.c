@@ -49,6 +49,38 @@
 
 typedef FLPSInfo SPEC;
 
+static SPEC *ps_options;
+
+
+/***************************************
+ ***************************************/
+
+static void
+init_ps_options( void )
+{
+    SPEC *sp = fl_calloc( 1, sizeof *sp );
+
+    ps_options = sp;
+    sp->orientation = FLPS_AUTO;
+    sp->paper_w = 8.5;
+    sp->paper_h = 11.0;
+    sp->auto_fit = 1;
+    sp->xdpi = sp->ydpi = fl_dpi;
+    sp->printer_dpi = 300;
+    sp->vm = sp->hm = 0.3;
+    sp->xscale = sp->yscale = 1.0;
+    sp->tmpdir = "/tmp";
+    sp->gamma = 1.0;
+    sp->verbose = 0;
+    sp->comment = 0;
+    sp->pack = 0;
+    sp->lastr = -1;
+    sp->ps_color = 1;
+    /* cache */
+    sp->cur_color = FLIMAGE_BADCOLOR;
+    sp->cur_style = sp->cur_size = sp->cur_lw = -1;
+}
+
 
 /***************************************
  ***************************************/
@@ -56,32 +88,11 @@ typedef FLPSInfo SPEC;
 FLPS_CONTROL *
 flimage_ps_options( void )
 {
-    static SPEC *sp;
+    static FLI_ONCE once = FLI_ONCE_INIT;
 
-    if ( ! sp )
-    {
-        sp = fl_calloc( 1, sizeof *sp );
-        sp->orientation = FLPS_AUTO;
-        sp->paper_w = 8.5;
-        sp->paper_h = 11.0;
-        sp->auto_fit = 1;
-        sp->xdpi = sp->ydpi = fl_dpi;
-        sp->printer_dpi = 300;
-        sp->vm = sp->hm = 0.3;
-        sp->xscale = sp->yscale = 1.0;
-        sp->tmpdir = "/tmp";
-        sp->gamma = 1.0;
-        sp->verbose = 0;
-        sp->comment = 0;
-        sp->pack = 0;
-        sp->lastr = -1;
-        sp->ps_color = 1;
-        /* cache */
-        sp->cur_color = FLIMAGE_BADCOLOR;
-        sp->cur_style = sp->cur_size = sp->cur_lw = -1;
-    }
+    fli_once( &once, init_ps_options );
 
-    return ( FLPS_CONTROL * ) sp;
+    return ( FLPS_CONTROL * ) ps_options;
 }
 
 
@@ -745,13 +756,23 @@ PS_write_image( FL_IMAGE * sim )
 }
 
 
+static const FLIMAGE_MAGIC ps_magic[ ] =
+{
+    { 0, 2, "%!" },
+    { 0, 0, NULL }
+};
+
+
 void
 flimage_enable_ps( void )
 {
-    flimage_add_format( "PostScript", "ps", "ps",
-                        FL_IMAGE_RGB | FL_IMAGE_GRAY,
-                        PS_identify, PS_description,
-                        PS_read_pixels, PS_write_image );
+    int k;
+
+    k = flimage_add_format( "PostScript", "ps", "ps",
+                            FL_IMAGE_RGB | FL_IMAGE_GRAY,
+                            PS_identify, PS_description,
+                            PS_read_pixels, PS_write_image );
+    flimage_set_magic( k, ps_magic );
 }
 
 
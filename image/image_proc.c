@@ -67,7 +67,8 @@ flimage_transform_pixels( FL_IMAGE * im,
     FL_PCTYPE *r,
               *g,
               *b;
-    SubImage *sub;
+    SubImage subimage,
+             *sub;
 
     if ( ! im || im->w <= 0 )
         return -1;
@@ -75,7 +76,10 @@ flimage_transform_pixels( FL_IMAGE * im,
     flimage_convert( im, FL_IMAGE_RGB, 0 );
     flimage_invalidate_pixels( im );
 
-    if ( ! ( sub = flimage_get_subimage( im, 1 ) ) )
+    if ( flimage_unshare( im ) < 0 )
+        return -1;
+
+    if ( ! ( sub = flimage_get_subimage( im, 1, &subimage ) ) )
         return -1;
 
     im->total = sub->h;
@@ -150,19 +154,15 @@ flimage_tint( FL_IMAGE     * im,
 }
 
 
-/* get a subimage of the image. if parameter make is true,
+/* get a subimage of the image into sub. if parameter make is true,
    we fake a matrix so processing is done in place
  */
 
-#define MAX_RETBUF  6       /* hack to be limited re-entrent */
-
 SubImage *
 flimage_get_subimage( FL_IMAGE * im,
-                      int        make )
+                      int        make,
+                      SubImage * sub )
 {
-    static SubImage subimage[ MAX_RETBUF ];
-    static int buf;
-    SubImage *sub = subimage + buf;
     void * ( * submat )( void *, int, int, int, int, int, int, unsigned int );
 
     submat = make ? make_submatrix : get_submatrix;
@@ -232,8 +232,6 @@ flimage_get_subimage( FL_IMAGE * im,
     }
     }
 
-    buf = ( buf + 1 ) % MAX_RETBUF;
-
     return sub;
 }
 
@@ -419,6 +417,9 @@ flimage_enhance( FL_IMAGE * im,
     else if (im->type == FL_IMAGE_MONO)
         flimage_convert(im, FL_IMAGE_GRAY, 0);
 
+    if ( flimage_unshare( im ) < 0 )
+        return -1;
+
     get_histogram( im );
     memset( sum, 0, sizeof sum );
     sum[ 0 ] = im->hist[ 3 ][ 0 ];
@@ -0,0 +1,1109 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  Rendering of annotations (markers and text) directly into the
+ *  pixels of an image, without an X display. Markers are drawn from
+ *  their PostScript descriptions (see image_marker.c), text with a
+ *  small built-in bitmap font. Nothing in here keeps static state, so
+ *  different images can be annotated from different threads.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flinternal.h"
+#include "flimage.h"
+#include "flimage_int.h"
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI  3.14159265358979323846
+#endif
+
+typedef struct
+{
+    float x,
+          y;
+} RPoint;
+
+/* A path made of several sub-paths stored back to back */
+
+typedef struct
+{
+    RPoint * p;
+    int    * start;     /* index of the first point of each sub-path */
+    int    * closed;
+    int      npts,
+             nsub,
+             maxpts,
+             maxsub;
+} RPath;
+
+typedef struct
+{
+    int r,
+        g,
+        b;
+} Pen;
+
+/* Maps the marker's unit square (-1 to 1, y pointing up) onto the image */
+
+typedef struct
+{
+    double x,
+           y,
+           hw,
+           hh,
+           cosa,
+           sina;
+} Xform;
+
+
+/***************************************
+ * Blends a color into a pixel, alpha being from 0 (transparent) to 255
+ ***************************************/
+
+static void
+blend( FL_IMAGE  * im,
+       int         x,
+       int         y,
+       const Pen * pen,
+       int         alpha )
+{
+    unsigned char *r,
+                  *g,
+                  *b;
+
+    if ( x < 0 || y < 0 || x >= im->w || y >= im->h || alpha <= 0 )
+        return;
+
+    r = im->red[ y ] + x;
+    g = im->green[ y ] + x;
+    b = im->blue[ y ] + x;
+
+    if ( alpha >= 255 )
+    {
+        *r = pen->r;
+        *g = pen->g;
+        *b = pen->b;
+        return;
+    }
+
+    *r += ( ( pen->r - *r ) * alpha ) / 255;
+    *g += ( ( pen->g - *g ) * alpha ) / 255;
+    *b += ( ( pen->b - *b ) * alpha ) / 255;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+set_pen( Pen          * pen,
+         unsigned int   col )
+{
+    FL_UNPACK( col, pen->r, pen->g, pen->b );
+}
+
+
+/**********************************************************************
+ * Paths
+ **********************************************************************/
+
+/***************************************
+ ***************************************/
+
+static int
+path_new_sub( RPath * path )
+{
+    if ( path->nsub == path->maxsub )
+    {
+        int n = path->maxsub ? 2 * path->maxsub : 8;
+        int *start = fl_realloc( path->start, n * sizeof *start ),
+            *closed;
+
+        if ( ! start )
+            return -1;
+        path->start = start;
+
+        if ( ! ( closed = fl_realloc( path->closed, n * sizeof *closed ) ) )
+            return -1;
+        path->closed = closed;
+
+        path->maxsub = n;
+    }
+
+    path->start[ path->nsub ] = path->npts;
+    path->closed[ path->nsub++ ] = 0;
+
+    return 0;
+}
+
+
+/***************************************
+ * Adds a point given in unit coordinates to the current sub-path
+ ***************************************/
+
+static int
+path_add( RPath       * path,
+          const Xform * xf,
+          double        u,
+          double        v )
+{
+    double su = u * xf->hw,
+           sv = v * xf->hh;
+
+    if ( ! path->nsub && path_new_sub( path ) < 0 )
+        return -1;
+
+    if ( path->npts == path->maxpts )
+    {
+        int n = path->maxpts ? 2 * path->maxpts : 32;
+        RPoint *p = fl_realloc( path->p, n * sizeof *p );
+
+        if ( ! p )
+            return -1;
+        path->p = p;
+        path->maxpts = n;
+    }
+
+    /* Integer coordinates are pixel centers, just like with X */
+
+    path->p[ path->npts ].x = xf->x + 0.5 + su * xf->cosa - sv * xf->sina;
+    path->p[ path->npts++ ].y = xf->y + 0.5 - su * xf->sina - sv * xf->cosa;
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+path_free( RPath * path )
+{
+    fli_safe_free( path->p );
+    fli_safe_free( path->start );
+    fli_safe_free( path->closed );
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+sub_count( const RPath * path,
+           int           i )
+{
+    return ( i + 1 < path->nsub ? path->start[ i + 1 ] : path->npts )
+           - path->start[ i ];
+}
+
+
+/***************************************
+ * Interprets the small PostScript subset used for marker definitions:
+ * numbers and the operators M (moveto), LT (lineto), L (M LT), C
+ * (closepath) and arc. Anything else is skipped.
+ ***************************************/
+
+static int
+parse_psdraw( const char  * s,
+              const Xform * xf,
+              RPath       * path )
+{
+    double st[ 8 ];
+    int n = 0,
+        err = 0;
+
+    while ( *s && ! err )
+    {
+        char op[ 16 ],
+             *end;
+        size_t len;
+        double v;
+
+        if ( isspace( ( unsigned char ) *s ) )
+        {
+            s++;
+            continue;
+        }
+
+        v = strtod( s, &end );
+
+        if ( end != s )
+        {
+            if ( n < 8 )
+                st[ n++ ] = v;
+            s = end;
+            continue;
+        }
+
+        for ( len = 0; *s && ! isspace( ( unsigned char ) *s ); s++ )
+            if ( len < sizeof op - 1 )
+                op[ len++ ] = *s;
+        op[ len ] = '\0';
+
+        if ( ( ! strcmp( op, "M" ) || ! strcmp( op, "moveto" ) ) && n >= 2 )
+            err =    path_new_sub( path ) < 0
+                  || path_add( path, xf, st[ n - 2 ], st[ n - 1 ] ) < 0;
+        else if ( ( ! strcmp( op, "LT" ) || ! strcmp( op, "lineto" ) )
+                  && n >= 2 )
+            err = path_add( path, xf, st[ n - 2 ], st[ n - 1 ] ) < 0;
+        else if ( ! strcmp( op, "L" ) && n >= 4 )
+            err =    path_new_sub( path ) < 0
+                  || path_add( path, xf, st[ n - 4 ], st[ n - 3 ] ) < 0
+                  || path_add( path, xf, st[ n - 2 ], st[ n - 1 ] ) < 0;
+        else if ( ! strcmp( op, "C" ) || ! strcmp( op, "closepath" ) )
+        {
+            if ( path->nsub )
+                path->closed[ path->nsub - 1 ] = 1;
+        }
+        else if ( ! strcmp( op, "arc" ) && n >= 5 )
+        {
+            double cx = st[ n - 5 ],
+                   cy = st[ n - 4 ],
+                   r  = st[ n - 3 ],
+                   a1 = st[ n - 2 ],
+                   a2 = st[ n - 1 ],
+                   a;
+            int i,
+                seg;
+
+            while ( a2 < a1 )
+                a2 += 360.0;
+
+            seg = 1 + ( a2 - a1 ) / 6.0;
+
+            for ( i = 0; i <= seg && ! err; i++ )
+            {
+                a = ( a1 + ( a2 - a1 ) * i / seg ) * M_PI / 180.0;
+                err = path_add( path, xf, cx + r * cos( a ),
+                                cy + r * sin( a ) ) < 0;
+            }
+        }
+
+        n = 0;
+    }
+
+    return err ? -1 : 0;
+}
+
+
+/**********************************************************************
+ * Scan conversion
+ **********************************************************************/
+
+/***************************************
+ * Even-odd fill of all sub-paths with at least 'minpts' points, each
+ * one being closed implicitely. Pixels get set if their centers are
+ * inside.
+ ***************************************/
+
+static void
+fill_path( FL_IMAGE    * im,
+           const RPath * path,
+           int           minpts,
+           const Pen   * pen )
+{
+    float ymin = im->h,
+          ymax = -1,
+          *xs,
+          t;
+    int i,
+        j,
+        k,
+        n,
+        nx,
+        y0,
+        y1;
+
+    for ( i = 0; i < path->nsub; i++ )
+        if ( sub_count( path, i ) >= minpts )
+            for ( k = 0; k < sub_count( path, i ); k++ )
+            {
+                ymin = FL_min( ymin, path->p[ path->start[ i ] + k ].y );
+                ymax = FL_max( ymax, path->p[ path->start[ i ] + k ].y );
+            }
+
+    y0 = FL_max( 0, ( int ) floor( ymin ) );
+    y1 = FL_min( im->h - 1, ( int ) ceil( ymax ) );
+
+    if ( y0 > y1 || ! ( xs = fl_malloc( path->npts * sizeof *xs ) ) )
+        return;
+
+    for ( j = y0; j <= y1; j++ )
+    {
+        float yc = j + 0.5;
+
+        for ( nx = 0, i = 0; i < path->nsub; i++ )
+        {
+            const RPoint *p = path->p + path->start[ i ];
+
+            if ( ( n = sub_count( path, i ) ) < minpts )
+                continue;
+
+            for ( k = 0; k < n; k++ )
+            {
+                const RPoint *a = p + k,
+                             *b = p + ( k + 1 ) % n;
+
+                if ( ( a->y <= yc ) != ( b->y <= yc ) )
+                    xs[ nx++ ] = a->x + ( yc - a->y ) * ( b->x - a->x )
+                                        / ( b->y - a->y );
+            }
+        }
+
+        /* Few crossings, so insertion sort is good enough */
+
+        for ( i = 1; i < nx; i++ )
+        {
+            for ( t = xs[ i ], k = i; k > 0 && xs[ k - 1 ] > t; k-- )
+                xs[ k ] = xs[ k - 1 ];
+            xs[ k ] = t;
+        }
+
+        for ( i = 0; i + 1 < nx; i += 2 )
+        {
+            int x0 = FL_max( 0, ( int ) ceil( xs[ i ] - 0.5 ) ),
+                x1 = FL_min( im->w, ( int ) ceil( xs[ i + 1 ] - 0.5 ) );
+
+            for ( k = x0; k < x1; k++ )
+                blend( im, k, j, pen, 255 );
+        }
+    }
+
+    fl_free( xs );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+fill_disc( FL_IMAGE    * im,
+           double        cx,
+           double        cy,
+           double        r,
+           const Pen   * pen )
+{
+    int i,
+        j,
+        x0 = FL_max( 0, ( int ) floor( cx - r ) ),
+        x1 = FL_min( im->w - 1, ( int ) ceil( cx + r ) ),
+        y0 = FL_max( 0, ( int ) floor( cy - r ) ),
+        y1 = FL_min( im->h - 1, ( int ) ceil( cy + r ) );
+    double dx,
+           dy;
+
+    for ( j = y0; j <= y1; j++ )
+        for ( dy = j + 0.5 - cy, i = x0; i <= x1; i++ )
+        {
+            dx = i + 0.5 - cx;
+            if ( dx * dx + dy * dy <= r * r )
+                blend( im, i, j, pen, 255 );
+        }
+}
+
+
+/***************************************
+ * Draws a single straight piece of a stroke
+ ***************************************/
+
+static void
+draw_segment( FL_IMAGE  * im,
+              RPoint      a,
+              RPoint      b,
+              int         thickness,
+              const Pen * pen )
+{
+    double dx = b.x - a.x,
+           dy = b.y - a.y,
+           len = sqrt( dx * dx + dy * dy );
+
+    if ( thickness <= 1 || len < 1.0e-3 )
+    {
+        int i,
+            n = ceil( FL_max( fabs( dx ), fabs( dy ) ) );
+
+        if ( n == 0 )
+            n = 1;
+
+        for ( i = 0; i <= n; i++ )
+            blend( im, floor( a.x + dx * i / n ), floor( a.y + dy * i / n ),
+                   pen, 255 );
+    }
+    else
+    {
+        RPoint q[ 4 ];
+        int start = 0,
+            closed = 1;
+        RPath quad = { q, &start, &closed, 4, 1, 4, 1 };
+        double nx = -dy / len * 0.5 * thickness,
+               ny = dx / len * 0.5 * thickness;
+
+        q[ 0 ].x = a.x + nx;
+        q[ 0 ].y = a.y + ny;
+        q[ 1 ].x = b.x + nx;
+        q[ 1 ].y = b.y + ny;
+        q[ 2 ].x = b.x - nx;
+        q[ 2 ].y = b.y - ny;
+        q[ 3 ].x = a.x - nx;
+        q[ 3 ].y = a.y - ny;
+
+        fill_path( im, &quad, 3, pen );
+
+        /* Round joins, otherwise there are notches at the corners */
+
+        if ( thickness > 2 )
+        {
+            fill_disc( im, a.x, a.y, 0.5 * thickness, pen );
+            fill_disc( im, b.x, b.y, 0.5 * thickness, pen );
+        }
+    }
+}
+
+
+/***************************************
+ * Strokes all sub-paths with the given line style. The dash patterns
+ * are the ones used for drawing with X (see lib/xdraw.c), scaled by
+ * the line thickness.
+ ***************************************/
+
+static void
+stroke_path( FL_IMAGE    * im,
+             const RPath * path,
+             int           thickness,
+             int           style,
+             const Pen   * pen )
+{
+    static const int dot[ ]      = { 2, 4 },
+                     dotdash[ ]  = { 7, 3, 2, 3 },
+                     dash[ ]     = { 4, 4 },
+                     longdash[ ] = { 10, 4 };
+    const int *pat = NULL;
+    int npat = 0,
+        i,
+        k;
+
+    if ( style == FL_DOT )
+    {
+        pat = dot;
+        npat = 2;
+    }
+    else if ( style == FL_DOTDASH )
+    {
+        pat = dotdash;
+        npat = 4;
+    }
+    else if ( style == FL_LONGDASH )
+    {
+        pat = longdash;
+        npat = 2;
+    }
+    else if (    style == FL_DASH
+              || style == FL_USERDASH
+              || style == FL_USERDOUBLEDASH )
+    {
+        pat = dash;
+        npat = 2;
+    }
+
+    for ( i = 0; i < path->nsub; i++ )
+    {
+        const RPoint *p = path->p + path->start[ i ];
+        int n = sub_count( path, i ),
+            nseg = path->closed[ i ] ? n : n - 1,
+            idx = 0;
+        double left = pat ? pat[ 0 ] * thickness : 0;
+
+        if ( n == 1 )
+            draw_segment( im, p[ 0 ], p[ 0 ], thickness, pen );
+
+        for ( k = 0; k < nseg; k++ )
+        {
+            RPoint a = p[ k ],
+                   b = p[ ( k + 1 ) % n ],
+                   s,
+                   e;
+            double dx = b.x - a.x,
+                   dy = b.y - a.y,
+                   len = sqrt( dx * dx + dy * dy ),
+                   pos = 0,
+                   step;
+
+            if ( ! pat )
+            {
+                draw_segment( im, a, b, thickness, pen );
+                continue;
+            }
+
+            while ( pos < len )
+            {
+                step = FL_min( left, len - pos );
+
+                if ( ! ( idx & 1 ) )
+                {
+                    s.x = a.x + dx * pos / len;
+                    s.y = a.y + dy * pos / len;
+                    e.x = a.x + dx * ( pos + step ) / len;
+                    e.y = a.y + dy * ( pos + step ) / len;
+                    draw_segment( im, s, e, thickness, pen );
+                }
+
+                pos += step;
+
+                if ( ( left -= step ) <= 0 )
+                {
+                    idx = ( idx + 1 ) % npat;
+                    left = pat[ idx ] * thickness;
+                }
+            }
+        }
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+raster_marker( FL_IMAGE             * im,
+               const FLIMAGE_MARKER * m )
+{
+    RPath path;
+    Xform xf;
+    Pen pen;
+    int thickness = m->thickness + ( m->thickness == 0 );
+
+    if ( ! m->psdraw )
+        return 0;
+
+    memset( &path, 0, sizeof path );
+    xf.x = m->x;
+    xf.y = m->y;
+    xf.hw = 0.5 * m->w;
+    xf.hh = 0.5 * m->h;
+    xf.cosa = cos( m->angle * M_PI / 1800.0 );
+    xf.sina = sin( m->angle * M_PI / 1800.0 );
+
+    if ( parse_psdraw( m->psdraw, &xf, &path ) < 0 )
+    {
+        path_free( &path );
+        flimage_error( im, "RasterizeAnnotation: malloc failed" );
+        return -1;
+    }
+
+    set_pen( &pen, m->color );
+
+    /* Like with X, only the markers that have an area get filled,
+       lines (e.g. "cross") are always stroked */
+
+    if ( m->fill )
+    {
+        int i,
+            stroked = 0;
+
+        fill_path( im, &path, 3, &pen );
+
+        for ( i = 0; i < path.nsub && ! stroked; i++ )
+            stroked = sub_count( &path, i ) < 3;
+
+        if ( stroked )
+            stroke_path( im, &path, thickness, m->style, &pen );
+    }
+    else
+        stroke_path( im, &path, thickness, m->style, &pen );
+
+    path_free( &path );
+    return 0;
+}
+
+
+/**********************************************************************
+ * Text
+ **********************************************************************/
+
+/* Built-in 8x16 font for the printable ASCII characters, one byte per
+   row with the most significant bit being the leftmost pixel. The
+   glyphs were rendered from DejaVu Sans Mono at 13 pixels. */
+
+#define CELL_W      8
+#define CELL_H      16
+#define BASELINE    12
+#define FONT_EM     13.0
+#define ITALIC      0.2
+
+static const unsigned char font8x16[ 95 ][ CELL_H ] =
+{
+    /*   */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* ! */ { 0x00, 0x00, 0x00, 0x10, 0x10, 0x10, 0x10, 0x10,
+              0x10, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 },
+    /* " */ { 0x00, 0x00, 0x00, 0x28, 0x28, 0x28, 0x28, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* # */ { 0x00, 0x00, 0x12, 0x12, 0x16, 0x7f, 0x24, 0x24,
+              0xfe, 0x28, 0x48, 0x48, 0x00, 0x00, 0x00, 0x00 },
+    /* $ */ { 0x00, 0x00, 0x00, 0x08, 0x3e, 0x49, 0x48, 0x38,
+              0x0e, 0x09, 0x49, 0x3e, 0x08, 0x08, 0x00, 0x00 },
+    /* % */ { 0x00, 0x00, 0x00, 0x60, 0x90, 0x90, 0x62, 0x1c,
+              0x66, 0x09, 0x09, 0x06, 0x00, 0x00, 0x00, 0x00 },
+    /* & */ { 0x00, 0x00, 0x00, 0x1c, 0x20, 0x20, 0x30, 0x49,
+              0x4d, 0x45, 0x62, 0x3d, 0x00, 0x00, 0x00, 0x00 },
+    /* ' */ { 0x00, 0x00, 0x00, 0x10, 0x10, 0x10, 0x10, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* ( */ { 0x00, 0x0c, 0x08, 0x08, 0x10, 0x10, 0x10, 0x10,
+              0x10, 0x10, 0x08, 0x08, 0x04, 0x00, 0x00, 0x00 },
+    /* ) */ { 0x00, 0x30, 0x10, 0x10, 0x08, 0x08, 0x08, 0x08,
+              0x08, 0x08, 0x10, 0x10, 0x30, 0x00, 0x00, 0x00 },
+    /* * */ { 0x00, 0x00, 0x00, 0x08, 0x49, 0x3e, 0x1c, 0x6b,
+              0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* + */ { 0x00, 0x00, 0x00, 0x00, 0x10, 0x10, 0x10, 0xfe,
+              0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* , */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+              0x00, 0x00, 0x18, 0x18, 0x10, 0x20, 0x00, 0x00 },
+    /* - */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+              0x38, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* . */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+              0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00 },
+    /* / */ { 0x00, 0x00, 0x00, 0x02, 0x04, 0x04, 0x08, 0x08,
+              0x18, 0x10, 0x10, 0x20, 0x20, 0x40, 0x00, 0x00 },
+    /* 0 */ { 0x00, 0x00, 0x00, 0x1c, 0x22, 0x41, 0x41, 0x49,
+              0x41, 0x41, 0x22, 0x1c, 0x00, 0x00, 0x00, 0x00 },
+    /* 1 */ { 0x00, 0x00, 0x00, 0x38, 0x08, 0x08, 0x08, 0x08,
+              0x08, 0x08, 0x08, 0x3e, 0x00, 0x00, 0x00, 0x00 },
+    /* 2 */ { 0x00, 0x00, 0x00, 0x3e, 0x43, 0x01, 0x01, 0x02,
+              0x0c, 0x18, 0x20, 0x7f, 0x00, 0x00, 0x00, 0x00 },
+    /* 3 */ { 0x00, 0x00, 0x00, 0x3e, 0x41, 0x01, 0x03, 0x1c,
+              0x03, 0x01, 0x43, 0x3e, 0x00, 0x00, 0x00, 0x00 },
+    /* 4 */ { 0x00, 0x00, 0x00, 0x06, 0x0a, 0x1a, 0x12, 0x22,
+              0x42, 0x7f, 0x02, 0x02, 0x00, 0x00, 0x00, 0x00 },
+    /* 5 */ { 0x00, 0x00, 0x00, 0x7e, 0x40, 0x40, 0x7c, 0x03,
+              0x01, 0x01, 0x43, 0x3c, 0x00, 0x00, 0x00, 0x00 },
+    /* 6 */ { 0x00, 0x00, 0x00, 0x1e, 0x21, 0x40, 0x5e, 0x63,
+              0x41, 0x41, 0x23, 0x1e, 0x00, 0x00, 0x00, 0x00 },
+    /* 7 */ { 0x00, 0x00, 0x00, 0x7f, 0x02, 0x02, 0x04, 0x04,
+              0x08, 0x18, 0x10, 0x20, 0x00, 0x00, 0x00, 0x00 },
+    /* 8 */ { 0x00, 0x00, 0x00, 0x3e, 0x41, 0x41, 0x41, 0x3e,
+              0x63, 0x41, 0x61, 0x3e, 0x00, 0x00, 0x00, 0x00 },
+    /* 9 */ { 0x00, 0x00, 0x00, 0x3c, 0x62, 0x41, 0x41, 0x63,
+              0x3d, 0x01, 0x42, 0x3c, 0x00, 0x00, 0x00, 0x00 },
+    /* : */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00,
+              0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00 },
+    /* ; */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x18, 0x18, 0x00,
+              0x00, 0x00, 0x18, 0x18, 0x10, 0x20, 0x00, 0x00 },
+    /* < */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x0e, 0x70,
+              0x70, 0x0e, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* = */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7f, 0x00,
+              0x00, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* > */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x38, 0x07,
+              0x07, 0x38, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* ? */ { 0x00, 0x00, 0x00, 0x38, 0x44, 0x04, 0x08, 0x10,
+              0x10, 0x00, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 },
+    /* @ */ { 0x00, 0x00, 0x00, 0x1e, 0x33, 0x21, 0x47, 0x49,
+              0x49, 0x49, 0x47, 0x20, 0x30, 0x1e, 0x00, 0x00 },
+    /* A */ { 0x00, 0x00, 0x00, 0x08, 0x14, 0x14, 0x14, 0x22,
+              0x22, 0x3e, 0x63, 0x41, 0x00, 0x00, 0x00, 0x00 },
+    /* B */ { 0x00, 0x00, 0x00, 0x7e, 0x41, 0x41, 0x41, 0x7e,
+              0x41, 0x41, 0x41, 0x7e, 0x00, 0x00, 0x00, 0x00 },
+    /* C */ { 0x00, 0x00, 0x00, 0x1e, 0x21, 0x40, 0x40, 0x40,
+              0x40, 0x40, 0x21, 0x1e, 0x00, 0x00, 0x00, 0x00 },
+    /* D */ { 0x00, 0x00, 0x00, 0x7c, 0x42, 0x41, 0x41, 0x41,
+              0x41, 0x41, 0x42, 0x7c, 0x00, 0x00, 0x00, 0x00 },
+    /* E */ { 0x00, 0x00, 0x00, 0x7f, 0x40, 0x40, 0x40, 0x7f,
+              0x40, 0x40, 0x40, 0x7f, 0x00, 0x00, 0x00, 0x00 },
+    /* F */ { 0x00, 0x00, 0x00, 0x7f, 0x40, 0x40, 0x40, 0x7f,
+              0x40, 0x40, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00 },
+    /* G */ { 0x00, 0x00, 0x00, 0x1e, 0x21, 0x40, 0x40, 0x43,
+              0x41, 0x41, 0x21, 0x1e, 0x00, 0x00, 0x00, 0x00 },
+    /* H */ { 0x00, 0x00, 0x00, 0x41, 0x41, 0x41, 0x41, 0x7f,
+              0x41, 0x41, 0x41, 0x41, 0x00, 0x00, 0x00, 0x00 },
+    /* I */ { 0x00, 0x00, 0x00, 0x7c, 0x10, 0x10, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x7c, 0x00, 0x00, 0x00, 0x00 },
+    /* J */ { 0x00, 0x00, 0x00, 0x1c, 0x04, 0x04, 0x04, 0x04,
+              0x04, 0x04, 0x44, 0x38, 0x00, 0x00, 0x00, 0x00 },
+    /* K */ { 0x00, 0x00, 0x00, 0x42, 0x44, 0x48, 0x50, 0x70,
+              0x48, 0x44, 0x44, 0x42, 0x00, 0x00, 0x00, 0x00 },
+    /* L */ { 0x00, 0x00, 0x00, 0x40, 0x40, 0x40, 0x40, 0x40,
+              0x40, 0x40, 0x40, 0x7f, 0x00, 0x00, 0x00, 0x00 },
+    /* M */ { 0x00, 0x00, 0x00, 0x63, 0x63, 0x55, 0x55, 0x55,
+              0x49, 0x41, 0x41, 0x41, 0x00, 0x00, 0x00, 0x00 },
+    /* N */ { 0x00, 0x00, 0x00, 0x61, 0x61, 0x51, 0x51, 0x49,
+              0x45, 0x45, 0x43, 0x43, 0x00, 0x00, 0x00, 0x00 },
+    /* O */ { 0x00, 0x00, 0x00, 0x1c, 0x22, 0x41, 0x41, 0x41,
+              0x41, 0x41, 0x22, 0x1c, 0x00, 0x00, 0x00, 0x00 },
+    /* P */ { 0x00, 0x00, 0x00, 0x7e, 0x43, 0x41, 0x41, 0x43,
+              0x7e, 0x40, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00 },
+    /* Q */ { 0x00, 0x00, 0x00, 0x1c, 0x22, 0x41, 0x41, 0x41,
+              0x41, 0x41, 0x23, 0x1e, 0x06, 0x02, 0x00, 0x00 },
+    /* R */ { 0x00, 0x00, 0x00, 0x7e, 0x43, 0x41, 0x41, 0x7e,
+              0x42, 0x41, 0x41, 0x40, 0x00, 0x00, 0x00, 0x00 },
+    /* S */ { 0x00, 0x00, 0x00, 0x3e, 0x61, 0x40, 0x60, 0x3e,
+              0x03, 0x01, 0x43, 0x3e, 0x00, 0x00, 0x00, 0x00 },
+    /* T */ { 0x00, 0x00, 0x00, 0xfe, 0x10, 0x10, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 },
+    /* U */ { 0x00, 0x00, 0x00, 0x41, 0x41, 0x41, 0x41, 0x41,
+              0x41, 0x41, 0x41, 0x3e, 0x00, 0x00, 0x00, 0x00 },
+    /* V */ { 0x00, 0x00, 0x00, 0x41, 0x63, 0x22, 0x22, 0x22,
+              0x14, 0x14, 0x14, 0x08, 0x00, 0x00, 0x00, 0x00 },
+    /* W */ { 0x00, 0x00, 0x00, 0x81, 0x81, 0x81, 0x5a, 0x5a,
+              0x5a, 0x66, 0x66, 0x66, 0x00, 0x00, 0x00, 0x00 },
+    /* X */ { 0x00, 0x00, 0x00, 0x63, 0x22, 0x14, 0x1c, 0x08,
+              0x14, 0x36, 0x22, 0x41, 0x00, 0x00, 0x00, 0x00 },
+    /* Y */ { 0x00, 0x00, 0x00, 0x82, 0x44, 0x28, 0x28, 0x10,
+              0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 },
+    /* Z */ { 0x00, 0x00, 0x00, 0x7f, 0x03, 0x06, 0x04, 0x08,
+              0x10, 0x30, 0x60, 0x7f, 0x00, 0x00, 0x00, 0x00 },
+    /* [ */ { 0x00, 0x1c, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x10, 0x1c, 0x00, 0x00, 0x00 },
+    /* \ */ { 0x00, 0x00, 0x00, 0x40, 0x20, 0x20, 0x10, 0x10,
+              0x18, 0x08, 0x08, 0x04, 0x04, 0x02, 0x00, 0x00 },
+    /* ] */ { 0x00, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
+              0x08, 0x08, 0x08, 0x08, 0x38, 0x00, 0x00, 0x00 },
+    /* ^ */ { 0x00, 0x00, 0x00, 0x10, 0x28, 0x44, 0xc6, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* _ */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x00 },
+    /* ` */ { 0x00, 0x00, 0x10, 0x08, 0x00, 0x00, 0x00, 0x00,
+              0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    /* a */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x1c, 0x22, 0x02,
+              0x3e, 0x42, 0x46, 0x3a, 0x00, 0x00, 0x00, 0x00 },
+    /* b */ { 0x00, 0x40, 0x40, 0x40, 0x40, 0x7c, 0x66, 0x42,
+              0x42, 0x42, 0x66, 0x7c, 0x00, 0x00, 0x00, 0x00 },
+    /* c */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x1c, 0x22, 0x40,
+              0x40, 0x40, 0x22, 0x1c, 0x00, 0x00, 0x00, 0x00 },
+    /* d */ { 0x00, 0x02, 0x02, 0x02, 0x02, 0x3e, 0x66, 0x42,
+              0x42, 0x42, 0x66, 0x3e, 0x00, 0x00, 0x00, 0x00 },
+    /* e */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x66, 0x42,
+              0x7e, 0x40, 0x62, 0x3c, 0x00, 0x00, 0x00, 0x00 },
+    /* f */ { 0x00, 0x0c, 0x10, 0x10, 0x10, 0x7c, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x10, 0x00, 0x00, 0x00, 0x00 },
+    /* g */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x66, 0x42,
+              0x42, 0x42, 0x66, 0x3a, 0x02, 0x22, 0x1c, 0x00 },
+    /* h */ { 0x00, 0x40, 0x40, 0x40, 0x40, 0x5c, 0x62, 0x42,
+              0x42, 0x42, 0x42, 0x42, 0x00, 0x00, 0x00, 0x00 },
+    /* i */ { 0x00, 0x10, 0x00, 0x00, 0x00, 0x70, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x7c, 0x00, 0x00, 0x00, 0x00 },
+    /* j */ { 0x00, 0x08, 0x00, 0x00, 0x00, 0x38, 0x08, 0x08,
+              0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x70, 0x00 },
+    /* k */ { 0x00, 0x40, 0x40, 0x40, 0x40, 0x44, 0x48, 0x50,
+              0x70, 0x48, 0x44, 0x42, 0x00, 0x00, 0x00, 0x00 },
+    /* l */ { 0x00, 0x70, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x0e, 0x00, 0x00, 0x00, 0x00 },
+    /* m */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x7f, 0x49, 0x49,
+              0x49, 0x49, 0x49, 0x49, 0x00, 0x00, 0x00, 0x00 },
+    /* n */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x5c, 0x62, 0x42,
+              0x42, 0x42, 0x42, 0x42, 0x00, 0x00, 0x00, 0x00 },
+    /* o */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x66, 0x42,
+              0x42, 0x42, 0x66, 0x3c, 0x00, 0x00, 0x00, 0x00 },
+    /* p */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x7c, 0x66, 0x42,
+              0x42, 0x42, 0x66, 0x7c, 0x40, 0x40, 0x40, 0x00 },
+    /* q */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x66, 0x42,
+              0x42, 0x42, 0x66, 0x3a, 0x02, 0x02, 0x02, 0x00 },
+    /* r */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x32, 0x20,
+              0x20, 0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0x00 },
+    /* s */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x3c, 0x42, 0x40,
+              0x3c, 0x02, 0x42, 0x3c, 0x00, 0x00, 0x00, 0x00 },
+    /* t */ { 0x00, 0x00, 0x00, 0x10, 0x10, 0x7e, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x0e, 0x00, 0x00, 0x00, 0x00 },
+    /* u */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x42, 0x42,
+              0x42, 0x42, 0x46, 0x3a, 0x00, 0x00, 0x00, 0x00 },
+    /* v */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x66, 0x24,
+              0x24, 0x3c, 0x18, 0x18, 0x00, 0x00, 0x00, 0x00 },
+    /* w */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x81, 0x81, 0x5a,
+              0x5a, 0x5a, 0x24, 0x24, 0x00, 0x00, 0x00, 0x00 },
+    /* x */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x24, 0x18,
+              0x18, 0x18, 0x24, 0x66, 0x00, 0x00, 0x00, 0x00 },
+    /* y */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x42, 0x22, 0x24,
+              0x24, 0x14, 0x18, 0x08, 0x08, 0x10, 0x30, 0x00 },
+    /* z */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x7e, 0x02, 0x04,
+              0x18, 0x20, 0x40, 0x7e, 0x00, 0x00, 0x00, 0x00 },
+    /* { */ { 0x00, 0x1c, 0x10, 0x10, 0x10, 0x10, 0x60, 0x10,
+              0x10, 0x10, 0x10, 0x10, 0x0c, 0x00, 0x00, 0x00 },
+    /* | */ { 0x00, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+              0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x00, 0x00 },
+    /* } */ { 0x00, 0x70, 0x10, 0x10, 0x10, 0x10, 0x0c, 0x10,
+              0x10, 0x10, 0x10, 0x10, 0x60, 0x00, 0x00, 0x00 },
+    /* ~ */ { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x39,
+              0x46, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+};
+
+
+/***************************************
+ * Returns if a font pixel of a line of text is set
+ ***************************************/
+
+static int
+glyph_bit( const char * s,
+           int          len,
+           int          x,
+           int          y )
+{
+    int c;
+
+    if ( x < 0 || y < 0 || y >= CELL_H || x >= len * CELL_W )
+        return 0;
+
+    c = ( unsigned char ) s[ x / CELL_W ];
+
+    if ( c < ' ' )
+        c = ' ';
+    else if ( c > '~' )
+        c = '?';
+
+    return ( font8x16[ c - ' ' ][ y ] >> ( 7 - x % CELL_W ) ) & 1;
+}
+
+
+/***************************************
+ * Bold glyphs are made by also setting the pixel right of each one
+ ***************************************/
+
+static int
+font_bit( const char * s,
+          int          len,
+          int          x,
+          int          y,
+          int          bold )
+{
+    return    glyph_bit( s, len, x, y )
+           || ( bold && glyph_bit( s, len, x - 1, y ) );
+}
+
+
+/***************************************
+ * Coverage (0 to 255) at a position within a line of text, given in
+ * font pixels, by bilinear interpolation between the font pixels
+ ***************************************/
+
+static int
+coverage( const char * s,
+          int          len,
+          double       x,
+          double       y,
+          int          bold,
+          int          italic )
+{
+    double fx,
+           fy,
+           c;
+    int ix,
+        iy;
+
+    if ( italic )
+        x -= ( BASELINE - y ) * ITALIC;
+
+    x -= 0.5;
+    y -= 0.5;
+    ix = floor( x );
+    iy = floor( y );
+    fx = x - ix;
+    fy = y - iy;
+
+    c =   ( 1 - fy ) * (   ( 1 - fx ) * font_bit( s, len, ix, iy, bold )
+                         + fx * font_bit( s, len, ix + 1, iy, bold ) )
+        + fy * (   ( 1 - fx ) * font_bit( s, len, ix, iy + 1, bold )
+                 + fx * font_bit( s, len, ix + 1, iy + 1, bold ) );
+
+    return c * 255 + 0.5;
+}
+
+
+/***************************************
+ * Draws a (possibly multi-line and rotated) string. Alignment is with
+ * respect to (x,y) in the same way as for display with X.
+ ***************************************/
+
+static int
+raster_text( FL_IMAGE           * im,
+             const FLIMAGE_TEXT * t )
+{
+    int *lstart,
+        *llen,
+        *loff,
+        nlines = 1,
+        maxlen = 0,
+        bold = ( t->style % FL_SHADOW_STYLE ) & FL_BOLD_STYLE,
+        italic = ( t->style % FL_SHADOW_STYLE ) & FL_ITALIC_STYLE,
+        i,
+        j,
+        k;
+    double sc = ( t->size > 0 ? t->size : FL_NORMAL_SIZE ) / FONT_EM,
+           cosa = cos( t->angle * M_PI / 1800.0 ),
+           sina = sin( t->angle * M_PI / 1800.0 ),
+           bw,
+           bh,
+           bx,
+           by,
+           xmin = im->w,
+           xmax = 0,
+           ymin = im->h,
+           ymax = 0;
+    Pen fg,
+        bg;
+
+    for ( i = 0; i < t->len; i++ )
+        nlines += t->str[ i ] == '\n';
+
+    if ( ! ( lstart = fl_malloc( 3 * nlines * sizeof *lstart ) ) )
+    {
+        flimage_error( im, "RasterizeAnnotation: malloc failed" );
+        return -1;
+    }
+
+    llen = lstart + nlines;
+    loff = llen + nlines;
+
+    for ( lstart[ 0 ] = 0, k = 0, i = 0; i <= t->len; i++ )
+        if ( i == t->len || t->str[ i ] == '\n' )
+        {
+            llen[ k ] = i - lstart[ k ];
+            maxlen = FL_max( maxlen, llen[ k ] );
+            if ( ++k < nlines )
+                lstart[ k ] = i + 1;
+        }
+
+    /* Lines are aligned within the text block, the block wrt. (x,y).
+       Everything in font pixels, with the y-axis pointing down. */
+
+    for ( k = 0; k < nlines; k++ )
+    {
+        if ( t->align & FL_ALIGN_LEFT )
+            loff[ k ] = 0;
+        else if ( t->align & FL_ALIGN_RIGHT )
+            loff[ k ] = ( maxlen - llen[ k ] ) * CELL_W;
+        else
+            loff[ k ] = ( maxlen - llen[ k ] ) * CELL_W / 2;
+    }
+
+    bw = maxlen * CELL_W;
+    bh = nlines * CELL_H;
+
+    if ( t->align & FL_ALIGN_LEFT )
+        bx = 0;
+    else if ( t->align & FL_ALIGN_RIGHT )
+        bx = -bw;
+    else
+        bx = -bw / 2;
+
+    if ( t->align & FL_ALIGN_TOP )
+        by = 0;
+    else if ( t->align & FL_ALIGN_BOTTOM )
+        by = -bh;
+    else
+        by = -bh / 2;
+
+    /* Bounding box of the rotated block, with some room for slanted
+       and bold glyphs */
+
+    for ( k = 0; k < 4; k++ )
+    {
+        double u = sc * ( bx + ( k & 1 ? bw + 4 : -1 ) ),
+               v = sc * ( by + ( k & 2 ? bh + 1 : -1 ) ),
+               x = t->x + u * cosa + v * sina,
+               y = t->y - u * sina + v * cosa;
+
+        xmin = FL_min( xmin, x );
+        xmax = FL_max( xmax, x );
+        ymin = FL_min( ymin, y );
+        ymax = FL_max( ymax, y );
+    }
+
+    set_pen( &fg, t->color );
+    set_pen( &bg, t->bcolor );
+
+    for ( j = FL_max( 0, floor( ymin ) ); j <= FL_min( im->h - 1, ymax ); j++ )
+        for ( i = FL_max( 0, floor( xmin ) );
+              i <= FL_min( im->w - 1, xmax ); i++ )
+        {
+            double dx = i + 0.5 - t->x,
+                   dy = j + 0.5 - t->y,
+                   u = ( dx * cosa - dy * sina ) / sc - bx,
+                   v = ( dx * sina + dy * cosa ) / sc - by;
+
+            if ( v < -1 || v >= bh + 1 )
+                continue;
+
+            if ( ! t->nobk && u >= 0 && u < bw && v >= 0 && v < bh )
+                blend( im, i, j, &bg, 255 );
+
+            k = FL_clamp( ( int ) floor( v / CELL_H ), 0, nlines - 1 );
+
+            blend( im, i, j, &fg,
+                   coverage( t->str + lstart[ k ], llen[ k ], u - loff[ k ],
+                             v - k * CELL_H, bold, italic ) );
+        }
+
+    fl_free( lstart );
+    return 0;
+}
+
+
+/***************************************
+ * Renders the markers and text of an image into its pixels without
+ * needing an X display. The image gets converted to RGB and the
+ * annotations are removed afterwards, just like with
+ * flimage_render_annotation().
+ ***************************************/
+
+int
+flimage_rasterize_annotation( FL_IMAGE * im )
+{
+    int i,
+        status = 0;
+
+    if ( ! im || im->type == FLIMAGE_NONE )
+        return -1;
+
+    if ( ! im->ntext && ! im->nmarkers )
+        return 0;
+
+    if ( flimage_convert( im, FL_IMAGE_RGB, 0 ) < 0 )
+        return -1;
+
+    flimage_invalidate_pixels( im );
+
+    if ( flimage_unshare( im ) < 0 )
+        return -1;
+
+    if ( ! im->dont_display_marker )
+        for ( i = 0; i < im->nmarkers && status == 0; i++ )
+            status = raster_marker( im, im->marker + i );
+
+    if ( ! im->dont_display_text )
+        for ( i = 0; i < im->ntext && status == 0; i++ )
+            status = raster_text( im, im->text + i );
+
+    im->modified = 1;
+    im->free_text( im );
+    im->free_markers( im );
+
+    return status;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
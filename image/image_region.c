@@ -0,0 +1,479 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  Region-on-demand reading of images too large to be held in memory.
+ *  Only the rows (and of those only the columns) that are needed for
+ *  a region are decoded, one block at a time. Decoded blocks are kept
+ *  in a LRU cache so that panning over an image doesn't hit the file
+ *  again for the parts that were already seen.
+ *
+ *  A format supporting this mode registers an open_region handler that
+ *  sets FLIMAGE_REGION's read_row, which gets called as
+ *
+ *     read_row( im, row, col, n, step, out )
+ *
+ *  and must store the n pixels at col, col + step, col + 2 * step...
+ *  of the full resolution row into out[0] (unsigned short, for gray and
+ *  colormapped images) or out[0], out[1], out[2] (unsigned char red,
+ *  green and blue).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flimage.h"
+#include "flimage_int.h"
+#include <string.h>
+
+#define DEFAULT_CACHE   ( 64UL * 1024 * 1024 )
+#define MAX_LEVEL       20
+
+#define BLOCK_HASH( l, x, y )  \
+    ( ( ( unsigned int ) ( x ) * 31 + ( y ) * 17 + ( l ) * 7 ) \
+      & ( FLIMAGE_REGION_HASH - 1 ) )
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_block( FLIMAGE_BLOCK * b )
+{
+    fli_safe_free( b->gray );
+    fli_safe_free( b->rgb[ 0 ] );
+    fli_safe_free( b->rgb[ 1 ] );
+    fli_safe_free( b->rgb[ 2 ] );
+    fl_free( b );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+unlink_block( FLIMAGE_REGION * rg,
+              FLIMAGE_BLOCK  * b )
+{
+    if ( b->prev )
+        b->prev->next = b->next;
+    else
+        rg->newest = b->next;
+
+    if ( b->next )
+        b->next->prev = b->prev;
+    else
+        rg->oldest = b->prev;
+
+    b->prev = b->next = NULL;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+push_block( FLIMAGE_REGION * rg,
+            FLIMAGE_BLOCK  * b )
+{
+    b->prev = NULL;
+    b->next = rg->newest;
+
+    if ( rg->newest )
+        rg->newest->prev = b;
+    else
+        rg->oldest = b;
+
+    rg->newest = b;
+}
+
+
+/***************************************
+ * Throw away the least recently used blocks until there's room for
+ * another need bytes
+ ***************************************/
+
+static void
+evict_blocks( FLIMAGE_REGION * rg,
+              unsigned long    need )
+{
+    FLIMAGE_BLOCK *b,
+                  **p;
+
+    while ( rg->oldest && rg->used + need > rg->limit )
+    {
+        b = rg->oldest;
+        unlink_block( rg, b );
+
+        for ( p = rg->hash + BLOCK_HASH( b->level, b->bx, b->by );
+              *p != b; p = &( *p )->hnext )
+            /* empty */ ;
+        *p = b->hnext;
+
+        rg->used -= b->size;
+        free_block( b );
+    }
+}
+
+
+/***************************************
+ * Decode the block (bx, by) of the given level
+ ***************************************/
+
+static FLIMAGE_BLOCK *
+decode_block( FL_IMAGE * im,
+              int        level,
+              int        bx,
+              int        by )
+{
+    FLIMAGE_REGION *rg = im->region;
+    FLIMAGE_BLOCK *b;
+    int step = 1 << level,
+        lw = ( rg->w + step - 1 ) >> level,
+        lh = ( rg->h + step - 1 ) >> level,
+        u0 = bx * FLIMAGE_REGION_BLOCK,
+        v0 = by * FLIMAGE_REGION_BLOCK,
+        is_rgb = rg->type == FL_IMAGE_RGB,
+        err = 0,
+        i;
+    void *out[ 3 ];
+
+    if ( ! ( b = fl_calloc( 1, sizeof *b ) ) )
+        return NULL;
+
+    b->level = level;
+    b->bx = bx;
+    b->by = by;
+    b->w = FL_min( FLIMAGE_REGION_BLOCK, lw - u0 );
+    b->h = FL_min( FLIMAGE_REGION_BLOCK, lh - v0 );
+    b->size = sizeof *b + ( unsigned long ) b->w * b->h * ( is_rgb ? 3 : 2 );
+
+    evict_blocks( rg, b->size );
+
+    if ( is_rgb )
+        err =    ! ( b->rgb[ 0 ] = fl_malloc( b->w * b->h ) )
+              || ! ( b->rgb[ 1 ] = fl_malloc( b->w * b->h ) )
+              || ! ( b->rgb[ 2 ] = fl_malloc( b->w * b->h ) );
+    else
+        err = ! ( b->gray = fl_malloc( b->w * b->h * sizeof *b->gray ) );
+
+    for ( i = 0; ! err && i < b->h; i++ )
+    {
+        if ( is_rgb )
+        {
+            out[ 0 ] = b->rgb[ 0 ] + i * b->w;
+            out[ 1 ] = b->rgb[ 1 ] + i * b->w;
+            out[ 2 ] = b->rgb[ 2 ] + i * b->w;
+        }
+        else
+            out[ 0 ] = b->gray + i * b->w;
+
+        err = rg->read_row( im, ( v0 + i ) << level, u0 << level,
+                            b->w, step, out ) < 0;
+    }
+
+    if ( err )
+    {
+        flimage_error( im, "%s: error decoding region", im->infile );
+        free_block( b );
+        return NULL;
+    }
+
+    b->hnext = rg->hash[ BLOCK_HASH( level, bx, by ) ];
+    rg->hash[ BLOCK_HASH( level, bx, by ) ] = b;
+    push_block( rg, b );
+    rg->used += b->size;
+
+    return b;
+}
+
+
+/***************************************
+ ***************************************/
+
+static FLIMAGE_BLOCK *
+get_block( FL_IMAGE * im,
+           int        level,
+           int        bx,
+           int        by )
+{
+    FLIMAGE_REGION *rg = im->region;
+    FLIMAGE_BLOCK *b = rg->hash[ BLOCK_HASH( level, bx, by ) ];
+
+    for ( ; b; b = b->hnext )
+    {
+        if ( b->level == level && b->bx == bx && b->by == by )
+        {
+            unlink_block( rg, b );
+            push_block( rg, b );
+            return b;
+        }
+    }
+
+    return decode_block( im, level, bx, by );
+}
+
+
+/***************************************
+ * Read the header of an image obtained from flimage_open() and hand
+ * it over to the format's region reader
+ ***************************************/
+
+static int
+open_region( FL_IMAGE * im )
+{
+    FLIMAGE_IO *io = im->image_io;
+    FLIMAGE_REGION *rg;
+
+    if ( ! im->fpin || ! io || ! io->read_description )
+    {
+        flimage_error( im, "ReadRegion: image not opened with flimage_open" );
+        return -1;
+    }
+
+    im->type = io->type;
+    im->fmt_name = io->short_name;
+    im->foffset = ftell( im->fpin );
+
+    if ( io->read_description( im ) < 0 )
+        return -1;
+
+    /* image_io can change for compressed files */
+
+    io = im->image_io;
+
+    if ( ! io->open_region )
+    {
+        flimage_error( im, "%s: can't read %s images by region",
+                       im->infile, io->short_name );
+        return -1;
+    }
+
+    if ( ! ( rg = fl_calloc( 1, sizeof *rg ) ) )
+    {
+        flimage_error( im, "ReadRegion: malloc() failed" );
+        return -1;
+    }
+
+    rg->w = im->w;
+    rg->h = im->h;
+    rg->level = -1;
+    rg->limit = im->setup->region_cache ?
+                im->setup->region_cache : DEFAULT_CACHE;
+    im->region = rg;
+
+    if ( io->open_region( im ) < 0 )
+    {
+        flimage_free_region( im );
+        return -1;
+    }
+
+    rg->type = im->type;
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+flimage_free_region( FL_IMAGE * im )
+{
+    FLIMAGE_REGION *rg = im->region;
+    FLIMAGE_BLOCK *b;
+
+    if ( ! rg )
+        return;
+
+    while ( ( b = rg->newest ) )
+    {
+        unlink_block( rg, b );
+        free_block( b );
+    }
+
+    if ( rg->cleanup )
+        rg->cleanup( im );
+
+    fl_free( rg );
+    im->region = NULL;
+}
+
+
+/***************************************
+ * Size of the whole image behind a region-on-demand image
+ ***************************************/
+
+int
+flimage_get_full_size( FL_IMAGE * im,
+                       int      * w,
+                       int      * h )
+{
+    FLIMAGE_REGION *rg;
+
+    if ( ! im || ( ! im->region && open_region( im ) < 0 ) )
+        return -1;
+
+    rg = im->region;
+    *w = rg->w;
+    *h = rg->h;
+
+    return 0;
+}
+
+
+/***************************************
+ * Replace the pixels of im with the part (x, y, w, h) of the image
+ * file at the given level, i.e., subsampled by 2^level. A width or
+ * height of 0 means up to the image border.
+ ***************************************/
+
+int
+flimage_read_region( FL_IMAGE * im,
+                     int        x,
+                     int        y,
+                     int        w,
+                     int        h,
+                     int        level )
+{
+    FLIMAGE_REGION *rg;
+    FLIMAGE_BLOCK *b;
+    int u0,
+        v0,
+        u1,
+        v1,
+        bx,
+        by,
+        us,
+        ue,
+        v,
+        n,
+        same;
+
+    if ( ! im || ( ! im->region && open_region( im ) < 0 ) )
+        return -1;
+
+    rg = im->region;
+    level = FL_clamp( level, 0, MAX_LEVEL );
+    x = FL_clamp( x, 0, rg->w - 1 );
+    y = FL_clamp( y, 0, rg->h - 1 );
+
+    if ( w <= 0 || x + w > rg->w )
+        w = rg->w - x;
+    if ( h <= 0 || y + h > rg->h )
+        h = rg->h - y;
+
+    same =    x == rg->x && y == rg->y && w == rg->rw && h == rg->rh
+           && level == rg->level;
+
+    /* still have it, unless the pixels were changed in the meantime */
+
+    if ( same && rg->current && im->type == rg->type )
+        return 0;
+
+    /* level coordinates of the region */
+
+    u0 = x >> level;
+    v0 = y >> level;
+    u1 = ( x + w - 1 ) >> level;
+    v1 = ( y + h - 1 ) >> level;
+
+    im->type = rg->type;
+    im->w = u1 - u0 + 1;
+    im->h = v1 - v0 + 1;
+    flimage_invalidate_pixels( im );
+
+    if ( flimage_getmem( im ) < 0 )
+    {
+        flimage_error( im, "ReadRegion: can't allocate %dx%d image",
+                       im->w, im->h );
+        return -1;
+    }
+
+    im->completed = 0;
+    im->total = v1 / FLIMAGE_REGION_BLOCK - v0 / FLIMAGE_REGION_BLOCK + 1;
+
+    for ( by = v0 / FLIMAGE_REGION_BLOCK;
+          by <= v1 / FLIMAGE_REGION_BLOCK; by++, im->completed++ )
+    {
+        im->visual_cue( im, "Reading region" );
+
+        for ( bx = u0 / FLIMAGE_REGION_BLOCK;
+              bx <= u1 / FLIMAGE_REGION_BLOCK; bx++ )
+        {
+            if ( ! ( b = get_block( im, level, bx, by ) ) )
+            {
+                rg->level = -1;
+                return -1;
+            }
+
+            us = FL_max( u0, bx * FLIMAGE_REGION_BLOCK );
+            ue = FL_min( u1, bx * FLIMAGE_REGION_BLOCK + b->w - 1 );
+            n = ue - us + 1;
+
+            for ( v = FL_max( v0, by * FLIMAGE_REGION_BLOCK );
+                  v <= v1 && v < by * FLIMAGE_REGION_BLOCK + b->h; v++ )
+            {
+                int off =   ( v - by * FLIMAGE_REGION_BLOCK ) * b->w
+                          + us - bx * FLIMAGE_REGION_BLOCK,
+                    r = v - v0,
+                    c = us - u0;
+
+                if ( rg->type == FL_IMAGE_RGB )
+                {
+                    memcpy( im->red[   r ] + c, b->rgb[ 0 ] + off, n );
+                    memcpy( im->green[ r ] + c, b->rgb[ 1 ] + off, n );
+                    memcpy( im->blue[  r ] + c, b->rgb[ 2 ] + off, n );
+                }
+                else if ( FL_IsCI( rg->type ) )
+                    memcpy( im->ci[ r ] + c, b->gray + off,
+                            n * sizeof *b->gray );
+                else
+                    memcpy( im->gray[ r ] + c, b->gray + off,
+                            n * sizeof *b->gray );
+            }
+        }
+    }
+
+    im->visual_cue( im, "Done Reading region" );
+
+    rg->x = x;
+    rg->y = y;
+    rg->rw = w;
+    rg->rh = h;
+    rg->level = level;
+    rg->current = 1;
+
+    im->original_type = im->type;
+    im->available_type = im->type;
+    im->modified = 1;
+
+    return 0;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
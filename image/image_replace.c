@@ -58,6 +58,9 @@ flimage_replace_pixel( FL_IMAGE     * im,
 
     flimage_invalidate_pixels( im );
 
+    if ( flimage_unshare( im ) < 0 )
+        return -1;
+
     if ( im->type == FL_IMAGE_RGB )
     {
         unsigned char *red   = im->red[   0 ];
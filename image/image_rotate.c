@@ -44,6 +44,8 @@ static void *rotate_matrix( void *,
                             int,
                             int,
                             size_t );
+static int rotate_in_place( FL_IMAGE *,
+                            int );
 
 
 /***************************************
@@ -77,6 +79,12 @@ flimage_rotate( FL_IMAGE * im,
     if ( deg % 900 == 0 )
     {
         deg /= 10;
+
+        /* if the size doesn't change we don't need a second copy */
+
+        if ( deg == 180 || im->w == im->h )
+            return rotate_in_place( im, deg );
+
         if ( im->type == FL_IMAGE_RGB )
         {
             r = rotate_matrix( im->red,   im->h, im->w, deg,
@@ -86,7 +94,7 @@ flimage_rotate( FL_IMAGE * im,
             b = rotate_matrix( im->blue,  im->h, im->w, deg,
                                sizeof **im->blue );
         }
-        else if ( im->type == FL_IMAGE_GRAY )
+        else if ( FL_IsGray( im->type ) )
             r = rotate_matrix( im->gray, im->h, im->w, deg, sizeof **im->gray );
         else if ( im->type == FL_IMAGE_CI )
             r = rotate_matrix( im->ci, im->h, im->w, deg, sizeof **im->ci );
@@ -116,8 +124,9 @@ flimage_rotate( FL_IMAGE * im,
         return 0;
     }
 
-    /* three shear is slightly faster , but with general transform,
-     * we save a lot of code */
+    /* three shears would be slightly faster, but using the general
+       transform saves a lot of code. For all but huge images the warp
+       works in fixed point and tile by tile, see image_warp.c */
 
     mat[ 0 ][ 0 ] = mat[ 1 ][ 1 ] = cos( deg * M_PI / 1800.0 );
     mat[ 0 ][ 1 ] = sin( deg * M_PI / 1800.0 );
@@ -152,6 +161,9 @@ flimage_flip( FL_IMAGE * im,
 {
     int err = 0;
 
+    if ( flimage_unshare( im ) < 0 )
+        return -1;
+
     if ( im->type == FL_IMAGE_RGB )
         err =    flip_matrix( im->red,   im->h, im->w, 1, axis ) < 0
               || flip_matrix( im->green, im->h, im->w, 1, axis ) < 0
@@ -236,54 +248,76 @@ flip_matrix( void * matrix,
 
 /* special angles: +-90, +-180 */
 /***************************************************************
- * rotate a matrix by 90, or -90 or multiples of it
- * Rotate 180 can be implented as two 90 rotations, but current
- * code is faster.
+ * rotate a matrix by 90 or -90 into a new matrix. Rotation by 180
+ * (and by 90 or -90 of square matrices) is done in place, see
+ * rotate_in_place() below.
  *
  * NOTE: input dimension is the diemsnion of the matrix to be
  *       rotated. caller must take care of the rotated dimensions
  **************************************************************/
 
+/* The rotations by 90 degrees read the input column by column. Done
+   naively each pixel read is from a different row, and for large
+   images the rows fall out of the cache long before the next column
+   gets read. So we work on tiles of ROT_TILE x ROT_TILE pixels, for
+   which the rows touched all stay in the cache */
+
+#define ROT_TILE  64
+
 /*  Rotate 90 degrees */
 
-#define DO_M90( type, out, in )                      \
-    do {                                             \
-        type  *p= ( ( type ** ) out )[ 0 ],          \
-             **o= in;                                \
-        int i,                                       \
-            j;                                       \
-        for ( j = 0; j < col; j++ )                  \
-        {                                            \
-            for ( i = row - 1; i >= 0; i-- )         \
-                *p++ = o[ i ][ j ];                  \
-        }                                            \
+#define DO_90( type, out, in )                                      \
+    do {                                                            \
+        type **o = out,                                             \
+             **s = in,                                              \
+             *p;                                                    \
+        int i0,                                                     \
+            j0,                                                     \
+            i,                                                      \
+            j,                                                      \
+            iend,                                                   \
+            jend;                                                   \
+        for ( i0 = 0; i0 < row; i0 += ROT_TILE )                    \
+        {                                                           \
+            iend = FL_min( i0 + ROT_TILE, row );                    \
+            for ( j0 = 0; j0 < col; j0 += ROT_TILE )                \
+            {                                                       \
+                jend = FL_min( j0 + ROT_TILE, col );                \
+                for ( j = j0; j < jend; j++ )                       \
+                    for ( p = o[ col - 1 - j ] + i0, i = i0;        \
+                          i < iend; i++ )                           \
+                        *p++ = s[ i ][ j ];                         \
+            }                                                       \
+        }                                                           \
     } while ( 0 )
 
 /*  Rotate -90 degrees */
 
-#define DO_90( type, out, in )                       \
-    do {                                             \
-        type  *p= ( ( type ** ) out )[ 0 ],          \
-             **o= in;                                \
-        int i,                                       \
-            j;                                       \
-        for ( j = col - 1; j >= 0; j-- )             \
-        {                                            \
-            for ( i = 0; i < row; i++ )              \
-                *p++ = o[ i ][ j ];                  \
-        }                                            \
+#define DO_M90( type, out, in )                                     \
+    do {                                                            \
+        type **o = out,                                             \
+             **s = in,                                              \
+             *p;                                                    \
+        int i0,                                                     \
+            j0,                                                     \
+            i,                                                      \
+            j,                                                      \
+            iend,                                                   \
+            jend;                                                   \
+        for ( i0 = 0; i0 < row; i0 += ROT_TILE )                    \
+        {                                                           \
+            iend = FL_min( i0 + ROT_TILE, row );                    \
+            for ( j0 = 0; j0 < col; j0 += ROT_TILE )                \
+            {                                                       \
+                jend = FL_min( j0 + ROT_TILE, col );                \
+                for ( j = j0; j < jend; j++ )                       \
+                    for ( p = o[ j ] + row - 1 - i0, i = i0;        \
+                          i < iend; i++ )                           \
+                        *p-- = s[ i ][ j ];                         \
+            }                                                       \
+        }                                                           \
     } while ( 0 )
 
-#define DO_180( ty, out, in )                               \
-    do {                                                    \
-        ty *p= ( ( ty ** ) out )[ 0 ],                      \
-           *o= ( ( ty ** ) in  )[ 0 ];                      \
-        ty *os;                                             \
-        for ( os= o + col * row-1 ; os > o; *p++ = *os-- )  \
-            /* empty */ ;                                   \
-    } while( 0 )
-
-
 
 /***************************************
  ***************************************/
@@ -336,13 +370,6 @@ rotate_matrix( void * m,
         else
             DO_M90( unsigned char, mm, m );
     }
-    else if ( deg == 180 || deg == -180 )
-    {
-        if ( e == 2 )
-            DO_180( unsigned short, mm, m );
-        else
-            DO_180( unsigned char, mm, m );
-    }
     else
     {
         M_err( "RotateMatrix", "InternalError: bad special angle\n" );
@@ -353,6 +380,110 @@ rotate_matrix( void * m,
 }
 
 
+/* Transpose a square matrix in place, again tile by tile. A tile
+   above the diagonal gets swapped with its mirror tile below it */
+
+#define DO_TRANSPOSE( type, matrix )                                \
+    do {                                                            \
+        type **mm = matrix,                                          \
+              tmp;                                                  \
+        int i0,                                                     \
+            j0,                                                     \
+            i,                                                      \
+            j,                                                      \
+            iend,                                                   \
+            jend;                                                   \
+        for ( i0 = 0; i0 < n; i0 += ROT_TILE )                      \
+        {                                                           \
+            iend = FL_min( i0 + ROT_TILE, n );                      \
+            for ( j0 = i0; j0 < n; j0 += ROT_TILE )                 \
+            {                                                       \
+                jend = FL_min( j0 + ROT_TILE, n );                  \
+                for ( i = i0; i < iend; i++ )                       \
+                    for ( j = j0 == i0 ? i + 1 : j0; j < jend; j++ ) \
+                    {                                               \
+                        tmp = mm[ i ][ j ];                          \
+                        mm[ i ][ j ] = mm[ j ][ i ];                  \
+                        mm[ j ][ i ] = tmp;                          \
+                    }                                               \
+            }                                                       \
+        }                                                           \
+    } while ( 0 )
+
+
+/***************************************
+ * Rotate a matrix without making a copy. Rotations by 90 or -90
+ * degrees (which only work for square matrices) are done as a
+ * transpose followed by a flip, rotation by 180 degrees is a flip
+ * about both axes
+ ***************************************/
+
+static int
+rotate_matrix_in_place( void * m,
+                        int    row,
+                        int    col,
+                        int    deg,
+                        int    esize )
+{
+    int n = row;
+
+    if ( deg == 180 )
+        return    flip_matrix( m, row, col, esize, 'c' ) < 0
+               || flip_matrix( m, row, col, esize, 'r' ) < 0 ? -1 : 0;
+
+    if ( esize == 2 )
+        DO_TRANSPOSE( unsigned short, m );
+    else
+        DO_TRANSPOSE( unsigned char, m );
+
+    return flip_matrix( m, row, col, esize, deg == 90 ? 'r' : 'c' );
+}
+
+
+/***************************************
+ * Rotate all the planes of an image in place. deg is 90, 180 or 270
+ ***************************************/
+
+static int
+rotate_in_place( FL_IMAGE * im,
+                 int        deg )
+{
+    int err;
+
+    if ( flimage_unshare( im ) < 0 )
+        return -1;
+
+    if ( im->type == FL_IMAGE_RGB )
+        err =    rotate_matrix_in_place( im->red,   im->h, im->w, deg, 1 ) < 0
+              || rotate_matrix_in_place( im->green, im->h, im->w, deg, 1 ) < 0
+              || rotate_matrix_in_place( im->blue,  im->h, im->w, deg, 1 ) < 0
+              || (    im->alpha
+                   && rotate_matrix_in_place( im->alpha, im->h, im->w,
+                                              deg, 1 ) < 0 );
+    else if ( FL_IsGray( im->type ) )
+        err = rotate_matrix_in_place( im->gray, im->h, im->w, deg, 2 ) < 0;
+    else if ( FL_IsCI( im->type ) )
+        err = rotate_matrix_in_place( im->ci, im->h, im->w, deg, 2 ) < 0;
+    else
+    {
+        M_err( "flimage_rotate", "InternalError: unsupported image "
+               "type\n" );
+        return -1;
+    }
+
+    if ( err )
+        return -1;
+
+    /* same as what flimage_replace_image() does for a new matrix */
+
+    flimage_invalidate_pixels( im );
+    im->sx = im->sy = im->sw = im->sh = 0;
+    im->modified = 1;
+
+    return 0;
+}
+
+
 /*
  * Local variables:
  * tab-width: 4
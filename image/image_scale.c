@@ -21,7 +21,8 @@
  *   Copyright (c) 1993, 1998-2002  T.C. Zhao
  *   All rights reserved.
  *
- *  Scale an image with or without subpixel sampling.
+ *  Scale an image with or without subpixel sampling or with one of
+ *  several resampling filters.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -31,6 +32,12 @@
 #include "include/forms.h"
 #include "flimage.h"
 #include "flimage_int.h"
+#include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI   3.1415926
+#endif
 
 
 /***************************************
@@ -198,6 +205,565 @@ image_scale( void     * om[ ],
 }
 
 
+/*
+ * Filter based resampling. For every (source size, destination size)
+ * pair a table is built once that holds, for each destination sample,
+ * the first source sample it depends on and the fixed point weights of
+ * all the source samples involved. The image is then resampled in two
+ * separable passes (horizontal into an intermediate buffer, then
+ * vertical) using integer arithmetic only.
+ */
+
+#define FILTER_BITS    12                     /* weight precision     */
+#define FILTER_ONE     ( 1 << FILTER_BITS )
+#define FILTER_MASK    ( FLIMAGE_AREA | FLIMAGE_BILINEAR \
+                         | FLIMAGE_BICUBIC | FLIMAGE_LANCZOS )
+
+typedef struct {
+    int    filter;          /* FLIMAGE_AREA etc.                    */
+    int    src,             /* number of source samples             */
+           dst;             /* number of destination samples        */
+    int    taps;            /* max. number of weights per sample    */
+    int  * start;           /* first source sample for each output  */
+    int  * ntaps;           /* number of weights actually used      */
+    int  * weight;          /* dst * taps weights                   */
+    int    refs;            /* cache and users still holding it     */
+} FilterTable;
+
+/* Tables are usually requested for the same sizes over and over again
+   (e.g. when making thumbnails of lots of images of identical size), so
+   keep the most recently used ones around. Tables are shared between
+   threads, one dropping out of the cache gets freed only once the last
+   user is done with it */
+
+#define NFILTER_CACHE  4
+
+static FilterTable *filter_cache[ NFILTER_CACHE ];
+static FLI_MUTEX filter_lock = FLI_MUTEX_INIT;
+
+
+/***************************************
+ ***************************************/
+
+static double
+sinc( double x )
+{
+    if ( x == 0.0 )
+        return 1.0;
+
+    x *= M_PI;
+    return sin( x ) / x;
+}
+
+
+/***************************************
+ * Returns the support radius of a filter in units of source samples
+ * (when magnifying)
+ ***************************************/
+
+static double
+filter_support( int filter )
+{
+    switch ( filter )
+    {
+        case FLIMAGE_BILINEAR :
+            return 1.0;
+
+        case FLIMAGE_BICUBIC :
+            return 2.0;
+
+        case FLIMAGE_LANCZOS :
+            return 3.0;
+
+        default :
+            return 0.5;
+    }
+}
+
+
+/***************************************
+ * Evaluates the filter kernel at distance x
+ ***************************************/
+
+static double
+filter_kernel( int    filter,
+               double x )
+{
+    if ( x < 0.0 )
+        x = -x;
+
+    switch ( filter )
+    {
+        case FLIMAGE_BILINEAR :
+            return x < 1.0 ? 1.0 - x : 0.0;
+
+        case FLIMAGE_BICUBIC :          /* Keys' cubic with a = -0.5 */
+            if ( x < 1.0 )
+                return ( 1.5 * x - 2.5 ) * x * x + 1.0;
+            if ( x < 2.0 )
+                return ( ( -0.5 * x + 2.5 ) * x - 4.0 ) * x + 2.0;
+            return 0.0;
+
+        case FLIMAGE_LANCZOS :
+            return x < 3.0 ? sinc( x ) * sinc( x / 3.0 ) : 0.0;
+
+        default :
+            return x < 0.5 ? 1.0 : 0.0;
+    }
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_filter_table( FilterTable * ft )
+{
+    if ( ! ft )
+        return;
+
+    fl_free( ft->start );
+    fl_free( ft->ntaps );
+    fl_free( ft->weight );
+    fl_free( ft );
+}
+
+
+/***************************************
+ * Weights for area averaging: each destination sample covers the
+ * interval [i * src / dst, (i + 1) * src / dst) of the source, and each
+ * source sample gets a weight proportional to its overlap with it.
+ ***************************************/
+
+static void
+area_weights( FilterTable * ft,
+              int           i,
+              double      * w )
+{
+    double scale = ( double ) ft->src / ft->dst;
+    double x1 = i * scale,
+           x2 = x1 + scale;
+    int k;
+
+    ft->start[ i ] = x1;
+    ft->ntaps[ i ] = 0;
+
+    for ( k = ft->start[ i ]; k < x2 && k < ft->src; k++ )
+    {
+        double a = FL_max( x1, k ),
+               b = FL_min( x2, k + 1 );
+
+        w[ ft->ntaps[ i ]++ ] = b - a;
+    }
+}
+
+
+/***************************************
+ * Weights for the convolution filters. When minifying, the kernel is
+ * stretched to the output sample spacing to avoid aliasing.
+ ***************************************/
+
+static void
+kernel_weights( FilterTable * ft,
+                int           i,
+                double      * w )
+{
+    double scale = ( double ) ft->src / ft->dst;
+    double fscale = FL_max( scale, 1.0 );
+    double support = filter_support( ft->filter ) * fscale;
+    double center = ( i + 0.5 ) * scale - 0.5;
+    int first = floor( center - support + 1.0 ),
+        last  = floor( center + support );
+    int k;
+
+    first = FL_max( first, 0 );
+    last  = FL_min( last, ft->src - 1 );
+
+    ft->start[ i ] = first;
+    ft->ntaps[ i ] = 0;
+
+    for ( k = first; k <= last && ft->ntaps[ i ] < ft->taps; k++ )
+        w[ ft->ntaps[ i ]++ ] = filter_kernel( ft->filter,
+                                               ( k - center ) / fscale );
+}
+
+
+/***************************************
+ * Builds the weight table for resampling 'src' samples into 'dst'
+ * samples. The weights for each output sample are normalized to sum
+ * up to exactly FILTER_ONE.
+ ***************************************/
+
+static FilterTable *
+make_filter_table( int filter,
+                   int src,
+                   int dst )
+{
+    FilterTable *ft = fl_calloc( 1, sizeof *ft );
+    double scale = ( double ) src / dst;
+    double *w;
+    int i,
+        k;
+
+    if ( ! ft )
+        return NULL;
+
+    ft->filter = filter;
+    ft->src    = src;
+    ft->dst    = dst;
+
+    if ( filter == FLIMAGE_AREA )
+        ft->taps = ceil( scale ) + 1;
+    else
+        ft->taps = 2 * ceil( filter_support( filter )
+                             * FL_max( scale, 1.0 ) ) + 1;
+
+    ft->start  = fl_malloc( dst * sizeof *ft->start );
+    ft->ntaps  = fl_malloc( dst * sizeof *ft->ntaps );
+    ft->weight = fl_malloc( dst * ft->taps * sizeof *ft->weight );
+    w          = fl_malloc( ft->taps * sizeof *w );
+
+    if ( ! ft->start || ! ft->ntaps || ! ft->weight || ! w )
+    {
+        fli_safe_free( w );
+        free_filter_table( ft );
+        return NULL;
+    }
+
+    for ( i = 0; i < dst; i++ )
+    {
+        int *iw = ft->weight + i * ft->taps;
+        double sum = 0.0;
+        int isum = 0,
+            imax = 0;
+
+        if ( filter == FLIMAGE_AREA )
+            area_weights( ft, i, w );
+        else
+            kernel_weights( ft, i, w );
+
+        for ( k = 0; k < ft->ntaps[ i ]; k++ )
+            sum += w[ k ];
+
+        if ( sum == 0.0 )
+        {
+            ft->ntaps[ i ] = 1;
+            w[ 0 ] = sum = 1.0;
+        }
+
+        for ( k = 0; k < ft->ntaps[ i ]; k++ )
+        {
+            iw[ k ] = floor( w[ k ] * FILTER_ONE / sum + 0.5 );
+            isum += iw[ k ];
+            if ( iw[ k ] > iw[ imax ] )
+                imax = k;
+        }
+
+        /* Put the rounding error on the largest weight */
+
+        iw[ imax ] += FILTER_ONE - isum;
+    }
+
+    fl_free( w );
+
+    return ft;
+}
+
+
+/***************************************
+ * Drop a reference to a table, must be called with the lock held
+ ***************************************/
+
+static void
+unref_filter_table( FilterTable * ft )
+{
+    if ( ft && --ft->refs == 0 )
+        free_filter_table( ft );
+}
+
+
+/***************************************
+ * Returns a weight table from the cache, making a new one if necessary.
+ * The caller has to hand it back with release_filter_table()
+ ***************************************/
+
+static FilterTable *
+get_filter_table( int filter,
+                  int src,
+                  int dst )
+{
+    FilterTable *ft = NULL,
+                *nft = NULL;
+    int i;
+
+    while ( 1 )
+    {
+        fli_lock( &filter_lock );
+
+        for ( i = 0; i < NFILTER_CACHE; i++ )
+        {
+            ft = filter_cache[ i ];
+
+            if (    ft
+                 && ft->filter == filter
+                 && ft->src == src
+                 && ft->dst == dst )
+                break;
+        }
+
+        if ( i < NFILTER_CACHE || nft )
+            break;
+
+        /* Computing the weights takes a while, don't keep other
+           threads waiting meanwhile */
+
+        fli_unlock( &filter_lock );
+
+        if ( ! ( nft = make_filter_table( filter, src, dst ) ) )
+            return NULL;
+    }
+
+    if ( i == NFILTER_CACHE )
+    {
+        ft = nft;
+        nft = NULL;
+        ft->refs = 1;
+        i = NFILTER_CACHE - 1;
+        unref_filter_table( filter_cache[ i ] );
+    }
+
+    /* Move to the front so the least recently used one drops out */
+
+    for ( ; i > 0; i-- )
+        filter_cache[ i ] = filter_cache[ i - 1 ];
+    filter_cache[ 0 ] = ft;
+
+    ft->refs++;
+
+    fli_unlock( &filter_lock );
+
+    /* another thread was quicker making the same table */
+
+    free_filter_table( nft );
+
+    return ft;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+release_filter_table( FilterTable * ft )
+{
+    fli_lock( &filter_lock );
+    unref_filter_table( ft );
+    fli_unlock( &filter_lock );
+}
+
+
+/***************************************
+ * Horizontal pass over a single row of 8 bit samples
+ ***************************************/
+
+static void
+hfilter_row8( const unsigned char * src,
+              int                 * dst,
+              FilterTable         * fx,
+              int                   shift )
+{
+    int *w = fx->weight;
+    int half = 1 << ( shift - 1 );
+    int i,
+        k;
+
+    for ( i = 0; i < fx->dst; i++, w += fx->taps )
+    {
+        const unsigned char *s = src + fx->start[ i ];
+        int sum = 0;
+
+        for ( k = 0; k < fx->ntaps[ i ]; k++ )
+            sum += w[ k ] * s[ k ];
+        dst[ i ] = ( sum + half ) >> shift;
+    }
+}
+
+
+/***************************************
+ * Horizontal pass over a single row of 16 bit samples
+ ***************************************/
+
+static void
+hfilter_row16( const unsigned short * src,
+               int                  * dst,
+               FilterTable          * fx,
+               int                    shift )
+{
+    int *w = fx->weight;
+    int half = 1 << ( shift - 1 );
+    int i,
+        k;
+
+    for ( i = 0; i < fx->dst; i++, w += fx->taps )
+    {
+        const unsigned short *s = src + fx->start[ i ];
+        int sum = 0;
+
+        for ( k = 0; k < fx->ntaps[ i ]; k++ )
+            sum += w[ k ] * s[ k ];
+        dst[ i ] = ( sum + half ) >> shift;
+    }
+}
+
+
+/***************************************
+ * Resamples a single channel of either unsigned char or unsigned short
+ * samples. The horizontal pass writes into an intermediate buffer with
+ * some extra bits of precision (for 8 bit data only, 16 bit data would
+ * overflow an int), the vertical pass then walks over complete rows of
+ * that buffer to keep memory accesses sequential.
+ ***************************************/
+
+static int
+filter_channel( void        * in,
+                void        * out,
+                int           is16,
+                FilterTable * fx,
+                FilterTable * fy,
+                int           maxval,
+                FL_IMAGE    * im )
+{
+    int extra = maxval > FL_PCMAX ? 0 : 6;
+    int shift = FILTER_BITS - extra,
+        vshift = FILTER_BITS + extra,
+        vround = 1 << ( vshift - 1 );
+    int **tmp = fl_get_matrix( fy->src, fx->dst, sizeof **tmp );
+    int *acc = fl_malloc( fx->dst * sizeof *acc );
+    unsigned char **in8 = in,
+                  **out8 = out;
+    unsigned short **in16 = in,
+                   **out16 = out;
+    int i,
+        j,
+        k,
+        v;
+
+    if ( ! tmp || ! acc )
+    {
+        fl_free_matrix( tmp );
+        fli_safe_free( acc );
+        return -1;
+    }
+
+    for ( j = 0; j < fy->src; j++ )
+    {
+        if ( is16 )
+            hfilter_row16( in16[ j ], tmp[ j ], fx, shift );
+        else
+            hfilter_row8( in8[ j ], tmp[ j ], fx, shift );
+    }
+
+    for ( j = 0; j < fy->dst; j++, im->completed++ )
+    {
+        int *w = fy->weight + j * fy->taps;
+
+        if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Scaling " );
+
+        memset( acc, 0, fx->dst * sizeof *acc );
+
+        for ( k = 0; k < fy->ntaps[ j ]; k++ )
+        {
+            int *t = tmp[ fy->start[ j ] + k ],
+                wk = w[ k ];
+
+            for ( i = 0; i < fx->dst; i++ )
+                acc[ i ] += wk * t[ i ];
+        }
+
+        for ( i = 0; i < fx->dst; i++ )
+        {
+            v = ( acc[ i ] + vround ) >> vshift;
+            v = v < 0 ? 0 : ( v > maxval ? maxval : v );
+
+            if ( is16 )
+                out16[ j ][ i ] = v;
+            else
+                out8[ j ][ i ] = v;
+        }
+    }
+
+    fl_free( acc );
+    fl_free_matrix( tmp );
+    return 0;
+}
+
+
+/***************************************
+ * Picks a single filter from the option bits, the better (but slower)
+ * one winning if more than one was requested
+ ***************************************/
+
+static int
+get_filter( int option )
+{
+    if ( option & FLIMAGE_LANCZOS )
+        return FLIMAGE_LANCZOS;
+    if ( option & FLIMAGE_BICUBIC )
+        return FLIMAGE_BICUBIC;
+    if ( option & FLIMAGE_BILINEAR )
+        return FLIMAGE_BILINEAR;
+    return FLIMAGE_AREA;
+}
+
+
+/***************************************
+ * Filtered scaling of a gray or RGB image. parameter im is used for
+ * reporting and to find out about the gray level range
+ ***************************************/
+
+static int
+image_filter( void     * om[ ],
+              void     * nm[ ],
+              int        h,
+              int        w,
+              int        nh,
+              int        nw,
+              int        comp,
+              int        filter,
+              FL_IMAGE * im )
+{
+    FilterTable *fx,
+                *fy;
+    int i,
+        err = 0;
+
+    if ( ! ( fx = get_filter_table( filter, w, nw ) ) )
+        return -1;
+
+    if ( ! ( fy = get_filter_table( filter, h, nh ) ) )
+    {
+        release_filter_table( fx );
+        return -1;
+    }
+
+    im->total = comp * nh;
+
+    if ( comp == 1 )
+        err = filter_channel( om[ 0 ], nm[ 0 ], 1, fx, fy,
+                              im->type == FL_IMAGE_GRAY16 ?
+                              im->gray_maxval : FL_PCMAX, im );
+    else
+        for ( i = 0; i < comp && err >= 0; i++ )
+            err = filter_channel( om[ i ], nm[ i ], 0, fx, fy, FL_PCMAX, im );
+
+    release_filter_table( fx );
+    release_filter_table( fy );
+
+    return err < 0 ? -1 : 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -222,7 +788,7 @@ flimage_scale( FL_IMAGE * im,
 
     /* Convert to RGB only if subpixel and not gray */
 
-    if ( option & FLIMAGE_SUBPIXEL )
+    if ( option & ( FLIMAGE_SUBPIXEL | FILTER_MASK ) )
     {
         if ( im->type == FL_IMAGE_CI )
             err = flimage_convert( im, FL_IMAGE_RGB, 0 ) < 0;
@@ -281,18 +847,27 @@ flimage_scale( FL_IMAGE * im,
 
     if ( option & FLIMAGE_ASPECT )
     {
-        static float m[ 2 ][ 2 ];
+        float m[ 2 ][ 2 ] = { { 0.0, 0.0 }, { 0.0, 0.0 } };
 
         m[ 0 ][ 0 ] = ( float ) nw / im->w;
         m[ 1 ][ 1 ] = ( float ) nh / im->h;
 
         m[ 0 ][ 0 ] = m[ 1 ][ 1 ] = FL_min( m[ 0 ][ 0 ], m[ 1 ][ 1 ] );
         fl_free_matrix( nm[ 0 ] );
+
+        /* Fitting is done by warping, which only knows about subpixel
+           sampling */
+
+        if ( option & FILTER_MASK )
+            option |= FLIMAGE_SUBPIXEL;
         err = flimage_warp( im, m, nw, nh, option );
         im->completed = im->h;
         im->visual_cue( im, "Scaling Done" );
         return err;
     }
+    else if ( option & FILTER_MASK )
+        err = image_filter( om, nm, im->h, im->w, nh, nw, comp,
+                            get_filter( option ), im ) < 0;
     else if ( option & FLIMAGE_SUBPIXEL )
         err = image_scale( om, nm, im->h, im->w, nh, nw, comp, im ) < 0;
     else
@@ -314,6 +889,154 @@ flimage_scale( FL_IMAGE * im,
 }
 
 
+/***************************************
+ * By how much an image of size w x h can be reduced (by an integer
+ * factor) and still be at least as large as im->target_w x im->target_h
+ ***************************************/
+
+int
+flimage_reduce_factor( FL_IMAGE * im,
+                       int        w,
+                       int        h )
+{
+    int f = 0;
+
+    if ( im->target_w > 0 )
+        f = FL_max( w / im->target_w, 1 );
+
+    if ( im->target_h > 0 )
+        f = f ? FL_min( f, FL_max( h / im->target_h, 1 ) )
+              : FL_max( h / im->target_h, 1 );
+
+    return f ? f : 1;
+}
+
+
+/***************************************
+ * Averages of f x f pixel blocks (of whatever is left at the right and
+ * bottom border), row by row. sums has room for one sum per output
+ * column
+ ***************************************/
+
+#define BOX_REDUCE( type, in, out, w, h, nw, nh, f, sums )              \
+    do {                                                                \
+        int r_, c_, x_, y_, ch_;                                        \
+        type *p_, *e_;                                                  \
+                                                                        \
+        for ( r_ = 0; r_ < nh; r_++ )                                   \
+        {                                                               \
+            memset( sums, 0, nw * sizeof *sums );                       \
+            ch_ = FL_min( f, h - r_ * f );                              \
+                                                                        \
+            for ( y_ = r_ * f; y_ < r_ * f + ch_; y_++ )                \
+                for ( p_ = in[ y_ ], c_ = 0, x_ = f; c_ < nw;           \
+                      c_++, x_ += f )                                   \
+                    for ( e_ = in[ y_ ] + FL_min( w, x_ ); p_ < e_; p_++ ) \
+                        sums[ c_ ] += *p_;                              \
+                                                                        \
+            for ( c_ = 0; c_ < nw; c_++ )                               \
+            {                                                           \
+                unsigned long n_ = ch_ * FL_min( f, w - c_ * f );       \
+                out[ r_ ][ c_ ] = ( sums[ c_ ] + n_ / 2 ) / n_;         \
+            }                                                           \
+        }                                                               \
+    } while ( 0 )
+
+
+/***************************************
+ * Fast reduction of an image by an integer factor, averaging blocks
+ * of f x f pixels. Color index and bitmap images are subsampled
+ ***************************************/
+
+int
+flimage_box_reduce( FL_IMAGE * im,
+                    int        f )
+{
+    int nw,
+        nh,
+        r,
+        c,
+        i,
+        comp = 1,
+        err;
+    void *om[ 3 ],
+         *nm[ 3 ] = { NULL, NULL, NULL };
+    unsigned long *sums;
+
+    if ( f <= 1 || ! im || im->w <= 0 || im->h <= 0 )
+        return 0;
+
+    if ( im->type == FL_IMAGE_PACKED || im->type == FL_IMAGE_NONE )
+        return -1;
+
+    nw = ( im->w + f - 1 ) / f;
+    nh = ( im->h + f - 1 ) / f;
+
+    if ( im->type == FL_IMAGE_RGB )
+    {
+        om[ 0 ] = im->red;
+        om[ 1 ] = im->green;
+        om[ 2 ] = im->blue;
+        comp = 3;
+    }
+    else
+        om[ 0 ] = FL_IsGray( im->type ) ? im->gray : im->ci;
+
+    sums = fl_malloc( nw * sizeof *sums );
+    err = ! sums;
+
+    for ( i = 0; i < comp && ! err; i++ )
+        err = ! ( nm[ i ] = fl_get_matrix( nh, nw, comp == 3 ?
+                                           sizeof **im->red :
+                                           sizeof **im->gray ) );
+
+    if ( err )
+    {
+        for ( i = 0; i < comp; i++ )
+            fl_free_matrix( nm[ i ] );
+        fli_safe_free( sums );
+        im->error_message( im, "Reduce: malloc failed" );
+        return -1;
+    }
+
+    flimage_invalidate_pixels( im );
+
+    for ( i = 0; i < comp; i++ )
+    {
+        if ( comp == 3 )
+        {
+            unsigned char **in = om[ i ],
+                          **out = nm[ i ];
+
+            BOX_REDUCE( unsigned char, in, out,
+                        im->w, im->h, nw, nh, f, sums );
+        }
+        else if ( FL_IsGray( im->type ) )
+        {
+            unsigned short **in = om[ i ],
+                           **out = nm[ i ];
+
+            BOX_REDUCE( unsigned short, in, out,
+                        im->w, im->h, nw, nh, f, sums );
+        }
+        else
+        {
+            unsigned short **in = om[ i ],
+                           **out = nm[ i ];
+
+            for ( r = 0; r < nh; r++ )
+                for ( c = 0; c < nw; c++ )
+                    out[ r ][ c ] = in[ r * f ][ c * f ];
+        }
+    }
+
+    fl_free( sums );
+    flimage_replace_image( im, nw, nh, nm[ 0 ], nm[ 1 ], nm[ 2 ] );
+
+    return 0;
+}
+
+
 /*
  * Local variables:
  * tab-width: 4
@@ -83,18 +83,29 @@ IRIS_dump( FL_IMAGE * im )
 }
 
 
+static const FLIMAGE_MAGIC iris_magic[ ] =
+{
+    { 0, 2, "\001\332" },
+    { 0, 2, "\332\001" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_sgi( void )
 {
-    flimage_add_format( "SGI Iris", "iris", "rgb",
-                        FL_IMAGE_RGB | FL_IMAGE_GRAY | FL_IMAGE_MONO,
-                        IRIS_identify,
-                        IRIS_description,
-                        IRIS_load,
-                        IRIS_dump);
+    int k;
+
+    k = flimage_add_format( "SGI Iris", "iris", "rgb",
+                            FL_IMAGE_RGB | FL_IMAGE_GRAY | FL_IMAGE_MONO,
+                            IRIS_identify,
+                            IRIS_description,
+                            IRIS_load,
+                            IRIS_dump);
+    flimage_set_magic( k, iris_magic );
 }
 
 
@@ -60,7 +60,7 @@ typedef struct
 } TIFFTag;
 
 
-static TIFFTag *find_tag( int );
+#define NTAGS  23     /* interestedTags[] including the sentinel */
 
 typedef struct
 {
@@ -85,8 +85,13 @@ typedef struct
     int offset_offset;
     int bytecount_offset;
     int max_tags;
+    TIFFTag tags[ NTAGS ];  /* values of the current IFD */
 } SPEC;
 
+static TIFFTag *find_tag( SPEC *,
+                          int );
+static void free_tags( SPEC * );
+
 static void initialize_tiff_io( SPEC *,
                                 int );
 
@@ -109,6 +114,19 @@ static int read_tiff_ifd( FILE * fp,
                           SPEC * sp );
 
 
+/***************************************
+ * Called before the SPEC gets freed, the tag values are still
+ * around if the image was only described or reading it failed
+ ***************************************/
+
+static void
+TIFF_cleanup( FL_IMAGE * im )
+{
+    if ( im->io_spec )
+        free_tags( im->io_spec );
+}
+
+
 /***************************************
  ***************************************/
 
@@ -151,17 +169,22 @@ TIFF_description( FL_IMAGE * im )
 
     if ( get_image_info_from_ifd( im ) < 0 )
     {
+        free_tags( sp );
         fl_free( sp );
         im->io_spec = NULL;
         im->spec_size = 0;
         return -1;
     }
 
+    im->cleanup = TIFF_cleanup;
+
     return 0;
 }
 
 
 static int read_pixels( FL_IMAGE * im );
+static int read_tiled_pixels( FL_IMAGE * im );
+static void set_bilevel_lut( FL_IMAGE * im );
 static int TIFF_next( FL_IMAGE * );
 static int load_tiff_colormap( FL_IMAGE * );
 
@@ -173,6 +196,7 @@ static int
 TIFF_readpixels( FL_IMAGE * im )
 {
     SPEC *sp = im->io_spec;
+    int ret;
 
     load_tiff_colormap( im );
 
@@ -183,7 +207,10 @@ TIFF_readpixels( FL_IMAGE * im )
 
     im->more = sp->ifd_offset != 0;
 
-    return read_pixels(im);
+    ret = read_pixels( im );
+    free_tags( sp );
+
+    return ret;
 }
 
 
@@ -210,6 +237,8 @@ TIFF_next( FL_IMAGE * im )
 }
 
 
+static int TIFF_open_region( FL_IMAGE * );
+
 static int write_ifd( FL_IMAGE *,
                       SPEC * );
 static int write_pixels( FL_IMAGE *,
@@ -291,18 +320,30 @@ TIFF_write( FL_IMAGE * image )
 }
 
 
+static const FLIMAGE_MAGIC tiff_magic[ ] =
+{
+    { 0, 4, "II*\0" },
+    { 0, 4, "MM\0*" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_tiff(void)
 {
-    flimage_add_format( "Tag Image File Format", "tiff", "tif",
-                        FL_IMAGE_FLEX,
-                        TIFF_identify,
-                        TIFF_description,
-                        TIFF_readpixels,
-                        TIFF_write);
+    int k;
+
+    k = flimage_add_format( "Tag Image File Format", "tiff", "tif",
+                            FL_IMAGE_FLEX,
+                            TIFF_identify,
+                            TIFF_description,
+                            TIFF_readpixels,
+                            TIFF_write);
+    flimage_set_magic( k, tiff_magic );
+    flimage_set_region_support( k, TIFF_open_region );
 }
 
 
@@ -310,6 +351,8 @@ flimage_enable_tiff(void)
  * TIFF tags
  *************************************************************************/
 
+/* value of tags not in the file, only ever read */
+
 static int junkBuffer;
 
 #define NV(a,t)  {a,#a,t,&junkBuffer,0,0,0}
@@ -352,6 +395,10 @@ static int junkBuffer;
 #define GrayResponse      291
 #define ColorResponse     301
 #define ColorMap          320
+#define TileWidth         322
+#define TileLength        323
+#define TileOffsets       324
+#define TileByteCounts    325
 
 /* tiff support types   */
 
@@ -370,9 +417,10 @@ enum
     kDouble   = 12
 };
 
-/* type is used for writing only */
+/* type is used for writing only. Each image gets its own copy of
+   the table to keep the tag values in */
 
-TIFFTag interestedTags[ ] =
+static const TIFFTag interestedTags[ NTAGS ] =
 {
     NV( ImageWidth,      kUShort ),
     NV( ImageHeight,     kUShort ),
@@ -392,29 +440,55 @@ TIFFTag interestedTags[ ] =
     NV( GrayResponse,    kUShort ),
     NV( ColorResponse,   kUShort ),
     NV( ColorMap,        kUShort ),
+    NV( TileWidth,       kULong  ),
+    NV( TileLength,      kULong  ),
+    NV( TileOffsets,     kULong  ),
+    NV( TileByteCounts,  kULong  ),
     /* sentinel */
 
     NV( 0,               kShort  )
 };
 
-static TIFFTag *
 
 /***************************************
  ***************************************/
 
-find_tag( int val )
+static TIFFTag *
+find_tag( SPEC * sp,
+          int    val )
 {
     TIFFTag *tag;
 
     /* if tags are more than about 20, binary search may be better */
 
-    for ( tag = interestedTags; tag->tag_value && tag->tag_value != val; tag++ )
+    for ( tag = sp->tags; tag->tag_value && tag->tag_value != val; tag++ )
         /* empty */ ;
 
     return tag->tag_value ? tag : 0;    /* &stag; */
 }
 
 
+/***************************************
+ * Release the tag values once everything needed has been taken from
+ * them. This also has to happen before the SPEC gets copied for the
+ * next frame
+ ***************************************/
+
+static void
+free_tags( SPEC * sp )
+{
+    TIFFTag *tag;
+
+    for ( tag = sp->tags; tag->tag_value; tag++ )
+    {
+        if ( tag->value != &junkBuffer )
+            fl_free( tag->value );
+        tag->value = &junkBuffer;
+        tag->count = 0;
+    }
+}
+
+
 /***************************************
  * convert tag value to image value
  ***************************************/
@@ -426,14 +500,14 @@ get_image_info_from_ifd( FL_IMAGE * im )
     SPEC *sp = im->io_spec;
     int i;
 
-    if ( ! ( tag = find_tag( ImageWidth ) ) )
+    if ( ! ( tag = find_tag( sp, ImageWidth ) ) )
     {
         flimage_error( im, "Bad ImageWidth tag" );
         return -1;
     }
     im->w = tag->value[ 0 ];
 
-    if ( ! ( tag = find_tag( ImageHeight ) ) )
+    if ( ! ( tag = find_tag( sp, ImageHeight ) ) )
     {
         flimage_error( im, "Bad ImageLength tag" );
         return -1; 
@@ -446,10 +520,10 @@ get_image_info_from_ifd( FL_IMAGE * im )
         return -1;
     }
 
-    if ( ! ( sp->spp = find_tag( SamplesPerPixel )->value[ 0 ] ) )
+    if ( ! ( sp->spp = find_tag( sp, SamplesPerPixel )->value[ 0 ] ) )
         sp->spp = 1;
 
-    tag = find_tag( BitsPerSample );
+    tag = find_tag( sp, BitsPerSample );
 
     for ( i = 0; i < sp->spp; i++ )
     {
@@ -460,7 +534,7 @@ get_image_info_from_ifd( FL_IMAGE * im )
         }
     }
 
-    tag = find_tag( PhotometricI );
+    tag = find_tag( sp, PhotometricI );
 
     switch ( tag->value[ 0 ] )
     {
@@ -476,7 +550,7 @@ get_image_info_from_ifd( FL_IMAGE * im )
 
         case PhotoPalette :
             im->type = FL_IMAGE_CI;
-            if ( ( im->map_len = find_tag( ColorMap )->count / 3 ) <= 0 )
+            if ( ( im->map_len = find_tag( sp, ColorMap )->count / 3 ) <= 0 )
             {
                 flimage_error( im, "Colormap is missing for PhotoPalette" );
                 return -1;
@@ -488,7 +562,8 @@ get_image_info_from_ifd( FL_IMAGE * im )
             break;
     }
 
-    if ( im->type == FL_IMAGE_GRAY16 && ( tag = find_tag( MaxSampleValue ) ) )
+    if (    im->type == FL_IMAGE_GRAY16
+         && ( tag = find_tag( sp, MaxSampleValue ) ) )
         im->gray_maxval = tag->value[ 0 ];
     else
         im->gray_maxval = ( 1 << sp->bps[ 0 ] ) - 1;
@@ -496,7 +571,22 @@ get_image_info_from_ifd( FL_IMAGE * im )
     return 0;
 }
 
-static int typeSize[ 13 ];
+static const int typeSize[ 13 ] =
+{
+    0,
+    1,      /* kUByte    */
+    1,      /* ASCII     */
+    2,      /* kUShort   */
+    4,      /* kULong    */
+    8,      /* RATIONAL  */
+    1,      /* SBYTE     */
+    0,
+    2,      /* kShort    */
+    4,      /* kLong     */
+    8,      /* SRATIONAL */
+    4,      /* kFloat    */
+    8       /* kDouble   */
+};
 
 
 /***************************************
@@ -507,18 +597,7 @@ static void
 initialize_tiff_io( SPEC * sp,
                     int    endian )
 {
-    if ( ! typeSize[ kUByte ] )
-    {
-        /* initialize the typeSize                       */
-
-        typeSize[ kUByte ] = typeSize[ SBYTE ] = 1;
-        typeSize[ ASCII ] = 1;
-        typeSize[ kShort ] = typeSize[ kUShort ] = 2;
-        typeSize[ kLong ] = typeSize[ kULong ] = 4;
-        typeSize[ RATIONAL ] = typeSize[ SRATIONAL ] = 8;
-        typeSize[ kFloat ] = 4;
-        typeSize[ kDouble ] = 8;
-    }
+    memcpy( sp->tags, interestedTags, sizeof sp->tags );
 
     /* initialize the functions that reads various types */
 
@@ -561,7 +640,7 @@ read_tag( FILE * fp,
     fseek( fp, offset, SEEK_SET );
 
     tag_val = sp->read2bytes( fp );
-    if ( ! ( tag = find_tag( tag_val ) ) )
+    if ( ! ( tag = find_tag( sp, tag_val ) ) )
     {
 #if TIFF_DEBUG
         fprintf( stderr, "Unsupported tag 0x%x(%d)\n", tag_val, tag_val );
@@ -622,6 +701,10 @@ read_tiff_ifd( FILE * fp,
         i;
     TIFFTag *tag;
 
+    /* forget what the previous IFD had */
+
+    free_tags( sp );
+
     fseek( fp, sp->ifd_offset, SEEK_SET );
 
     num_tags = sp->read2bytes( fp );
@@ -637,7 +720,7 @@ read_tiff_ifd( FILE * fp,
 
     /* validate the tags (sort of) */
 
-    if ( ! ( tag = find_tag( BitsPerSample ) )->count )
+    if ( ! ( tag = find_tag( sp, BitsPerSample ) )->count )
         return -1;
 
     if (    tag->value[ 0 ] != 1
@@ -651,7 +734,7 @@ read_tiff_ifd( FILE * fp,
     }
 
 #if TIFF_DEBUG
-    for ( tag = interestedTags; tag->tag_value; tag++ )
+    for ( tag = sp->tags; tag->tag_value; tag++ )
     {
         if ( tag->count )
             fprintf( stderr, "%s\t count=%2d\t val=%d\n",
@@ -730,7 +813,10 @@ read_pixels( FL_IMAGE * im )
     unsigned short *sbuf;
     FILE *fp = im->fpin;
 
-    rowsPerStripTag = find_tag( RowsPerStrip );
+    if ( find_tag( sp, TileWidth )->count )
+        return read_tiled_pixels( im );
+
+    rowsPerStripTag = find_tag( sp, RowsPerStrip );
 
     if ( ( val = rowsPerStripTag->value[ 0 ] ) <= 0 )
     {
@@ -738,7 +824,7 @@ read_pixels( FL_IMAGE * im )
         return -1;
     }
 
-    if (    ( compress = find_tag( Compression )->value[ 0 ] )
+    if (    ( compress = find_tag( sp, Compression )->value[ 0 ] )
          && compress != Uncompressed )
     {
         flimage_error( im, "can't handled compressed TIF" );
@@ -746,7 +832,7 @@ read_pixels( FL_IMAGE * im )
     }
 
     nstrips = ( im->h + val - 1 ) / val;
-    bytecountTag = find_tag( StripByteCount );
+    bytecountTag = find_tag( sp, StripByteCount );
 
     if ( nstrips != bytecountTag->count )
     {
@@ -754,9 +840,10 @@ read_pixels( FL_IMAGE * im )
         return -1;
     }
 
-    bpl = ( im->w * sp->spp * find_tag( BitsPerSample )->value[ 0 ] + 7 ) / 8;
+    bpl = ( im->w * sp->spp * find_tag( sp, BitsPerSample )->value[ 0 ] + 7 )
+          / 8;
     rps = rowsPerStripTag->value[ 0 ];
-    tag = find_tag( StripOffsets );
+    tag = find_tag( sp, StripOffsets );
 
     if ( ! ( tmpbuffer = fl_malloc( bytecountTag->value[ 0 ] + 4 ) ) )
     {
@@ -838,7 +925,7 @@ read_pixels( FL_IMAGE * im )
         }
         else if ( sp->spp == 3 || sp->spp == 4 )
         {
-            int config = find_tag( PlannarConfig )->value[ 0 ];
+            int config = find_tag( sp, PlannarConfig )->value[ 0 ];
 
             if ( sp->bps[ 0 ] == 8 )
             {
@@ -889,15 +976,306 @@ read_pixels( FL_IMAGE * im )
 
     fl_free( tmpbuffer );
 
-    if ( find_tag(BitsPerSample)->value[ 0 ] == 1 )
+    set_bilevel_lut( im );
+
+    /* TODO: post-processing gamma, color/gray response etc */
+
+    if ( err )
+        flimage_error( im, "ErrorReading" );
+
+    return err ? -1 : 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+set_bilevel_lut( FL_IMAGE * im )
+{
+    SPEC *sp = im->io_spec;
+
+    if ( find_tag( sp, BitsPerSample )->value[ 0 ] == 1 )
     {
-        int b = find_tag( PhotometricI )->value[0] != PhotoBW0Black;
+        int b = find_tag( sp, PhotometricI )->value[0] != PhotoBW0Black;
         im->red_lut[ b ] = im->green_lut[ b ] = im->blue_lut[ b ] = 0;
         im->red_lut[ ! b ] = im->green_lut[ ! b ] = im->blue_lut[ ! b ] =
                                                                       FL_PCMAX;
     }
+}
 
-    /* TODO: post-processing gamma, color/gray response etc */
+
+/*************************************************************************
+ * Row access to uncompressed strips and tiles. Used for tiled TIFFs and
+ * for reading regions of images too large to be read as a whole.
+ *************************************************************************/
+
+typedef struct
+{
+    int             spp;
+    int             bps;
+    int             rps;        /* rows per strip                       */
+    int             tw,         /* tile size, 0 for stripped images     */
+                    th;
+    int             ntx;        /* tiles per row of tiles               */
+    int             bpl;        /* bytes per row (per tile row if tiled) */
+    int             noffsets;
+    int           * offsets;    /* strip or tile offsets                */
+    unsigned char * buf;
+} LAYOUT;
+
+
+/***************************************
+ * Collect the layout of the current IFD. Since the tags are only
+ * good until the next TIFF gets read, we keep our own copy
+ ***************************************/
+
+static int
+get_layout( FL_IMAGE * im,
+            LAYOUT   * lay )
+{
+    SPEC *sp = im->io_spec;
+    TIFFTag *tag;
+    int compress,
+        bits,
+        n;
+
+    if (    ( compress = find_tag( sp, Compression )->value[ 0 ] )
+         && compress != Uncompressed )
+    {
+        flimage_error( im, "can't handled compressed TIF" );
+        return -1;
+    }
+
+    lay->spp = sp->spp;
+    lay->bps = sp->bps[ 0 ];
+
+    if ( lay->spp == 1 )
+    {
+        if ( lay->bps > 8 && lay->bps != 16 )
+        {
+            flimage_error( im, "Unsupported bps=%d", lay->bps );
+            return -1;
+        }
+    }
+    else if ( lay->spp == 3 || lay->spp == 4 )
+    {
+        tag = find_tag( sp, PlannarConfig );
+
+        if ( lay->bps != 8 || ( tag->count && tag->value[ 0 ] != RGBRGB ) )
+        {
+            flimage_error( im, "Unsupported bps=%d or PlannarConfig",
+                           lay->bps );
+            return -1;
+        }
+    }
+    else
+    {
+        flimage_error( im, "spp=%d unsupported", lay->spp );
+        return -1;
+    }
+
+    bits = lay->spp * lay->bps;
+
+    if ( find_tag( sp, TileWidth )->count )
+    {
+        lay->tw = find_tag( sp, TileWidth )->value[ 0 ];
+        lay->th = find_tag( sp, TileLength )->value[ 0 ];
+
+        /* tile width is required to be a multiple of 16, so tiles
+           always start on a byte boundary */
+
+        if ( lay->tw <= 0 || lay->tw % 8 || lay->th <= 0 )
+        {
+            flimage_error( im, "Bad tile size %dx%d", lay->tw, lay->th );
+            return -1;
+        }
+
+        lay->ntx = ( im->w + lay->tw - 1 ) / lay->tw;
+        lay->bpl = lay->tw * bits / 8;
+        n = lay->ntx * ( ( im->h + lay->th - 1 ) / lay->th );
+        tag = find_tag( sp, TileOffsets );
+    }
+    else
+    {
+        if (    ! find_tag( sp, RowsPerStrip )->count
+             || ( lay->rps = find_tag( sp, RowsPerStrip )->value[ 0 ] ) <= 0
+             || lay->rps > im->h )
+            lay->rps = im->h;
+
+        lay->bpl = ( im->w * bits + 7 ) / 8;
+        n = ( im->h + lay->rps - 1 ) / lay->rps;
+        tag = find_tag( sp, StripOffsets );
+    }
+
+    if ( tag->count != n )
+    {
+        flimage_error( im, "Inconsistent in number of %s",
+                       lay->tw ? "tiles" : "strips" );
+        return -1;
+    }
+
+    lay->noffsets = n;
+    lay->offsets = fl_malloc( n * sizeof *lay->offsets );
+    lay->buf = fl_malloc( ( im->w * bits + 7 ) / 8 + lay->bpl + 4 );
+
+    if ( ! lay->offsets || ! lay->buf )
+    {
+        fli_safe_free( lay->offsets );
+        fli_safe_free( lay->buf );
+        flimage_error( im, "Can't allocate row buffer" );
+        return -1;
+    }
+
+    memcpy( lay->offsets, tag->value, n * sizeof *lay->offsets );
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_layout( LAYOUT * lay )
+{
+    fli_safe_free( lay->offsets );
+    fli_safe_free( lay->buf );
+}
+
+
+/***************************************
+ * Read n pixels starting at col, step pixels apart, of the given row
+ * into out (see image_region.c)
+ ***************************************/
+
+static int
+read_layout_row( LAYOUT * lay,
+                 FILE   * fp,
+                 int      row,
+                 int      col,
+                 int      n,
+                 int      step,
+                 void  ** out )
+{
+    int bits = lay->spp * lay->bps,
+        last = col + ( n - 1 ) * step,
+        b0 = col * bits / 8,
+        b1 = ( last * bits + bits - 1 ) / 8,
+        p,
+        k;
+    unsigned char *buf = lay->buf;
+
+    if ( ! lay->tw )
+    {
+        fseek( fp, lay->offsets[ row / lay->rps ]
+                   + ( long ) ( row % lay->rps ) * lay->bpl + b0, SEEK_SET );
+        if ( fread( buf, 1, b1 - b0 + 1, fp ) != ( size_t ) ( b1 - b0 + 1 ) )
+            return -1;
+    }
+    else
+    {
+        int tx,
+            s,
+            e,
+            base = ( row / lay->th ) * lay->ntx;
+
+        /* with byte aligned tiles, the tile rows put side by side are
+           just a normal row */
+
+        for ( tx = b0 / lay->bpl; tx <= b1 / lay->bpl; tx++ )
+        {
+            s = FL_max( b0, tx * lay->bpl );
+            e = FL_min( b1, tx * lay->bpl + lay->bpl - 1 );
+
+            fseek( fp, lay->offsets[ base + tx ]
+                       + ( long ) ( row % lay->th ) * lay->bpl
+                       + s - tx * lay->bpl, SEEK_SET );
+            if ( fread( buf + s - b0, 1, e - s + 1, fp )
+                                                  != ( size_t ) ( e - s + 1 ) )
+                return -1;
+        }
+    }
+
+    if ( lay->spp > 1 )
+    {
+        unsigned char *r = out[ 0 ],
+                      *g = out[ 1 ],
+                      *b = out[ 2 ];
+
+        for ( p = col * lay->spp - b0, k = 0; k < n;
+              k++, p += step * lay->spp )
+        {
+            r[ k ] = buf[ p ];
+            g[ k ] = buf[ p + 1 ];
+            b[ k ] = buf[ p + 2 ];
+        }
+    }
+    else if ( lay->bps == 8 )
+    {
+        unsigned short *o = out[ 0 ];
+
+        for ( p = col - b0, k = 0; k < n; k++, p += step )
+            o[ k ] = buf[ p ];
+    }
+    else if ( lay->bps == 16 )
+    {
+        unsigned short *o = out[ 0 ];
+
+        /* always MSB, see read_pixels() */
+
+        for ( p = 2 * col - b0, k = 0; k < n; k++, p += 2 * step )
+            o[ k ] = ( buf[ p ] << 8 ) | buf[ p + 1 ];
+    }
+    else
+    {
+        unsigned short *o = out[ 0 ];
+        int mask = ( 1 << lay->bps ) - 1;
+
+        for ( p = col * lay->bps - 8 * b0, k = 0; k < n;
+              k++, p += step * lay->bps )
+            o[ k ] = ( buf[ p >> 3 ] >> ( 8 - lay->bps - ( p & 7 ) ) ) & mask;
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ ***************************************/
+
+static int
+read_tiled_pixels( FL_IMAGE * im )
+{
+    LAYOUT lay;
+    int row,
+        err = 0;
+    void *out[ 3 ];
+
+    memset( &lay, 0, sizeof lay );
+
+    if ( get_layout( im, &lay ) < 0 )
+        return -1;
+
+    for ( row = 0; ! err && row < im->h; row++, im->completed++ )
+    {
+        if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Reading TIFF" );
+
+        if ( im->type == FL_IMAGE_RGB )
+        {
+            out[ 0 ] = im->red[ row ];
+            out[ 1 ] = im->green[ row ];
+            out[ 2 ] = im->blue[ row ];
+        }
+        else
+            out[ 0 ] = FL_IsCI( im->type ) ? im->ci[ row ] : im->gray[ row ];
+
+        err = read_layout_row( &lay, im->fpin, row, 0, im->w, 1, out ) < 0;
+    }
+
+    free_layout( &lay );
+    set_bilevel_lut( im );
 
     if ( err )
         flimage_error( im, "ErrorReading" );
@@ -906,6 +1284,81 @@ read_pixels( FL_IMAGE * im )
 }
 
 
+/***************************************
+ ***************************************/
+
+static int
+TIFF_read_row( FL_IMAGE * im,
+               int        row,
+               int        col,
+               int        n,
+               int        step,
+               void    ** out )
+{
+    FLIMAGE_REGION *rg = im->region;
+
+    return read_layout_row( rg->spec, im->fpin, row, col, n, step, out );
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+TIFF_close_region( FL_IMAGE * im )
+{
+    FLIMAGE_REGION *rg = im->region;
+
+    free_layout( rg->spec );
+    fli_safe_free( rg->spec );
+}
+
+
+/***************************************
+ * Prepare for region-on-demand reading. Called right after
+ * TIFF_description, everything needed from the tags gets copied
+ ***************************************/
+
+static int
+TIFF_open_region( FL_IMAGE * im )
+{
+    FLIMAGE_REGION *rg = im->region;
+    LAYOUT *lay = fl_calloc( 1, sizeof *lay );
+
+    if ( ! lay || get_layout( im, lay ) < 0 )
+    {
+        fli_safe_free( lay );
+        free_tags( im->io_spec );
+        return -1;
+    }
+
+    if ( FL_IsCI( im->type ) )
+    {
+        if ( im->map_len <= 0 )
+            im->map_len = 2;
+
+        if ( flimage_getcolormap( im ) < 0 )
+        {
+            free_layout( lay );
+            fl_free( lay );
+            free_tags( im->io_spec );
+            return -1;
+        }
+
+        load_tiff_colormap( im );
+        set_bilevel_lut( im );
+    }
+
+    free_tags( im->io_spec );
+
+    rg->spec = lay;
+    rg->read_row = TIFF_read_row;
+    rg->cleanup = TIFF_close_region;
+
+    return 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -913,8 +1366,8 @@ static int
 load_tiff_colormap( FL_IMAGE * im )
 {
     FILE *fp = im->fpin;
-    TIFFTag *tag = find_tag( ColorMap );
     SPEC *sp = im->io_spec;
+    TIFFTag *tag = find_tag( sp, ColorMap );
 
     if ( ! tag->count )
         return 0;
@@ -1003,7 +1456,7 @@ write_tag( FILE * fp,
     TIFFTag *tag;
     int i;
 
-    tag = find_tag( tag_val );
+    tag = find_tag( sp, tag_val );
     sp->write2bytes( tag_val, fp );
     sp->write2bytes( tag->type, fp );
     sp->write4bytes( count, fp );
@@ -57,9 +57,8 @@ spline_int_interpolate( const int * wx,
            a,
            b,
            x;
-    static int nwork = 0;
-    static double *y2 = NULL,
-                  *u = NULL;
+    double *y2,
+           *u;
 
     if ( nin <= 3 )
     {
@@ -68,12 +67,9 @@ spline_int_interpolate( const int * wx,
         return -1;
     }
 
-    if ( nwork < nin )
-    {
-        y2 = fl_realloc( y2, nin * sizeof *y2 );
-        u = fl_realloc( u, nin * sizeof *u );
-        nwork = nin;
-    }
+    if ( ! ( y2 = fl_malloc( 2 * nin * sizeof *y2 ) ) )
+        return -1;
+    u = y2 + nin;
 
     y2[ 0 ] = u[ 0 ] = 0.0;
 
@@ -142,6 +138,9 @@ spline_int_interpolate( const int * wx,
     }
 
     y[ nout - 1 ] = wy[ nin - 1 ];
+
+    fl_free( y2 );
+
     return nout;
 }
 
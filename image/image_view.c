@@ -0,0 +1,710 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  Zoomed and panned display of (large) images. The zoomed image is
+ *  cut into tiles of TILE_SIZE x TILE_SIZE screen pixels. A tile gets
+ *  made from the level of an image pyramid (each level half the size
+ *  of the one before, made by averaging 2x2 pixels, and only built
+ *  when first needed) that is closest to but not smaller than the
+ *  zoomed image, converted for the window and kept as a pixmap on the
+ *  server. The pixmaps are kept in a LRU cache, so that showing the
+ *  image again, panned, only costs a XCopyArea() per visible tile
+ *  plus making the tiles that just came into view.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flimage.h"
+#include "flimage_int.h"
+#include <string.h>
+#include <math.h>
+
+#define TILE_SIZE       256
+#define VIEW_HASH       256
+#define DEFAULT_CACHE   ( 32UL * 1024 * 1024 )
+#define MAX_LEVEL       24
+
+#define TILE_HASH( z, x, y )  \
+    ( ( ( unsigned int ) ( x ) * 31 + ( y ) * 17 + ( int ) ( ( z ) * 64 ) ) \
+      & ( VIEW_HASH - 1 ) )
+
+typedef struct view_tile_ VIEW_TILE;
+
+struct view_tile_ {
+    VIEW_TILE     * prev,           /* LRU list, most recent first */
+                  * next;
+    VIEW_TILE     * hnext;          /* hash chain                  */
+    double          zoom;
+    int             x,              /* tile column and row         */
+                    y;
+    Pixmap          pixmap;
+    unsigned long   size;
+};
+
+/* A level of the pyramid. Level 0 is the image itself, RGB and gray
+   images are used directly, for color index and packed images level 0
+   has no pixels of its own. The other levels are RGB, or gray for gray
+   images */
+
+typedef struct {
+    int               w,
+                      h;
+    unsigned char  ** r,
+                   ** g,
+                   ** b;
+    unsigned short ** gray;
+} VIEW_LEVEL;
+
+typedef struct {
+    int               w,            /* what the pyramid was made from */
+                      h,
+                      type;
+    void            * pixels;
+    VIEW_LEVEL        level[ MAX_LEVEL ];
+    int               nlevels;      /* levels made so far             */
+    VIEW_TILE       * head,
+                    * tail;
+    VIEW_TILE       * hash[ VIEW_HASH ];
+    unsigned long     size,
+                      limit;
+    int               depth;        /* of the window tiles are for    */
+    void            * visual;
+} FLIMAGE_VIEW;
+
+
+/***************************************
+ ***************************************/
+
+static void *
+image_pixels( FL_IMAGE * im )
+{
+    if ( FL_IsGray( im->type ) )
+        return im->gray;
+    else if ( FL_IsCI( im->type ) )
+        return im->ci;
+    else if ( im->type == FL_IMAGE_PACKED )
+        return im->packed;
+
+    return im->red;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+unlink_tile( FLIMAGE_VIEW * v,
+             VIEW_TILE    * t )
+{
+    if ( t->prev )
+        t->prev->next = t->next;
+    else
+        v->head = t->next;
+
+    if ( t->next )
+        t->next->prev = t->prev;
+    else
+        v->tail = t->prev;
+
+    t->prev = t->next = NULL;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+push_tile( FLIMAGE_VIEW * v,
+           VIEW_TILE    * t )
+{
+    t->prev = NULL;
+    t->next = v->head;
+
+    if ( v->head )
+        v->head->prev = t;
+    else
+        v->tail = t;
+
+    v->head = t;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_tile( FL_IMAGE     * im,
+           FLIMAGE_VIEW * v,
+           VIEW_TILE    * t )
+{
+    VIEW_TILE **p = v->hash + TILE_HASH( t->zoom, t->x, t->y );
+
+    while ( *p != t )
+        p = &( *p )->hnext;
+    *p = t->hnext;
+
+    unlink_tile( v, t );
+    v->size -= t->size;
+
+    if ( t->pixmap )
+        XFreePixmap( im->xdisplay, t->pixmap );
+    fl_free( t );
+}
+
+
+/***************************************
+ * Throw out least recently used tiles until the cache is small enough
+ ***************************************/
+
+static void
+evict_tiles( FL_IMAGE      * im,
+             FLIMAGE_VIEW  * v,
+             unsigned long   limit )
+{
+    while ( v->tail && v->size > limit )
+        free_tile( im, v, v->tail );
+}
+
+
+/***************************************
+ * Get the pixels of a row of a color index or packed image as RGB
+ ***************************************/
+
+static void
+rgb_row( FL_IMAGE      * im,
+         int             row,
+         unsigned char * rgb[ 3 ] )
+{
+    int i;
+
+    if ( im->type == FL_IMAGE_PACKED )
+        for ( i = 0; i < im->w; i++ )
+        {
+            rgb[ 0 ][ i ] = FL_GETR( im->packed[ row ][ i ] );
+            rgb[ 1 ][ i ] = FL_GETG( im->packed[ row ][ i ] );
+            rgb[ 2 ][ i ] = FL_GETB( im->packed[ row ][ i ] );
+        }
+    else
+        for ( i = 0; i < im->w; i++ )
+        {
+            rgb[ 0 ][ i ] = im->red_lut[   im->ci[ row ][ i ] ];
+            rgb[ 1 ][ i ] = im->green_lut[ im->ci[ row ][ i ] ];
+            rgb[ 2 ][ i ] = im->blue_lut[  im->ci[ row ][ i ] ];
+        }
+}
+
+
+/***************************************
+ * Make level k of the pyramid from level k - 1
+ ***************************************/
+
+static int
+make_level( FL_IMAGE     * im,
+            FLIMAGE_VIEW * v,
+            int            k )
+{
+    VIEW_LEVEL *src = v->level + k - 1,
+               *dst = v->level + k;
+    unsigned char *rgb[ 2 ][ 3 ],
+                  *tmp = NULL;
+    int i,
+        j,
+        c,
+        j0,
+        j1,
+        total = im->total,
+        err;
+
+    dst->w = ( src->w + 1 ) / 2;
+    dst->h = ( src->h + 1 ) / 2;
+
+    if ( FL_IsGray( im->type ) )
+        err = ! ( dst->gray = fl_get_matrix( dst->h, dst->w,
+                                             sizeof **dst->gray ) );
+    else
+        err =    ! ( dst->r = fl_get_matrix( dst->h, dst->w, sizeof **dst->r ) )
+              || ! ( dst->g = fl_get_matrix( dst->h, dst->w, sizeof **dst->g ) )
+              || ! ( dst->b = fl_get_matrix( dst->h, dst->w, sizeof **dst->b ) )
+              || (    ! src->r
+                   && ! ( tmp = fl_malloc( 6 * src->w ) ) );
+
+    if ( err )
+    {
+        fl_free_matrix( dst->gray );
+        fl_free_matrix( dst->r );
+        fl_free_matrix( dst->g );
+        fl_free_matrix( dst->b );
+        memset( dst, 0, sizeof *dst );
+        flimage_error( im, "can't get memory for the image pyramid" );
+        return -1;
+    }
+
+    if ( tmp )
+        for ( c = 0; c < 6; c++ )
+            rgb[ c / 3 ][ c % 3 ] = tmp + c * src->w;
+
+    im->total = dst->h;
+    im->completed = 0;
+
+    for ( i = 0; i < dst->h; i++, im->completed++ )
+    {
+        int r0 = 2 * i,
+            r1 = FL_min( 2 * i + 1, src->h - 1 );
+
+        if ( ! ( im->completed & FLIMAGE_REPFREQ ) )
+            im->visual_cue( im, "Making pyramid" );
+
+        if ( dst->gray )
+        {
+            unsigned short *s0 = src->gray[ r0 ],
+                           *s1 = src->gray[ r1 ];
+
+            for ( j = 0; j < dst->w; j++ )
+            {
+                j0 = 2 * j;
+                j1 = FL_min( j0 + 1, src->w - 1 );
+                dst->gray[ i ][ j ] =
+                             ( s0[ j0 ] + s0[ j1 ] + s1[ j0 ] + s1[ j1 ] + 2 )
+                           / 4;
+            }
+
+            continue;
+        }
+
+        if ( src->r )
+        {
+            rgb[ 0 ][ 0 ] = src->r[ r0 ];
+            rgb[ 0 ][ 1 ] = src->g[ r0 ];
+            rgb[ 0 ][ 2 ] = src->b[ r0 ];
+            rgb[ 1 ][ 0 ] = src->r[ r1 ];
+            rgb[ 1 ][ 1 ] = src->g[ r1 ];
+            rgb[ 1 ][ 2 ] = src->b[ r1 ];
+        }
+        else
+        {
+            rgb_row( im, r0, rgb[ 0 ] );
+            rgb_row( im, r1, rgb[ 1 ] );
+        }
+
+        for ( c = 0; c < 3; c++ )
+        {
+            unsigned char **dm = c == 0 ? dst->r : c == 1 ? dst->g : dst->b,
+                          *s0 = rgb[ 0 ][ c ],
+                          *s1 = rgb[ 1 ][ c ],
+                          *d = dm[ i ];
+
+            for ( j = 0; j < dst->w; j++ )
+            {
+                j0 = 2 * j;
+                j1 = FL_min( j0 + 1, src->w - 1 );
+                d[ j ] = ( s0[ j0 ] + s0[ j1 ] + s1[ j0 ] + s1[ j1 ] + 2 ) / 4;
+            }
+        }
+    }
+
+    fli_safe_free( tmp );
+    im->total = total;
+
+    return 0;
+}
+
+
+/***************************************
+ * Get (or make) the view state of the image. If the image's pixels
+ * aren't the ones the pyramid was made from anymore it's thrown away
+ ***************************************/
+
+static FLIMAGE_VIEW *
+get_view( FL_IMAGE * im )
+{
+    FLIMAGE_VIEW *v = im->view;
+
+    if (    v
+         && (    v->w != im->w
+              || v->h != im->h
+              || v->type != im->type
+              || v->pixels != image_pixels( im ) ) )
+        flimage_free_view( im );
+
+    if ( im->view )
+        return im->view;
+
+    if ( ! ( v = fl_calloc( 1, sizeof *v ) ) )
+    {
+        flimage_error( im, "malloc() failed" );
+        return NULL;
+    }
+
+    v->w = im->w;
+    v->h = im->h;
+    v->type = im->type;
+    v->pixels = image_pixels( im );
+    v->limit = im->setup->view_cache ? im->setup->view_cache : DEFAULT_CACHE;
+
+    v->level[ 0 ].w = im->w;
+    v->level[ 0 ].h = im->h;
+
+    if ( FL_IsGray( im->type ) )
+        v->level[ 0 ].gray = im->gray;
+    else if ( im->type == FL_IMAGE_RGB )
+    {
+        v->level[ 0 ].r = im->red;
+        v->level[ 0 ].g = im->green;
+        v->level[ 0 ].b = im->blue;
+    }
+
+    v->nlevels = 1;
+
+    return im->view = v;
+}
+
+
+/***************************************
+ * Make the tile at column tx and row ty of the image zoomed by zoom
+ * (which is zw by zh pixels) from level k of the pyramid
+ ***************************************/
+
+static VIEW_TILE *
+make_tile( FL_IMAGE     * im,
+           FLIMAGE_VIEW * v,
+           FL_WINDOW      win,
+           double         zoom,
+           int            k,
+           int            tx,
+           int            ty,
+           int            zw,
+           int            zh )
+{
+    VIEW_LEVEL *lv = v->level + k;
+    double s = ldexp( zoom, k );
+    int x0 = tx * TILE_SIZE,
+        y0 = ty * TILE_SIZE,
+        w = FL_min( TILE_SIZE, zw - x0 ),
+        h = FL_min( TILE_SIZE, zh - y0 ),
+        xmap[ TILE_SIZE ],
+        i,
+        j,
+        sy;
+    FL_IMAGE *tile;
+    VIEW_TILE *t;
+
+    if ( ! ( t = fl_calloc( 1, sizeof *t ) ) || ! ( tile = flimage_alloc( ) ) )
+    {
+        fli_safe_free( t );
+        flimage_error( im, "malloc() failed" );
+        return NULL;
+    }
+
+    for ( j = 0; j < w; j++ )
+        xmap[ j ] = FL_min( ( int ) ( ( x0 + j ) / s ), lv->w - 1 );
+
+    tile->w = w;
+    tile->h = h;
+    tile->xdisplay = im->xdisplay;
+    tile->tran_rgb = im->tran_rgb;
+    tile->app_background = im->app_background;
+
+    if ( FL_IsGray( im->type ) )
+    {
+        tile->type = im->type;
+        tile->gray_maxval = im->gray_maxval;
+        tile->level = im->level;
+        tile->wwidth = im->wwidth;
+    }
+    else if ( k == 0 && FL_IsCI( im->type ) )
+    {
+        tile->type = im->type;
+        tile->map_len = im->map_len;
+        tile->tran_index = im->tran_index;
+    }
+    else
+        tile->type = FL_IMAGE_RGB;
+
+    if ( flimage_getmem( tile ) < 0 )
+    {
+        flimage_free( tile );
+        fl_free( t );
+        return NULL;
+    }
+
+    if ( FL_IsCI( tile->type ) )
+    {
+        memcpy( tile->red_lut,   im->red_lut,
+                im->map_len * sizeof *im->red_lut );
+        memcpy( tile->green_lut, im->green_lut,
+                im->map_len * sizeof *im->green_lut );
+        memcpy( tile->blue_lut,  im->blue_lut,
+                im->map_len * sizeof *im->blue_lut );
+    }
+
+    for ( i = 0; i < h; i++ )
+    {
+        sy = FL_min( ( int ) ( ( y0 + i ) / s ), lv->h - 1 );
+
+        if ( FL_IsGray( tile->type ) )
+            for ( j = 0; j < w; j++ )
+                tile->gray[ i ][ j ] = lv->gray[ sy ][ xmap[ j ] ];
+        else if ( FL_IsCI( tile->type ) )
+            for ( j = 0; j < w; j++ )
+                tile->ci[ i ][ j ] = im->ci[ sy ][ xmap[ j ] ];
+        else if ( lv->r )
+            for ( j = 0; j < w; j++ )
+            {
+                tile->red[   i ][ j ] = lv->r[ sy ][ xmap[ j ] ];
+                tile->green[ i ][ j ] = lv->g[ sy ][ xmap[ j ] ];
+                tile->blue[  i ][ j ] = lv->b[ sy ][ xmap[ j ] ];
+            }
+        else                        /* level 0 of a packed image */
+            for ( j = 0; j < w; j++ )
+            {
+                FL_PACKED4 p = im->packed[ sy ][ xmap[ j ] ];
+
+                tile->red[   i ][ j ] = FL_GETR( p );
+                tile->green[ i ][ j ] = FL_GETG( p );
+                tile->blue[  i ][ j ] = FL_GETB( p );
+            }
+    }
+
+    t->pixmap = flimage_to_pixmap( tile, win );
+    flimage_free( tile );
+
+    if ( ! t->pixmap )
+    {
+        fl_free( t );
+        return NULL;
+    }
+
+    t->zoom = zoom;
+    t->x = tx;
+    t->y = ty;
+    t->size =   ( unsigned long ) w * h
+              * ( v->depth > 16 ? 4 : ( v->depth > 8 ? 2 : 1 ) );
+
+    return t;
+}
+
+
+/***************************************
+ * Get a tile from the cache or make it
+ ***************************************/
+
+static VIEW_TILE *
+get_tile( FL_IMAGE     * im,
+          FLIMAGE_VIEW * v,
+          FL_WINDOW      win,
+          double         zoom,
+          int            k,
+          int            tx,
+          int            ty,
+          int            zw,
+          int            zh )
+{
+    unsigned int hv = TILE_HASH( zoom, tx, ty );
+    VIEW_TILE *t;
+
+    for ( t = v->hash[ hv ]; t; t = t->hnext )
+        if ( t->zoom == zoom && t->x == tx && t->y == ty )
+        {
+            unlink_tile( v, t );
+            push_tile( v, t );
+            return t;
+        }
+
+    if ( ! ( t = make_tile( im, v, win, zoom, k, tx, ty, zw, zh ) ) )
+        return NULL;
+
+    t->hnext = v->hash[ hv ];
+    v->hash[ hv ] = t;
+    push_tile( v, t );
+    v->size += t->size;
+
+    return t;
+}
+
+
+/***************************************
+ * Show the image zoomed by zoom (i.e. zoom is the number of screen
+ * pixels per image pixel), with the image point (x,y) at the upper
+ * left hand corner of the part of the window starting at (im->wx,
+ * im->wy)
+ ***************************************/
+
+int
+flimage_view_display( FL_IMAGE  * im,
+                      FL_WINDOW   win,
+                      double      x,
+                      double      y,
+                      double      zoom )
+{
+    FLIMAGE_VIEW *v;
+    VIEW_TILE *t;
+    XWindowAttributes xwa;
+    int vw,
+        vh,
+        zw,
+        zh,
+        ox,
+        oy,
+        k,
+        tx,
+        ty,
+        dx,
+        dy,
+        sx,
+        sy,
+        w,
+        h;
+
+    if ( ! im || win <= 0 || im->w <= 0 || im->type == FL_IMAGE_NONE )
+        return -1;
+
+    if ( zoom <= 0.0 || ( zw = im->w * zoom + 0.5 ) <= 0 )
+    {
+        flimage_error( im, "bad zoom factor" );
+        return -1;
+    }
+
+    zh = FL_max( ( int ) ( im->h * zoom + 0.5 ), 1 );
+    ox = floor( x * zoom );
+    oy = floor( y * zoom );
+
+    if ( ! ( v = get_view( im ) ) )
+        return -1;
+
+    XGetWindowAttributes( im->xdisplay, win, &xwa );
+
+    /* tiles made for a different kind of window are useless */
+
+    if ( xwa.depth != v->depth || xwa.visual != v->visual )
+    {
+        evict_tiles( im, v, 0 );
+        v->depth = xwa.depth;
+        v->visual = xwa.visual;
+    }
+
+    /* use the smallest level that is still at least as large as the
+       zoomed image */
+
+    for ( k = 0;
+             k + 1 < MAX_LEVEL
+          && ldexp( zoom, k + 1 ) <= 1.0
+          && v->level[ k ].w > 1
+          && v->level[ k ].h > 1;
+          k++ )
+        if ( k + 1 >= v->nlevels )
+        {
+            if ( make_level( im, v, k + 1 ) < 0 )
+                return -1;
+            v->nlevels = k + 2;
+        }
+
+    vw = FL_max( xwa.width  - im->wx, 0 );
+    vh = FL_max( xwa.height - im->wy, 0 );
+
+    /* clear what the image doesn't cover */
+
+    if ( ! im->setup->do_not_clear )
+    {
+        if ( ox < 0 )
+            XClearArea( im->xdisplay, win, im->wx, im->wy,
+                        FL_min( -ox, vw ), vh, 0 );
+        if ( zw - ox < vw )
+            XClearArea( im->xdisplay, win, im->wx + FL_max( zw - ox, 0 ),
+                        im->wy, vw - FL_max( zw - ox, 0 ), vh, 0 );
+        if ( oy < 0 )
+            XClearArea( im->xdisplay, win, im->wx, im->wy,
+                        vw, FL_min( -oy, vh ), 0 );
+        if ( zh - oy < vh )
+            XClearArea( im->xdisplay, win, im->wx,
+                        im->wy + FL_max( zh - oy, 0 ),
+                        vw, vh - FL_max( zh - oy, 0 ), 0 );
+    }
+
+    if ( ! im->gc )
+        im->gc = XCreateGC( im->xdisplay, win, 0, 0 );
+
+    for ( ty = FL_max( oy, 0 ) / TILE_SIZE;
+          ty * TILE_SIZE < FL_min( oy + vh, zh ); ty++ )
+        for ( tx = FL_max( ox, 0 ) / TILE_SIZE;
+              tx * TILE_SIZE < FL_min( ox + vw, zw ); tx++ )
+        {
+            if ( ! ( t = get_tile( im, v, win, zoom, k, tx, ty, zw, zh ) ) )
+                return -1;
+
+            /* clip the tile to the viewport */
+
+            dx = tx * TILE_SIZE - ox;
+            dy = ty * TILE_SIZE - oy;
+            w = FL_min( TILE_SIZE, zw - tx * TILE_SIZE );
+            h = FL_min( TILE_SIZE, zh - ty * TILE_SIZE );
+            sx = FL_max( -dx, 0 );
+            sy = FL_max( -dy, 0 );
+            w = FL_min( w, vw - dx ) - sx;
+            h = FL_min( h, vh - dy ) - sy;
+
+            XCopyArea( im->xdisplay, t->pixmap, win, im->gc, sx, sy, w, h,
+                       im->wx + dx + sx, im->wy + dy + sy );
+        }
+
+    evict_tiles( im, v, v->limit );
+
+    return 0;
+}
+
+
+/***************************************
+ * Throw away the pyramid and the tiles, e.g. after the pixels of the
+ * image have been changed in place
+ ***************************************/
+
+void
+flimage_free_view( FL_IMAGE * im )
+{
+    FLIMAGE_VIEW *v;
+    int k;
+
+    if ( ! im || ! ( v = im->view ) )
+        return;
+
+    evict_tiles( im, v, 0 );
+
+    for ( k = 1; k < v->nlevels; k++ )
+    {
+        fl_free_matrix( v->level[ k ].gray );
+        fl_free_matrix( v->level[ k ].r );
+        fl_free_matrix( v->level[ k ].g );
+        fl_free_matrix( v->level[ k ].b );
+    }
+
+    fl_free( v );
+    im->view = NULL;
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -32,6 +32,8 @@
 #include "flimage.h"
 #include "flimage_int.h"
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
 
 
 /***************************************
@@ -407,6 +409,303 @@ transform_rgb( unsigned char ** or,
 }
 
 
+/* Fixed point fast path. The source position of an output pixel is
+   kept as a 16.16 fixed point number and advanced by a constant step
+   along a row, so the inner loops need neither floats nor the LUTs.
+   The output is produced in tiles of FIX_TILE x FIX_TILE pixels: the
+   part of the source a tile reads from is small enough to stay in the
+   cache even if the output rows run at an angle through the source.
+   The position at the start of each row of a tile is recomputed in
+   floating point, so rounding errors of the step can't add up over
+   more than FIX_TILE pixels. */
+
+#define FIX_BITS   16
+#define FIX_ONE    ( 1L << FIX_BITS )
+#define FIX_TILE   64
+
+
+/***************************************
+ * Convert a (source) position to fixed point
+ ***************************************/
+
+static long
+to_fix( double v )
+{
+    return ( long ) floor( v * FIX_ONE + 0.5 );
+}
+
+
+/***************************************
+ * Check if all source positions the output pixels map to can be
+ * represented in fixed point. Since the transformation is linear
+ * it is enough to check the corners of the output
+ ***************************************/
+
+static int
+fixed_ok( float m[ ][ 2 ],
+          int   shift[ ],
+          int   nw,
+          int   nh )
+{
+    double lim = LONG_MAX / 4 / FIX_ONE - 2 * FIX_TILE,
+           x,
+           y;
+    int i;
+
+    for ( i = 0; i < 4; i++ )
+    {
+        x = ( i & 1 ? nw : 0 ) - shift[ 0 ];
+        y = ( i & 2 ? nh : 0 ) - shift[ 1 ];
+
+        if (    fabs( m[ 0 ][ 0 ] * x + m[ 0 ][ 1 ] * y ) > lim
+             || fabs( m[ 1 ][ 0 ] * x + m[ 1 ][ 1 ] * y ) > lim )
+            return 0;
+    }
+
+    return 1;
+}
+
+
+/* Helpers for the fixed point rows: the source position (x,y) is
+   split into the integer pixel position (ix,iy) and 8 bit weights
+   (fx,fy). For sub-pixel sampling the pixel position is that of the
+   upper left of the 4 samples used, which can be -1. FixOutside() is
+   true if the output pixel gets the fill color */
+
+#define FixOutside( x, y, ix, iy )                                      \
+    (    ( x ) < 0 || ( y ) < 0                                         \
+      || ( ( ix ) = ( x ) >> FIX_BITS ) >= w                            \
+      || ( ( iy ) = ( y ) >> FIX_BITS ) >= h )
+
+#define FixOutsideSubP( x, y, ix, iy )                                  \
+    (    ( x ) <= -FIX_ONE || ( y ) <= -FIX_ONE                         \
+      || ( ( ix ) = ( ( ( x ) + FIX_ONE ) >> FIX_BITS ) - 1 ) >= w      \
+      || ( ( iy ) = ( ( ( y ) + FIX_ONE ) >> FIX_BITS ) - 1 ) >= h )
+
+#define FixWeight( v )                                                  \
+    ( ( ( ( v ) + FIX_ONE ) & ( FIX_ONE - 1 ) ) >> ( FIX_BITS - 8 ) )
+
+#define FixInside( ix, iy )                                             \
+    ( ( ix ) >= 0 && ( iy ) >= 0 && ( ix ) < w - 1 && ( iy ) < h - 1 )
+
+/* Bilinear interpolation of a sample of src, using fill for the (fake)
+   samples just outside of the image, exactly as interpol2d_short()
+   does */
+
+#define FixInterpol( out, src, ix, iy, fx, fy, fill )                   \
+    do {                                                                \
+        unsigned long s00,                                              \
+                      s01,                                              \
+                      s10,                                              \
+                      s11;                                              \
+                                                                        \
+        if ( FixInside( ix, iy ) )                                      \
+        {                                                               \
+            s00 = src[ iy     ][ ix     ];                              \
+            s10 = src[ iy     ][ ix + 1 ];                              \
+            s01 = src[ iy + 1 ][ ix     ];                              \
+            s11 = src[ iy + 1 ][ ix + 1 ];                              \
+        }                                                               \
+        else                                                            \
+        {                                                               \
+            s00 = ix >= 0 && iy >= 0 ? src[ iy ][ ix ] : fill;          \
+            s10 = ix < w - 1 && iy >= 0 ? src[ iy ][ ix + 1 ] : fill;   \
+            s01 = ix >= 0 && iy < h - 1 ? src[ iy + 1 ][ ix ] : fill;   \
+            s11 =    ix < w - 1 && iy < h - 1                           \
+                  ? src[ iy + 1 ][ ix + 1 ] : fill;                     \
+        }                                                               \
+                                                                        \
+        s00 = s00 * ( 256 - fx ) + s10 * fx;                            \
+        s01 = s01 * ( 256 - fx ) + s11 * fx;                            \
+        out = ( s00 * ( 256 - fy ) + s01 * fy + 0x8000 ) >> 16;         \
+    } while ( 0 )
+
+
+/***************************************
+ * Fill n pixels starting at out from the gray or color index matrix
+ * in, with the position in the source starting at (x,y) and advancing
+ * by (dx,dy) per pixel
+ ***************************************/
+
+static void
+fixed_row_short( unsigned short ** in,
+                 unsigned short  * out,
+                 int               w,
+                 int               h,
+                 long              x,
+                 long              y,
+                 long              dx,
+                 long              dy,
+                 int               n,
+                 unsigned int      fill,
+                 int               subp )
+{
+    unsigned short *pend = out + n;
+    unsigned long fx,
+                  fy;
+    long ix,
+         iy;
+
+    if ( ! subp )
+    {
+        for ( ; out < pend; out++, x += dx, y += dy )
+            *out = FixOutside( x, y, ix, iy ) ? fill : in[ iy ][ ix ];
+        return;
+    }
+
+    for ( ; out < pend; out++, x += dx, y += dy )
+    {
+        if ( FixOutsideSubP( x, y, ix, iy ) )
+        {
+            *out = fill;
+            continue;
+        }
+
+        fx = FixWeight( x );
+        fy = FixWeight( y );
+        FixInterpol( *out, in, ix, iy, fx, fy, fill );
+    }
+}
+
+
+/***************************************
+ * Same for the three planes of a RGB image
+ ***************************************/
+
+static void
+fixed_row_rgb( unsigned char ** in[ ],
+               unsigned char  * out[ ],
+               int              w,
+               int              h,
+               long             x,
+               long             y,
+               long             dx,
+               long             dy,
+               int              n,
+               unsigned int     fill[ ],
+               int              subp )
+{
+    unsigned char **r = in[ 0 ],
+                  **g = in[ 1 ],
+                  **b = in[ 2 ],
+                  *nr = out[ 0 ],
+                  *ng = out[ 1 ],
+                  *nb = out[ 2 ],
+                  *pend = nr + n;
+    unsigned long fx,
+                  fy;
+    long ix,
+         iy;
+
+    if ( ! subp )
+    {
+        for ( ; nr < pend; nr++, ng++, nb++, x += dx, y += dy )
+        {
+            if ( FixOutside( x, y, ix, iy ) )
+            {
+                *nr = fill[ 0 ];
+                *ng = fill[ 1 ];
+                *nb = fill[ 2 ];
+            }
+            else
+            {
+                *nr = r[ iy ][ ix ];
+                *ng = g[ iy ][ ix ];
+                *nb = b[ iy ][ ix ];
+            }
+        }
+
+        return;
+    }
+
+    for ( ; nr < pend; nr++, ng++, nb++, x += dx, y += dy )
+    {
+        if ( FixOutsideSubP( x, y, ix, iy ) )
+        {
+            *nr = fill[ 0 ];
+            *ng = fill[ 1 ];
+            *nb = fill[ 2 ];
+            continue;
+        }
+
+        fx = FixWeight( x );
+        fy = FixWeight( y );
+        FixInterpol( *nr, r, ix, iy, fx, fy, fill[ 0 ] );
+        FixInterpol( *ng, g, ix, iy, fx, fy, fill[ 1 ] );
+        FixInterpol( *nb, b, ix, iy, fx, fy, fill[ 2 ] );
+    }
+}
+
+
+/***************************************
+ * Transform nplanes source matrices (one of unsigned shorts for gray
+ * or color index images, three of unsigned chars for RGB) with the
+ * fixed point code
+ ***************************************/
+
+static void
+transform_fixed( void         ** in[ ],
+                 void         ** out[ ],
+                 int             nplanes,
+                 int             w,
+                 int             h,
+                 int             nw,
+                 int             nh,
+                 float           m[ ][ 2 ],
+                 int             shift[ ],
+                 unsigned int    fill[ ],
+                 int             subp,
+                 FL_IMAGE      * im )
+{
+    long dx = to_fix( m[ 0 ][ 0 ] ),
+         dy = to_fix( m[ 1 ][ 0 ] ),
+         x,
+         y;
+    double bias = subp ? 0.0 : 0.1;
+    unsigned char *row[ 3 ];
+    int r0,
+        rend,
+        c0,
+        r,
+        n,
+        k;
+
+    for ( r0 = 0; r0 < nh; r0 = rend )
+    {
+        im->visual_cue( im, subp ? "FixedSubP" : "Fixed" );
+
+        rend = FL_min( r0 + FIX_TILE, nh );
+
+        for ( c0 = 0; c0 < nw; c0 += FIX_TILE )
+        {
+            n = FL_min( FIX_TILE, nw - c0 );
+
+            for ( r = r0; r < rend; r++ )
+            {
+                x = to_fix(   m[ 0 ][ 0 ] * ( c0 - shift[ 0 ] )
+                            + m[ 0 ][ 1 ] * ( r  - shift[ 1 ] ) + bias );
+                y = to_fix(   m[ 1 ][ 0 ] * ( c0 - shift[ 0 ] )
+                            + m[ 1 ][ 1 ] * ( r  - shift[ 1 ] ) + bias );
+
+                if ( nplanes == 1 )
+                    fixed_row_short( ( unsigned short ** ) in[ 0 ],
+                                     ( unsigned short * ) out[ 0 ][ r ] + c0,
+                                     w, h, x, y, dx, dy, n, fill[ 0 ], subp );
+                else
+                {
+                    for ( k = 0; k < 3; k++ )
+                        row[ k ] = ( unsigned char * ) out[ k ][ r ] + c0;
+                    fixed_row_rgb( ( unsigned char *** ) in, row,
+                                   w, h, x, y, dx, dy, n, fill, subp );
+                }
+            }
+        }
+
+        im->completed += rend - r0;
+    }
+}
+
+
 /***************************************
  ***************************************/
 
@@ -419,6 +718,7 @@ flimage_warp( FL_IMAGE * im,
 {
     int subp = option & FLIMAGE_SUBPIXEL,
         err = 0,
+        fixed,
         i;
     int center = ! ( ( option & FLIMAGE_NOCENTER ) == FLIMAGE_NOCENTER );
     int neww,
@@ -429,6 +729,8 @@ flimage_warp( FL_IMAGE * im,
                   **g = NULL,
                   **b = NULL;
     unsigned int fill;
+    void **in[ 3 ],
+         **out[ 3 ];
     float x[ 4 ],
           y[ 4 ],
           xmin,
@@ -542,25 +844,67 @@ flimage_warp( FL_IMAGE * im,
     im->completed = 1;
     im->visual_cue( im, "Transforming" );
 
+    fixed = fixed_ok( inv, shift, nw, nh );
+
     if ( FL_IsGray( im->type ) )
     {
         fill = FL_RGB2GRAY( FL_GETR( fill ), FL_GETG( fill ), FL_GETB( fill ) );
-        if ( ! ( err = ( transform_short( im->gray, us, im->w, im->h, nw, nh,
-                                          inv, shift, fill, subp, im) < 0 ) ) )
+        if ( im->type == FL_IMAGE_GRAY16 )
+            fill = fill * im->gray_maxval / FL_PCMAX;
+
+        if ( fixed )
+        {
+            in[ 0 ] = ( void ** ) im->gray;
+            out[ 0 ] = ( void ** ) us;
+            transform_fixed( in, out, 1, im->w, im->h, nw, nh,
+                             inv, shift, &fill, subp, im );
+        }
+        else
+            err = transform_short( im->gray, us, im->w, im->h, nw, nh,
+                                   inv, shift, fill, subp, im) < 0;
+        if ( ! err )
             flimage_replace_image( im, nw, nh, us, 0, 0 );
     }
     else if ( FL_IsCI( im->type ) )
     {
         fill = flimage_get_closest_color_from_map( im, fill );
-        if ( ! ( err = ( transform_short( im->ci, us, im->w, im->h, nw, nh,
-                                          inv, shift, fill, 0, im ) < 0 ) ) )
+
+        if ( fixed )
+        {
+            in[ 0 ] = ( void ** ) im->ci;
+            out[ 0 ] = ( void ** ) us;
+            transform_fixed( in, out, 1, im->w, im->h, nw, nh,
+                             inv, shift, &fill, 0, im );
+        }
+        else
+            err = transform_short( im->ci, us, im->w, im->h, nw, nh,
+                                   inv, shift, fill, 0, im ) < 0;
+        if ( ! err )
             flimage_replace_image( im, nw, nh, us, 0, 0 );
     }
     else if ( im->type == FL_IMAGE_RGB )
     {
-        if ( ! ( err = ( transform_rgb( im->red, im->green, im->blue,
-                                        r, g, b, im->w, im->h, nw, nh, inv,
-                                        shift, fill, subp, im ) < 0 ) ) )
+        if ( fixed )
+        {
+            unsigned int fillc[ 3 ];
+
+            in[ 0 ] = ( void ** ) im->red;
+            in[ 1 ] = ( void ** ) im->green;
+            in[ 2 ] = ( void ** ) im->blue;
+            out[ 0 ] = ( void ** ) r;
+            out[ 1 ] = ( void ** ) g;
+            out[ 2 ] = ( void ** ) b;
+            fillc[ 0 ] = FL_GETR( fill );
+            fillc[ 1 ] = FL_GETG( fill );
+            fillc[ 2 ] = FL_GETB( fill );
+            transform_fixed( in, out, 3, im->w, im->h, nw, nh,
+                             inv, shift, fillc, subp, im );
+        }
+        else
+            err = transform_rgb( im->red, im->green, im->blue,
+                                 r, g, b, im->w, im->h, nw, nh, inv,
+                                 shift, fill, subp, im ) < 0;
+        if ( ! err )
             flimage_replace_image( im, nw, nh, r, g, b );
     }
     else
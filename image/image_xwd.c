@@ -134,9 +134,6 @@ swap_header( XWDFileHeader * h )
 }
 
 
-static int need_swap;
-
-
 /***************************************
  * XWD does not have a signature, we'll have to guess
  ***************************************/
@@ -150,9 +147,7 @@ XWD_identify( FILE * fp )
         return 0;
     rewind( fp );
 
-    need_swap = ( h.file_version != XWD_FILE_VERSION );
-
-    if ( need_swap )
+    if ( h.file_version != XWD_FILE_VERSION )
         swap_header( &h );
 
     if ( h.file_version != XWD_FILE_VERSION )
@@ -215,7 +210,9 @@ XWD_description( FL_IMAGE * im )
     if ( fread( header, 1, sizeof *header, fp ) != sizeof *header )
         M_err( "ImageXWD", "failure to read from file" );
 
-    if ( ( sp->swap = need_swap ) )
+    /* same guess as in XWD_identify() */
+
+    if ( ( sp->swap = header->file_version != XWD_FILE_VERSION ) )
         swap_header( header );
 
     fli_rgbmask_to_shifts( header->red_mask,   &sp->rshifts, &sp->rbits );
@@ -532,10 +529,7 @@ XWD_write_image( FL_IMAGE * im )
     int ( * write32 )( int, FILE * ),
         ( * write16 )( int, FILE * );
     unsigned char *uc;
-    static int machine_endian = -1;
-
-    if ( machine_endian < 0 )
-        machine_endian = detect_endian( );
+    int machine_endian = detect_endian( );
 
     /* some programs expect MSBF always. Force it */
 
@@ -703,16 +697,27 @@ XWD_write_image( FL_IMAGE * im )
 }
 
 
+static const FLIMAGE_MAGIC xwd_magic[ ] =
+{
+    { 4, 4, "\0\0\0\7" },
+    { 4, 4, "\7\0\0\0" },
+    { 0, 0, NULL }
+};
+
+
 /***************************************
  ***************************************/
 
 void
 flimage_enable_xwd( void )
 {
-    flimage_add_format( "X Window Dump", "xwd", "xwd",
-                        FL_IMAGE_FLEX & ~FL_IMAGE_PACKED,
-                        XWD_identify, XWD_description,
-                        XWD_read_pixels, XWD_write_image );
+    int k;
+
+    k = flimage_add_format( "X Window Dump", "xwd", "xwd",
+                            FL_IMAGE_FLEX & ~FL_IMAGE_PACKED,
+                            XWD_identify, XWD_description,
+                            XWD_read_pixels, XWD_write_image );
+    flimage_set_magic( k, xwd_magic );
 }
 
 
@@ -32,6 +32,26 @@
 #include "flimage_int.h"
 
 
+/* The data of a matrix made by fl_get_matrix() are preceded by a small
+   header with a reference count, so that several matrices (i.e. row
+   pointer arrays) can sit on the same data. The data get freed when the
+   last of them goes away. The union just keeps the data aligned */
+
+typedef union {
+    struct {
+        int    refs;
+        int    nrows;
+        size_t size;
+    } h;
+    double align;
+    void * palign;
+} MatData;
+
+#define MAT_DATA( m )  ( ( MatData * ) ( ( char ** ) ( m ) )[ 0 ] - 1 )
+
+static FLI_MUTEX share_lock = FLI_MUTEX_INIT;
+
+
 /***************************************
  ***************************************/
 
@@ -41,6 +61,8 @@ fl_get_matrix( int          nrows,
                unsigned int esize )
 {
     char **mat;
+    MatData *data;
+    size_t size = ( size_t ) nrows * ncols * esize;
     int i;
 
     if ( ! ( mat = fl_malloc( ( nrows + 1 ) * sizeof *mat ) ) )
@@ -48,12 +70,18 @@ fl_get_matrix( int          nrows,
 
     mat[ 0 ] = ( void * ) FL_GET_MATRIX;
 
-    if ( ! ( mat[ 1 ] = fl_calloc( nrows * ncols, esize ) ) )
+    if ( ! ( data = fl_calloc( 1, sizeof *data + size ) ) )
     {
         fl_free( mat );
         return NULL;
     }
 
+    data->h.refs = 1;
+    data->h.nrows = nrows;
+    data->h.size = size;
+
+    mat[ 1 ] = ( char * ) ( data + 1 );
+
     for ( i = 2; i <= nrows; i++ )
         mat[ i ] = mat[ i - 1 ] + ncols * esize;
 
@@ -86,6 +114,89 @@ fl_make_matrix( int            nrows,
 }
 
 
+/***************************************
+ * Make a new matrix sitting on the data of a matrix from fl_get_matrix()
+ * without copying them. Matrices made with fl_make_matrix() don't own
+ * their data and can't be shared, for these NULL is returned
+ ***************************************/
+
+void *
+fl_share_matrix( void * p )
+{
+    char **matrix = p,
+         **mat;
+    MatData *data;
+
+    if ( ! p || matrix[ -1 ] != ( char * ) FL_GET_MATRIX )
+        return NULL;
+
+    data = MAT_DATA( matrix );
+
+    if ( ! ( mat = fl_malloc( ( data->h.nrows + 1 ) * sizeof *mat ) ) )
+        return NULL;
+
+    memcpy( mat, matrix - 1, ( data->h.nrows + 1 ) * sizeof *mat );
+
+    fli_lock( &share_lock );
+    data->h.refs++;
+    fli_unlock( &share_lock );
+
+    return mat + 1;
+}
+
+
+/***************************************
+ * Give a matrix a private copy of its data if they are shared with
+ * another matrix, i.e. before writing to it. The row pointers get moved
+ * to the copy, the matrix itself stays the same
+ ***************************************/
+
+int
+fl_unshare_matrix( void * p )
+{
+    char **matrix = p,
+         *old;
+    MatData *data,
+            *copy;
+    int i,
+        refs;
+
+    if ( ! p || matrix[ -1 ] != ( char * ) FL_GET_MATRIX )
+        return 0;
+
+    data = MAT_DATA( matrix );
+
+    fli_lock( &share_lock );
+    refs = data->h.refs;
+    fli_unlock( &share_lock );
+
+    if ( refs == 1 )
+        return 0;
+
+    if ( ! ( copy = fl_malloc( sizeof *copy + data->h.size ) ) )
+        return -1;
+
+    memcpy( copy, data, sizeof *copy + data->h.size );
+    copy->h.refs = 1;
+
+    old = matrix[ 0 ];
+    for ( i = 0; i < data->h.nrows; i++ )
+        matrix[ i ] = ( char * ) ( copy + 1 ) + ( matrix[ i ] - old );
+
+    /* if the other users let go of the data while we were copying
+       we're the one to free them */
+
+    fli_lock( &share_lock );
+    refs = --data->h.refs;
+    fli_unlock( &share_lock );
+
+    if ( ! refs )
+        fl_free( data );
+
+    return 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -93,6 +204,8 @@ void
 fl_free_matrix( void *p )
 {
     char **matrix = p;
+    MatData *data;
+    int refs;
 
     if ( ! p )
         return;
@@ -100,7 +213,17 @@ fl_free_matrix( void *p )
     if ( matrix[ -1 ] && matrix[ 0 ] )
     {
         if ( matrix[ -1 ] == ( char * ) FL_GET_MATRIX )
-            fl_free( matrix[ 0 ] );
+        {
+            data = MAT_DATA( matrix );
+
+            fli_lock( &share_lock );
+            refs = --data->h.refs;
+            fli_unlock( &share_lock );
+
+            if ( ! refs )
+                fl_free( data );
+        }
+
         fl_free( matrix - 1 );
     }
 }
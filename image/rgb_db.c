@@ -28,6 +28,9 @@
 #include "config.h"
 #endif
 
+#include <stdlib.h>
+#include <ctype.h>
+
 #include "include/forms.h"
 #include "flimage.h"
 
@@ -44,6 +47,152 @@ fl_init_RGBdatabase( const char * f  FL_UNUSED_ARG )
 }
 
 
+/* Without a connection to the X server (e.g. when converting images in
+   a batch job, without fl_initialize() having been called) we can't ask
+   the server to parse color names. Numerical specifications are parsed
+   here instead and names are looked up in the small table below of the
+   colors most often found in XPM files */
+
+typedef struct {
+    const char * name;
+    int          r,
+                 g,
+                 b;
+} RGB_NAME;
+
+static RGB_NAME rgb_names[ ] =
+{
+    { "black",     0,   0,   0   },
+    { "white",     255, 255, 255 },
+    { "red",       255, 0,   0   },
+    { "green",     0,   255, 0   },
+    { "blue",      0,   0,   255 },
+    { "yellow",    255, 255, 0   },
+    { "cyan",      0,   255, 255 },
+    { "magenta",   255, 0,   255 },
+    { "gray",      190, 190, 190 },
+    { "grey",      190, 190, 190 },
+    { "darkgray",  169, 169, 169 },
+    { "darkgrey",  169, 169, 169 },
+    { "lightgray", 211, 211, 211 },
+    { "lightgrey", 211, 211, 211 },
+    { "dimgray",   105, 105, 105 },
+    { "dimgrey",   105, 105, 105 },
+    { "orange",    255, 165, 0   },
+    { "brown",     165, 42,  42  },
+    { "pink",      255, 192, 203 },
+    { "purple",    160, 32,  240 },
+    { "navy",      0,   0,   128 },
+    { "maroon",    176, 48,  96  },
+    { "gold",      255, 215, 0   },
+    { "wheat",     245, 222, 179 },
+    { "tan",       210, 180, 140 },
+    { NULL,        0,   0,   0   }
+};
+
+
+/***************************************
+ * Parse n hex digits into a value in the range 0-255, the same way as
+ * XParseColor() would: in "#..." specifications the digits are the
+ * most significant bits, in "rgb:..." they're scaled to the full range
+ ***************************************/
+
+static int
+hex_value( const char * s,
+           int          n,
+           int          scale,
+           int        * v )
+{
+    unsigned long val = 0;
+    int i;
+
+    for ( i = 0; i < n; i++ )
+    {
+        if ( ! isxdigit( ( unsigned char ) s[ i ] ) )
+            return -1;
+        val = 16 * val + ( isdigit( ( unsigned char ) s[ i ] ) ?
+                           s[ i ] - '0' : tolower( s[ i ] ) - 'a' + 10 );
+    }
+
+    if ( scale )
+        val = val * 0xffff / ( ( 1UL << ( 4 * n ) ) - 1 );
+    else
+        val <<= 16 - 4 * n;
+
+    *v = val ? ( ( val << 8 ) - 1 ) / 0xffff : 0;
+    return 0;
+}
+
+
+/***************************************
+ * Parse "#rgb", "#rrggbb", "#rrrgggbbb", "#rrrrggggbbbb",
+ * "rgb:r/g/b" (with 1 to 4 digits per component) and color names
+ ***************************************/
+
+static int
+parse_color( const char * colname,
+             int        * r,
+             int        * g,
+             int        * b )
+{
+    char name[ 32 ];
+    const char *s;
+    int i,
+        n,
+        len = strlen( colname );
+
+    if ( *colname == '#' )
+    {
+        if ( ( n = ( len - 1 ) / 3 ) < 1 || n > 4 || 3 * n != len - 1 )
+            return -1;
+        return    hex_value( colname + 1,         n, 0, r ) < 0
+               || hex_value( colname + 1 + n,     n, 0, g ) < 0
+               || hex_value( colname + 1 + 2 * n, n, 0, b ) < 0 ? -1 : 0;
+    }
+
+    if ( strncasecmp( colname, "rgb:", 4 ) == 0 )
+    {
+        int *v[ 3 ] = { r, g, b };
+
+        for ( s = colname + 4, i = 0; i < 3; i++, s += n + 1 )
+        {
+            n = strcspn( s, "/" );
+            if (    n < 1 || n > 4 || ( i < 2 ) != ( s[ n ] == '/' )
+                 || hex_value( s, n, 1, v[ i ] ) < 0 )
+                return -1;
+        }
+        return 0;
+    }
+
+    /* names are case insensitive and may contain blanks */
+
+    for ( n = 0, s = colname; *s && n < ( int ) sizeof name - 1; s++ )
+        if ( *s != ' ' )
+            name[ n++ ] = tolower( ( unsigned char ) *s );
+    name[ n ] = '\0';
+
+    if (    ( ! strncmp( name, "gray", 4 ) || ! strncmp( name, "grey", 4 ) )
+         && isdigit( ( unsigned char ) name[ 4 ] ) )
+    {
+        if ( ( i = atoi( name + 4 ) ) > 100 )
+            return -1;
+        *r = *g = *b = ( i * 255 + 50 ) / 100;
+        return 0;
+    }
+
+    for ( i = 0; rgb_names[ i ].name; i++ )
+        if ( ! strcmp( name, rgb_names[ i ].name ) )
+        {
+            *r = rgb_names[ i ].r;
+            *g = rgb_names[ i ].g;
+            *b = rgb_names[ i ].b;
+            return 0;
+        }
+
+    return -1;
+}
+
+
 /***************************************
  * A new implementation from Rouben Rostamian
  * Changed to make it work with machines that a color depth of 32 bit
@@ -62,6 +211,9 @@ int fl_lookup_RGBcolor( const char * colname,
     XColor xc;
     XColor w;
 
+    if ( ! fl_display )
+        return parse_color( colname, r, g, b );
+
     if (    XParseColor( fl_display, fl_state[ fl_vmode ].colormap,
                          "rgb:ffff/ffff/ffff",  &w ) == 0 
          || XParseColor( fl_display, fl_state[ fl_vmode ].colormap,
@@ -114,6 +114,11 @@ drawit( Window   win,
         }
     }
 
+    if ( win == flx->win )
+        fli_flush_batch_area( x, y, w, h );
+    else
+        fli_flush_batch( );
+
     fl_color( fcol );
     fl_bk_color( bcol );
 
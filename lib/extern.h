@@ -48,7 +48,7 @@ extern FLI_CONTEXT * fli_context;
 extern FLI_TARGET * flx;
 extern long fli_requested_vid;
 extern int fli_no_connection;
-extern char fli_curfnt[ 127 ];
+extern const char *fli_curfnt;
 extern FLI_WIN *fli_app_win;
 
 extern void fli_draw_tbox( int,
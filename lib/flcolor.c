@@ -52,8 +52,8 @@ static int allow_leakage;
 static FL_COLOR lastmapped;     /* so fli_textcolor can refresh its cache */
 
 
-static void fli_free_newpixel( unsigned long );
 static FL_COLOR rgb2pixel( unsigned int, unsigned int, unsigned int );
+static void forget_rgb_pixels( Colormap );
 
 /* this needs to be changed to a lookup table */
 
@@ -940,6 +940,8 @@ fli_free_colormap( int vmode )
             fli_gray_pattern[ i ] = None;
         }
 
+    forget_rgb_pixels( fli_map( vmode ) );
+
     if ( fli_visual( vmode ) != DefaultVisual( flx->display, fl_screen ) )
         XFreeColormap( flx->display, fli_map( vmode ) );
 
@@ -977,6 +979,46 @@ fl_get_pixel( FL_COLOR col )
 }
 
 
+/* Stamp of the entries of the RGB pixel cache that must not be replaced
+   (while fl_get_pixels() is running), 0 if there are none */
+
+static unsigned int rgb_pin;
+
+
+/***************************************
+ * Converts an array of XForms colors (or packed RGB colors in RGB
+ * mode) to the pixel values X understands. In RGB mode none of the
+ * pixels returned gets freed for another color in the same call.
+ ***************************************/
+
+void
+fl_get_pixels( const FL_COLOR * cols,
+               unsigned long  * pixels,
+               int              n )
+{
+    static unsigned int last_pin;
+    int i;
+
+    if ( ! cols || ! pixels || n <= 0 )
+        return;
+
+    if ( ! flx->isRGBColor )
+    {
+        for ( i = 0; i < n; i++ )
+            pixels[ i ] = fl_get_pixel( cols[ i ] );
+        return;
+    }
+
+    if ( ! ( rgb_pin = ++last_pin ) )
+        rgb_pin = last_pin = 1;
+
+    for ( i = 0; i < n; i++ )
+        pixels[ i ] = fl_get_pixel( cols[ i ] );
+
+    rgb_pin = 0;
+}
+
+
 /***************************************
  ***************************************/
 
@@ -1007,6 +1049,11 @@ fl_color( FL_COLOR col )
 {
     static int vmode = -1;
 
+    /* Normally just another GC gets used instead of changing the color */
+
+    if ( fli_select_color_gc( col ) )
+        return;
+
     if ( flx->color != col || vmode != fl_vmode )
     {
         unsigned long p = fl_get_pixel( col );
@@ -1019,74 +1066,268 @@ fl_color( FL_COLOR col )
 }
 
 
+/****************************************************************
+ * RGB pixel cache
+ *
+ * Pixels for packed RGB colors on visuals with a colormap. Allocating
+ * a cell each time such a color gets used (and freeing it again when
+ * done with drawing) costs a round trip to the server per color, so
+ * the cells stay allocated while the colors are in the cache. The cache
+ * is set associative, keyed by colormap and RGB value, and within a set
+ * the least recently used entry gets replaced, freeing its cell. Since
+ * the visuals with colormaps are the ones with few cells, at most a
+ * quarter of them is kept allocated, beyond that the least recently
+ * used cell of the whole cache is freed first.
+ ****************************************************************{*/
+
+#define RGB_CACHE_BITS   8
+#define RGB_CACHE_SETS   ( 1 << RGB_CACHE_BITS )
+#define RGB_CACHE_WAYS   4
+#define RGB_CACHE_SIZE   ( RGB_CACHE_SETS * RGB_CACHE_WAYS )
+#define RGB_CELL_SHARE   4      /* at most 1/4 of the cells are kept */
+
+typedef struct {
+    Colormap      cmap;         /* None for an unused entry */
+    FL_COLOR      col;          /* color as passed to fl_get_pixel() */
+    unsigned long rgb;
+    unsigned long pixel;
+    unsigned int  last_used;
+    unsigned int  pin;
+    int           owned;        /* set if a cell got allocated */
+} RGB_CACHED;
+
+static RGB_CACHED rgb_cache[ RGB_CACHE_SIZE ];
+static unsigned int rgb_cache_clock;
+static int rgb_cells;           /* number of cells allocated */
+
+
+/***************************************
+ * Frees the cell of a cache entry (if it got allocated) and makes
+ * sure its pixel isn't used anymore for the color
+ ***************************************/
+
+static void
+release_rgb_pixel( RGB_CACHED * e )
+{
+    if ( e->cmap == None )
+        return;
+
+    if ( e->owned )
+    {
+        XFreeColors( flx->display, e->cmap, &e->pixel, 1, 0 );
+        e->owned = 0;
+        rgb_cells--;
+    }
+
+    if ( flx->color == e->col )
+        flx->color = BadPixel;
+    fli_forget_gc_color( e->col );
+
+    e->cmap = None;
+    e->last_used = 0;
+}
+
+
 /***************************************
+ * Drops all entries for a colormap, must be called before the
+ * colormap gets freed
+ ***************************************/
+
+static void
+forget_rgb_pixels( Colormap cmap )
+{
+    RGB_CACHED *e;
+
+    for ( e = rgb_cache; e < rgb_cache + RGB_CACHE_SIZE; e++ )
+        if ( e->cmap == cmap )
+            release_rgb_pixel( e );
+}
+
+
+/***************************************
+ * Makes sure another cell can be allocated without the cache holding
+ * more than its share of the cells of the visual by freeing the least
+ * recently used ones. Returns 0 if that's impossible since they're all
+ * pinned.
+ ***************************************/
+
+static int
+make_room_for_rgb_cell( FL_STATE * s )
+{
+    int max_cells = ( s->xvinfo ? s->xvinfo->colormap_size : 1 << s->depth )
+                    / RGB_CELL_SHARE;
+    RGB_CACHED *e,
+               *lru;
+
+    while ( rgb_cells >= FL_max( max_cells, 1 ) )
+    {
+        lru = NULL;
+
+        for ( e = rgb_cache; e < rgb_cache + RGB_CACHE_SIZE; e++ )
+            if (    e->owned
+                 && ! ( rgb_pin && e->pin == rgb_pin )
+                 && ( ! lru || e->last_used < lru->last_used ) )
+                lru = e;
+
+        if ( ! lru )
+            return 0;
+
+        release_rgb_pixel( lru );
+    }
+
+    return 1;
+}
+
+
+/***************************************
+ * Returns the pixel of the closest color in the colormap, for when
+ * no cell can be allocated anymore
  ***************************************/
 
 static unsigned long
-get_rgb_pixel( FL_COLOR   packed,
-               int      * newpix )
+closest_rgb_pixel( FL_STATE   * s,
+                   unsigned int r,
+                   unsigned int g,
+                   unsigned int b )
 {
-    FL_STATE *s = &fl_state[ fl_vmode ];
-    unsigned long pixel;
     static Colormap lastcolormap;
     static XColor *xcolor;
     static int new_col;
-    XColor xc;
+    unsigned long pixel;
+    int max_col;
 
-    unsigned int r = FL_GETR( packed );
-    unsigned int g = FL_GETG( packed );
-    unsigned int b = FL_GETB( packed );
+    if ( ( max_col = FL_min( 256, 1 << s->depth ) ) == 0 )
+        max_col = 256;
 
-    *newpix = 0;
-    if ( s->vclass == TrueColor || s->vclass == DirectColor )
-        return rgb2pixel( r, g, b );
-    else
-    {
-        int max_col;
+    if ( ! xcolor )
+        xcolor = fl_malloc( 256 * sizeof *xcolor );
 
-        xc.flags = DoRed | DoGreen | DoBlue;
-        xc.red   = ( r << 8 ) | 0xff;
-        xc.green = ( g << 8 ) | 0xff;
-        xc.blue  = ( b << 8 ) | 0xff;
+    /* Not theoretically correct as colormap may have changed
+     * since the last time we asked for colors. Take a chance for
+     * performace. */
 
-        new_col++;
+    if ( lastcolormap != s->colormap || ++new_col > 3 )
+    {
+        int i;
 
-        if ( ( *newpix = XAllocColor( flx->display, s->colormap, &xc ) ) )
-            return xc.pixel;
+        for ( i = 0; i < max_col; i++ )
+            xcolor[ i ].pixel = i;
+        XQueryColors( flx->display, s->colormap, xcolor, max_col );
+        fli_forget_closest_color( xcolor );
+        lastcolormap = s->colormap;
+        new_col = 0;
+    }
 
-        /* Color allocation failed. Search for best match */
+    fli_find_closest_color( r, g, b, xcolor, max_col, &pixel );
+    return pixel;
+}
 
-        if ( ( max_col = FL_min( 256, 1 << s->depth ) ) == 0 )
-            max_col = 256;
 
-        if ( ! xcolor )
-            xcolor = fl_malloc( 256 * sizeof *xcolor );
+/***************************************
+ * Returns the pixel for a RGB color from the cache, allocating
+ * a cell for it if it's not in the cache yet
+ ***************************************/
 
-        /* Not theoretically correct as colormap may have changed
-         * since the last time we asked for colors. Take a chance for
-         * performace. */
+static unsigned long
+cached_rgb_pixel( FL_STATE   * s,
+                  FL_COLOR     col,
+                  unsigned int r,
+                  unsigned int g,
+                  unsigned int b )
+{
+    unsigned long rgb = ( r << 16 ) | ( g << 8 ) | b;
+    unsigned int h = ( unsigned int ) ( ( rgb ^ s->colormap )
+                                        * 2654435761UL );
+    RGB_CACHED *set = rgb_cache
+                      + ( ( h >> ( 32 - RGB_CACHE_BITS ) )
+                          & ( RGB_CACHE_SETS - 1 ) ) * RGB_CACHE_WAYS,
+               *e = NULL;
+    XColor xc;
+    int i;
 
-        if ( lastcolormap != s->colormap || new_col > 3 )
-        {
-            int i;
+    rgb_cache_clock++;
 
-            for ( i = 0; i < max_col; i++ )
-                xcolor[ i ].pixel = i;
-            XQueryColors( flx->display, s->colormap, xcolor, max_col );
-            lastcolormap = s->colormap;
-            new_col = 0;
+    for ( i = 0; i < RGB_CACHE_WAYS; i++ )
+        if ( set[ i ].cmap == s->colormap && set[ i ].rgb == rgb )
+        {
+            set[ i ].col = col;
+            set[ i ].last_used = rgb_cache_clock;
+            if ( rgb_pin )
+                set[ i ].pin = rgb_pin;
+            return set[ i ].pixel;
         }
 
-        fli_find_closest_color( r, g, b, xcolor, max_col, &pixel );
-        return pixel;
+    /* Replace the least recently used entry, but not one that's pinned */
+
+    for ( i = 0; i < RGB_CACHE_WAYS; i++ )
+        if (    ! ( rgb_pin && set[ i ].cmap != None
+                    && set[ i ].pin == rgb_pin )
+             && ( ! e || set[ i ].last_used < e->last_used ) )
+            e = set + i;
+
+    xc.flags = DoRed | DoGreen | DoBlue;
+    xc.red   = ( r << 8 ) | 0xff;
+    xc.green = ( g << 8 ) | 0xff;
+    xc.blue  = ( b << 8 ) | 0xff;
+
+    /* With all entries of the set pinned a newly allocated cell couldn't
+       be freed anymore */
+
+    if ( ! e )
+        return closest_rgb_pixel( s, r, g, b );
+
+    release_rgb_pixel( e );
+
+    if (    make_room_for_rgb_cell( s )
+         && XAllocColor( flx->display, s->colormap, &xc ) )
+    {
+        e->owned = 1;
+        e->pixel = xc.pixel;
+        rgb_cells++;
     }
+    else
+        e->pixel = closest_rgb_pixel( s, r, g, b );
+
+    e->cmap      = s->colormap;
+    e->col       = col;
+    e->rgb       = rgb;
+    e->last_used = rgb_cache_clock;
+    e->pin       = rgb_pin;
+
+    return e->pixel;
 }
 
 
 /***************************************
  ***************************************/
 
-static void
+static unsigned long
+get_rgb_pixel( FL_COLOR   packed,
+               int      * newpix )
+{
+    FL_STATE *s = &fl_state[ fl_vmode ];
+    unsigned int r = FL_GETR( packed );
+    unsigned int g = FL_GETG( packed );
+    unsigned int b = FL_GETB( packed );
+
+    /* Cells allocated for RGB colors are owned by the cache, callers
+       must not free them */
+
+    *newpix = 0;
+
+    if ( s->vclass == TrueColor || s->vclass == DirectColor )
+        return rgb2pixel( r, g, b );
+
+    return cached_rgb_pixel( s, packed, r, g, b );
+}
+
+/****** End of RGB pixel cache ***********************}***/
+
+
+/***************************************
+ ***************************************/
+
+void
 fli_free_newpixel( unsigned long pixel )
 {
     if ( flx->newpix )
@@ -1150,7 +1391,13 @@ fl_bk_color( FL_COLOR col )
 {
     if ( flx->bkcolor != col )
     {
-        unsigned long p = fl_get_pixel( col );
+        unsigned long p;
+
+        /* Batched dashed lines may be drawn with the background color */
+
+        fli_flush_batch( );
+
+        p = fl_get_pixel( col );
 
         flx->bkcolor = col;
         XSetBackground( flx->display, flx->gc, p );
@@ -1200,10 +1447,14 @@ fl_mapcolor( FL_COLOR col,
     if ( col < FL_BUILT_IN_COLS )
         M_warn( "fl_mapcolor", "Changing reserved color" );
 
-    /* Must invalidate color cache */
+    /* Must invalidate color cache and boxes drawn with the old color */
 
     if ( col == flx->color )
         flx->color = BadPixel;
+    fli_forget_gc_color( col );
+
+    fli_clear_box_cache( );
+    fli_clear_symbol_cache( );
 
     lut = fl_state[ fl_vmode ].lut;
 
@@ -1261,6 +1512,13 @@ fl_mapcolor( FL_COLOR col,
         return lut[ col ];
     }
 
+    /* With a TrueColor visual the pixel value can be calculated, there
+       are no cells to be freed or allocated (which would cost two round
+       trips to the server) */
+
+    if ( fl_vmode == TrueColor )
+        return lut[ col ] = rgb2pixel( r, g, b );
+
     /* pixel value known by the server */
 
     if ( ! allow_leakage && fli_depth( fl_vmode ) >= 4 && pixel != BadPixel )
@@ -1529,6 +1787,52 @@ fl_mode_capable( int mode,
 }
 
 
+/* Pixel values of the red, green and blue components for each of their
+ * 256 possible values, per visual class. They get recalculated whenever
+ * the masks of the visual differ from the ones they were made for (all
+ * masks being 0 at the start makes the initial tables of 0's valid) */
+
+typedef struct {
+    unsigned long rmask,
+                  gmask,
+                  bmask;
+    unsigned long r[ 256 ],
+                  g[ 256 ],
+                  b[ 256 ];
+} RGB_TABLES;
+
+static RGB_TABLES rgb_tables[ DirectColor + 1 ];
+
+
+/***************************************
+ ***************************************/
+
+static void
+fill_rgb_table( unsigned long * table,
+                unsigned int    bits,
+                unsigned int    shift,
+                unsigned long   mask )
+{
+    unsigned long i;
+
+    /* This drops bits and looks bad if primary color resolution is less
+       than 6, but the server calculates color this way. A better way would
+       be v = ((float) i * ((1L << bits) - 1) / 255.0 + 0.1); */
+
+    for ( i = 0; i < 256; i++ )
+    {
+        unsigned long v = i;
+
+        if ( bits < 8 )
+            v >>= 8 - bits;
+        else if ( bits > 8 )
+            v <<= bits - 8;
+
+        table[ i ] = ( v << shift ) & mask;
+    }
+}
+
+
 /***************************************
  * Convert a RGB triple into a pixel value usable in DirectColor
  * and TrueColor. Note the RGB triple is ONE-BYTE EACH.
@@ -1540,27 +1844,21 @@ rgb2pixel( unsigned int r,
            unsigned int b )
 {
     FL_State *s = fl_state + fl_vmode;
+    RGB_TABLES *t = rgb_tables + fl_vmode;
 
-    /* This one drops bits and looks bad if primary color resolution is less
-       than 6, but the server calculates color this way. A better way would be
-       r = ((float) r * ((1L << s->rbits) - 1) / 255.0 + 0.1); */
-
-    if ( s->rbits < 8 )
+    if (    t->rmask != s->rmask
+         || t->gmask != s->gmask
+         || t->bmask != s->bmask )
     {
-        r >>= 8 - s->rbits;
-        g >>= 8 - s->gbits;
-        b >>= 8 - s->bbits;
-    }
-    else if ( s->rbits > 8 )
-    {
-        r <<= 8 - s->rbits;
-        g <<= 8 - s->gbits;
-        b <<= 8 - s->bbits;
+        fill_rgb_table( t->r, s->rbits, s->rshift, s->rmask );
+        fill_rgb_table( t->g, s->gbits, s->gshift, s->gmask );
+        fill_rgb_table( t->b, s->bbits, s->bshift, s->bmask );
+        t->rmask = s->rmask;
+        t->gmask = s->gmask;
+        t->bmask = s->bmask;
     }
 
-    return   ( ( ( unsigned long ) r << s->rshift ) & s->rmask )
-           | ( ( ( unsigned long ) g << s->gshift ) & s->gmask )
-           | ( ( ( unsigned long ) b << s->bshift ) & s->bmask );
+    return t->r[ r & 0xff ] | t->g[ g & 0xff ] | t->b[ b & 0xff ];
 }
 
 
@@ -1723,6 +2021,9 @@ fl_free_colors( FL_COLOR * c,
     lut = fl_state[ fl_vmode ].lut;
     pix = pixels;
 
+    fli_clear_box_cache( );
+    fli_clear_symbol_cache( );
+
     for ( k = 0; k < n; k++, c++, pix++ )
     {
         /* If requested color is reserved, warn */
@@ -1734,6 +2035,7 @@ fl_free_colors( FL_COLOR * c,
 
         if ( *c == flx->color )
             flx->color = BadPixel;
+        fli_forget_gc_color( *c );
 
         for ( i = 0; j < 0 && i < flmapsize; i++ )
             if ( *c == fli_imap[ i ].index )
@@ -1756,11 +2058,287 @@ fl_free_colors( FL_COLOR * c,
 }
 
 
+/* Correct formula is (.299,.587,.114) */
+
+#define COLOR_DISTANCE( dr, dg, db )   \
+    ( 3L * ( dr ) * ( dr ) + 4L * ( dg ) * ( dg ) + 2L * ( db ) * ( db ) )
+
+
 /***************************************
- * (r,g,b) input should be 8bit each
+ * Search the given map entries (all if cand is NULL) for the one
+ * closest to (r,g,b), all 8 bit
+ ***************************************/
+
+static int
+closest_color( int                    r,
+               int                    g,
+               int                    b,
+               const unsigned char  * rgb,
+               const unsigned short * cand,
+               int                    n )
+{
+    long mindiff = 0x7fffffffL,
+         diff;
+    const unsigned char *c;
+    int i,
+        j,
+        k = 0;
+
+    for ( i = 0; i < n; i++ )
+    {
+        j = cand ? cand[ i ] : i;
+        c = rgb + 3 * j;
+        diff = COLOR_DISTANCE( r - c[ 0 ], g - c[ 1 ], b - c[ 2 ] );
+
+        if ( diff < mindiff )
+        {
+            mindiff = diff;
+            k = j;
+        }
+    }
+
+    return k;
+}
+
+
+/* Inverse colormap: a 5/6/5 bit RGB cube with the index of the closest
+ * map entry for each cell. Cells are only searched for when they are
+ * first asked for, so looking up the few hundred colors of an image
+ * (or the few of a form) against a full colormap doesn't cost a search
+ * of the complete cube. On a miss all cells of the surrounding box of
+ * ICMAP_BOX color units are filled, searching only the entries that
+ * can be the closest to some point in the box */
+
+#define ICMAP_RBITS   5
+#define ICMAP_GBITS   6
+#define ICMAP_BBITS   5
+#define ICMAP_CELLS   ( 1L << ( ICMAP_RBITS + ICMAP_GBITS + ICMAP_BBITS ) )
+#define ICMAP_EMPTY   0xffff
+#define ICMAP_BOX     32
+
+#define ICMAP_CELL( r, g, b )                                          \
+    (   ( ( ( r ) >> ( 8 - ICMAP_RBITS ) ) << ( ICMAP_GBITS + ICMAP_BBITS ) ) \
+      | ( ( ( g ) >> ( 8 - ICMAP_GBITS ) ) << ICMAP_BBITS )            \
+      | ( ( b ) >> ( 8 - ICMAP_BBITS ) ) )
+
+struct fli_icmap_ {
+    const XColor   * map;      /* what the table was made from */
+    int              len;
+    unsigned char  * rgb;      /* 8 bit copy of the map        */
+    unsigned short * cell;
+    unsigned short * cand;     /* scratch space for fill_box() */
+    long           * dmin;
+};
+
+
+/***************************************
+ * Shortest and longest distance along one axis between the
+ * value v and the range [lo,hi]
+ ***************************************/
+
+static void
+axis_dist( int   v,
+           int   lo,
+           int   hi,
+           int * dmin,
+           int * dmax )
+{
+    if ( v < lo )
+    {
+        *dmin = lo - v;
+        *dmax = hi - v;
+    }
+    else if ( v > hi )
+    {
+        *dmin = v - hi;
+        *dmax = v - lo;
+    }
+    else
+    {
+        *dmin = 0;
+        *dmax = FL_max( v - lo, hi - v );
+    }
+}
+
+
+/***************************************
+ * Fill all cells of the box the color (r,g,b) falls into
+ ***************************************/
+
+static void
+fill_box( FLI_ICMAP * icmap,
+          int         r,
+          int         g,
+          int         b )
+{
+    int lo[ 3 ],
+        dmin[ 3 ],
+        dmax[ 3 ],
+        i,
+        n,
+        cr,
+        cg,
+        cb;
+    long minmax = 0x7fffffffL,
+         d;
+    const unsigned char *c;
+
+    lo[ 0 ] = r & ~ ( ICMAP_BOX - 1 );
+    lo[ 1 ] = g & ~ ( ICMAP_BOX - 1 );
+    lo[ 2 ] = b & ~ ( ICMAP_BOX - 1 );
+
+    /* An entry can't be the closest one to any point in the box if its
+       shortest distance to the box is larger than the longest distance
+       of some other entry */
+
+    for ( i = 0, c = icmap->rgb; i < icmap->len; i++, c += 3 )
+    {
+        axis_dist( c[ 0 ], lo[ 0 ], lo[ 0 ] + ICMAP_BOX - 1,
+                   dmin, dmax );
+        axis_dist( c[ 1 ], lo[ 1 ], lo[ 1 ] + ICMAP_BOX - 1,
+                   dmin + 1, dmax + 1 );
+        axis_dist( c[ 2 ], lo[ 2 ], lo[ 2 ] + ICMAP_BOX - 1,
+                   dmin + 2, dmax + 2 );
+
+        icmap->dmin[ i ] = COLOR_DISTANCE( dmin[ 0 ], dmin[ 1 ], dmin[ 2 ] );
+        d = COLOR_DISTANCE( dmax[ 0 ], dmax[ 1 ], dmax[ 2 ] );
+        if ( d < minmax )
+            minmax = d;
+    }
+
+    for ( n = i = 0; i < icmap->len; i++ )
+        if ( icmap->dmin[ i ] <= minmax )
+            icmap->cand[ n++ ] = i;
+
+    /* Search the remaining ones for the center of each cell */
+
+    for ( cr = lo[ 0 ] + ( 1 << ( 7 - ICMAP_RBITS ) );
+          cr < lo[ 0 ] + ICMAP_BOX; cr += 1 << ( 8 - ICMAP_RBITS ) )
+        for ( cg = lo[ 1 ] + ( 1 << ( 7 - ICMAP_GBITS ) );
+              cg < lo[ 1 ] + ICMAP_BOX; cg += 1 << ( 8 - ICMAP_GBITS ) )
+            for ( cb = lo[ 2 ] + ( 1 << ( 7 - ICMAP_BBITS ) );
+                  cb < lo[ 2 ] + ICMAP_BOX; cb += 1 << ( 8 - ICMAP_BBITS ) )
+                icmap->cell[ ICMAP_CELL( cr, cg, cb ) ] =
+                    closest_color( cr, cg, cb, icmap->rgb, icmap->cand, n );
+}
+
+
+/***************************************
+ * Make an (empty) inverse colormap for the first len entries of map
+ ***************************************/
+
+FLI_ICMAP *
+fli_icmap_create( const XColor * map,
+                  int            len )
+{
+    FLI_ICMAP *icmap;
+    int i;
+
+    if ( ! map || len <= 0 || len >= ICMAP_EMPTY )
+        return NULL;
+
+    if ( ! ( icmap = fl_calloc( 1, sizeof *icmap ) ) )
+        return NULL;
+
+    icmap->map = map;
+    icmap->len = len;
+    icmap->rgb = fl_malloc( 3 * len );
+    icmap->cell = fl_malloc( ICMAP_CELLS * sizeof *icmap->cell );
+    icmap->cand = fl_malloc( len * sizeof *icmap->cand );
+    icmap->dmin = fl_malloc( len * sizeof *icmap->dmin );
+
+    if ( ! icmap->rgb || ! icmap->cell || ! icmap->cand || ! icmap->dmin )
+    {
+        fli_icmap_free( icmap );
+        return NULL;
+    }
+
+    for ( i = 0; i < len; i++ )
+    {
+        icmap->rgb[ 3 * i     ] = ( map[ i ].red   >> 8 ) & 0xff;
+        icmap->rgb[ 3 * i + 1 ] = ( map[ i ].green >> 8 ) & 0xff;
+        icmap->rgb[ 3 * i + 2 ] = ( map[ i ].blue  >> 8 ) & 0xff;
+    }
+
+    memset( icmap->cell, 0xff, ICMAP_CELLS * sizeof *icmap->cell );
+
+    return icmap;
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+fli_icmap_free( FLI_ICMAP * icmap )
+{
+    if ( ! icmap )
+        return;
+
+    fli_safe_free( icmap->rgb );
+    fli_safe_free( icmap->cell );
+    fli_safe_free( icmap->cand );
+    fli_safe_free( icmap->dmin );
+    fl_free( icmap );
+}
+
+
+/***************************************
+ * Returns the index of the map entry closest to (r,g,b), which must
+ * be 8 bit each. The search is done for the center of the cell the
+ * color falls into
+ ***************************************/
+
+int
+fli_icmap_lookup( FLI_ICMAP * icmap,
+                  int         r,
+                  int         g,
+                  int         b )
+{
+    unsigned short *cell = icmap->cell + ICMAP_CELL( r, g, b );
+
+    if ( *cell == ICMAP_EMPTY )
+        fill_box( icmap, r, g, b );
+
+    return *cell;
+}
+
+
+/* The last few maps fli_find_closest_color() was asked about, most
+   recently used first */
+
+#define ICMAP_CACHED  4
+
+static FLI_ICMAP *icmap_cache[ ICMAP_CACHED ];
+
+
+/***************************************
+ * Must be called whenever the content of a map that was passed to
+ * fli_find_closest_color() changes or the map gets freed
  ***************************************/
 
-#define LINEAR_COLOR_DISTANCE  0
+void
+fli_forget_closest_color( const XColor * map )
+{
+    int i,
+        j;
+
+    for ( i = j = 0; i < ICMAP_CACHED; i++ )
+    {
+        if ( icmap_cache[ i ] && icmap_cache[ i ]->map == map )
+            fli_icmap_free( icmap_cache[ i ] );
+        else
+            icmap_cache[ j++ ] = icmap_cache[ i ];
+    }
+
+    while ( j < ICMAP_CACHED )
+        icmap_cache[ j++ ] = NULL;
+}
+
+
+/***************************************
+ * (r,g,b) input should be 8bit each
+ ***************************************/
 
 int
 fli_find_closest_color( int             r,
@@ -1770,39 +2348,57 @@ fli_find_closest_color( int             r,
                         int             len,
                         unsigned long * pix )
 {
-    long mindiff = 0x7fffffffL,
-         diff;
-    int dr,
-        dg,
-        db;
+    FLI_ICMAP *icmap;
     int i,
         k;
 
-    for ( k = i = 0; i < len; i++ )
+    r &= 0xff;
+    g &= 0xff;
+    b &= 0xff;
+
+    for ( i = 0; i < ICMAP_CACHED; i++ )
+        if (    icmap_cache[ i ]
+             && icmap_cache[ i ]->map == map
+             && icmap_cache[ i ]->len == len )
+            break;
+
+    if ( i == ICMAP_CACHED )
     {
-        dr = r - ( ( map[ i ].red   >> 8 ) & 0xff );
-        dg = g - ( ( map[ i ].green >> 8 ) & 0xff );
-        db = b - ( ( map[ i ].blue  >> 8 ) & 0xff );
+        if ( ! ( icmap = fli_icmap_create( map, len ) ) )
+        {
+            unsigned char *rgb;
 
-        /* Correct formula is (.299,.587,.114) */
+            /* Out of memory, just search the map */
 
-#if LINEAR_COLOR_DISTANCE
-        diff = 3 * FL_abs( dr ) + 4 * FL_abs( dg ) + 2 * FL_abs( db );
-#else
-        diff = 3 * ( dr * dr ) + 4 * ( dg * dg ) + 2 * ( db * db );
-#endif
+            if ( len <= 0 || ! ( rgb = fl_malloc( 3 * len ) ) )
+                return -1;
 
-        if ( diff < 0 )
-            fprintf( stderr, "dr = %d dg = %d db = %d diff = %ld\n",
-                     dr, dg, db, diff );
+            for ( i = 0; i < len; i++ )
+            {
+                rgb[ 3 * i     ] = ( map[ i ].red   >> 8 ) & 0xff;
+                rgb[ 3 * i + 1 ] = ( map[ i ].green >> 8 ) & 0xff;
+                rgb[ 3 * i + 2 ] = ( map[ i ].blue  >> 8 ) & 0xff;
+            }
 
-        if ( diff < mindiff )
-        {
-            mindiff = diff;
-            k = i;
-            *pix = map[ i ].pixel;
+            k = closest_color( r, g, b, rgb, NULL, len );
+            fl_free( rgb );
+            *pix = map[ k ].pixel;
+            return k;
         }
+
+        fli_icmap_free( icmap_cache[ --i ] );
     }
+    else
+        icmap = icmap_cache[ i ];
+
+    /* Move to the front */
+
+    for ( ; i > 0; i-- )
+        icmap_cache[ i ] = icmap_cache[ i - 1 ];
+    icmap_cache[ 0 ] = icmap;
+
+    k = fli_icmap_lookup( icmap, r, g, b );
+    *pix = map[ k ].pixel;
 
     return k;
 }
@@ -33,6 +33,8 @@
 #include "include/forms.h"
 #include "flinternal.h"
 
+#include <string.h>
+
 
 #define FLI_SHADOW_COL   FL_RIGHT_BCOL
 
@@ -327,6 +329,223 @@ fl_oval3dbox( int      style,
     } while ( 0 )
 
 
+/* Cache of boxes drawn into pixmaps, used while drawing forms for which
+   this was requested via fl_set_form_box_cache(). Entries are keyed by
+   everything that determines what a box looks like, so changing an
+   object's attributes just results in another entry getting used. */
+
+#define BOX_CACHE_SIZE      64
+#define BOX_CACHE_MAX_AREA  ( 256 * 256 )
+
+typedef struct {
+    Pixmap        pixmap;
+    int           vmode;
+    int           style;
+    FL_Coord      w;
+    FL_Coord      h;
+    FL_COLOR      col;
+    int           bw;
+    unsigned long last_used;
+} CACHED_BOX;
+
+static CACHED_BOX box_cache[ BOX_CACHE_SIZE ];
+static int box_cache_enabled;
+
+/* GCs for copying, without the NoExpose event for each copy */
+
+static GC box_copy_gc[ DirectColor + 1 ];
+
+
+/***************************************
+ * Switches use of the box cache on or off, returns the previous setting
+ ***************************************/
+
+int
+fli_set_box_cache( int yes )
+{
+    int old = box_cache_enabled;
+
+    box_cache_enabled = yes;
+    return old;
+}
+
+
+/***************************************
+ * Returns if the box cache is to be used
+ ***************************************/
+
+int
+fli_get_box_cache( void )
+{
+    return box_cache_enabled;
+}
+
+
+/***************************************
+ * Frees all cached boxes (and the GCs for copying them), needed when
+ * colors get changed
+ ***************************************/
+
+void
+fli_clear_box_cache( void )
+{
+    CACHED_BOX *b;
+    int i;
+
+    for ( b = box_cache; b < box_cache + BOX_CACHE_SIZE; b++ )
+        if ( b->pixmap != None )
+        {
+            XFreePixmap( flx->display, b->pixmap );
+            b->pixmap = None;
+        }
+
+    for ( i = 0; i <= DirectColor; i++ )
+        if ( box_copy_gc[ i ] )
+        {
+            XFreeGC( flx->display, box_copy_gc[ i ] );
+            box_copy_gc[ i ] = NULL;
+        }
+}
+
+
+/***************************************
+ * Draws a box into a pixmap from the cache
+ ***************************************/
+
+static void
+render_cached_box( CACHED_BOX * b )
+{
+    Window win = flx->win;
+    FL_Coord gx, gy, gw, gh,
+             nx, ny, nw, nh;
+    int gclip = fl_get_global_clipping( &gx, &gy, &gw, &gh ),
+        nclip = fl_get_clipping( 0, &nx, &ny, &nw, &nh );
+
+    /* Clipping is for the window, not the pixmap */
+
+    fl_unset_clipping( );
+    fli_unset_global_clipping( );
+
+    flx->win = b->pixmap;
+    box_cache_enabled = 0;
+    fl_draw_box( b->style, 0, 0, b->w, b->h, b->col, b->bw );
+    box_cache_enabled = 1;
+    fli_flush_batch( );
+    flx->win = win;
+
+    if ( gclip )
+        fli_set_global_clipping( gx, gy, gw, gh );
+    if ( nclip )
+        fl_set_clipping( nx, ny, nw, nh );
+}
+
+
+/***************************************
+ * Tries to draw a box by copying it from the cache (drawing it into a
+ * new pixmap of the cache if necessary). Returns 0 if the box can't be
+ * cached and must be drawn directly.
+ ***************************************/
+
+static int
+draw_cached_box( int      style,
+                 FL_Coord x,
+                 FL_Coord y,
+                 FL_Coord w,
+                 FL_Coord h,
+                 FL_COLOR c,
+                 int      bw )
+{
+    static unsigned long stamp;
+    CACHED_BOX *b,
+               *use = NULL;
+    FL_Coord sx = x,
+             sy = y,
+             sw = w,
+             sh = h,
+             cx, cy, cw, ch;
+
+    /* Only boxes that cover their whole rectangle can be cached (and a
+       flat box is just a single rectangle, nothing to be gained) */
+
+    if (    ! box_cache_enabled
+         || flx->win == None
+         || fli_dithered( fl_vmode )
+         || fl_get_drawmode( ) != GXcopy
+         || w <= 0
+         || h <= 0
+         || w * h > BOX_CACHE_MAX_AREA
+         || (    style != FL_UP_BOX
+              && style != FL_DOWN_BOX
+              && style != FL_BORDER_BOX
+              && style != FL_FRAME_BOX
+              && style != FL_EMBOSSED_BOX ) )
+        return 0;
+
+    for ( b = box_cache; b < box_cache + BOX_CACHE_SIZE; b++ )
+    {
+        if (    b->pixmap != None
+             && b->vmode  == fl_vmode
+             && b->style  == style
+             && b->w      == w
+             && b->h      == h
+             && b->col    == c
+             && b->bw     == bw )
+        {
+            use = b;
+            break;
+        }
+
+        if (    ! use
+             || (    use->pixmap != None
+                  && ( b->pixmap == None || b->last_used < use->last_used ) ) )
+            use = b;
+    }
+
+    if ( b == box_cache + BOX_CACHE_SIZE )
+    {
+        if ( use->pixmap != None )
+            XFreePixmap( flx->display, use->pixmap );
+
+        use->pixmap = XCreatePixmap( flx->display, flx->win, w, h,
+                                     fli_depth( fl_vmode ) );
+        use->vmode  = fl_vmode;
+        use->style  = style;
+        use->w      = w;
+        use->h      = h;
+        use->col    = c;
+        use->bw     = bw;
+        render_cached_box( use );
+    }
+
+    use->last_used = ++stamp;
+
+    /* The copy GC isn't clipped, so only copy what's within the current
+       clipping region */
+
+    if ( fl_get_clipping( 1, &cx, &cy, &cw, &ch ) )
+    {
+        sx = FL_max( x, cx );
+        sy = FL_max( y, cy );
+        sw = FL_min( x + w, cx + cw ) - sx;
+        sh = FL_min( y + h, cy + ch ) - sy;
+    }
+
+    if ( sw <= 0 || sh <= 0 )
+        return 1;
+
+    if ( ! box_copy_gc[ fl_vmode ] )
+    {
+        box_copy_gc[ fl_vmode ] = XCreateGC( flx->display, flx->win, 0, NULL );
+        XSetGraphicsExposures( flx->display, box_copy_gc[ fl_vmode ], False );
+    }
+
+    fli_flush_batch_area( sx, sy, sw, sh );
+    XCopyArea( flx->display, use->pixmap, flx->win, box_copy_gc[ fl_vmode ],
+               sx - x, sy - y, sw, sh, sx, sy );
+    return 1;
+}
+
+
 /***************************************
  * Draw a rectangular box. TODO: need to change primitive box
  * drawing using frame
@@ -353,7 +572,7 @@ fl_draw_box( int      style,
     if ( c == FL_NoColor )
         c = FL_COL1;
 
-    if ( style == FL_NO_BOX )
+    if ( style == FL_NO_BOX || draw_cached_box( style, x, y, w, h, c, bw ) )
         return;
 
     if ( ! ( B = ( bw > 0 ) ) )
@@ -785,11 +1004,64 @@ fl_draw_frame( int      style,
 
 /********* Some convience functions, sort of GL in X   ******{*****/
 
-#define MAX_BUF_POINT  128
-static FL_POINT xpbuf[ MAX_BUF_POINT ];
+/* The buffer for the vertices grows as needed and is kept for reuse */
+
+static FL_POINT *xpbuf;
+static int xpbuf_size;
 static int npt;
 static FL_COLOR pcol;
 
+/* Range coordinates get restricted to, X uses 16-bit coordinates and
+   some servers have problems with values near the limits */
+
+#define MIN_COORD  -16384.0f
+#define MAX_COORD   16383.0f
+
+
+/***************************************
+ * Returns a pointer to the place where the next 'n' vertices are to be
+ * stored, making sure there's also room for the one polygons need for
+ * closing them
+ ***************************************/
+
+static FL_POINT *
+get_vertex_space( int n )
+{
+    if ( npt + n + 1 > xpbuf_size )
+    {
+        xpbuf_size = FL_max( 2 * xpbuf_size, npt + n + 1 );
+        xpbuf_size = FL_max( xpbuf_size, 128 );
+        xpbuf = fl_realloc( xpbuf, xpbuf_size * sizeof *xpbuf );
+    }
+
+    return xpbuf + npt;
+}
+
+
+/***************************************
+ * Converts 'n' pairs of floating point coordinates to vertices (rounded
+ * to the nearest integers and restricted to the range X can handle).
+ * There are no dependencies between the iterations of the loop, so the
+ * compiler can vectorize it.
+ ***************************************/
+
+static void
+convert_float_vertices( FL_POINT    * p,
+                        const float * xy,
+                        int           n )
+{
+    short *dest = &p->x;
+    int i;
+
+    for ( i = 0; i < 2 * n; i++ )
+    {
+        float v = xy[ i ];
+
+        v = v < MIN_COORD ? MIN_COORD : ( v > MAX_COORD ? MAX_COORD : v );
+        dest[ i ] = v >= 0.0f ? v + 0.5f : v - 0.5f;
+    }
+}
+
 
 /***************************************
  ***************************************/
@@ -798,14 +1070,11 @@ void
 fli_add_vertex( FL_Coord x,
                 FL_Coord y )
 {
-    if ( npt >= MAX_BUF_POINT )
-    {
-        M_err( "fli_add_vertex", "Vertices Out of bounds" );
-        return;
-    }
+    FL_POINT *p = get_vertex_space( 1 );
 
-    xpbuf[ npt   ].x = x;
-    xpbuf[ npt++ ].y = y;
+    p->x = x;
+    p->y = y;
+    npt++;
 }
 
 
@@ -816,14 +1085,12 @@ void
 fli_add_float_vertex( float x,
                       float y )
 {
-    if ( npt >= MAX_BUF_POINT )
-    {
-        M_err( "fli_add_float_vertex", "Vertices Out of bounds" );
-        return;
-    }
+    float xy[ 2 ];
 
-    xpbuf[ npt   ].x = FL_nint( x );
-    xpbuf[ npt++ ].y = FL_nint( y );
+    xy[ 0 ] = x;
+    xy[ 1 ] = y;
+    convert_float_vertices( get_vertex_space( 1 ), xy, 1 );
+    npt++;
 }
 
 
@@ -844,12 +1111,6 @@ fli_reset_vertex( void )
 void
 fli_endline( void )
 {
-    if ( npt >= MAX_BUF_POINT )
-    {
-        M_err( "fli_endline", "Vertices Out of bounds" );
-        return;
-    }
-
     fl_lines( xpbuf, npt, flx->color );
 }
 
@@ -860,29 +1121,223 @@ fli_endline( void )
 void
 fli_endclosedline( void )
 {
-    if ( npt + 1 >= MAX_BUF_POINT )
+    if ( npt > 0 )
+        fl_polyl( xpbuf, npt, pcol );
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+fli_endpolygon( void )
+{
+    if ( npt > 0 )
+        fl_polyf( xpbuf, npt, flx->color );
+}
+
+
+/* Bits of the outcodes for Cohen-Sutherland line clipping */
+
+#define CS_LEFT    1
+#define CS_RIGHT   2
+#define CS_TOP     4
+#define CS_BOTTOM  8
+
+
+/***************************************
+ * Returns the outcode of a point with respect to a rectangle
+ ***************************************/
+
+static int
+outcode( float         x,
+         float         y,
+         const float * r )
+{
+    int code = 0;
+
+    if ( x < r[ 0 ] )
+        code |= CS_LEFT;
+    else if ( x > r[ 2 ] )
+        code |= CS_RIGHT;
+
+    if ( y < r[ 1 ] )
+        code |= CS_TOP;
+    else if ( y > r[ 3 ] )
+        code |= CS_BOTTOM;
+
+    return code;
+}
+
+
+/***************************************
+ * Clips a line segment to a rectangle (given as left, top, right and
+ * bottom coordinates), returns 0 if nothing of the segment is left
+ ***************************************/
+
+static int
+clip_segment( float       * seg,
+              const float * r )
+{
+    int c0 = outcode( seg[ 0 ], seg[ 1 ], r ),
+        c1 = outcode( seg[ 2 ], seg[ 3 ], r );
+
+    while ( c0 | c1 )
     {
-        M_err( "fli_endclosedline", "Vertices Out of bounds" );
-        return;
+        int c = c0 ? c0 : c1;
+        float x,
+              y;
+
+        if ( c0 & c1 )
+            return 0;
+
+        if ( c & CS_LEFT )
+        {
+            x = r[ 0 ];
+            y = seg[ 1 ] + ( seg[ 3 ] - seg[ 1 ] ) * ( x - seg[ 0 ] )
+                           / ( seg[ 2 ] - seg[ 0 ] );
+        }
+        else if ( c & CS_RIGHT )
+        {
+            x = r[ 2 ];
+            y = seg[ 1 ] + ( seg[ 3 ] - seg[ 1 ] ) * ( x - seg[ 0 ] )
+                           / ( seg[ 2 ] - seg[ 0 ] );
+        }
+        else if ( c & CS_TOP )
+        {
+            y = r[ 1 ];
+            x = seg[ 0 ] + ( seg[ 2 ] - seg[ 0 ] ) * ( y - seg[ 1 ] )
+                           / ( seg[ 3 ] - seg[ 1 ] );
+        }
+        else
+        {
+            y = r[ 3 ];
+            x = seg[ 0 ] + ( seg[ 2 ] - seg[ 0 ] ) * ( y - seg[ 1 ] )
+                           / ( seg[ 3 ] - seg[ 1 ] );
+        }
+
+        if ( c == c0 )
+        {
+            seg[ 0 ] = x;
+            seg[ 1 ] = y;
+            c0 = outcode( x, y, r );
+        }
+        else
+        {
+            seg[ 2 ] = x;
+            seg[ 3 ] = y;
+            c1 = outcode( x, y, r );
+        }
     }
 
-    fl_polyl( xpbuf, npt, pcol );
+    return 1;
 }
 
 
 /***************************************
+ * Draws the vertices collected so far as a polyline and starts over
+ ***************************************/
+
+static void
+flush_polyline( FL_COLOR col )
+{
+    if ( npt > 1 )
+        fl_lines( xpbuf, npt, col );
+    npt = 0;
+}
+
+
+/***************************************
+ * Draws connected line segments between 'n' points with floating point
+ * coordinates, stored as x, y pairs in 'xy'. There's no limit on the
+ * number of points. Segments get clipped to the current clipping region
+ * (or, if there's no clipping, to the range of coordinates X can deal
+ * with) before being converted to integer coordinates, so points far
+ * outside of the drawable don't result in wrapped-around coordinates.
  ***************************************/
 
 void
-fli_endpolygon( void )
+fl_polyline_f( const float * xy,
+               int           n,
+               FL_COLOR      col )
 {
-    if ( npt + 1 >= MAX_BUF_POINT )
+    float r[ 4 ];
+    FL_Coord x = 0,
+             y = 0,
+             w = 0,
+             h = 0;
+    int i;
+
+    if ( flx->win == None || ! xy || n < 2 )
+        return;
+
+    /* Clip to a slightly larger rectangle than the clipping region so
+       that wide lines and line joins at its borders look right */
+
+    if ( fl_get_clipping( 1, &x, &y, &w, &h ) )
     {
-        M_err( "fli_endpolygon", "Vertices Out of bounds" );
+        float m = fl_get_linewidth( ) + 1;
+
+        r[ 0 ] = x - m;
+        r[ 1 ] = y - m;
+        r[ 2 ] = x + w + m;
+        r[ 3 ] = y + h + m;
+    }
+    else
+    {
+        r[ 0 ] = r[ 1 ] = MIN_COORD;
+        r[ 2 ] = r[ 3 ] = MAX_COORD;
+    }
+
+    npt = 0;
+
+    /* Usually all points are within the rectangle and can be converted
+       all at once */
+
+    for ( i = 0; i < n && ! outcode( xy[ 2 * i ], xy[ 2 * i + 1 ], r ); i++ )
+        /* empty */ ;
+
+    if ( i == n )
+    {
+        convert_float_vertices( get_vertex_space( n ), xy, n );
+        npt = n;
+        flush_polyline( col );
         return;
     }
 
-    fl_polyf( xpbuf, npt, flx->color );
+    /* Otherwise clip each segment, whenever a segment had its start
+       point moved or a part at its end cut off a new polyline has to
+       be started */
+
+    for ( i = 0; i < n - 1; i++ )
+    {
+        float seg[ 4 ];
+
+        memcpy( seg, xy + 2 * i, sizeof seg );
+
+        if ( ! clip_segment( seg, r ) )
+        {
+            flush_polyline( col );
+            continue;
+        }
+
+        if ( seg[ 0 ] != xy[ 2 * i ] || seg[ 1 ] != xy[ 2 * i + 1 ] )
+            flush_polyline( col );
+
+        if ( npt == 0 )
+        {
+            convert_float_vertices( get_vertex_space( 1 ), seg, 1 );
+            npt++;
+        }
+
+        convert_float_vertices( get_vertex_space( 1 ), seg + 2, 1 );
+        npt++;
+
+        if ( seg[ 2 ] != xy[ 2 * i + 2 ] || seg[ 3 ] != xy[ 2 * i + 3 ] )
+            flush_polyline( col );
+    }
+
+    flush_polyline( col );
 }
 
 
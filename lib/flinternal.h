@@ -310,6 +310,37 @@ long fli_query_namedcolor( const char *s );
 
 void fli_free_xtext_workmem( void );
 
+/* Line breaks, underline positions and widths of a (multi-line) string
+   as drawn by fli_draw_string(). For object labels this is kept with
+   the object and only redone when the label or its font changes. */
+
+typedef struct {
+    char * str;                 /* the line, '\0'-terminated */
+    int    len;                 /* its length (without underline char) */
+    int    index;               /* where the line begins in the string */
+    int    underline_index;     /* -1 if nothing is to be underlined */
+    int    width;               /* width in pixels */
+    XRectangle ul;              /* underline, relative to the baseline */
+    int    x;                   /* position where it was drawn last */
+    int    y;
+} FLI_LINE_INFO;
+
+struct FL_label_layout_ {
+    char          * str;        /* copy of the string, split into lines */
+    FLI_LINE_INFO * lines;
+    int             nlines;
+    int             maxlines;
+    const char    * label;      /* what the layout was made for */
+    int             style,
+                    size;
+    XFontStruct   * fs;
+    Font            fid;
+};
+
+void fli_set_label_object( FL_OBJECT * );
+
+void fli_free_label_layout( FL_OBJECT * );
+
 int fli_get_pos_in_string( int,
                            FL_Coord,
                            FL_Coord,
@@ -358,6 +389,8 @@ int fli_get_max_pixels_line( void );
 
 void fli_init_font( void );
 
+void fli_preload_form_fonts( FL_FORM * );
+
 void fli_canonicalize_rect( FL_Coord *,
                             FL_Coord *,
                             FL_Coord *,
@@ -443,6 +476,33 @@ void fli_set_additional_clipping( FL_Coord,
 
 FL_RECT * fli_get_global_clip_rect( void );
 
+void fli_begin_batch( void );
+
+void fli_end_batch( void );
+
+void fli_flush_batch( void );
+
+void fli_flush_batch_area( int,
+                           int,
+                           int,
+                           int );
+
+void fli_pause_batch( void );
+
+void fli_resume_batch( void );
+
+int fli_set_box_cache( int );
+
+int fli_get_box_cache( void );
+
+void fli_clear_box_cache( void );
+
+void fli_clear_symbol_cache( void );
+
+int fli_select_color_gc( FL_COLOR );
+
+void fli_forget_gc_color( FL_COLOR );
+
 
 /* Application windows */
 
@@ -773,6 +833,40 @@ void fli_recount_auto_objects( void );
 
 int fli_get_tabpixels( XFontStruct * );
 
+int fli_text_width( XFontStruct *,
+                    const char  *,
+                    int           );
+
+void fli_xft_init( void );
+
+int fli_xft_char_widths( XFontStruct *,
+                         int         * );
+
+int fli_xft_begin( Drawable,
+                   XFontStruct * );
+
+void fli_xft_end( void );
+
+int fli_xft_draw_string( Display    *,
+                         Drawable,
+                         GC,
+                         int,
+                         int,
+                         const char *,
+                         int );
+
+int fli_xft_draw_image_string( Display    *,
+                               Drawable,
+                               GC,
+                               int,
+                               int,
+                               const char *,
+                               int );
+
+void fli_xft_forget_font( XFontStruct * );
+
+void fli_xft_finish( void );
+
 int fli_get_default_scrollbarsize( FL_OBJECT * );
 
 void fli_set_app_name( const char *,
@@ -928,6 +1022,20 @@ int fli_find_closest_color( int,
                             int,
                             unsigned long * );
 
+void fli_forget_closest_color( const XColor * );
+
+typedef struct fli_icmap_ FLI_ICMAP;
+
+FLI_ICMAP *fli_icmap_create( const XColor *,
+                             int );
+
+void fli_icmap_free( FLI_ICMAP * );
+
+int fli_icmap_lookup( FLI_ICMAP *,
+                      int,
+                      int,
+                      int );
+
 void fli_rgbmask_to_shifts( unsigned long,
                             unsigned int *,
                             unsigned int * );
@@ -1079,6 +1187,8 @@ void fli_textcolor( FL_COLOR col );
 
 void fli_bk_textcolor( FL_COLOR col );
 
+void fli_free_newpixel( unsigned long );
+
 char * fli_fix_dirname( char * dir );
 
 Cursor fli_get_cursor_byname( int name );
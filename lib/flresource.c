@@ -77,6 +77,7 @@ static XrmOptionDescRec copt[ ] =
     { "-double",    "*doubleBuffer",     XrmoptionNoArg,  ( caddr_t ) "1" },
     { "-bw",        "*borderWidth",      XrmoptionSepArg, ( caddr_t ) 0   },
     { "-vid",       "*visualID",         XrmoptionSepArg, ( caddr_t ) 0   },
+    { "-xft",       "*useXft",           XrmoptionNoArg,  ( caddr_t ) "1" },
 
 #ifdef DO_GAMMA_CORRECTION
     { "-rgamma",    "*rgamma",           XrmoptionSepArg, ( caddr_t ) 0   },
@@ -106,7 +107,8 @@ static Bop OpPrivateMap,
            OpStandardMap,
            OpDouble;
 static Bop OpSync,
-           OpULW = "1";
+           OpULW = "1",
+           OpUseXft;
 static Iop OpDebug,
            OpDepth,
            OpULT = "-1";
@@ -181,6 +183,7 @@ static FL_resource internal_resources[ ] =
     SetR( ulPropWidth, "ULWidth", FL_BOOL, OpULW, 0 ),
     SetR( backingStore, "BackingStore", FL_INT, OpBS, 0 ),
     SetR( safe, "Safe", FL_INT, OpSafe, 0 ),
+    SetR( useXft, "UseXft", FL_BOOL, OpUseXft, 0 ),
     { "coordUnit", "CoordUnit", FL_STRING, OpCoordUnit, OpCoordUnit, 32 },
     { "visualID", "VisualID", FL_LONG, &fli_requested_vid, OpVisualID, 0 }
 };
@@ -296,6 +299,12 @@ fl_set_defaults( unsigned long   mask,
         sprintf( OpSafe, "%d", cntl->safe );
     }
 
+    if ( mask & FL_PDUseXft )
+    {
+        SetMember( useXft );
+        sprintf( OpUseXft, "%d", cntl->useXft != 0 );
+    }
+
     if ( mask & FL_PDBS )
     {
         SetMember( backingStore );
@@ -1149,6 +1158,7 @@ fl_initialize( int        * na,
 
     fl_vmode = fli_initialize_program_visual( );
     fli_init_colormap( fl_vmode );
+    fli_xft_init( );
     fli_init_font( );
     fli_init_context( );
 
@@ -1310,6 +1320,15 @@ fl_finish( void )
 
     fli_free_xtext_workmem( );
 
+    /* Close fonts used for drawing via Xft */
+
+    fli_xft_finish( );
+
+    /* Free the pixmaps of cached boxes and symbols */
+
+    fli_clear_box_cache( );
+    fli_clear_symbol_cache( );
+
     /* Release memory used for symbols */
 
     fli_release_symbols( );
@@ -47,6 +47,40 @@ static char * get_fname( const char *,
                          int );
 
 
+/* Direct lookup table for the fonts already loaded (or substituted),
+   indexed by style and size, so that the common case of a request for
+   a font we've seen before neither needs to assemble the font name nor
+   to search through the list of sizes of the style. Rows get allocated
+   only for styles actually used. */
+
+#define FS_LOOKUP_SIZES  128
+
+typedef struct {
+    XFontStruct * fs;
+    char        * name;     /* complete name of font requested */
+} FS_LOOKUP;
+
+static FS_LOOKUP * fs_lookup[ FL_MAXFONTS ];
+
+
+/* Table of the advance widths of all 256 characters of a font, so that
+   measuring a string doesn't require going through the XCharStruct's of
+   the font for each character. 'fixed_width' is set to the width of all
+   characters for fonts where all have the same width, otherwise -1. */
+
+typedef struct {
+    XFontStruct * fs;
+    int           fixed_width;
+    int           width[ 256 ];
+} WIDTH_TABLE;
+
+static WIDTH_TABLE ** width_tables;
+static int nwidth_tables;
+static WIDTH_TABLE * last_width_table;
+
+static void drop_width_table( XFontStruct * );
+
+
 /*
  * Question marks indicate the sizes in tenth of a point. It will be
  * replaced on the fly by the font requesting routines. Depending on
@@ -190,6 +224,44 @@ fl_set_font( int numb,
 }
 
 
+/***************************************
+ * Removes an entry from the font lookup table
+ ***************************************/
+
+static void
+forget_entry( FS_LOOKUP * e )
+{
+    if ( fli_curfnt == e->name )
+        fli_curfnt = "";
+
+    fli_safe_free( e->name );
+    e->fs = NULL;
+}
+
+
+/***************************************
+ * Removes all entries from the font lookup table that refer to a
+ * font that is about to be freed (including those where the font
+ * was used as a substitute for a font that couldn't be loaded)
+ ***************************************/
+
+static void
+forget_font( XFontStruct * fs )
+{
+    int n,
+        i;
+
+    for ( n = 0; n < FL_MAXFONTS; n++ )
+        if ( fs_lookup[ n ] )
+            for ( i = 0; i < FS_LOOKUP_SIZES; i++ )
+                if ( fs_lookup[ n ][ i ].fs == fs )
+                    forget_entry( fs_lookup[ n ] + i );
+
+    drop_width_table( fs );
+    fli_xft_forget_font( fs );
+}
+
+
 /***************************************
  * Add a new font (indexed by n) or change an existing font.
  * Preferably the font name constains a '?' in the size
@@ -228,10 +300,21 @@ fl_set_font_name( int          n,
 
         for ( i = 0; i < flf->nsize; i++ )
             if ( flf->size[ i ] > 0 )
+            {
+                forget_font( flf->fs[ i ] );
                 XFreeFont( flx->display, flf->fs[ i ] );
+            }
         *flf->fname = '\0';
     }
 
+    if ( fs_lookup[ n ] )
+    {
+        int i;
+
+        for ( i = 0; i < FS_LOOKUP_SIZES; i++ )
+            forget_entry( fs_lookup[ n ] + i );
+    }
+
     flf->nsize = 0;
     strcpy( flf->fname, name );
 
@@ -298,6 +381,24 @@ fl_enumerate_fonts( void ( * output )( const char *s ),
 }
 
 
+/***************************************
+ * Stores a font in the lookup table together with the name of
+ * the font requested (which then becomes the current font name)
+ ***************************************/
+
+static void
+remember_font( FS_LOOKUP   * e,
+               XFontStruct * fs )
+{
+    if ( ! e )
+        return;
+
+    e->fs = fs;
+    e->name = fl_strdup( fli_curfnt );
+    fli_curfnt = e->name;
+}
+
+
 /***************************************
  * All font changes go through this routine. If with_fail is false,
  * this routine will not fail even if requested font can't be loaded.
@@ -311,6 +412,7 @@ try_get_font_struct( int numb,
 {
     FL_FONT *flf = fl_fonts;
     XFontStruct *fs = NULL;
+    FS_LOOKUP *e = NULL;
     int i,
         is_subst = 0;
 
@@ -347,7 +449,25 @@ try_get_font_struct( int numb,
         return fl_state[ fl_vmode ].cur_fnt;
     }
 
-    strcpy( fli_curfnt, get_fname( flf->fname, size ) );
+    /* Check the lookup table first, that's all that's needed for all
+       but the very first request for a style and size */
+
+    if ( size < FS_LOOKUP_SIZES )
+    {
+        if ( ! fs_lookup[ numb ] )
+            fs_lookup[ numb ] = fl_calloc( FS_LOOKUP_SIZES,
+                                           sizeof *fs_lookup[ numb ] );
+
+        e = fs_lookup[ numb ] + size;
+
+        if ( e->fs )
+        {
+            fli_curfnt = e->name;
+            return e->fs;
+        }
+    }
+
+    fli_curfnt = get_fname( flf->fname, size );
 
     /* Search for requested size in the cached fonts - fonts with "negative
        sizes" are replacement fonts found before */
@@ -359,7 +479,10 @@ try_get_font_struct( int numb,
     /* Return it if font has already been loaded (i.e. is in the cache) */
 
     if ( fs )
+    {
+        remember_font( e, fs );
         return fs;
+    }
 
     /* Try to load the font */
 
@@ -403,14 +526,24 @@ try_get_font_struct( int numb,
 
     if ( flf->nsize == FL_MAX_FONTSIZES )
     {
-        if ( flf->size[ FL_MAX_FONTSIZES - 1 ] > 0 )
+        int old_size = flf->size[ FL_MAX_FONTSIZES - 1 ];
+
+        if ( old_size > 0 )
+        {
+            forget_font( flf->fs[ FL_MAX_FONTSIZES - 1 ] );
             XFreeFont( flx->display, flf->fs[ FL_MAX_FONTSIZES - 1 ] );
+        }
+        else if ( - old_size < FS_LOOKUP_SIZES && fs_lookup[ numb ] )
+            forget_entry( fs_lookup[ numb ] - old_size );
+
         flf->nsize--;
     }
 
     flf->fs[ flf->nsize ] = fs;
     flf->size[ flf->nsize++ ] = is_subst ? - size : size;
 
+    remember_font( e, fs );
+
     /* Here we are guranteed a valid font handle although there is no
        gurantee the font handle corresponds to the font requested */
 
@@ -429,6 +562,177 @@ fl_get_font_struct( int style,
 }
 
 
+/***************************************
+ * Loads all fonts needed for the labels of the objects of a form
+ * in one go before the form gets shown, so that drawing the form
+ * the first time doesn't get interrupted by lots of requests for
+ * fonts. Fonts already loaded cost a table lookup only.
+ ***************************************/
+
+void
+fli_preload_form_fonts( FL_FORM * form )
+{
+    FL_OBJECT *obj;
+
+    if ( ! form || fli_no_connection || ! flx || ! flx->display )
+        return;
+
+    for ( obj = form->first; obj; obj = obj->next )
+        if (    obj->objclass != FL_BEGIN_GROUP
+             && obj->objclass != FL_END_GROUP
+             && obj->label
+             && *obj->label )
+            fl_get_font_struct( obj->lstyle, obj->lsize );
+}
+
+
+/***************************************
+ * Returns the information about a character of a font, using the
+ * same rules as Xlib does (i.e. characters not within the range of
+ * the font or that don't exist are replaced by the default character,
+ * and NULL gets returned if that doesn't exist either)
+ ***************************************/
+
+static XCharStruct *
+get_char_info( XFontStruct * fs,
+               unsigned int  ch )
+{
+    unsigned int row = ch >> 8,
+                 col = ch & 0xff;
+    XCharStruct *cs;
+
+    if (    row < fs->min_byte1
+         || row > fs->max_byte1
+         || col < fs->min_char_or_byte2
+         || col > fs->max_char_or_byte2 )
+        return NULL;
+
+    if ( ! fs->per_char )
+        return &fs->min_bounds;
+
+    cs = fs->per_char
+         + ( row - fs->min_byte1 )
+           * ( fs->max_char_or_byte2 - fs->min_char_or_byte2 + 1 )
+         + col - fs->min_char_or_byte2;
+
+    if (    cs->width == 0
+         && ! ( cs->lbearing | cs->rbearing | cs->ascent | cs->descent ) )
+        return NULL;
+
+    return cs;
+}
+
+
+/***************************************
+ * Returns the table of character widths for a font, creating it
+ * if it doesn't exist yet
+ ***************************************/
+
+static WIDTH_TABLE *
+get_width_table( XFontStruct * fs )
+{
+    WIDTH_TABLE *wt;
+    XCharStruct *def,
+                *cs;
+    int i;
+
+    if ( last_width_table && last_width_table->fs == fs )
+        return last_width_table;
+
+    for ( i = 0; i < nwidth_tables; i++ )
+        if ( width_tables[ i ]->fs == fs )
+            return last_width_table = width_tables[ i ];
+
+    wt = fl_malloc( sizeof *wt );
+    wt->fs = fs;
+
+    /* Only the first row of two-byte fonts can be reached with single
+       byte strings */
+
+    def = get_char_info( fs, fs->default_char );
+
+    /* If text gets drawn via Xft the widths must be those of the Xft
+       font used instead of the core font */
+
+    if ( fli_xft_char_widths( fs, wt->width ) )
+    {
+        wt->fixed_width = wt->width[ 0 ];
+        for ( i = 1; i < 256 && wt->fixed_width >= 0; i++ )
+            if ( wt->width[ i ] != wt->fixed_width )
+                wt->fixed_width = -1;
+    }
+    else
+    {
+        for ( i = 0; i < 256; i++ )
+        {
+            if ( ! ( cs = get_char_info( fs, i ) ) )
+                cs = def;
+            wt->width[ i ] = cs ? cs->width : 0;
+        }
+
+        /* Same shortcut as Xlib takes for fonts with fixed width
+           characters */
+
+        wt->fixed_width =    def && fs->min_bounds.width == fs->max_bounds.width
+                           ? fs->min_bounds.width : -1;
+    }
+
+    width_tables = fl_realloc( width_tables,
+                               ++nwidth_tables * sizeof *width_tables );
+    width_tables[ nwidth_tables - 1 ] = wt;
+
+    return last_width_table = wt;
+}
+
+
+/***************************************
+ * Gets rid of the table of character widths of a font about to be freed
+ ***************************************/
+
+static void
+drop_width_table( XFontStruct * fs )
+{
+    int i;
+
+    if ( last_width_table && last_width_table->fs == fs )
+        last_width_table = NULL;
+
+    for ( i = 0; i < nwidth_tables; i++ )
+        if ( width_tables[ i ]->fs == fs )
+        {
+            fl_free( width_tables[ i ] );
+            width_tables[ i ] = width_tables[ --nwidth_tables ];
+            break;
+        }
+}
+
+
+/***************************************
+ * Returns the width of a string (which must not contain tabs or
+ * newlines) in the given font. Does the same as XTextWidth() but
+ * uses a table of the widths of the characters of the font instead
+ * of having to look up the information for each character.
+ ***************************************/
+
+int
+fli_text_width( XFontStruct * fs,
+                const char  * s,
+                int           len )
+{
+    WIDTH_TABLE *wt = get_width_table( fs );
+    const unsigned char *p = ( const unsigned char * ) s;
+    int w = 0;
+
+    if ( wt->fixed_width >= 0 )
+        return len > 0 ? len * wt->fixed_width : 0;
+
+    while ( len-- > 0 )
+        w += wt->width[ *p++ ];
+
+    return w;
+}
+
+
 /***************************************
  * Similar to fl_get_string_xxxGC except that there is no side effects.
  * Must not free the fontstruct as structure FL_FONT caches the
@@ -443,7 +747,7 @@ fl_get_string_width( int          style,
 {
     XFontStruct *fs = fl_get_font_struct( style, size );
 
-    return fli_no_connection ? ( len * size ) : XTextWidth( fs, s, len );
+    return fli_no_connection ? ( len * size ) : fli_text_width( fs, s, len );
 }
 
 
@@ -468,11 +772,11 @@ fli_get_string_widthTABfs( XFontStruct * fs,
     for ( w = 0, q = s; *q && ( p = strchr( q, '\t' ) ) && ( p - s ) < len;
           q = p + 1 )
     {
-        w += XTextWidth( fs, q, p - q );
+        w += fli_text_width( fs, q, p - q );
         w = ( ( w / tab ) + 1 ) * tab;
     }
 
-    return w += XTextWidth( fs, q, len - ( q - s ) );
+    return w += fli_text_width( fs, q, len - ( q - s ) );
 }
 
 
@@ -644,8 +948,8 @@ fl_set_tabstop( const char *s )
 int
 fli_get_tabpixels( XFontStruct * fs )
 {
-    return   XTextWidth( fs, *tabstop, *tabstopNchar )
-           + XTextWidth( fs, " ", 1 );
+    return   fli_text_width( fs, *tabstop, *tabstopNchar )
+           + fli_text_width( fs, " ", 1 );
 }
 
 
@@ -691,7 +995,7 @@ static char *
 get_fname( const char * str,
            int          size )
 {
-    static char fname[ sizeof fli_curfnt ];
+    static char fname[ 127 ];
     char len_str[ 50 ];    /* should be enough for all ints */
     char *p;
 
@@ -858,6 +858,25 @@ fl_set_form_dblbuffer( FL_FORM * form,
 }
 
 
+/***************************************
+ * Switches on or off drawing the boxes of the objects of a form from
+ * pixmaps in which boxes with the same properties were drawn before
+ ***************************************/
+
+void
+fl_set_form_box_cache( FL_FORM * form,
+                       int       yesno )
+{
+    if ( ! form )
+    {
+        M_err( "fl_set_form_box_cache", "NULL form" );
+        return;
+    }
+
+    form->use_box_cache = yesno;
+}
+
+
 /***************************************
  * Sets the size of a form
  ***************************************/
@@ -1359,6 +1378,8 @@ fl_show_form_window( FL_FORM * form )
     if ( form->window == None || form->visible != FL_INVISIBLE )
         return form->window;
 
+    fli_preload_form_fonts( form );
+
     fl_winshow( form->window );
     form->visible = FL_VISIBLE;
     reshape_form( form );
@@ -87,7 +87,7 @@ FL_IOPT fli_cntl;
 
 FLI_CONTEXT *fli_context;
 
-char fli_curfnt[ 127 ];
+const char *fli_curfnt = "";
 
 FL_FORM *fl_current_form;
 
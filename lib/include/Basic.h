@@ -668,6 +668,7 @@ typedef enum {
 typedef struct FL_FORM_    FL_FORM;
 typedef struct FL_OBJECT_  FL_OBJECT;
 typedef struct FL_pixmap_  FL_pixmap;
+typedef struct FL_label_layout_  FL_label_layout;
 
 struct FL_OBJECT_ {
     FL_FORM        * form;           /* the form this object belongs to */
@@ -771,6 +772,8 @@ struct FL_OBJECT_ {
     int              group_id;
     int              want_motion;
     int              want_update;
+    FL_label_layout * label_layout;  /* cached line breaks and widths of
+                                        the label (internal use only) */
 };
 
 
@@ -892,6 +895,7 @@ struct FL_FORM_ {
     void                   ( * pre_attach )( FL_FORM * );
     void                 * attach_data;
     int                    in_redraw;
+    int                    use_box_cache;    /* true if boxes get cached */
 };
 
 
@@ -1113,6 +1117,9 @@ FL_EXPORT void fl_redraw_form( FL_FORM * form );
 FL_EXPORT void fl_set_form_dblbuffer( FL_FORM * form,
                                       int       y );
 
+FL_EXPORT void fl_set_form_box_cache( FL_FORM * form,
+                                      int       y );
+
 FL_EXPORT Window fl_prepare_form_window( FL_FORM    * form,
                                          int          place,
                                          int          border,
@@ -1500,6 +1507,10 @@ FL_EXPORT unsigned long fl_getmcolor( FL_COLOR   i,
 
 FL_EXPORT unsigned long fl_get_pixel( FL_COLOR col );
 
+FL_EXPORT void fl_get_pixels( const FL_COLOR * cols,
+                              unsigned long  * pixels,
+                              int              n );
+
 #define fl_get_flcolor   fl_get_pixel
 
 FL_EXPORT void fl_get_icm_color( FL_COLOR   col,
@@ -237,6 +237,10 @@ FL_EXPORT void fl_lines( FL_POINT * xp,
                          int        n,
                          FL_COLOR   col );
 
+FL_EXPORT void fl_polyline_f( const float * xy,
+                              int           n,
+                              FL_COLOR      col );
+
 FL_EXPORT void fl_line( FL_Coord xi,
                         FL_Coord yi,
                         FL_Coord xf,
@@ -730,6 +734,7 @@ typedef struct {
     int    safe;
     char * rgbfile;             /* where RGB file is, not used */
     char   vname[ 24 ];
+    int    useXft;              /* draw text via Xft if available */
 } FL_IOPT;
 
 #define FL_PDButtonLabelSize  FL_PDButtonFontSize
@@ -762,7 +767,8 @@ enum {
     FL_PDMenuFontSize    = ( 1 << 21 ),
     FL_PDBrowserFontSize = ( 1 << 22 ),
     FL_PDChoiceFontSize  = ( 1 << 23 ),
-    FL_PDLabelFontSize   = ( 1 << 24 )
+    FL_PDLabelFontSize   = ( 1 << 24 ),
+    FL_PDUseXft          = ( 1 << 25 )
 };
 
 #define FL_PDButtonLabel   FL_PDButtonLabelSize
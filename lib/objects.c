@@ -690,6 +690,7 @@ fl_free_object( FL_OBJECT * obj )
 
     /* Finally free all other memory we allocated for the object */
 
+    fli_free_label_layout( obj );
     fli_safe_free( obj->label );
     fli_safe_free( obj->tooltip );
     fli_safe_free( obj->shortcut );
@@ -1087,6 +1088,7 @@ fl_set_object_label( FL_OBJECT  * obj,
         fl_hide_object( obj );
     }
 
+    fli_free_label_layout( obj );
     obj->label = fl_realloc( obj->label, strlen( label ) + 1 );
     strcpy( obj->label, label );
 
@@ -1228,6 +1230,7 @@ fl_set_object_lsize( FL_OBJECT * obj,
     }
 
     obj->lsize = lsize;
+    fli_free_label_layout( obj );
     fli_handle_object( obj, FL_ATTRIB, 0, 0, 0, NULL, 0 );
 
     if ( obj->objclass == FL_TABFOLDER )
@@ -1294,6 +1297,7 @@ fl_set_object_lstyle( FL_OBJECT * obj,
     }
 
     obj->lstyle = lstyle;
+    fli_free_label_layout( obj );
     fli_handle_object( obj, FL_ATTRIB, 0, 0, 0, NULL, 0 );
 
     if ( obj->objclass == FL_TABFOLDER )
@@ -1906,6 +1910,7 @@ fl_set_object_shortcut( FL_OBJECT  * obj,
     {
         size_t len = strlen( obj->label ) + 1;
 
+        fli_free_label_layout( obj );
         obj->label = fl_realloc( obj->label, len + 1 );
         memmove( obj->label + n + 1, obj->label + n, len - n );
         obj->label[ n ] = *fl_ul_magic_char;
@@ -2296,6 +2301,24 @@ objects_intersect( const FL_OBJECT * obj1,
 }
 
 
+/***************************************
+ * Returns if an object might draw using other means than the functions
+ * from xdraw.c and thus can't have its drawing batched
+ ***************************************/
+
+static int
+draws_unbatched( FL_OBJECT * obj )
+{
+    return    obj->objclass == FL_FREE
+           || obj->objclass == FL_CANVAS
+           || obj->objclass == FL_GLCANVAS
+           || obj->objclass == FL_XYPLOT
+           || obj->objclass >= FL_USER_CLASS_START
+           || obj->prehandle
+           || obj->posthandle;
+}
+
+
 /***************************************
  * Redraws a form or only a subset of its objects - when called with the
  * 'draw_all' argument being set it redraws the complete form with all its
@@ -2310,6 +2333,7 @@ redraw( FL_FORM * form,
         int       draw_all )
 {
     FL_OBJECT *obj;
+    int box_cache;
 
     /* If the form is invisible or frozen we're already done */
 
@@ -2331,9 +2355,16 @@ redraw( FL_FORM * form,
     fli_set_form_window( form );
     fli_create_form_pixmap( form );
 
+    /* Collect rectangles, lines etc. of the same color for drawing them
+       with as few requests as possible */
+
+    fli_begin_batch( );
+    box_cache = fli_set_box_cache( form->use_box_cache );
+
     for ( obj = bg_object( form ); obj; obj = obj->next )
     {
-        int needs_redraw = obj->redraw;
+        int needs_redraw = obj->redraw,
+            unbatched;
 
         obj->redraw = 0;
 
@@ -2353,6 +2384,12 @@ redraw( FL_FORM * form,
 
         fli_create_object_pixmap( obj );
 
+        /* Objects that may draw using Xlib directly must be drawn with
+           batching switched off */
+
+        if ( ( unbatched = draws_unbatched( obj ) ) )
+            fli_pause_batch( );
+
         /* Don't allow free objects to draw outside of their boxes. */
 
         if ( obj->objclass == FL_FREE )
@@ -2375,8 +2412,14 @@ redraw( FL_FORM * form,
         fli_show_object_pixmap( obj );
 
         fli_handle_object( obj, FL_DRAWLABEL, 0, 0, 0, NULL, 0 );
+
+        if ( unbatched )
+            fli_resume_batch( );
     }
 
+    fli_set_box_cache( box_cache );
+    fli_end_batch( );
+
     /* Copy the forms pixmap to its window (if double buffering is on) */
 
     fli_show_form_pixmap( form );
@@ -2927,17 +2970,21 @@ FL_RECT *
 fli_intersect_rects( const FL_RECT * r1,
                      const FL_RECT * r2 )
 {
-    FL_RECT * p = fl_malloc( sizeof *p );
-    int x = FL_min( r1->x + r1->width,  r2->x + r2->width  ),
-        y = FL_min( r1->y + r1->height, r2->y + r2->height );
+    FL_RECT * p;
+    int x = FL_max( r1->x, r2->x ),
+        y = FL_max( r1->y, r2->y ),
+        w = FL_min( r1->x + r1->width,  r2->x + r2->width  ) - x,
+        h = FL_min( r1->y + r1->height, r2->y + r2->height ) - y;
 
-    p->x      = FL_max( r1->x, r2->x );
-    p->y      = FL_max( r1->y, r2->y );
-    p->width  = x - p->x;
-    p->height = y - p->y;
+    /* Check before storing, width and height of a FL_RECT are unsigned */
 
-    if ( p->width <= 0 || p->height <= 0 )
-        fli_safe_free( p );
+    if ( w <= 0 || h <= 0 || ! ( p = fl_malloc( sizeof *p ) ) )
+        return NULL;
+
+    p->x      = x;
+    p->y      = y;
+    p->width  = w;
+    p->height = h;
 
     return p;
 }
@@ -3087,12 +3134,16 @@ fl_draw_object_label( FL_OBJECT * obj )
 
     align = fl_to_outside_lalign( obj->align );
 
+    fli_set_label_object( obj );
+
     if ( fl_is_inside_lalign( obj->align ) )
         fl_draw_text( align, obj->x, obj->y, obj->w, obj->h,
                       obj->lcol, obj->lstyle, obj->lsize, obj->label );
     else
         fl_draw_text_beside( align, obj->x, obj->y, obj->w, obj->h,
                              obj->lcol, obj->lstyle, obj->lsize, obj->label );
+
+    fli_set_label_object( NULL );
 }
 
 
@@ -3102,9 +3153,11 @@ fl_draw_object_label( FL_OBJECT * obj )
 void
 fl_draw_object_label_outside( FL_OBJECT * obj )
 {
+    fli_set_label_object( obj );
     fl_draw_text_beside( fl_to_outside_lalign( obj->align ),
                          obj->x, obj->y, obj->w, obj->h,
                          obj->lcol, obj->lstyle, obj->lsize, obj->label );
+    fli_set_label_object( NULL );
 }
 
 
@@ -87,6 +87,8 @@ handle_background( FL_OBJECT * obj,
     if ( obj->type == FL_INVISIBLE_POSITIONER || FL_ObjWin( obj ) == None )
         return;
 
+    fli_flush_batch( );
+
     /* If no GC has been created do it now. */
 
     if ( sp->copy_gc == None )
@@ -93,7 +93,8 @@ draw_motion( FL_OBJECT * ob )
 {
     FLI_SLIDER_SPEC *sp = ob->spec;
     XRectangle xrec[ 2 ];
-    int abbw = FL_abs( ob->bw );
+    int abbw = FL_abs( ob->bw ),
+        i;
     FL_COLOR col;
 
     if (    ob->type != FL_VERT_BROWSER_SLIDER2
@@ -130,9 +131,17 @@ draw_motion( FL_OBJECT * ob )
             xrec[ 1 ].height = sp->h - knob.y - knob.h + 1;
         }
 
-        XSetClipRectangles( flx->display, flx->gc, 0, 0, xrec, 2, Unsorted );
-        fl_draw_box( FL_FLAT_BOX, ob->x + sp->x + abbw, ob->y + sp->y + abbw,
-                     sp->w - 2 * abbw, sp->h - 2 * abbw, ob->col1, 0 );
+        /* Draw the background on both sides of the knob, using the
+           clipping functions so all GCs get clipped */
+
+        for ( i = 0; i < 2; i++ )
+        {
+            fl_set_clipping( xrec[ i ].x, xrec[ i ].y,
+                             xrec[ i ].width, xrec[ i ].height );
+            fl_draw_box( FL_FLAT_BOX,
+                         ob->x + sp->x + abbw, ob->y + sp->y + abbw,
+                         sp->w - 2 * abbw, sp->h - 2 * abbw, ob->col1, 0 );
+        }
     }
     else if (    ob->type == FL_HOR_THIN_SLIDER
               || ob->type == FL_VERT_THIN_SLIDER
@@ -56,11 +56,41 @@ typedef struct
     FL_DRAWPTR   drawit;        /* how to draw it   */
     char       * name;          /* symbol name      */
     int          scalable;      /* currently unused */
+    int          builtin;       /* set for the library's own symbols */
+    size_t       next;          /* index + 1 of next symbol in hash chain */
 } SYMBOL;
 
 static SYMBOL * symbols = NULL;     /* list of symbols */
 static size_t nsymbols = 0;         /* number of symbols */
 
+/* Hash table for finding symbols by name, each entry is the index + 1 of
+   the first symbol of a chain (or 0 for an empty chain) */
+
+#define SYMBOL_HASH_SIZE  64
+
+static size_t symbol_hash[ SYMBOL_HASH_SIZE ];
+
+static int adding_builtins;
+
+/* Labels of symbols already parsed, with the symbol and the modifiers
+   found in the label. Entries get replaced when another label with the
+   same hash value is drawn. */
+
+typedef struct
+{
+    char   * label;
+    SYMBOL * sym;
+    int      delta;
+    int      equalscale;
+    int      rotated;
+} PARSED_LABEL;
+
+#define PARSED_LABELS  64
+
+static PARSED_LABEL parsed_labels[ PARSED_LABELS ];
+
+static void forget_parsed_labels( void );
+
 #define swapit( type, a, b )  \
     do { type a_;             \
          a_ = a;              \
@@ -83,6 +113,35 @@ static size_t nsymbols = 0;         /* number of symbols */
 
 
 
+/***************************************
+ ***************************************/
+
+static unsigned int
+hash_string( const char * s )
+{
+    unsigned int h = 0;
+
+    while ( *s )
+        h = 31 * h + ( unsigned char ) *s++;
+
+    return h;
+}
+
+
+/***************************************
+ * Adds a symbol from the list to the hash table
+ ***************************************/
+
+static void
+link_symbol( size_t i )
+{
+    unsigned int h = hash_string( symbols[ i ].name ) % SYMBOL_HASH_SIZE;
+
+    symbols[ i ].next = symbol_hash[ h ];
+    symbol_hash[ h ] = i + 1;
+}
+
+
 /***************************************
  * Check if the requested symbol exsits and return it (or NULL if it can't
  * be found)
@@ -91,15 +150,488 @@ static size_t nsymbols = 0;         /* number of symbols */
 static SYMBOL *
 find_symbol( const char * name )
 {
-    size_t i;
+    size_t i = symbol_hash[ hash_string( name ) % SYMBOL_HASH_SIZE ];
+
+    for ( ; i; i = symbols[ i - 1 ].next )
+        if ( ! strcmp( symbols[ i - 1 ].name, name ) )
+            return symbols + i - 1;
+
+    return NULL;
+}
+
+
+/***************************************
+ * Parses the label of a symbol, i.e. checks for character sequences
+ * that are for increasing or decreasing the size of the symbol,
+ * maintain the aspect ratio or indicate rotation, and looks up the
+ * symbol named by the rest of the label. Returns 0 if there's no
+ * such symbol.
+ ***************************************/
+
+static int
+parse_label( const char   * label,
+             PARSED_LABEL * p )
+{
+    static short defr[ ] = { 0, 225, 270, 315, 180, 0, 0, 135, 90, 45 };
+    int pos = 1;
+
+    p->delta = p->equalscale = p->rotated = 0;
+
+    while ( label[ pos ] )
+    {
+        if (    label[ pos ] == '-'
+             && isdigit( ( unsigned char ) label[ pos + 1 ] )
+             && label[ pos + 1 ] != '0' )
+        {
+            p->delta += label[ ++pos ] - '0';
+            ++pos;
+        }
+        else if (    label[ pos ] == '+'
+                  && isdigit( ( unsigned char ) label[ pos + 1 ] )
+                  && label[ pos + 1 ] != '0' )
+        {
+            p->delta -= label[ ++pos ] - '0';
+            ++pos;
+        }
+        else if ( label[ pos ] == '#' )
+        {
+            p->equalscale = 1;
+            ++pos;
+        }
+        else if ( isdigit( ( unsigned char ) label[ pos ] ) )
+        {
+            if ( label[ pos ] == '0' )
+            {
+                char *eptr;
+
+                p->rotated = strtol( label + ++pos, &eptr, 10 );
+                pos = eptr - label;
+
+                while ( p->rotated >= 360 )
+                    p->rotated %= 360;
+                while ( p->rotated < 0 )
+                    p->rotated = 360 - ( -p->rotated % 360 );
+            }
+            else
+                p->rotated = defr[ label[ pos++ ] - '0' ];
+        }
+        else
+            break;
+    }
+
+    /* Check if the reminder of the string is a valid symbol */
+
+    return ( p->sym = find_symbol( label + pos ) ) != NULL;
+}
+
+
+/***************************************
+ * Returns the parsed label from the list of already parsed labels,
+ * parsing it if it's not in there yet. Returns NULL if the label
+ * isn't for a known symbol.
+ ***************************************/
+
+static PARSED_LABEL *
+get_parsed_label( const char * label )
+{
+    PARSED_LABEL *p = parsed_labels + hash_string( label ) % PARSED_LABELS,
+                 tmp;
+
+    if ( p->label && ! strcmp( p->label, label ) )
+        return p;
+
+    if ( ! parse_label( label, &tmp ) )
+        return NULL;
+
+    fli_safe_free( p->label );
+    *p = tmp;
+    p->label = fl_strdup( label );
+
+    return p;
+}
+
+
+/***************************************
+ * Empties the list of already parsed labels
+ ***************************************/
+
+static void
+forget_parsed_labels( void )
+{
+    PARSED_LABEL *p;
+
+    for ( p = parsed_labels; p < parsed_labels + PARSED_LABELS; p++ )
+        fli_safe_free( p->label );
+}
+
+
+/***************************************
+ * Draws a symbol from a parsed label, clipped to its bounding box
+ ***************************************/
+
+static void
+draw_symbol( PARSED_LABEL * p,
+             FL_Coord       x,
+             FL_Coord       y,
+             FL_Coord       w,
+             FL_Coord       h,
+             FL_COLOR       col )
+{
+    FL_Coord dx = 0,
+             dy = 0;
+    int orig_x = x,
+        orig_y = y,
+        orig_w = w,
+        orig_h = h;
+    int is_clipped = 0,
+        clip_x,
+        clip_y,
+        clip_w,
+        clip_h;
+
+    if ( p->equalscale )
+    {
+        dx = w > h ? ( w - h ) / 2 : 0;
+        dy = w > h ? 0 : ( h - w ) / 2;
+        w = h = FL_min( w, h );
+    }
+
+    if ( p->delta )
+        ShrinkBox( x, y, w, h, p->delta );
+
+    if ( w <= 0 || h <= 0 )
+        return;
+
+    /* For rotated of 90 or 180 degrees switch w and h and the bounding box */
+
+    if ( p->rotated == 90 || p->rotated == 270 )
+    {
+        x += ( w - h ) / 2;
+        y += ( h - w ) / 2;
+        swapit( FL_Coord, w, h );
+    }
+
+    if ( fl_is_clipped( 0 ) )
+    {
+        is_clipped = 1;
+        fl_get_clipping( 0, &clip_x, &clip_y, &clip_w, &clip_h );
+        fli_set_additional_clipping( orig_x, orig_y, orig_w, orig_h );
+    }
+    else
+        fl_set_clipping( orig_x, orig_y, orig_w, orig_h );
+
+    /* User defined symbols may use Xlib directly */
+
+    fli_pause_batch( );
+    p->sym->drawit( x + dx, y + dy, w, h, p->rotated, col );
+    fli_resume_batch( );
+
+    if ( is_clipped )
+        fl_set_clipping( clip_x, clip_y, clip_w, clip_h );
+    else
+        fl_unset_clipping( );
+}
+
+
+/****************************************************************
+ * Symbol cache
+ *
+ * While a form that uses the box cache (see fl_set_form_box_cache())
+ * gets drawn the library's own symbols are kept in pixmaps, together
+ * with a mask of the pixels the symbol covers, so that drawing the
+ * same symbol again (as e.g. for a toolbar full of arrow buttons)
+ * just requires copying it through the mask. The mask is found by
+ * drawing the symbol on two different backgrounds and checking which
+ * pixels differ from the background in either of them.
+ ****************************************************************{*/
+
+#define SYMBOL_CACHE_SIZE      64
+#define SYMBOL_CACHE_MAX_AREA  ( 128 * 128 )
+
+typedef struct {
+    Pixmap        pixmap;
+    Pixmap        mask;
+    int           vmode;
+    SYMBOL      * sym;
+    int           delta;
+    int           equalscale;
+    int           rotated;
+    FL_Coord      w;
+    FL_Coord      h;
+    FL_COLOR      col;
+    int           lw;
+    int           ls;
+    unsigned long last_used;
+} CACHED_SYMBOL;
+
+static CACHED_SYMBOL symbol_cache[ SYMBOL_CACHE_SIZE ];
+
+/* GCs for copying through the masks and the masks they're set up for */
+
+static GC copy_gc[ DirectColor + 1 ];
+static Pixmap copy_gc_mask[ DirectColor + 1 ];
+
+
+/***************************************
+ * Frees the pixmaps of all cached symbols, needed when colors
+ * or symbols get changed
+ ***************************************/
+
+void
+fli_clear_symbol_cache( void )
+{
+    CACHED_SYMBOL *c;
+    int i;
+
+    for ( c = symbol_cache; c < symbol_cache + SYMBOL_CACHE_SIZE; c++ )
+        if ( c->pixmap != None )
+        {
+            XFreePixmap( flx->display, c->pixmap );
+            XFreePixmap( flx->display, c->mask );
+            c->pixmap = c->mask = None;
+        }
+
+    for ( i = 0; i <= DirectColor; i++ )
+        copy_gc_mask[ i ] = None;
+}
+
+
+/***************************************
+ * Draws the symbol on a background of the given color into the
+ * drawable the cache entry is for
+ ***************************************/
+
+static void
+render_cached_symbol( CACHED_SYMBOL * c,
+                      PARSED_LABEL  * p,
+                      Pixmap          pixmap,
+                      FL_COLOR        bkcol )
+{
+    flx->win = pixmap;
+    fl_rectf( 0, 0, c->w, c->h, bkcol );
+    draw_symbol( p, 0, 0, c->w, c->h, c->col );
+}
+
+
+/***************************************
+ * Creates the pixmap and the mask for a symbol
+ ***************************************/
+
+static int
+make_cached_symbol( CACHED_SYMBOL * c,
+                    PARSED_LABEL  * p )
+{
+    Window win = flx->win;
+    Pixmap other;
+    XImage *img1 = NULL,
+           *img2 = NULL;
+    unsigned long bk1 = fl_get_pixel( FL_BLACK ),
+                  bk2 = fl_get_pixel( FL_WHITE );
+    FL_Coord gx, gy, gw, gh,
+             nx, ny, nw, nh;
+    int gclip = fl_get_global_clipping( &gx, &gy, &gw, &gh ),
+        nclip = fl_get_clipping( 0, &nx, &ny, &nw, &nh );
+    int bpl = ( c->w + 7 ) / 8,
+        x,
+        y;
+    char *bits;
+
+    if ( ! ( bits = fl_calloc( bpl * c->h, 1 ) ) )
+        return 0;
+
+    c->pixmap = XCreatePixmap( flx->display, win, c->w, c->h,
+                               fli_depth( fl_vmode ) );
+    other = XCreatePixmap( flx->display, win, c->w, c->h,
+                           fli_depth( fl_vmode ) );
+
+    /* Clipping is for the window, not the pixmaps */
+
+    fli_flush_batch( );
+    fli_pause_batch( );
+    fl_unset_clipping( );
+    fli_unset_global_clipping( );
+
+    render_cached_symbol( c, p, c->pixmap, FL_BLACK );
+    render_cached_symbol( c, p, other, FL_WHITE );
+    flx->win = win;
+
+    if ( gclip )
+        fli_set_global_clipping( gx, gy, gw, gh );
+    if ( nclip )
+        fl_set_clipping( nx, ny, nw, nh );
+    fli_resume_batch( );
+
+    img1 = XGetImage( flx->display, c->pixmap, 0, 0, c->w, c->h,
+                      AllPlanes, ZPixmap );
+    img2 = XGetImage( flx->display, other, 0, 0, c->w, c->h,
+                      AllPlanes, ZPixmap );
+    XFreePixmap( flx->display, other );
+
+    if ( ! img1 || ! img2 )
+    {
+        if ( img1 )
+            XDestroyImage( img1 );
+        if ( img2 )
+            XDestroyImage( img2 );
+        fl_free( bits );
+        XFreePixmap( flx->display, c->pixmap );
+        c->pixmap = None;
+        return 0;
+    }
+
+    /* A pixel belongs to the symbol if it differs from the background in
+       at least one of the images */
+
+    for ( y = 0; y < c->h; y++ )
+        for ( x = 0; x < c->w; x++ )
+            if (    XGetPixel( img1, x, y ) != bk1
+                 || XGetPixel( img2, x, y ) != bk2 )
+                bits[ y * bpl + x / 8 ] |= 1 << ( x % 8 );
+
+    XDestroyImage( img1 );
+    XDestroyImage( img2 );
+
+    c->mask = XCreateBitmapFromData( flx->display, win, bits, c->w, c->h );
+    fl_free( bits );
+
+    return 1;
+}
+
+
+/***************************************
+ * Tries to draw a symbol by copying it from the cache (drawing it into
+ * new pixmaps of the cache if necessary). Returns 0 if the symbol can't
+ * be cached and must be drawn directly.
+ ***************************************/
+
+static int
+draw_cached_symbol( PARSED_LABEL * p,
+                    FL_Coord       x,
+                    FL_Coord       y,
+                    FL_Coord       w,
+                    FL_Coord       h,
+                    FL_COLOR       col )
+{
+    static unsigned long stamp;
+    CACHED_SYMBOL *c,
+                  *use = NULL;
+    int lw = fl_get_linewidth( ),
+        ls = fl_get_linestyle( );
+    FL_Coord sx = x,
+             sy = y,
+             sw = w,
+             sh = h,
+             cx = 0,
+             cy = 0,
+             cw = 0,
+             ch = 0;
+
+    /* Symbols defined by the user might draw with Xlib directly and
+       could look different each time, so only our own get cached. And
+       points of a symbol with negative coordinates get rounded towards
+       0, so it would look a bit different when drawn at the origin of
+       the pixmap. */
+
+    if (    ! fli_get_box_cache( )
+         || ! p->sym->builtin
+         || flx->win == None
+         || fli_dithered( fl_vmode )
+         || fl_get_drawmode( ) != GXcopy
+         || x < 0
+         || y < 0
+         || w <= 0
+         || h <= 0
+         || w * h > SYMBOL_CACHE_MAX_AREA )
+        return 0;
 
-    for ( i = 0; i < nsymbols; i++ )
-        if ( ! strcmp( symbols[ i ].name, name ) )
+    for ( c = symbol_cache; c < symbol_cache + SYMBOL_CACHE_SIZE; c++ )
+    {
+        if (    c->pixmap     != None
+             && c->vmode      == fl_vmode
+             && c->sym        == p->sym
+             && c->delta      == p->delta
+             && c->equalscale == p->equalscale
+             && c->rotated    == p->rotated
+             && c->w          == w
+             && c->h          == h
+             && c->col        == col
+             && c->lw         == lw
+             && c->ls         == ls )
+        {
+            use = c;
             break;
+        }
+
+        if (    ! use
+             || (    use->pixmap != None
+                  && ( c->pixmap == None || c->last_used < use->last_used ) ) )
+            use = c;
+    }
+
+    if ( c == symbol_cache + SYMBOL_CACHE_SIZE )
+    {
+        if ( use->pixmap != None )
+        {
+            if ( copy_gc_mask[ use->vmode ] == use->mask )
+                copy_gc_mask[ use->vmode ] = None;
+            XFreePixmap( flx->display, use->pixmap );
+            XFreePixmap( flx->display, use->mask );
+            use->pixmap = use->mask = None;
+        }
+
+        use->vmode      = fl_vmode;
+        use->sym        = p->sym;
+        use->delta      = p->delta;
+        use->equalscale = p->equalscale;
+        use->rotated    = p->rotated;
+        use->w          = w;
+        use->h          = h;
+        use->col        = col;
+        use->lw         = lw;
+        use->ls         = ls;
+
+        if ( ! make_cached_symbol( use, p ) )
+            return 0;
+    }
+
+    use->last_used = ++stamp;
+
+    /* The mask replaces the clipping rectangle, so only the part of the
+       symbol within the current clipping region gets copied */
+
+    if ( fl_get_clipping( 1, &cx, &cy, &cw, &ch ) )
+    {
+        sx = FL_max( x, cx );
+        sy = FL_max( y, cy );
+        sw = FL_min( x + w, cx + cw ) - sx;
+        sh = FL_min( y + h, cy + ch ) - sy;
+    }
+
+    if ( sw <= 0 || sh <= 0 )
+        return 1;
+
+    if ( ! copy_gc[ fl_vmode ] )
+    {
+        copy_gc[ fl_vmode ] = XCreateGC( flx->display, flx->win, 0, NULL );
+        XSetGraphicsExposures( flx->display, copy_gc[ fl_vmode ], False );
+    }
+
+    if ( copy_gc_mask[ fl_vmode ] != use->mask )
+    {
+        XSetClipMask( flx->display, copy_gc[ fl_vmode ], use->mask );
+        copy_gc_mask[ fl_vmode ] = use->mask;
+    }
+
+    fli_flush_batch( );
+    XSetClipOrigin( flx->display, copy_gc[ fl_vmode ], x, y );
+    XCopyArea( flx->display, use->pixmap, flx->win, copy_gc[ fl_vmode ],
+               sx - x, sy - y, sw, sh, sx, sy );
 
-    return i < nsymbols ? symbols + i : NULL;
+    return 1;
 }
 
+/****** End of symbol cache ***********************}***/
+
 
 /******************* PUBLIC ROUTINES ******************{**/
 
@@ -136,10 +668,18 @@ fl_add_symbol( const char * name,
 
         s = symbols + nsymbols - 1;
         s->name = fl_strdup( name );
+        link_symbol( nsymbols - 1 );
     }
 
     s->drawit   = drawit;
     s->scalable = scalable;
+    s->builtin  = adding_builtins;
+
+    /* The symbols might have moved and what was drawn for the old one
+       mustn't be used anymore */
+
+    forget_parsed_labels( );
+    fli_clear_symbol_cache( );
 
     return 1;
 }
@@ -168,6 +708,13 @@ fl_delete_symbol( const char * name )
     if ( ( s = fl_realloc( symbols, --nsymbols * sizeof *symbols ) ) )
         symbols = s;
 
+    memset( symbol_hash, 0, sizeof symbol_hash );
+    for ( pos = 0; pos < nsymbols; pos++ )
+        link_symbol( pos );
+
+    forget_parsed_labels( );
+    fli_clear_symbol_cache( );
+
     return 1;
 }
 
@@ -184,120 +731,19 @@ fl_draw_symbol( const char * label,
                 FL_Coord     h,
                 FL_COLOR     col )
 {
-    int pos,
-        equalscale = 0;
-    FL_Coord dx = 0,
-             dy = 0;
-    int rotated = 0,
-        delta = 0;
-    short defr[ ] = { 0, 225, 270, 315, 180, 0, 0, 135, 90, 45 };
-    SYMBOL *s;
-    int orig_x = x,
-        orig_y = y,
-        orig_w = w,
-        orig_h = h;
-    int is_clipped = 0,
-        clip_x,
-        clip_y,
-        clip_w,
-        clip_h;
+    PARSED_LABEL *p;
 
     if ( ! label || *label != '@' )
         return 0;
 
-    pos = 1;
-
-    /* Check for character sequences that are for increasing or decreasing
-       the size of the symbol, maintain the aspect ratio or indicate
-       rotation. */
-
-    while ( label[ pos ] )
-    {
-        if (    label[ pos ] == '-'
-             && isdigit( ( unsigned char ) label[ pos + 1 ] )
-             && label[ pos + 1 ] != '0' )
-        {
-            delta += label[ ++pos ] - '0';
-            ++pos;
-        }
-        else if (    label[ pos ] == '+'
-                  && isdigit( ( unsigned char ) label[ pos + 1 ] )
-                  && label[ pos + 1 ] != '0' )
-        {
-            delta -= label[ ++pos ] - '0';
-            ++pos;
-        }
-        else if ( label[ pos ] == '#' )
-        {
-            equalscale = 1;
-            ++pos;
-        }
-        else if ( isdigit( ( unsigned char ) label[ pos ] ) )
-        {
-            if ( label[ pos ] == '0' )
-            {
-                char *eptr;
-
-                rotated = strtol( label + ++pos, &eptr, 10 );
-                pos = label - eptr;
-
-                while ( rotated >= 360 )
-                    rotated %= 360;
-                while ( rotated < 0 )
-                    rotated = 360 - ( -rotated % 360 );
-            }
-            else
-                rotated = defr[ label[ pos++ ] - '0' ];
-        }
-        else
-            break;
-    }
-
-    /* Check if the reminder of the string is a valid symbol */
-
-    if ( ! ( s = find_symbol( label + pos ) ) )
+    if ( ! ( p = get_parsed_label( label ) ) )
     {
         M_err( "fl_draw_symbol", "Bad symbol: \"%s\"", label );
         return 0;
     }
 
-    if ( equalscale )
-    {
-        dx = w > h ? ( w - h ) / 2 : 0;
-        dy = w > h ? 0 : ( h - w ) / 2;
-        w = h = FL_min( w, h );
-    }
-
-    if ( delta )
-        ShrinkBox( x, y, w, h, delta );
-
-    if ( w <= 0 || h <= 0 )
-        return 1;
-
-    /* For rotated of 90 or 180 degrees switch w and h and the bounding box */
-
-    if ( rotated == 90 || rotated == 270 )
-    {
-        x += ( w - h ) / 2;
-        y += ( h - w ) / 2;
-        swapit( FL_Coord, w, h );
-    }
-
-    if ( fl_is_clipped( 0 ) )
-    {
-        is_clipped = 1;
-        fl_get_clipping( 0, &clip_x, &clip_y, &clip_w, &clip_h );
-        fli_set_additional_clipping( orig_x, orig_y, orig_w, orig_h );
-    }
-    else
-        fl_set_clipping( orig_x, orig_y, orig_w, orig_h );
-
-    s->drawit( x + dx, y + dy, w, h, rotated, col );
-
-    if ( is_clipped )
-        fl_set_clipping( clip_x, clip_y, clip_w, clip_h );
-    else
-        fl_unset_clipping( );
+    if ( ! draw_cached_symbol( p, x, y, w, h, col ) )
+        draw_symbol( p, x, y, w, h, col );
 
     return 1;
 }
@@ -1344,6 +1790,8 @@ fli_init_symbols( void )
     if ( symbols )
         return;
 
+    adding_builtins = 1;
+
     fl_add_symbol( "",            draw_arrow_right,            1 );
     fl_add_symbol( "->",          draw_arrow_right,            1 );
     fl_add_symbol( ">",           draw_arrow_tip_right,        1 );
@@ -1376,6 +1824,8 @@ fli_init_symbols( void )
     fl_add_symbol( "arrow",       draw_long_arrow_right,       1 );
     fl_add_symbol( "RippleLines", draw_ripplelines,            1 );
     fl_add_symbol( "+",           draw_plus,                   1 );
+
+    adding_builtins = 0;
 }
 
 
@@ -1385,8 +1835,17 @@ fli_init_symbols( void )
 void
 fli_release_symbols( void )
 {
+    int i;
+
     while ( nsymbols > 0 )
         fl_delete_symbol( symbols[ nsymbols - 1 ].name );
+
+    for ( i = 0; i <= DirectColor; i++ )
+        if ( copy_gc[ i ] )
+        {
+            XFreeGC( flx->display, copy_gc[ i ] );
+            copy_gc[ i ] = NULL;
+        }
 }
 
 
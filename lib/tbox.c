@@ -1687,6 +1687,7 @@ draw_tbox( FL_OBJECT * obj )
     fl_draw_box( obj->boxtype, obj->x, obj->y, obj->w, obj->h,
                  obj->col1, obj->bw );
 
+    fli_flush_batch( );
     XFillRectangle( flx->display, FL_ObjWin( obj ),
                     sp->backgroundGC,
                     obj->x + sp->x - ( LEFT_MARGIN > 0 ),
@@ -1698,6 +1699,11 @@ draw_tbox( FL_OBJECT * obj )
 
     fl_set_clipping( obj->x, obj->y, obj->w, obj->h );
 
+    /* The GCs for the text are clipped to the text area, text drawn via
+       Xft needs the same as text clipping */
+
+    fl_set_text_clipping( obj->x + sp->x, obj->y + sp->y, sp->w, sp->h );
+
     for ( i = 0; i < sp->num_lines; i++ )
     {
         TBOX_LINE *tl;
@@ -1729,11 +1735,13 @@ draw_tbox( FL_OBJECT * obj )
         /* Draw background of line in selection color if necessary*/
 
         if ( tl->selected )
+        {
+            fli_flush_batch( );
             XFillRectangle( flx->display, FL_ObjWin( obj ), sp->selectGC,
                             obj->x + sp->x - ( LEFT_MARGIN > 0 ),
                             obj->y + sp->y + tl->y - sp->yoffset,
                             sp->w + ( LEFT_MARGIN > 0 ), tl->h );
-
+        }
 
         /* If there's no text or the text isn't visible within the textbox
            nothing needs to be drawn */
@@ -1788,6 +1796,7 @@ draw_tbox( FL_OBJECT * obj )
                             tl->style, tl->size, tl->text, tl->len, 0 );
     }
 
+    fl_unset_text_clipping( );
     fl_unset_clipping( );
 }
 
@@ -35,13 +35,44 @@
 #include "include/forms.h"
 #include "flinternal.h"
 
+#include <string.h>
 
 static int fli_mono_dither( unsigned long );
 static void fli_set_current_gc( GC );
+static void apply_clipping( GC );
 
 static GC dithered_gc;
 
 
+/* Types of primitives that can be collected for drawing several of them
+   with a single request (see the "Batching" section below) */
+
+enum {
+    BATCH_FILLED_RECT,
+    BATCH_RECT,
+    BATCH_SEGMENT,
+    BATCH_POINT,
+    BATCH_FILLED_ARC,
+    BATCH_ARC,
+    BATCH_FILLED_POLYGON,
+    BATCH_NUM_TYPES
+};
+
+static int batch_add( int,
+                      FL_COLOR,
+                      int,
+                      int,
+                      int,
+                      int,
+                      int,
+                      int );
+static int batch_add_polygon( FL_COLOR,
+                              FL_POINT *,
+                              int );
+static void flush_batch_points( FL_POINT *,
+                                int );
+
+
 /*******************************************************************
  * Rectangle routines
  ****************************************************************{**/
@@ -74,6 +105,10 @@ fl_rectangle( int      fill,
 
     fli_canonicalize_rect( &x, &y, &w, &h );
 
+    if ( ! bw && batch_add( fill ? BATCH_FILLED_RECT : BATCH_RECT, col,
+                            x, y, w, h, 0, 0 ) )
+        return;
+
     draw_as = fill ? XFillRectangle : XDrawRectangle;
 
     if ( bw && fill )
@@ -117,6 +152,11 @@ fl_polygon( int        fill,
     if ( flx->win == None || n <= 0 )
         return;
 
+    if ( fill && ! bw && batch_add_polygon( col, xp, n ) )
+        return;
+
+    flush_batch_points( xp, n );
+
     if ( bw )
     {
         flx->gc = dithered_gc;
@@ -222,6 +262,10 @@ fl_oval( int      fill,
     if ( flx->win == None || w <= 0 || h <= 0 )
         return;
 
+    if ( ! bw && batch_add( fill ? BATCH_FILLED_ARC : BATCH_ARC, col,
+                            x, y, w, h, 0, 360 * 64 ) )
+        return;
+
     draw_as = fill ? XFillArc : XDrawArc;
 
     if ( bw )
@@ -255,6 +299,10 @@ fl_ovalbound( FL_Coord x,
     if ( flx->win == None || w <= 0 || h <= 0 )
         return;
 
+    if (    batch_add( BATCH_FILLED_ARC, col, x, y, w, h, 0, 360 * 64 )
+         && batch_add( BATCH_ARC, FL_BLACK, x, y, w - 1, h - 1, 0, 360 * 64 ) )
+        return;
+
     fl_color( col );
     XFillArc( flx->display, flx->win, flx->gc, x, y, w, h, 0, 360 * 64 );
     fl_color( FL_BLACK );
@@ -297,6 +345,10 @@ fl_ovalarc( int      fill,
     if ( flx->win == None || w <= 0 || h <= 0 )
         return;
 
+    if ( ! mono && batch_add( fill ? BATCH_FILLED_ARC : BATCH_ARC, col,
+                              x, y, w, h, t0 * 6.4, dt * 6.4 ) )
+        return;
+
     draw_as = fill ? XFillArc : XDrawArc;
 
     if ( mono )
@@ -377,6 +429,10 @@ fl_pieslice( int      fill,
     if ( flx->win == None || w <= 0 || h <= 0)
         return;
 
+    if ( ! bw && batch_add( fill ? BATCH_FILLED_ARC : BATCH_ARC, col,
+                            x, y, w, h, a1 * 6.4, delta * 6.4 ) )
+        return;
+
     draw_as = fill ? XFillArc : XDrawArc;
 
     if ( bw )
@@ -413,6 +469,7 @@ fl_lines( FL_POINT * xp,
     if ( flx->win == None  || n <= 0 )
         return;
 
+    flush_batch_points( xp, n );
     fl_color( col );
 
     /* We may need to break up the request into smaller pieces */
@@ -459,7 +516,8 @@ fl_line( FL_Coord xi,
          FL_Coord yf,
          FL_COLOR c )
 {
-    if ( flx->win == None )
+    if (    flx->win == None
+         || batch_add( BATCH_SEGMENT, c, xi, yi, xf, yf, 0, 0 ) )
         return;
 
     fl_color( c );
@@ -481,7 +539,8 @@ fl_point( FL_Coord x,
           FL_Coord y,
           FL_COLOR c )
 {
-    if ( flx->win == None )
+    if (    flx->win == None
+         || batch_add( BATCH_POINT, c, x, y, 0, 0, 0, 0 ) )
         return;
 
     fl_color( c );
@@ -501,6 +560,7 @@ fl_points( FL_POINT * p,
     if ( flx->win == None || np <= 0 )
         return;
 
+    flush_batch_points( p, np );
     fl_color( c );
     XDrawPoints( flx->display, flx->win, flx->gc, p, np, CoordModeOrigin );
 }
@@ -527,6 +587,8 @@ fl_linewidth( int n )
     if ( lw == n )
         return;
 
+    fli_flush_batch( );
+
     gcmask = GCLineWidth;
     gcvalue.line_width = lw = n;
     XChangeGC( flx->display, flx->gc, gcmask, &gcvalue );
@@ -548,6 +610,27 @@ static void fli_xdashedlinestyle( Display *,
                                   const char *,
                                   int );
 
+/* Dash pattern of the current GC and a counter incremented each time it
+   gets changed (for bringing the GCs from the pool up to date) */
+
+static char *cur_dash;
+static int cur_ndash;
+static unsigned int dash_gen = 1;
+
+
+/***************************************
+ ***************************************/
+
+static void
+remember_dashes( const char * dash,
+                 int          ndash )
+{
+    cur_dash = fl_realloc( cur_dash, ndash );
+    memcpy( cur_dash, dash, ndash );
+    cur_ndash = ndash;
+    dash_gen++;
+}
+
 /***************************************
  ***************************************/
 
@@ -565,6 +648,7 @@ fli_xlinestyle( Display * d,
     if ( ls == n )
         return;
 
+    fli_flush_batch( );
     ls = n;
 
     gcmask = GCLineStyle;
@@ -620,7 +704,10 @@ void
 fl_drawmode( int request )
 {
     if ( drmode != request )
+    {
+        fli_flush_batch( );
         XSetFunction( flx->display, flx->gc, drmode = request );
+    }
 }
 
 
@@ -641,6 +728,9 @@ fli_xdashedlinestyle( Display    * d,
         ndash = 2;
     }
 
+    if ( gc == flx->gc )
+        remember_dashes( dash, ndash );
+
     XSetDashes( d, gc, 0, ( char * ) dash, ndash );
 }
 
@@ -679,6 +769,8 @@ fl_dashedlinestyle( const char * dash,
         ndash = 2;
     }
 
+    fli_flush_batch( );
+    remember_dashes( dash, ndash );
     XSetDashes( flx->display, flx->gc, 0, ( char * ) dash, ndash );
 }
 
@@ -700,6 +792,11 @@ enum {
 
 
 static int fli_is_clipped[ ] = { 0, 0, 0, 0 };
+
+/* Incremented each time the clipping of the current GC changes, so GCs
+   from the pool (see below) can tell if their clipping is outdated */
+
+static unsigned int clip_gen = 1;
 static FL_RECT fli_clip_rect[ ] = { { 0, 0, 0, 0 },
                                     { 0, 0, 0, 0 },
                                     { 0, 0, 0, 0 },
@@ -775,6 +872,8 @@ fli_set_global_clipping( FL_Coord x,
         return;
     }
 
+    fli_flush_batch( );
+
     SET_RECT( fli_clip_rect[ FLI_GLOBAL_CLIP ], x, y, w, h );
 
     /* If normal clipping is already on intersect the new global and the
@@ -828,6 +927,7 @@ fli_set_global_clipping( FL_Coord x,
                             fli_clip_rect + FLI_GLOBAL_CLIP, 1, Unsorted );
 
     fli_is_clipped[ FLI_GLOBAL_CLIP ] = 1;
+    clip_gen++;
 }
 
 
@@ -841,6 +941,8 @@ fli_unset_global_clipping( void )
     if ( ! fli_is_clipped[ FLI_GLOBAL_CLIP ] )
         return;
 
+    fli_flush_batch( );
+
     SET_RECT( fli_clip_rect[ FLI_GLOBAL_CLIP ], 0, 0, 0, 0 );
 
     /* If normal clipping is also on set the clipping rectangle to that set
@@ -861,6 +963,7 @@ fli_unset_global_clipping( void )
         XSetClipMask( flx->display, flx->textgc, None );
 
     fli_is_clipped[ FLI_GLOBAL_CLIP ] = 0;
+    clip_gen++;
 }
 
 
@@ -904,6 +1007,9 @@ unset_clipping( int type,
     if ( ! fli_is_clipped[ type ] )
         return;
 
+    if ( type != FLI_TEXT_CLIP )
+        fli_flush_batch( );
+
     SET_RECT( fli_clip_rect[ type ], 0, 0, 0, 0 );
 
     if ( fli_is_clipped[ FLI_GLOBAL_CLIP ] )
@@ -913,6 +1019,9 @@ unset_clipping( int type,
         XSetClipMask( flx->display, gc, None );
 
     fli_is_clipped[ type ] = 0;
+
+    if ( type == FLI_NORMAL_CLIP )
+        clip_gen++;
 }
 
 
@@ -938,6 +1047,12 @@ set_clipping( int      type,
         return;
     }
 
+    /* Text clipping only changes the GC for text which isn't used for
+       batched primitives */
+
+    if ( type != FLI_TEXT_CLIP )
+        fli_flush_batch( );
+
     SET_RECT( fli_clip_rect[ type ], x, y, w, h );
 
     if ( fli_is_clipped[ FLI_GLOBAL_CLIP ] )
@@ -962,6 +1077,9 @@ set_clipping( int      type,
                             1, Unsorted );
 
     fli_is_clipped[ type ] = 1;
+
+    if ( type == FLI_NORMAL_CLIP )
+        clip_gen++;
 }
 
 
@@ -1210,9 +1328,22 @@ fli_set_current_gc( GC gc )
     if ( flx->gc == gc )
         return;
 
+    fli_flush_batch( );
+
     flx->gc    = gc;
     flx->color = FL_NoColor;
 
+    apply_clipping( gc );
+}
+
+
+/***************************************
+ * Sets up a GC for the current (normal and global) clipping
+ ***************************************/
+
+static void
+apply_clipping( GC gc )
+{
     if (    fli_is_clipped[ FLI_GLOBAL_CLIP ]
          && fli_is_clipped[ FLI_NORMAL_CLIP ] )
     {
@@ -1242,6 +1373,317 @@ fli_set_current_gc( GC gc )
 }
 
 
+/********************************************************************
+ * GC pool
+ *
+ * Instead of changing the foreground color of a single GC each time
+ * fl_color() gets called with a different color (a box with a 3D look
+ * e.g. uses four or more colors) a small pool of GCs is used, each
+ * keeping the color it was last used with, and fl_color() just switches
+ * to the one for the requested color. Line width, line style, drawing
+ * mode, dash pattern, background color and clipping get only set on the
+ * current GC. Each GC in the pool remembers the values it had when it
+ * stopped being the current one and, when becoming the current GC again,
+ * only what was changed in between gets updated.
+ *
+ * Code drawing with Xlib directly (free objects, canvases etc.) expects
+ * the GC returned by fl_get_gc(), i.e., gc[ 0 ], to be the one with the
+ * current attributes and may change its color by itself. So while such
+ * code draws (i.e. while batching is paused) the pool isn't used.
+ ****************************************************************{*/
+
+#define GC_POOL_SIZE  6     /* fl_state[].gc[ 6 ] and higher are used
+                               for other purposes */
+
+typedef struct {
+    GC            gc;
+    FL_COLOR      col;
+    FL_COLOR      bkcol;
+    int           lw;
+    int           ls;
+    int           drmode;
+    unsigned int  dash_gen;
+    unsigned int  clip_gen;
+    unsigned long last_used;
+} POOLED_GC;
+
+static POOLED_GC gc_pool[ DirectColor + 1 ][ GC_POOL_SIZE ];
+static POOLED_GC *cur_pooled_gc;
+static int gc_pool_paused;
+
+
+/***************************************
+ * Marks a GC from the pool as having unknown attributes
+ ***************************************/
+
+static void
+invalidate_pooled_gc( POOLED_GC * p )
+{
+    p->bkcol    = FL_NoColor;
+    p->lw       = -1;
+    p->ls       = -1;
+    p->drmode   = -1;
+    p->dash_gen = 0;
+    p->clip_gen = 0;
+}
+
+
+/***************************************
+ * Records the current attributes for a GC that stops being the current one
+ ***************************************/
+
+static void
+save_pooled_gc( POOLED_GC * p )
+{
+    p->bkcol    = flx->bkcolor;
+    p->lw       = lw;
+    p->ls       = ls;
+    p->drmode   = drmode;
+    p->dash_gen = dash_gen;
+    p->clip_gen = clip_gen;
+}
+
+
+/***************************************
+ * Returns if a GC from the pool has all the current attributes
+ ***************************************/
+
+static int
+pooled_gc_is_current( POOLED_GC * p )
+{
+    return    p->bkcol    == flx->bkcolor
+           && p->lw       == lw
+           && p->ls       == ls
+           && p->drmode   == drmode
+           && p->dash_gen == dash_gen
+           && p->clip_gen == clip_gen;
+}
+
+
+/***************************************
+ * Brings the attributes of a GC from the pool up to date
+ ***************************************/
+
+static void
+update_pooled_gc( POOLED_GC * p )
+{
+    XGCValues gcvalue;
+    unsigned long gcmask = 0;
+
+    if ( p->lw != lw )
+    {
+        gcvalue.line_width = lw;
+        gcmask |= GCLineWidth;
+    }
+
+    if ( p->ls != ls )
+    {
+        gcvalue.line_style = ls > LineDoubleDash ? LineOnOffDash : ls;
+        gcmask |= GCLineStyle;
+    }
+
+    if ( p->drmode != drmode )
+    {
+        gcvalue.function = drmode;
+        gcmask |= GCFunction;
+    }
+
+    if ( gcmask )
+        XChangeGC( flx->display, p->gc, gcmask, &gcvalue );
+
+    if ( p->dash_gen != dash_gen && cur_dash )
+        XSetDashes( flx->display, p->gc, 0, cur_dash, cur_ndash );
+
+    if ( p->clip_gen != clip_gen )
+        apply_clipping( p->gc );
+
+    if ( p->bkcol != flx->bkcolor && flx->bkcolor != FL_NoColor )
+    {
+        unsigned long pixel = fl_get_pixel( flx->bkcolor );
+
+        XSetBackground( flx->display, p->gc, pixel );
+        fli_free_newpixel( pixel );
+    }
+
+    save_pooled_gc( p );
+}
+
+
+/***************************************
+ * Called when the pixel value for a color changes, GCs from the pool
+ * still having the old pixel value for it must not be used anymore
+ ***************************************/
+
+void
+fli_forget_gc_color( FL_COLOR col )
+{
+    int i,
+        j;
+
+    for ( i = 0; i <= DirectColor; i++ )
+        for ( j = 0; j < GC_POOL_SIZE; j++ )
+            if ( gc_pool[ i ][ j ].col == col )
+                gc_pool[ i ][ j ].col = FL_NoColor;
+}
+
+
+/***************************************
+ * Called from fl_color() to make a GC with the requested color the
+ * current GC. Returns 0 if the pool can't be used (e.g. since the
+ * current GC is one used for dithering), in which case the color of
+ * the current GC must be changed.
+ ***************************************/
+
+int
+fli_select_color_gc( FL_COLOR col )
+{
+    static unsigned long stamp;
+    POOLED_GC *pool = gc_pool[ fl_vmode ],
+              *p,
+              *best = NULL;
+    int i;
+
+    if (    gc_pool_paused
+         || fli_dithered( fl_vmode )
+         || ! fl_state[ fl_vmode ].gc[ 0 ] )
+        return 0;
+
+    /* Set up the pool on first use (or when the GCs got re-created) */
+
+    if ( pool[ 0 ].gc != fl_state[ fl_vmode ].gc[ 0 ] )
+    {
+        for ( i = 0; i < GC_POOL_SIZE; i++ )
+        {
+            pool[ i ].gc        = fl_state[ fl_vmode ].gc[ i ];
+            pool[ i ].col       = FL_NoColor;
+            pool[ i ].last_used = 0;
+            invalidate_pooled_gc( pool + i );
+        }
+
+        if ( cur_pooled_gc >= pool && cur_pooled_gc < pool + GC_POOL_SIZE )
+            cur_pooled_gc = NULL;
+    }
+
+    /* Check if the current GC is from the pool and we know about it being
+       the current one. If it got made the current one by other means its
+       attributes are unknown and also those of the GC we thought to be
+       current may have been changed. */
+
+    if ( ! cur_pooled_gc || cur_pooled_gc->gc != flx->gc )
+    {
+        for ( p = pool; p < pool + GC_POOL_SIZE && p->gc != flx->gc; p++ )
+            /* empty */ ;
+
+        if ( p == pool + GC_POOL_SIZE )
+            return 0;
+
+        if ( cur_pooled_gc )
+            invalidate_pooled_gc( cur_pooled_gc );
+
+        p->col = flx->color = FL_NoColor;
+        invalidate_pooled_gc( p );
+        update_pooled_gc( p );
+        cur_pooled_gc = p;
+    }
+
+    cur_pooled_gc->last_used = ++stamp;
+
+    if ( cur_pooled_gc->col == col && flx->color == col )
+        return 1;
+
+    /* Prefer a GC with the color and all other attributes as required,
+       then one with just the right color and finally the one that was
+       unused for the longest time */
+
+    for ( p = pool; p < pool + GC_POOL_SIZE; p++ )
+    {
+        if ( p == cur_pooled_gc )
+            continue;
+
+        if ( p->col == col )
+        {
+            if ( ! best || best->col != col || pooled_gc_is_current( p ) )
+                best = p;
+        }
+        else if (    ! best
+                  || (    best->col != col
+                       && p->last_used < best->last_used ) )
+            best = p;
+    }
+
+    save_pooled_gc( cur_pooled_gc );
+
+    if ( best->col != col )
+    {
+        unsigned long pixel = fl_get_pixel( col );
+
+        XSetForeground( flx->display, best->gc, pixel );
+        fli_free_newpixel( pixel );
+        best->col = col;
+    }
+
+    if ( ! pooled_gc_is_current( best ) )
+        update_pooled_gc( best );
+
+    best->last_used = ++stamp;
+    cur_pooled_gc = best;
+    flx->gc    = best->gc;
+    flx->color = col;
+
+    return 1;
+}
+
+
+/***************************************
+ * Stops using the pool, making gc[ 0 ] the current GC with all the
+ * current attributes
+ ***************************************/
+
+static void
+pause_gc_pool( void )
+{
+    POOLED_GC *p = gc_pool[ fl_vmode ];
+
+    if ( gc_pool_paused++ )
+        return;
+
+    if (    ! cur_pooled_gc
+         || cur_pooled_gc->gc != flx->gc
+         || p->gc != fl_state[ fl_vmode ].gc[ 0 ]
+         || cur_pooled_gc == p )
+        return;
+
+    save_pooled_gc( cur_pooled_gc );
+
+    if ( ! pooled_gc_is_current( p ) )
+        update_pooled_gc( p );
+
+    cur_pooled_gc = p;
+    flx->gc    = p->gc;
+    flx->color = p->col;
+}
+
+
+/***************************************
+ * Starts using the pool again, the color of gc[ 0 ] may have been
+ * changed behind our back
+ ***************************************/
+
+static void
+resume_gc_pool( void )
+{
+    if ( gc_pool_paused <= 0 || --gc_pool_paused > 0 || ! cur_pooled_gc )
+        return;
+
+    cur_pooled_gc->col = FL_NoColor;
+    if ( cur_pooled_gc->gc == flx->gc )
+        flx->color = FL_NoColor;
+}
+
+
+/****** End of GC pool ***********************}***/
+
+
 /***************************************
  * Manually dither non-gray scale colors by changing default GC. Grayscales
  * are typically used in buttons, boxes etc, better not to dither them
@@ -1295,6 +1737,632 @@ fli_mono_dither( unsigned long col )
 }
 
 
+
+/********************************************************************
+ * Batching
+ *
+ * While a form gets redrawn many rectangles, lines, arcs and filled
+ * polygons are drawn, each in a request of its own and usually preceded
+ * by a request for changing the foreground color. Between calls of
+ * fli_begin_batch() and fli_end_batch() these primitives aren't drawn
+ * immediately but collected in groups of primitives of the same type
+ * and color, which then each get drawn with a single XFillRectangles(),
+ * XDrawSegments() etc. request (or, for polygons, at least with a single
+ * change of the color). A primitive only gets added to an existing group if it
+ * doesn't overlap with anything drawn after the primitives already in
+ * that group, so the result is the same as when drawing immediately.
+ * Everything that changes the GC must call fli_flush_batch() first and
+ * what draws by other means fli_flush_batch_area() for the region it
+ * draws to.
+ ****************************************************************{*/
+
+#define MAX_BATCH_GROUPS   32
+#define MAX_BATCH_ITEMS    512
+#define MAX_BATCH_POLYGON  16       /* most points of a batched polygon */
+
+typedef struct {
+    int        type;
+    Drawable   win;
+    FL_COLOR   col;
+    int        n;
+    size_t     size;        /* bytes allocated for the items */
+    size_t     used;        /* and in use */
+    void     * items;
+    int        x1,          /* bounding box of all items (inclusive) */
+               y1,
+               x2,
+               y2;
+} BATCH_GROUP;
+
+static BATCH_GROUP batch_groups[ MAX_BATCH_GROUPS ];
+static int nbatch_groups;
+static int batch_level;
+static int batch_paused;
+
+static size_t batch_item_size[ BATCH_NUM_TYPES ] = {
+    sizeof( XRectangle ),
+    sizeof( XRectangle ),
+    sizeof( XSegment ),
+    sizeof( XPoint ),
+    sizeof( XArc ),
+    sizeof( XArc )
+};
+
+
+/***************************************
+ * Starts collecting primitives, calls may be nested
+ ***************************************/
+
+void
+fli_begin_batch( void )
+{
+    batch_level++;
+}
+
+
+/***************************************
+ * Stops collecting primitives (when the outermost call of
+ * fli_begin_batch() is matched) and draws all still pending
+ ***************************************/
+
+void
+fli_end_batch( void )
+{
+    fli_flush_batch( );
+
+    if ( batch_level > 0 )
+        batch_level--;
+}
+
+
+/***************************************
+ * Temporarily switches off batching (and the GC pool), e.g. while code
+ * not using the functions from this file (and thus not knowing about
+ * batching) draws something. Must be matched by a call of
+ * fli_resume_batch().
+ ***************************************/
+
+void
+fli_pause_batch( void )
+{
+    fli_flush_batch( );
+    batch_paused++;
+    pause_gc_pool( );
+}
+
+
+/***************************************
+ ***************************************/
+
+void
+fli_resume_batch( void )
+{
+    if ( batch_paused > 0 )
+    {
+        batch_paused--;
+        resume_gc_pool( );
+    }
+}
+
+
+/***************************************
+ * How far drawing a primitive may extend beyond its coordinates
+ ***************************************/
+
+static int
+batch_margin( int type )
+{
+    if (    type == BATCH_FILLED_RECT
+         || type == BATCH_FILLED_ARC
+         || type == BATCH_FILLED_POLYGON )
+        return 0;
+
+    return lw / 2 + 1;
+}
+
+
+/***************************************
+ * Returns if anything in a group overlaps the rectangle from (x1, y1)
+ * to (x2, y2) in the current drawable. The bounding box of the group
+ * is only a first check, it gets rather coarse once the group has
+ * collected primitives from all over the window.
+ ***************************************/
+
+static int
+batch_group_overlaps( BATCH_GROUP * g,
+                      int           x1,
+                      int           y1,
+                      int           x2,
+                      int           y2 )
+{
+    char *item = g->items,
+         *end = item + g->used;
+    int margin = batch_margin( g->type );
+
+    if (    g->win != flx->win
+         || x1 > g->x2 || g->x1 > x2
+         || y1 > g->y2 || g->y1 > y2 )
+        return 0;
+
+    x1 -= margin;
+    y1 -= margin;
+    x2 += margin;
+    y2 += margin;
+
+    while ( item < end )
+    {
+        int ix1, iy1, ix2, iy2;
+
+        switch ( g->type )
+        {
+            case BATCH_FILLED_RECT :
+            case BATCH_RECT :
+            {
+                XRectangle *r = ( XRectangle * ) item;
+
+                ix1 = r->x;
+                iy1 = r->y;
+                ix2 = r->x + r->width;
+                iy2 = r->y + r->height;
+                item += sizeof *r;
+                break;
+            }
+
+            case BATCH_SEGMENT :
+            {
+                XSegment *s = ( XSegment * ) item;
+
+                ix1 = FL_min( s->x1, s->x2 );
+                iy1 = FL_min( s->y1, s->y2 );
+                ix2 = FL_max( s->x1, s->x2 );
+                iy2 = FL_max( s->y1, s->y2 );
+                item += sizeof *s;
+                break;
+            }
+
+            case BATCH_POINT :
+            {
+                XPoint *p = ( XPoint * ) item;
+
+                ix1 = ix2 = p->x;
+                iy1 = iy2 = p->y;
+                item += sizeof *p;
+                break;
+            }
+
+            case BATCH_FILLED_POLYGON :
+            {
+                XPoint *p = ( XPoint * ) item,
+                       *q = p + 1;
+                int n = p->x;
+
+                ix1 = ix2 = q->x;
+                iy1 = iy2 = q->y;
+
+                while ( --n > 0 )
+                {
+                    q++;
+                    ix1 = FL_min( ix1, q->x );
+                    iy1 = FL_min( iy1, q->y );
+                    ix2 = FL_max( ix2, q->x );
+                    iy2 = FL_max( iy2, q->y );
+                }
+
+                item += ( p->x + 1 ) * sizeof *p;
+                break;
+            }
+
+            default :
+            {
+                XArc *arc = ( XArc * ) item;
+
+                ix1 = arc->x;
+                iy1 = arc->y;
+                ix2 = arc->x + arc->width;
+                iy2 = arc->y + arc->height;
+                item += sizeof *arc;
+                break;
+            }
+        }
+
+        if ( x1 <= ix2 && ix1 <= x2 && y1 <= iy2 && iy1 <= y2 )
+            return 1;
+    }
+
+    return 0;
+}
+
+
+/***************************************
+ * Draws the oldest 'n' groups of pending primitives in the order they
+ * were created in, the remaining ones stay pending
+ ***************************************/
+
+static void
+draw_batch_groups( int n )
+{
+    BATCH_GROUP *g,
+                tmp;
+    int i;
+
+    if ( n <= 0 )
+        return;
+
+    for ( g = batch_groups; g < batch_groups + n; g++ )
+    {
+        fl_color( g->col );
+
+        switch ( g->type )
+        {
+            case BATCH_FILLED_RECT :
+                XFillRectangles( flx->display, g->win, flx->gc,
+                                 g->items, g->n );
+                break;
+
+            case BATCH_RECT :
+                XDrawRectangles( flx->display, g->win, flx->gc,
+                                 g->items, g->n );
+                break;
+
+            case BATCH_SEGMENT :
+                XDrawSegments( flx->display, g->win, flx->gc,
+                               g->items, g->n );
+                break;
+
+            case BATCH_POINT :
+                XDrawPoints( flx->display, g->win, flx->gc,
+                             g->items, g->n, CoordModeOrigin );
+                break;
+
+            case BATCH_FILLED_ARC :
+                XFillArcs( flx->display, g->win, flx->gc, g->items, g->n );
+                break;
+
+            case BATCH_ARC :
+                XDrawArcs( flx->display, g->win, flx->gc, g->items, g->n );
+                break;
+
+            case BATCH_FILLED_POLYGON :
+            {
+                XPoint *p = g->items,
+                       *pend = ( XPoint * ) ( ( char * ) g->items + g->used );
+
+                for ( ; p < pend; p += p->x + 1 )
+                    XFillPolygon( flx->display, g->win, flx->gc, p + 1, p->x,
+                                  Nonconvex, CoordModeOrigin );
+                break;
+            }
+        }
+
+        g->n = 0;
+        g->used = 0;
+    }
+
+    /* Move the groups still pending to the front, swapping keeps the
+       memory for the items of the drawn ones */
+
+    for ( i = n; i < nbatch_groups; i++ )
+    {
+        tmp = batch_groups[ i - n ];
+        batch_groups[ i - n ] = batch_groups[ i ];
+        batch_groups[ i ] = tmp;
+    }
+
+    nbatch_groups -= n;
+}
+
+
+/***************************************
+ * Draws all pending primitives. Since this is called before the GC
+ * gets changed, the caller may already have set the color it's going
+ * to draw with, so that's set again afterwards.
+ ***************************************/
+
+void
+fli_flush_batch( void )
+{
+    FL_COLOR col = flx->color;
+
+    if ( ! nbatch_groups )
+        return;
+
+    draw_batch_groups( nbatch_groups );
+
+    if ( col != FL_NoColor )
+        fl_color( col );
+}
+
+
+/***************************************
+ * Called before something gets drawn directly into the rectangle at
+ * (x, y) of size w x h: draws the pending primitives it would get drawn
+ * over (and all older ones). Primitives not overlapping it can stay
+ * pending since the order in which they get drawn doesn't matter.
+ ***************************************/
+
+void
+fli_flush_batch_area( int x,
+                      int y,
+                      int w,
+                      int h )
+{
+    int i;
+
+    for ( i = nbatch_groups - 1; i >= 0; i-- )
+        if ( batch_group_overlaps( batch_groups + i,
+                                   x, y, x + w - 1, y + h - 1 ) )
+            break;
+
+    draw_batch_groups( i + 1 );
+}
+
+
+/***************************************
+ * Same for polygons, lines and points drawn directly
+ ***************************************/
+
+static void
+flush_batch_points( FL_POINT * p,
+                    int        n )
+{
+    int x1, y1, x2, y2,
+        margin = lw / 2 + 1;
+
+    if ( ! nbatch_groups )
+        return;
+
+    x1 = x2 = p->x;
+    y1 = y2 = p->y;
+
+    while ( --n > 0 )
+    {
+        p++;
+        x1 = FL_min( x1, p->x );
+        y1 = FL_min( y1, p->y );
+        x2 = FL_max( x2, p->x );
+        y2 = FL_max( y2, p->y );
+    }
+
+    fli_flush_batch_area( x1 - margin, y1 - margin,
+                          x2 - x1 + 2 * margin + 1, y2 - y1 + 2 * margin + 1 );
+}
+
+
+/***************************************
+ * Returns the group a primitive of the given type and color, covering
+ * the rectangle from (x1, y1) to (x2, y2), can be added to and makes
+ * sure there's room for another 'size' bytes in it. Returns NULL if
+ * batching isn't possible at the moment.
+ ***************************************/
+
+static BATCH_GROUP *
+get_batch_group( int      type,
+                 FL_COLOR col,
+                 int      x1,
+                 int      y1,
+                 int      x2,
+                 int      y2,
+                 size_t   size )
+{
+    BATCH_GROUP *g = NULL;
+    int margin = batch_margin( type ),
+        i;
+
+    /* Dithering for monochrome displays uses different GCs and drawing
+       modes other than GXcopy may depend on the exact order of drawing */
+
+    if (    ! batch_level
+         || batch_paused
+         || drmode != GXcopy
+         || fli_dithered( fl_vmode ) )
+        return NULL;
+
+    /* Lines may extend beyond the nominal coordinates */
+
+    x1 -= margin;
+    y1 -= margin;
+    x2 += margin;
+    y2 += margin;
+
+    /* Look for the newest group the primitive can be added to without
+       changing what's drawn on top of what */
+
+    for ( i = nbatch_groups - 1; i >= 0; i-- )
+    {
+        BATCH_GROUP *cg = batch_groups + i;
+
+        if (    cg->type == type
+             && cg->win  == flx->win
+             && cg->col  == col
+             && cg->n    <  MAX_BATCH_ITEMS )
+        {
+            g = cg;
+            break;
+        }
+
+        if ( batch_group_overlaps( cg, x1, y1, x2, y2 ) )
+            break;
+    }
+
+    if ( ! g )
+    {
+        if ( nbatch_groups == MAX_BATCH_GROUPS )
+            fli_flush_batch( );
+
+        g = batch_groups + nbatch_groups++;
+        g->type = type;
+        g->win  = flx->win;
+        g->col  = col;
+        g->n    = 0;
+        g->used = 0;
+        g->x1   = x1;
+        g->y1   = y1;
+        g->x2   = x2;
+        g->y2   = y2;
+    }
+    else
+    {
+        g->x1 = FL_min( g->x1, x1 );
+        g->y1 = FL_min( g->y1, y1 );
+        g->x2 = FL_max( g->x2, x2 );
+        g->y2 = FL_max( g->y2, y2 );
+    }
+
+    /* The memory for the items is kept between flushes, but a group may
+       get reused for items of a different size */
+
+    if ( g->used + size > g->size )
+    {
+        g->size = FL_max( 2 * g->size, g->used + 16 * size );
+        g->items = fl_realloc( g->items, g->size );
+    }
+
+    return g;
+}
+
+
+/***************************************
+ * Adds a primitive to the group it can be drawn with. For rectangles
+ * and arcs 'a' to 'd' are position and size (and 'e' and 'f' the
+ * angles of arcs), for segments the coordinates of the end points and
+ * for points the position. Returns 0 if batching isn't possible at the
+ * moment and the primitive must be drawn immediately.
+ ***************************************/
+
+static int
+batch_add( int      type,
+           FL_COLOR col,
+           int      a,
+           int      b,
+           int      c,
+           int      d,
+           int      e,
+           int      f )
+{
+    BATCH_GROUP *g;
+    void *item;
+
+    if ( type == BATCH_SEGMENT )
+        g = get_batch_group( type, col, FL_min( a, c ), FL_min( b, d ),
+                             FL_max( a, c ), FL_max( b, d ),
+                             batch_item_size[ type ] );
+    else if ( type == BATCH_POINT )
+        g = get_batch_group( type, col, a, b, a, b,
+                             batch_item_size[ type ] );
+    else
+        g = get_batch_group( type, col, a, b, a + c, b + d,
+                             batch_item_size[ type ] );
+
+    if ( ! g )
+        return 0;
+
+    item = ( char * ) g->items + g->used;
+
+    switch ( type )
+    {
+        case BATCH_FILLED_RECT :
+        case BATCH_RECT :
+        {
+            XRectangle *r = item;
+
+            r->x      = a;
+            r->y      = b;
+            r->width  = c;
+            r->height = d;
+            break;
+        }
+
+        case BATCH_SEGMENT :
+        {
+            XSegment *s = item;
+
+            s->x1 = a;
+            s->y1 = b;
+            s->x2 = c;
+            s->y2 = d;
+            break;
+        }
+
+        case BATCH_POINT :
+        {
+            XPoint *p = item;
+
+            p->x = a;
+            p->y = b;
+            break;
+        }
+
+        default :
+        {
+            XArc *arc = item;
+
+            arc->x      = a;
+            arc->y      = b;
+            arc->width  = c;
+            arc->height = d;
+            arc->angle1 = e;
+            arc->angle2 = f;
+            break;
+        }
+    }
+
+    g->used += batch_item_size[ type ];
+    g->n++;
+    return 1;
+}
+
+
+/***************************************
+ * Adds a filled polygon with 'n' points. X can't fill several polygons
+ * in one request, but polygons of the same color still need only one
+ * change of the color and, more importantly, don't force the drawing
+ * of everything pending below them (the bevels of 3D boxes are drawn
+ * on top of the box). Each polygon is stored as an XPoint with the
+ * number of points in 'x', followed by the points.
+ ***************************************/
+
+static int
+batch_add_polygon( FL_COLOR   col,
+                   FL_POINT * xp,
+                   int        n )
+{
+    BATCH_GROUP *g;
+    XPoint *p;
+    int x1, y1, x2, y2,
+        i;
+
+    if ( n > MAX_BATCH_POLYGON )
+        return 0;
+
+    x1 = x2 = xp[ 0 ].x;
+    y1 = y2 = xp[ 0 ].y;
+
+    for ( i = 1; i < n; i++ )
+    {
+        x1 = FL_min( x1, xp[ i ].x );
+        y1 = FL_min( y1, xp[ i ].y );
+        x2 = FL_max( x2, xp[ i ].x );
+        y2 = FL_max( y2, xp[ i ].y );
+    }
+
+    if ( ! ( g = get_batch_group( BATCH_FILLED_POLYGON, col, x1, y1, x2, y2,
+                                  ( n + 1 ) * sizeof *p ) ) )
+        return 0;
+
+    p = ( XPoint * ) ( ( char * ) g->items + g->used );
+    p->x = n;
+    p->y = 0;
+    memcpy( p + 1, xp, n * sizeof *p );
+
+    g->used += ( n + 1 ) * sizeof *p;
+    g->n++;
+    return 1;
+}
+
+
+/****** End of batching ***********************}***/
+
+
 /*
  * Local variables:
  * tab-width: 4
@@ -0,0 +1,447 @@
+/*
+ *  This file is part of the XForms library package.
+ *
+ *  XForms is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1, or
+ *  (at your option) any later version.
+ *
+ *  XForms is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with XForms.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * \file xft.c
+ *
+ * Optional drawing of text with antialiased fonts via Xft and the
+ * X Render extension. Fonts are still selected and managed as core
+ * X fonts (so that all the code dealing with XFontStruct's keeps
+ * working), but for each core font a matching Xft font is opened
+ * and used for drawing and for the widths of the characters. The
+ * glyphs get uploaded to the server only once per font by Xft, so
+ * drawing a string just sends a single request with the character
+ * codes.
+ *
+ * If the library was built without Xft support or the user didn't
+ * ask for it (via the "-xft" option or the "useXft" resource) all
+ * functions here return without doing anything and the core font
+ * functions get used.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "include/forms.h"
+#include "flinternal.h"
+
+#ifdef HAVE_XFT
+
+#include <X11/Xatom.h>
+#include <X11/Xft/Xft.h>
+
+typedef struct {
+    XFontStruct * fs;
+    XftFont     * xf;
+} XFT_FONT;
+
+static int xft_enabled;
+
+static XFT_FONT * xft_fonts;
+static int nxft_fonts;
+
+/* State while drawing a run of text (see fli_xft_begin()) */
+
+static XftDraw * xft_draw;
+static XftFont * xft_font;
+
+
+/***************************************
+ * Returns the Xft font matching a core font, opening it if necessary
+ ***************************************/
+
+static XftFont *
+get_xft_font( XFontStruct * fs )
+{
+    XftFont *xf = NULL;
+    unsigned long val;
+    int i;
+
+    for ( i = 0; i < nxft_fonts; i++ )
+        if ( xft_fonts[ i ].fs == fs )
+            return xft_fonts[ i ].xf;
+
+    /* Use the name the server reports for the font, that's the complete
+       name even if the font was requested with wildcards. If this fails
+       at least get something of the same size. */
+
+    if ( XGetFontProperty( fs, XA_FONT, &val ) )
+    {
+        char *name = XGetAtomName( flx->display, val );
+
+        if ( name )
+        {
+            xf = XftFontOpenXlfd( flx->display, fl_screen, name );
+            XFree( name );
+        }
+    }
+
+    if ( ! xf )
+        xf = XftFontOpen( flx->display, fl_screen,
+                          XFT_PIXEL_SIZE, XftTypeDouble,
+                          ( double ) ( fs->ascent + fs->descent ),
+                          NULL );
+
+    if ( ! xf )
+        M_warn( "get_xft_font", "Can't open Xft font, using core font" );
+
+    /* Also remember failures, no point in trying again */
+
+    xft_fonts = fl_realloc( xft_fonts, ++nxft_fonts * sizeof *xft_fonts );
+    xft_fonts[ nxft_fonts - 1 ].fs = fs;
+    xft_fonts[ nxft_fonts - 1 ].xf = xf;
+
+    return xf;
+}
+
+
+/***************************************
+ * Converts a pixel value to the color Xft needs for drawing
+ ***************************************/
+
+static void
+pixel_to_xft_color( unsigned long pixel,
+                    XftColor    * color )
+{
+    static unsigned long last_pixel;
+    static XColor last_xc;
+    static int last_vmode = -1;
+
+    if ( last_vmode != fl_vmode || last_pixel != pixel )
+    {
+        last_xc.pixel = pixel;
+        XQueryColor( flx->display, fli_colormap( fl_vmode ), &last_xc );
+        last_pixel = pixel;
+        last_vmode = fl_vmode;
+    }
+
+    color->pixel = pixel;
+    color->color.red   = last_xc.red;
+    color->color.green = last_xc.green;
+    color->color.blue  = last_xc.blue;
+    color->color.alpha = 0xffff;
+}
+
+
+/***************************************
+ * Converts the foreground or background color of a GC for Xft
+ ***************************************/
+
+static void
+gc_to_xft_color( GC         gc,
+                 int        background,
+                 XftColor * color )
+{
+    XGCValues xgcv;
+    unsigned long pixel;
+
+    XGetGCValues( flx->display, gc,
+                  background ? GCBackground : GCForeground, &xgcv );
+    pixel = background ? xgcv.background : xgcv.foreground;
+
+    /* For true color visuals the color can be calculated directly from
+       the pixel value, otherwise the server must be asked */
+
+    if ( fli_class( fl_vmode ) == TrueColor )
+    {
+        Visual *vis = fli_visual( fl_vmode );
+        unsigned long mask[ 3 ] = { vis->red_mask,
+                                    vis->green_mask,
+                                    vis->blue_mask };
+        unsigned short *c[ 3 ] = { &color->color.red,
+                                   &color->color.green,
+                                   &color->color.blue };
+        int i;
+
+        for ( i = 0; i < 3; i++ )
+        {
+            unsigned long m = mask[ i ],
+                          v = pixel & m;
+
+            if ( ! m )
+            {
+                *c[ i ] = 0;
+                continue;
+            }
+
+            while ( ! ( m & 1 ) )
+            {
+                m >>= 1;
+                v >>= 1;
+            }
+
+            *c[ i ] = ( v * 0xffff ) / m;
+        }
+
+        color->pixel = pixel;
+        color->color.alpha = 0xffff;
+    }
+    else
+        pixel_to_xft_color( pixel, color );
+}
+
+
+#endif /* HAVE_XFT */
+
+
+/***************************************
+ * Called on initialization, switches to drawing text via Xft if
+ * the user asked for it and the server supports it
+ ***************************************/
+
+void
+fli_xft_init( void )
+{
+#ifdef HAVE_XFT
+    if ( ! fli_cntl.useXft )
+        return;
+
+    if ( ! XftDefaultHasRender( flx->display ) )
+    {
+        M_warn( "fli_xft_init", "Server doesn't support the X Render "
+                "extension, using core fonts" );
+        return;
+    }
+
+    xft_enabled = 1;
+#else
+    if ( fli_cntl.useXft )
+        M_warn( "fli_xft_init", "Library was built without Xft support, "
+                "using core fonts" );
+#endif
+}
+
+
+/***************************************
+ * Fills in the widths of all characters of the Xft font matching a
+ * core font, returns 0 if Xft isn't used (or the font can't be found)
+ ***************************************/
+
+int
+fli_xft_char_widths( XFontStruct * fs,
+                     int         * width )
+{
+#ifdef HAVE_XFT
+    XftFont *xf;
+    XGlyphInfo gi;
+    int i;
+
+    if ( ! xft_enabled || ! ( xf = get_xft_font( fs ) ) )
+        return 0;
+
+    for ( i = 0; i < 256; i++ )
+    {
+        FcChar8 c = i;
+
+        XftTextExtents8( flx->display, xf, &c, 1, &gi );
+        width[ i ] = gi.xOff;
+    }
+
+    return 1;
+#else
+    ( void ) fs;
+    ( void ) width;
+    return 0;
+#endif
+}
+
+
+/***************************************
+ * Must be called before a run of strings in a font get drawn into a
+ * drawable via fli_xft_draw_string() or fli_xft_draw_image_string().
+ * Returns 0 if Xft isn't to be used and the core functions must be
+ * used instead. The current text clipping region (which includes the
+ * global clipping) is applied to all strings of the run.
+ ***************************************/
+
+int
+fli_xft_begin( Drawable      d,
+               XFontStruct * fs )
+{
+#ifdef HAVE_XFT
+    FL_Coord x,
+             y,
+             w,
+             h;
+
+    if (    ! xft_enabled
+         || ! d
+         || ! fs
+         || ! ( xft_font = get_xft_font( fs ) ) )
+        return 0;
+
+    /* A new XftDraw is used for each run: the picture it creates on the
+       server must not outlive the drawable (which might be a pixmap used
+       for double buffering that's going to be freed soon) */
+
+    if ( ! ( xft_draw = XftDrawCreate( flx->display, d,
+                                       fli_visual( fl_vmode ),
+                                       fli_colormap( fl_vmode ) ) ) )
+        return 0;
+
+    if ( fl_get_text_clipping( 1, &x, &y, &w, &h ) )
+    {
+        XRectangle xr;
+
+        xr.x      = x;
+        xr.y      = y;
+        xr.width  = FL_max( w, 0 );
+        xr.height = FL_max( h, 0 );
+        XftDrawSetClipRectangles( xft_draw, 0, 0, &xr, 1 );
+    }
+
+    return 1;
+#else
+    ( void ) d;
+    ( void ) fs;
+    return 0;
+#endif
+}
+
+
+/***************************************
+ * Ends a run of strings drawn with Xft
+ ***************************************/
+
+void
+fli_xft_end( void )
+{
+#ifdef HAVE_XFT
+    if ( xft_draw )
+        XftDrawDestroy( xft_draw );
+    xft_draw = NULL;
+    xft_font = NULL;
+#endif
+}
+
+
+/***************************************
+ * Replacement for XDrawString(), draws the string in the foreground
+ * color of the GC with the font the run was started with
+ ***************************************/
+
+int
+fli_xft_draw_string( Display    * display  FL_UNUSED_ARG,
+                     Drawable     d        FL_UNUSED_ARG,
+                     GC           gc,
+                     int          x,
+                     int          y,
+                     const char * s,
+                     int          len )
+{
+#ifdef HAVE_XFT
+    XftColor color;
+
+    if ( ! xft_draw || len <= 0 )
+        return 0;
+
+    gc_to_xft_color( gc, 0, &color );
+    XftDrawString8( xft_draw, &color, xft_font, x, y,
+                    ( const FcChar8 * ) s, len );
+#else
+    ( void ) gc;
+    ( void ) x;
+    ( void ) y;
+    ( void ) s;
+    ( void ) len;
+#endif
+
+    return 0;
+}
+
+
+/***************************************
+ * Replacement for XDrawImageString(), fills the area of the string with
+ * the background color of the GC before drawing the string
+ ***************************************/
+
+int
+fli_xft_draw_image_string( Display    * display,
+                           Drawable     d,
+                           GC           gc,
+                           int          x,
+                           int          y,
+                           const char * s,
+                           int          len )
+{
+#ifdef HAVE_XFT
+    XftColor color;
+    XGlyphInfo gi;
+
+    if ( ! xft_draw || len <= 0 )
+        return 0;
+
+    XftTextExtents8( flx->display, xft_font, ( const FcChar8 * ) s, len,
+                     &gi );
+    gc_to_xft_color( gc, 1, &color );
+    XftDrawRect( xft_draw, &color, x, y - xft_font->ascent, gi.xOff,
+                 xft_font->ascent + xft_font->descent );
+#endif
+
+    return fli_xft_draw_string( display, d, gc, x, y, s, len );
+}
+
+
+/***************************************
+ * Closes the Xft font for a core font that's about to be freed
+ ***************************************/
+
+void
+fli_xft_forget_font( XFontStruct * fs )
+{
+#ifdef HAVE_XFT
+    int i;
+
+    for ( i = 0; i < nxft_fonts; i++ )
+        if ( xft_fonts[ i ].fs == fs )
+        {
+            if ( xft_fonts[ i ].xf )
+                XftFontClose( flx->display, xft_fonts[ i ].xf );
+            xft_fonts[ i ] = xft_fonts[ --nxft_fonts ];
+            break;
+        }
+#else
+    ( void ) fs;
+#endif
+}
+
+
+/***************************************
+ * Closes all Xft fonts, called from fl_finish()
+ ***************************************/
+
+void
+fli_xft_finish( void )
+{
+#ifdef HAVE_XFT
+    while ( nxft_fonts > 0 )
+        fli_xft_forget_font( xft_fonts[ 0 ].fs );
+
+    fli_safe_free( xft_fonts );
+    xft_enabled = 0;
+#endif
+}
+
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
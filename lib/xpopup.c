@@ -274,7 +274,8 @@ reset_max_width( PopUP * m )
         b = t = fl_strdup( m->title );
         while ( ( b = strchr( b, '\b' ) ) )
             memmove( b, b + 1, strlen( b ) );
-        m->title_width = XTextWidth( pup_title_font_struct, t, strlen( t ) );
+        m->title_width = fli_text_width( pup_title_font_struct,
+                                         t, strlen( t ) );
         fl_free( t );
     }
     else
@@ -479,8 +480,8 @@ parse_entry( int          n,
             b = t = fl_strdup( c );
             while ( ( b = strchr( b, '\b' ) ) )
                 memmove( b, b + 1, strlen( b ) );
-            m->title_width = XTextWidth( pup_title_font_struct,
-                                         t, strlen( t ) );
+            m->title_width = fli_text_width( pup_title_font_struct,
+                                             t, strlen( t ) );
             fl_free( t );
             fl_free( item );
             m->item[ m->nitems ] = NULL;
@@ -1579,7 +1580,8 @@ fl_setpup_title( int          nm,
     b = t = fl_strdup( title ? title : "" );
     while ( ( b = strchr( b, '\b' ) ) )
         memmove( b, b + 1, strlen( b ) );
-    m->title_width = XTextWidth( pup_title_font_struct, t, strlen( t ) );
+    m->title_width = fli_text_width( pup_title_font_struct,
+                                     t, strlen( t ) );
     fl_free( t );
 }
 
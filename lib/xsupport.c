@@ -343,6 +343,7 @@ fli_show_object_pixmap( FL_OBJECT * obj )
          || NON_SQB( obj ) )
         return;
 
+    fli_flush_batch( );
     XCopyArea( flx->display, p->pixmap, p->win, flx->gc,
                0, 0, p->w, p->h, p->x, p->y );
 
@@ -458,6 +459,7 @@ fli_show_form_pixmap( FL_FORM * form )
          || p->h <= 0 )
         return;
 
+    fli_flush_batch( );
     XCopyArea( flx->display, p->pixmap, p->win, flx->gc,
                0, 0, p->w, p->h, 0, 0 );
 
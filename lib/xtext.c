@@ -41,30 +41,19 @@
 static int UL_thickness = -1;
 static int UL_propwidth = 1;    /* 1 for proportional, 0 for constant */
 
-static void do_underline( FL_Coord,
-                          FL_Coord,
-                          const char *,
-                          int );
-
-static void do_underline_all( FL_Coord,
-                              FL_Coord,
-                              const char *,
-                              int,
-                              unsigned long *,
-                              unsigned long * );
+static void get_underline_all_rect( const char *,
+                                    int,
+                                    XRectangle * );
 
 #define NUM_LINES_INCREMENT  64
 
-static struct LINE_INFO {
-    char * str;
-    int    len;
-    int    index;
-    int    underline_index;
-    int    x;
-    int    y;
-} * lines = NULL;
-    
-static int nlines;
+/* Layout for strings that aren't the label of an object */
+
+static FL_label_layout workmem;
+
+/* Object whose label is being drawn (see fl_draw_object_label()) */
+
+static FL_OBJECT *label_obj = NULL;
 
 static int max_pixelline = 0;
 
@@ -72,11 +61,25 @@ static int max_pixelline = 0;
 /***************************************
  ***************************************/
 
-static int
-extend_workmem( int nl )
+static void
+extend_lines( FL_label_layout * lo,
+              int               nl )
 {
-    lines = fl_realloc( lines, nl * sizeof *lines );
-    return nlines = nl;
+    lo->lines = fl_realloc( lo->lines, nl * sizeof *lo->lines );
+    lo->maxlines = nl;
+}
+
+
+/***************************************
+ ***************************************/
+
+static void
+free_layout( FL_label_layout * lo )
+{
+    fli_safe_free( lo->str );
+    fli_safe_free( lo->lines );
+    lo->nlines = lo->maxlines = 0;
+    lo->label = NULL;
 }
 
 
@@ -86,8 +89,160 @@ extend_workmem( int nl )
 void
 fli_free_xtext_workmem( void )
 {
-    fli_safe_free( lines );
-    nlines = 0;
+    free_layout( &workmem );
+}
+
+
+/***************************************
+ * Split a copy of the string into lines, storing the index where each
+ * of them begins in the original string as well as the length
+ ***************************************/
+
+static void
+split_lines( FL_label_layout * lo,
+             const char      * istr )
+{
+    size_t len;
+    char *p;
+
+    lo->nlines = 0;
+
+    if ( ! istr || ! *istr )
+        return;
+
+    len = strlen( istr ) + 1;
+    lo->str = fl_realloc( lo->str, len );
+    memcpy( lo->str, istr, len );
+
+    for ( p = lo->str; p; lo->nlines++ )
+    {
+        FLI_LINE_INFO *line;
+
+        /* Make sure we have enough memory */
+
+        if ( lo->nlines >= lo->maxlines )
+            extend_lines( lo, lo->maxlines + NUM_LINES_INCREMENT );
+
+        /* Get pointer to the start of the line and it's index in the
+           complete string */
+
+        line = lo->lines + lo->nlines;
+        line->str = p;
+        line->index = p - lo->str;
+        line->underline_index = -1;
+
+        /* Try to find the next new line and replace the '\n' with '\0' */
+
+        if ( ( p = strchr( p, '\n' ) ) )
+            *p++ = '\0';
+
+        /* Calculate the length of the string */
+
+        line->len = p ? ( p - line->str - 1 ) : ( int ) strlen( line->str );
+    }
+}
+
+
+/***************************************
+ * Check the lines for the special character which indicates underlining
+ * (all the line if it's in the very first position, otherwise just after
+ * the character to underline), remove it from the string but remember
+ * were it was. Then determine the width (in pixel) of the lines and where
+ * the underline goes with the current font.
+ ***************************************/
+
+static void
+measure_lines( FL_label_layout * lo,
+               int               from,
+               int               to )
+{
+    for ( ; from < to; from++ )
+    {
+        FLI_LINE_INFO *line = lo->lines + from;
+        char *p;
+
+        if ( ( p = strchr( line->str, *fl_ul_magic_char ) ) )
+        {
+            line->underline_index = p - line->str;
+            memmove( p, p + 1, line->len-- - line->underline_index );
+        }
+
+        line->width = fli_text_width( flx->fs, line->str, line->len );
+
+        if ( line->underline_index > 0 )
+            line->ul = *fli_get_underline_rect( flx->fs, 0, 0, line->str,
+                                                line->underline_index - 1 );
+        else if ( line->underline_index == 0 )
+            get_underline_all_rect( line->str, line->len, &line->ul );
+    }
+}
+
+
+/***************************************
+ * Makes fli_draw_string() use (and, if necessary, create) the layout
+ * kept with the object when it gets asked to draw the object's label.
+ * Must be reset by passing NULL when done.
+ ***************************************/
+
+void
+fli_set_label_object( FL_OBJECT * obj )
+{
+    label_obj = obj;
+}
+
+
+/***************************************
+ * Must be called whenever the label of an object changes
+ ***************************************/
+
+void
+fli_free_label_layout( FL_OBJECT * obj )
+{
+    if ( obj->label_layout )
+    {
+        free_layout( obj->label_layout );
+        fli_safe_free( obj->label_layout );
+    }
+}
+
+
+/***************************************
+ * Returns the cached layout of the label of the object set with
+ * fli_set_label_object() if that's what 'str' is, redoing it if the
+ * font changed. Expects the font to be already set.
+ ***************************************/
+
+static FL_label_layout *
+get_label_layout( const char * str,
+                  int          style,
+                  int          size )
+{
+    FL_label_layout *lo;
+
+    if ( ! label_obj || str != label_obj->label )
+        return NULL;
+
+    if (    ! ( lo = label_obj->label_layout )
+         && ! ( lo = label_obj->label_layout = fl_calloc( 1, sizeof *lo ) ) )
+        return NULL;
+
+    if (    lo->label == str
+         && lo->style == style
+         && lo->size  == size
+         && lo->fs    == flx->fs
+         && lo->fid   == flx->fs->fid )
+        return lo;
+
+    split_lines( lo, str );
+    measure_lines( lo, 0, lo->nlines );
+
+    lo->label = str;
+    lo->style = style;
+    lo->size  = size;
+    lo->fs    = flx->fs;
+    lo->fid   = flx->fs->fid;
+
+    return lo;
 }
 
 
@@ -171,12 +326,12 @@ fli_draw_string( int           align,
                  FL_COLOR      bkcol )
 {
     int i;
-    int lnumb = 0;           /* number of lines in string */
+    int lnumb;               /* number of lines in string */
     int max_pixels = 0;
     int horalign,
         vertalign;
-    char * str = NULL,
-         * p = NULL;
+    FL_label_layout *lo = NULL;
+    FLI_LINE_INFO *lines;
     DrawString drawIt = img ? XDrawImageString : XDrawString;
 
     /* Check if anything has to be drawn at all - do nothing if we either
@@ -192,39 +347,25 @@ fli_draw_string( int           align,
          || ( curspos > 0 && ! ( istr && *istr ) ) )
         return 0;
 
-    /* We operate only on a copy of the input string */
-
-    if ( istr && *istr )
-        p = str = fl_strdup( istr );
-
-    /* Split the string into lines, store the index where each of them begins
-       in the original string as well as the length */
-
-    while ( p )
-    {
-        /* Make sure we have enough memory */
-
-        if ( lnumb >= nlines )
-            extend_workmem( nlines + NUM_LINES_INCREMENT );
-
-        /* Get pointer to the start of the line and it's index in the
-           complete string */
+    /* All measuring is done with the font set up */
 
-        lines[ lnumb ].str = p;
-        lines[ lnumb ].index = p - str;   /* where line begins in str */
-
-        /* Try to find the next new line and replace the '\n' with '\0' */
+    fl_set_font( style, size );
 
-        if ( ( p = strchr( p, '\n' ) ) )
-            *p++ = '\0';
+    /* Labels of objects without cursor or selection come with a cached
+       layout, everything else gets split into lines on each call */
 
-        /* Calculate the length of the string */
+    if ( curspos < 0 && selstart >= selend )
+        lo = get_label_layout( istr, style, size );
 
-        lines[ lnumb ].len = p ? ( p - lines[ lnumb ].str - 1 ) :
-                                 ( int ) strlen( lines[ lnumb ].str );
-        ++lnumb;
+    if ( ! lo )
+    {
+        lo = &workmem;
+        split_lines( lo, istr );
     }
 
+    lines = lo->lines;
+    lnumb = lo->nlines;
+
     /* Correct values for the top and end line to be shown (they are given
        starting at 1) */
 
@@ -234,46 +375,36 @@ fli_draw_string( int           align,
     if ( --endline >= lnumb || endline < 0 )
         endline = lnumb;
 
-    /* Calculate coordinates of all lines (for y the baseline position),
-     for that make sure the correct font is set up */
+    if ( lo == &workmem )
+        measure_lines( lo, topline, endline );
+
+    /* Calculate coordinates of all lines (for y the baseline position) */
 
-    fl_set_font( style, size );
     fli_get_hv_align( align, &horalign, &vertalign );
 
     for ( i = topline; i < endline; i++ )
     {
-        struct LINE_INFO *line = lines + i;
-        int width;
+        FLI_LINE_INFO *line = lines + i;
+        int width = line->width;
 
-        /* Check for the special character which indicates underlining (all
-           the line if it's in the very first position, otherwise just after
-           the character to underline), remove it from the string but remember
-           were it was and correct the selection positions if necessary (i.e.
-           if they are in the line after the character to be underlined).
-           Same for the cursor position if it's in the line. */
+        /* Correct the selection positions if necessary (i.e. if they are in
+           the line after the character to be underlined), same for the
+           cursor position if it's in the line */
 
-        if ( ( p = strchr( line->str, *fl_ul_magic_char ) ) )
+        if ( line->underline_index >= 0 )
         {
-            line->underline_index = p - line->str;
+            int len = line->len + 1;     /* with the underline char */
 
-            if (    selstart < line->index + line->len
+            if (    selstart < line->index + len
                  && selstart > line->index + line->underline_index )
                 --selstart;
-            if (    selend < line->index + line->len
+            if (    selend < line->index + len
                  && selend > line->index + line->underline_index )
                 --selend;
             if (    curspos >= line->index + line->underline_index
-                 && selstart < line->index + line->len )
+                 && selstart < line->index + len )
                 --curspos;
-
-            memmove( p, p + 1, line->len-- - line->underline_index );
         }
-        else
-            line->underline_index = -1;
-
-        /* Determine the width (in pixel) of the line) */
-
-        width = XTextWidth( flx->fs, line->str, line->len );
 
         if ( width > max_pixels )
         {
@@ -328,16 +459,43 @@ fli_draw_string( int           align,
     if ( clip > 0 )
         fl_set_text_clipping( x, y, w, h );
 
+    /* Anything still pending below the text must be drawn first (with
+       some room for glyphs extending beyond their nominal width) */
+
+    if ( topline < endline )
+    {
+        int x1 = lines[ topline ].x,
+            x2 = x1 + lines[ topline ].width,
+            margin = flx->fheight / 2;
+
+        for ( i = topline + 1; i < endline; i++ )
+        {
+            x1 = FL_min( x1, lines[ i ].x );
+            x2 = FL_max( x2, lines[ i ].x + lines[ i ].width );
+        }
+
+        fli_flush_batch_area( x1 - margin,
+                              lines[ topline ].y - flx->fasc - margin,
+                              x2 - x1 + 2 * margin,
+                                lines[ endline - 1 ].y + flx->fdesc
+                              - lines[ topline ].y + flx->fasc + 2 * margin );
+    }
+
     /* Set foreground and background color for text */
 
     fli_textcolor( forecol );
     fli_bk_textcolor( bkcol );
 
+    /* All lines get drawn with Xft if that's in use */
+
+    if ( fli_xft_begin( flx->win, flx->fs ) )
+        drawIt = img ? fli_xft_draw_image_string : fli_xft_draw_string;
+
     /* Draw all the lines requested */
 
     for ( i = topline; i < endline; i++ )
     {
-        struct LINE_INFO *line = lines + i;
+        FLI_LINE_INFO *line = lines + i;
         FL_COLOR underline_col = forecol;
         int xsel = 0,       /* start position of selected text */
             wsel = 0;       /* and its length (in pixel) */
@@ -391,9 +549,9 @@ fli_draw_string( int           align,
                region (the -1 in the calculation  of wsel is a fudge factor
                to make it look a bit better) */
 
-            xsel = line->x + XTextWidth( flx->fs, line->str, start );
+            xsel = line->x + fli_text_width( flx->fs, line->str, start );
 
-            wsel = XTextWidth( flx->fs, line->str + start, len ) - 1;
+            wsel = fli_text_width( flx->fs, line->str + start, len ) - 1;
             if ( xsel + wsel > x + w )
                 wsel = x + w - xsel;
 
@@ -402,6 +560,8 @@ fli_draw_string( int           align,
             fl_rectf( xsel, line->y - flx->fasc, wsel,
                       flx->fheight, forecol );
 
+            fli_flush_batch_area( xsel, line->y - flx->fasc,
+                                  wsel, flx->fheight );
             fli_textcolor( backcol );
             drawIt( flx->display, flx->win, flx->textgc, xsel,
                     line->y, line->str + start, len );
@@ -413,31 +573,30 @@ fli_draw_string( int           align,
 
         /* Next do underlining */
 
-        if ( line->underline_index > 0 )
-        {
-            fl_color( underline_col );
-            do_underline( line->x, line->y, line->str,
-                          line->underline_index - 1 );
-        }
-        else if ( line->underline_index == 0 )
+        if (    line->underline_index >= 0
+             && line->ul.width > 0
+             && line->ul.height > 0 )
         {
-            unsigned long offset,
-                          thickness;
-
-            fl_color( forecol );
-            do_underline_all( line->x, line->y, line->str,
-                              line->len, &offset, &thickness );
-
-            /* If wsel is larger than 0 some part of the underlined
+            fli_flush_batch_area( line->x + line->ul.x,
+                                  line->y + line->ul.y,
+                                  line->ul.width, line->ul.height );
+            fl_color( line->underline_index > 0 ? underline_col : forecol );
+            XFillRectangle( flx->display, flx->win, flx->gc,
+                            line->x + line->ul.x, line->y + line->ul.y,
+                            line->ul.width, line->ul.height );
+
+            /* If wsel is larger than 0 some part of an all underlined
                string is selected and then we need to draw underine of
                the part of the string that is selected in the color used
                for drawing that part of the string. */
 
-            if ( wsel > 0 && thickness > 0 )
+            if ( line->underline_index == 0 && wsel > 0 )
             {
+                fli_flush_batch_area( xsel, line->y + line->ul.y,
+                                      wsel, line->ul.height );
                 fl_color( underline_col );
                 XFillRectangle( flx->display, flx->win, flx->gc, xsel,
-                                line->y + offset, wsel, thickness);
+                                line->y + line->ul.y, wsel, line->ul.height );
             }
         }
 
@@ -446,8 +605,8 @@ fli_draw_string( int           align,
         if (    curspos >= line->index
              && curspos <= line->index + line->len )
         {
-            int tt = XTextWidth( flx->fs, line->str,
-                                 curspos - line->index );
+            int tt = fli_text_width( flx->fs, line->str,
+                                     curspos - line->index );
 
             fl_rectf( line->x + tt, line->y - flx->fasc,
                       2, flx->fheight, curscol );
@@ -479,9 +638,7 @@ fli_draw_string( int           align,
         fl_rectf( xc, yc, 2, flx->fheight, curscol );
     }
 
-    /* Free our copy of the string */
-
-    fli_safe_free( str );
+    fli_xft_end( );
 
     /* Reset clipping if required */
 
@@ -581,7 +738,8 @@ fli_get_pos_in_string( int          align,
     int lnumb = 0;             /* number of lines  */
     int horalign,
         vertalign;
-    struct LINE_INFO * line;
+    FLI_LINE_INFO * lines,
+                  * line;
     int width;                 /* string width of that line... */
     int xstart;                /* start x-coordinate of this line  */
     int toppos;                /* y-coord of the top line  */
@@ -611,15 +769,17 @@ fli_get_pos_in_string( int          align,
 
     while ( p )
     {
-        if ( lnumb + 1 >= nlines )
-            extend_workmem( nlines + NUM_LINES_INCREMENT );
+        if ( lnumb + 1 >= workmem.maxlines )
+            extend_lines( &workmem, workmem.maxlines + NUM_LINES_INCREMENT );
 
-        lines[ lnumb ].str = ( char * ) p;
-        lines[ lnumb++ ].index = p - str;
+        workmem.lines[ lnumb ].str = ( char * ) p;
+        workmem.lines[ lnumb++ ].index = p - str;
         if ( ( p = strchr( p, '\n' ) ) )
             ++p;
     }
 
+    lines = workmem.lines;
+
     /* Find the line in which the mouse is  */
 
     fli_get_hv_align( align, &horalign, &vertalign );
@@ -665,7 +825,7 @@ fli_get_pos_in_string( int          align,
 
     /* Calculate width and start x-coordinate of the line */
 
-    width = XTextWidth( flx->fs, line->str, line->len );
+    width = fli_text_width( flx->fs, line->str, line->len );
 
     switch ( horalign )
     {
@@ -710,7 +870,7 @@ fli_get_pos_in_string( int          align,
 
     *xp = ( double ) ( xpos * line->len ) / width;
 
-    xlen = XTextWidth( flx->fs, line->str, ++*xp );
+    xlen = fli_text_width( flx->fs, line->str, ++*xp );
 
     /* If we don't have hit it directly search to the left or right */
 
@@ -719,7 +879,7 @@ fli_get_pos_in_string( int          align,
         do
         {
             *xp -= 1;
-            xlen = XTextWidth( flx->fs, line->str, *xp );
+            xlen = fli_text_width( flx->fs, line->str, *xp );
         }
         while ( *xp > 0 && xlen > xpos );
         *xp += 1;
@@ -728,7 +888,7 @@ fli_get_pos_in_string( int          align,
         do
         {
             *xp += 1;
-            xlen = XTextWidth( flx->fs, line->str, *xp );
+            xlen = fli_text_width( flx->fs, line->str, *xp );
         }
         while ( *xp < lines->len && xlen < xpos );
 
@@ -1005,8 +1165,8 @@ fli_get_underline_rect( XFontStruct * fs,
        of D. Of course, if UL_width == proportional, this really does not
        matter */
 
-    ul_width = XTextWidth( fs, NARROW( ch ) ? "h" : "D", 1 );
-    ul_rwidth = XTextWidth( fs, str + n, 1 );
+    ul_width = fli_text_width( fs, NARROW( ch ) ? "h" : "D", 1 );
+    ul_rwidth = fli_text_width( fs, str + n, 1 );
 
     pre = str[ 0 ] == *fl_ul_magic_char;
 
@@ -1027,25 +1187,6 @@ fli_get_underline_rect( XFontStruct * fs,
 }
 
 
-/***************************************
- ***************************************/
-
-static void
-do_underline( FL_Coord     x,
-              FL_Coord     y,
-              const char * cstr,
-              int          n )
-{
-    XRectangle *xr = fli_get_underline_rect( flx->fs, x, y, cstr, n );
-
-    if ( flx->win == None || xr->width <= 0 ||  xr->height <= 0 )
-        return;
-
-    XFillRectangle( flx->display, flx->win, flx->gc, xr->x, xr->y,
-                    xr->width, xr->height );
-}
-
-
 #define has_desc( s )    (    strchr( s, 'g' )  \
                            || strchr( s, 'j' )  \
                            || strchr( s, 'q' )  \
@@ -1054,40 +1195,32 @@ do_underline( FL_Coord     x,
 
 
 /***************************************
- * Underline whole string
+ * Underline for a whole string, relative to the start of its baseline
  ***************************************/
 
 static void
-do_underline_all( FL_Coord        x,
-                  FL_Coord        y,
-                  const char    * str,
-                  int             n,
-                  unsigned long * ul_pos,
-                  unsigned long * ul_thickness )
+get_underline_all_rect( const char * str,
+                        int          n,
+                        XRectangle * xr )
 {
-    int ul_width;
-
-    if ( flx->win == None )
-        return;
+    unsigned long ul_pos,
+                  ul_thickness = 0;
 
     if ( UL_thickness < 0 )
-        XGetFontProperty( flx->fs, XA_UNDERLINE_THICKNESS, ul_thickness );
+        XGetFontProperty( flx->fs, XA_UNDERLINE_THICKNESS, &ul_thickness );
     else
-        *ul_thickness = UL_thickness;
-
-    if ( *ul_thickness == 0 || *ul_thickness > 100 )
-        *ul_thickness = strstr( fli_curfnt, "bold" ) ? 2 : 1;
-
-    if ( ! XGetFontProperty( flx->fs, XA_UNDERLINE_POSITION, ul_pos ) )
-        *ul_pos = has_desc( str ) ? ( 1 + flx->fdesc ) : 1;
+        ul_thickness = UL_thickness;
 
-    ul_width = XTextWidth( flx->fs, str, n );
+    if ( ul_thickness == 0 || ul_thickness > 100 )
+        ul_thickness = strstr( fli_curfnt, "bold" ) ? 2 : 1;
 
-    /* Draw it */
+    if ( ! XGetFontProperty( flx->fs, XA_UNDERLINE_POSITION, &ul_pos ) )
+        ul_pos = has_desc( str ) ? ( 1 + flx->fdesc ) : 1;
 
-    if ( ul_width > 0 && *ul_thickness > 0 )
-        XFillRectangle( flx->display, flx->win, flx->gc, x, y + *ul_pos,
-                        ul_width, *ul_thickness );
+    xr->x = 0;
+    xr->y = ul_pos;
+    xr->width = FL_max( fli_text_width( flx->fs, str, n ), 0 );
+    xr->height = ul_thickness;
 }
 
 
@@ -1117,18 +1250,27 @@ fli_draw_stringTAB( Window       win,
 
     tab = fli_get_tabpixels( fs );
 
+    fli_flush_batch( );
     XSetFont( flx->display, gc, fs->fid );
 
+    /* With Xft the text clipping region gets used since the clipping of
+       the GC isn't available */
+
+    if ( fli_xft_begin( win, fs ) )
+        drawIt = img ? fli_xft_draw_image_string : fli_xft_draw_string;
+
     for ( w = 0, q = s; *q && ( p = strchr( q, '\t' ) ) && p - s < len;
           q = p + 1 )
     {
         drawIt( flx->display, win, gc, x + w, y, ( char * ) q, p - q );
-        w += XTextWidth( fs, q, p - q );
+        w += fli_text_width( fs, q, p - q );
         w = ( w / tab + 1 ) * tab;
     }
 
     drawIt( flx->display, win, gc, x + w, y, ( char * ) q, s - q + len );
 
+    fli_xft_end( );
+
     return 0;
 }
 